@@ -0,0 +1,287 @@
+#include "database.h"
+#include "schema.h"
+#include "sqlite3.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Backoff while another connection holds the lock: waits double from
+// BUSY_BASE_MS up to BUSY_MAX_MS
+#define BUSY_BASE_MS 2
+#define BUSY_MAX_MS 250
+
+// Database state
+static sqlite3* db = NULL;
+static sqlite3_stmt* stmtInsertPlay = NULL;  // Cached INSERT for play_history, prepared in OpenDatabase
+static sqlite3_stmt* stmtInsertSpooled = NULL;  // ...and the one that skips plays already stored
+static sqlite3_stmt* stmtBegin = NULL;       // Cached BEGIN/COMMIT/ROLLBACK used when batching writes
+static sqlite3_stmt* stmtCommit = NULL;
+static sqlite3_stmt* stmtRollback = NULL;
+static bool walEnabled = false;              // Journal mode is WAL, so idle checkpoints are worthwhile
+static int busyTimeoutMs = 0;                // Busy handler state (one thread uses the connection at a time)
+static int busyWaitedMs = 0;
+static uint32_t busyRandom = 0;
+
+static int BusyHandler(void*, int attempt);
+static void ConfigureDatabase(const DatabaseOptions& options);
+static bool PrepareStatements();
+static void FinalizeStatements();
+static bool StepPlayEvent(sqlite3_stmt* stmt, const PlayEvent& event);
+
+// Initialize SQLite database
+bool OpenDatabase(const char* path, const DatabaseOptions& options) {
+    int rc = sqlite3_open(path, &db);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+    
+    // Wait out other instances writing to the same file, from the first
+    // statement on (the schema check needs the lock too)
+    busyTimeoutMs = std::max(options.busyTimeoutMs, 0);
+    busyRandom = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+    sqlite3_busy_handler(db, BusyHandler, NULL);
+    
+    // Apply journal mode and durability settings
+    ConfigureDatabase(options);
+    
+    // Create (or migrate) the play history schema
+    if (!CreateSchema(db, options.normalized)) {
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+    
+    // Prepare hot statements once for the lifetime of the connection
+    if (!PrepareStatements()) {
+        CloseDatabase();
+        return false;
+    }
+    
+    return true;
+}
+
+// Called by SQLite while another connection holds the lock; returning 0
+// gives up and the statement fails with SQLITE_BUSY. Each wait is a random
+// 50-100% of the backoff step, so instances that collided don't retry in
+// lockstep.
+static int BusyHandler(void*, int attempt) {
+    if (attempt == 0) busyWaitedMs = 0;
+    if (busyWaitedMs >= busyTimeoutMs) return 0;
+    
+    int step = std::min(BUSY_BASE_MS << std::min(attempt, 16), BUSY_MAX_MS);
+    busyRandom ^= busyRandom << 13;
+    busyRandom ^= busyRandom >> 17;
+    busyRandom ^= busyRandom << 5;
+    int delay = step / 2 + (int)(busyRandom % (uint32_t)(step / 2 + 1));
+    delay = std::max(std::min(delay, busyTimeoutMs - busyWaitedMs), 1);
+    
+    sqlite3_sleep(delay);
+    busyWaitedMs += delay;
+    return 1;
+}
+
+// Apply journaling PRAGMAs
+static void ConfigureDatabase(const DatabaseOptions& options) {
+    walEnabled = false;
+    if (options.wal) {
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, "PRAGMA journal_mode=WAL;", -1, &stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char* mode = (const char*)sqlite3_column_text(stmt, 0);
+                walEnabled = EqualsIgnoreCase(mode ? mode : "", "wal");
+            }
+            sqlite3_finalize(stmt);
+        }
+    }
+    
+    if (options.synchronous) {
+        const char* levels[] = { "off", "normal", "full", "extra" };
+        for (const char* level : levels) {
+            if (EqualsIgnoreCase(options.synchronous, level)) {
+                char pragma[64];
+                snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%s;", level);
+                sqlite3_exec(db, pragma, NULL, NULL, NULL);
+                break;
+            }
+        }
+    }
+    
+    if (walEnabled && options.walAutocheckpoint >= 0) {
+        sqlite3_wal_autocheckpoint(db, options.walAutocheckpoint);
+    }
+}
+
+// Prepare statements that are reused on every logged track
+static bool PrepareStatements() {
+    const char* insertSQL = 
+        "INSERT INTO play_history (played_at_ms, utc_offset_min, filepath, filename, title, artist, album, genre, track_number, year, duration_ms, source) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    
+    // A spooled play may have been committed just before the database went
+    // away; the timestamp is in milliseconds, so the same file from the same
+    // source at the same instant is the same play
+    const char* insertSpooledSQL = 
+        "INSERT INTO play_history (played_at_ms, utc_offset_min, filepath, filename, title, artist, album, genre, track_number, year, duration_ms, source) "
+        "SELECT ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12 "
+        "WHERE NOT EXISTS (SELECT 1 FROM play_history WHERE played_at_ms = ?1 AND filepath IS ?3 AND source IS ?12);";
+    
+    if (sqlite3_prepare_v3(db, insertSQL, -1, SQLITE_PREPARE_PERSISTENT, &stmtInsertPlay, NULL) != SQLITE_OK) return false;
+    if (sqlite3_prepare_v3(db, insertSpooledSQL, -1, SQLITE_PREPARE_PERSISTENT, &stmtInsertSpooled, NULL) != SQLITE_OK) return false;
+    // IMMEDIATE takes the write lock up front, where the busy handler can
+    // wait for it; a deferred transaction that later needs to upgrade its
+    // lock gets SQLITE_BUSY without waiting if another writer is active
+    if (sqlite3_prepare_v3(db, "BEGIN IMMEDIATE;", -1, SQLITE_PREPARE_PERSISTENT, &stmtBegin, NULL) != SQLITE_OK) return false;
+    if (sqlite3_prepare_v3(db, "COMMIT;", -1, SQLITE_PREPARE_PERSISTENT, &stmtCommit, NULL) != SQLITE_OK) return false;
+    if (sqlite3_prepare_v3(db, "ROLLBACK;", -1, SQLITE_PREPARE_PERSISTENT, &stmtRollback, NULL) != SQLITE_OK) return false;
+    return true;
+}
+
+// Finalize cached statements (must happen before the connection is closed)
+static void FinalizeStatements() {
+    sqlite3_stmt** statements[] = { &stmtInsertPlay, &stmtInsertSpooled, &stmtBegin, &stmtCommit, &stmtRollback };
+    for (sqlite3_stmt** stmt : statements) {
+        if (*stmt) {
+            sqlite3_finalize(*stmt);
+            *stmt = NULL;
+        }
+    }
+}
+
+void CloseDatabase() {
+    FinalizeStatements();
+    if (db) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+    walEnabled = false;
+}
+
+bool IsDatabaseOpen() {
+    return db != NULL;
+}
+
+bool IsWalEnabled() {
+    return walEnabled;
+}
+
+bool WritePlayEvent(const PlayEvent& event) {
+    // Reuse the cached INSERT statement
+    return StepPlayEvent(stmtInsertPlay, event);
+}
+
+bool WriteSpooledPlayEvent(const PlayEvent& event) {
+    return StepPlayEvent(stmtInsertSpooled, event);
+}
+
+// Bind an event to one of the INSERT statements and run it
+static bool StepPlayEvent(sqlite3_stmt* stmt, const PlayEvent& event) {
+    if (!stmt) return false;
+    
+    // Bind parameters straight from the event's arena (the event outlives
+    // the step, so no copies are needed, and the lengths are known): the
+    // text fields before the source are parameters 3 to 10, in order
+    sqlite3_bind_int64(stmt, 1, event.playedAtMs);
+    sqlite3_bind_int(stmt, 2, event.utcOffsetMin);
+    for (int field = PlayFilepath; field < PlaySource; field++) {
+        sqlite3_bind_text(stmt, 3 + field, event.GetText((PlayField)field), (int)event.GetLength((PlayField)field), SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 11, event.durationMs);
+    if (event.GetLength(PlaySource) > 0) {
+        sqlite3_bind_text(stmt, 12, event.GetText(PlaySource), (int)event.GetLength(PlaySource), SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, 12);
+    }
+    
+    // Execute, then reset so the statement is ready for the next track
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// Open a transaction so a batch of plays costs a single journal write
+bool BeginBatch() {
+    if (!stmtBegin) return false;
+    int rc = sqlite3_step(stmtBegin);
+    sqlite3_reset(stmtBegin);
+    return rc == SQLITE_DONE;
+}
+
+// If SQLite already rolled the transaction back (autocommit is on again),
+// the batch is gone and the caller must not think it was stored
+bool CommitBatch() {
+    if (!stmtCommit || sqlite3_get_autocommit(db)) return false;
+    
+    int rc = sqlite3_step(stmtCommit);
+    sqlite3_reset(stmtCommit);
+    if (rc != SQLITE_DONE) {
+        // Don't leave the connection stuck inside a failed transaction
+        RollbackBatch();
+        return false;
+    }
+    return true;
+}
+
+bool RollbackBatch() {
+    if (!stmtRollback || sqlite3_get_autocommit(db)) return true;
+    int rc = sqlite3_step(stmtRollback);
+    sqlite3_reset(stmtRollback);
+    return rc == SQLITE_DONE;
+}
+
+// PASSIVE never waits on readers, so reporting tools are not disturbed
+bool CheckpointDatabase() {
+    if (!db || !walEnabled) return false;
+    return sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL) == SQLITE_OK;
+}
+
+bool WriteMetrics(const PlayMetrics& metrics, int64_t recordedAtMs, const char* source) {
+    if (!db || !CreateMetricsTable(db)) return false;
+    
+    const char* insertSQL =
+        "INSERT INTO metrics (recorded_at_ms, source, name, count, total_us, p50_us, p90_us, p99_us, max_us) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, insertSQL, -1, &stmt, NULL) != SQLITE_OK) return false;
+    
+    // One transaction for the whole snapshot
+    bool ok = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_bind_int64(stmt, 1, recordedAtMs);
+    if (source && source[0]) {
+        sqlite3_bind_text(stmt, 2, source, -1, SQLITE_STATIC);
+    }
+    
+    for (int i = 0; ok && i < MetricStageCount; i++) {
+        const LatencyHistogram& stage = metrics.GetStage((MetricStage)i);
+        sqlite3_bind_text(stmt, 3, GetMetricStageName((MetricStage)i), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)stage.GetCount());
+        sqlite3_bind_int64(stmt, 5, (sqlite3_int64)(stage.GetTotalNs() / 1000));
+        sqlite3_bind_int64(stmt, 6, (sqlite3_int64)(stage.GetQuantileNs(0.5) / 1000));
+        sqlite3_bind_int64(stmt, 7, (sqlite3_int64)(stage.GetQuantileNs(0.9) / 1000));
+        sqlite3_bind_int64(stmt, 8, (sqlite3_int64)(stage.GetQuantileNs(0.99) / 1000));
+        sqlite3_bind_int64(stmt, 9, (sqlite3_int64)(stage.GetMaxNs() / 1000));
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    
+    // Counters leave the timing columns NULL
+    for (int column = 5; column <= 9; column++) {
+        sqlite3_bind_null(stmt, column);
+    }
+    for (int i = 0; ok && i < MetricCounterCount; i++) {
+        sqlite3_bind_text(stmt, 3, GetMetricCounterName((MetricCounter)i), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)metrics.GetCounter((MetricCounter)i));
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    
+    ok = ok && sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK;
+    if (!ok && !sqlite3_get_autocommit(db)) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+    return ok;
+}
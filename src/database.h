@@ -0,0 +1,49 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include "metrics.h"
+#include "playevent.h"
+
+// Options applied when the database is opened
+struct DatabaseOptions {
+    bool normalized;           // Store plays as ids into interned artist/album/genre/file/track tables
+    bool wal;                  // Use write-ahead logging instead of the rollback journal
+    const char* synchronous;   // "off" | "normal" | "full" | "extra", or NULL for SQLite's default
+    int walAutocheckpoint;     // WAL pages before SQLite checkpoints on its own (< 0 = SQLite's default)
+    int busyTimeoutMs;         // Keep retrying while another process holds the lock (0 = fail at once)
+};
+
+// Open (creating if necessary) the play history database
+bool OpenDatabase(const char* path, const DatabaseOptions& options);
+
+// Close database connection
+void CloseDatabase();
+
+// True if a database is open
+bool IsDatabaseOpen();
+
+// True if the open database is in WAL mode
+bool IsWalEnabled();
+
+// Insert a play event (writer thread only). Returns false on failure.
+bool WritePlayEvent(const PlayEvent& event);
+
+// Insert a play event replayed from the spool unless a play of the same
+// file at the same instant is already stored (writer thread only)
+bool WriteSpooledPlayEvent(const PlayEvent& event);
+
+// Open/commit/abandon a transaction around a batch of plays (writer thread
+// only). CommitBatch fails if the transaction was lost, e.g. rolled back by
+// SQLite after an I/O error.
+bool BeginBatch();
+bool CommitBatch();
+bool RollbackBatch();
+
+// Checkpoint the WAL while the player is idle (writer thread only)
+bool CheckpointDatabase();
+
+// Add a snapshot of the instrumentation to the metrics table, creating it
+// if needed, outside any batch (writer thread only)
+bool WriteMetrics(const PlayMetrics& metrics, int64_t recordedAtMs, const char* source);
+
+#endif // DATABASE_H
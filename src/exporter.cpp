@@ -0,0 +1,407 @@
+#include "exporter.h"
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define EXPORT_MAGIC "WNPC"
+
+enum ColumnEncoding {
+    EncodeInt64,
+    EncodeText,
+    EncodeDictionary
+};
+
+struct ExportColumn {
+    const char* name;
+    ColumnEncoding encoding;
+};
+
+// Strings that repeat from play to play are dictionary-encoded
+static const ExportColumn exportColumns[] = {
+    { "id", EncodeInt64 },
+    { "played_at_ms", EncodeInt64 },
+    { "utc_offset_min", EncodeInt64 },
+    { "filepath", EncodeText },
+    { "filename", EncodeText },
+    { "title", EncodeText },
+    { "artist", EncodeDictionary },
+    { "album", EncodeDictionary },
+    { "genre", EncodeDictionary },
+    { "track_number", EncodeText },
+    { "year", EncodeText },
+    { "duration_ms", EncodeInt64 },
+    { "source", EncodeDictionary }
+};
+#define EXPORT_COLUMN_COUNT ((int)(sizeof(exportColumns) / sizeof(exportColumns[0])))
+
+// Byte length of the valid UTF-8 sequence at s, or 0 if it isn't one
+static int GetUtf8Length(const unsigned char* s, int available) {
+    unsigned char c = s[0];
+    int length;
+    unsigned char low = 0x80, high = 0xBF;  // Allowed range of the second byte
+    if (c >= 0xC2 && c <= 0xDF) length = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        if (c == 0xE0) low = 0xA0;        // Overlong
+        else if (c == 0xED) high = 0x9F;  // Surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        if (c == 0xF0) low = 0x90;        // Overlong
+        else if (c == 0xF4) high = 0x8F;  // Beyond U+10FFFF
+    } else return 0;
+    
+    if (available < length || s[1] < low || s[1] > high) return 0;
+    for (int i = 2; i < length; i++) {
+        if (s[i] < 0x80 || s[i] > 0xBF) return 0;
+    }
+    return length;
+}
+
+static void AppendJsonString(std::string& out, const unsigned char* s, int length) {
+    out += '"';
+    for (int i = 0; i < length;) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+            i++;
+        } else if (c < 0x20) {
+            char escape[8];
+            if (c == '\n') out += "\\n";
+            else if (c == '\r') out += "\\r";
+            else if (c == '\t') out += "\\t";
+            else {
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            }
+            i++;
+        } else if (c < 0x80) {
+            out += (char)c;
+            i++;
+        } else {
+            int sequence = GetUtf8Length(s + i, length - i);
+            if (sequence > 0) {
+                out.append((const char*)s + i, sequence);
+                i += sequence;
+            } else {
+                // A byte from some other code page; keep it as its Latin-1 character
+                out += (char)(0xC0 | (c >> 6));
+                out += (char)(0x80 | (c & 0x3F));
+                i++;
+            }
+        }
+    }
+    out += '"';
+}
+
+static void AppendCsvField(std::string& out, const char* s, int length) {
+    bool quote = false;
+    for (int i = 0; i < length && !quote; i++) {
+        quote = s[i] == ',' || s[i] == '"' || s[i] == '\r' || s[i] == '\n';
+    }
+    if (!quote) {
+        out.append(s, length);
+        return;
+    }
+    
+    out += '"';
+    for (int i = 0; i < length; i++) {
+        if (s[i] == '"') out += '"';
+        out += s[i];
+    }
+    out += '"';
+}
+
+static void AppendInt64(std::string& out, int64_t value) {
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+    out.append(text, length);
+}
+
+static void AppendCsvRow(std::string& line, sqlite3_stmt* stmt) {
+    for (int column = 0; column < EXPORT_COLUMN_COUNT; column++) {
+        if (column > 0) line += ',';
+        if (sqlite3_column_type(stmt, column) == SQLITE_NULL) continue;
+        
+        if (exportColumns[column].encoding == EncodeInt64) {
+            AppendInt64(line, sqlite3_column_int64(stmt, column));
+        } else {
+            const char* text = (const char*)sqlite3_column_text(stmt, column);
+            AppendCsvField(line, text ? text : "", sqlite3_column_bytes(stmt, column));
+        }
+    }
+    line += '\n';
+}
+
+static void AppendJsonRow(std::string& line, sqlite3_stmt* stmt) {
+    line += '{';
+    for (int column = 0; column < EXPORT_COLUMN_COUNT; column++) {
+        if (column > 0) line += ',';
+        line += '"';
+        line += exportColumns[column].name;
+        line += "\":";
+        
+        if (sqlite3_column_type(stmt, column) == SQLITE_NULL) {
+            line += "null";
+        } else if (exportColumns[column].encoding == EncodeInt64) {
+            AppendInt64(line, sqlite3_column_int64(stmt, column));
+        } else {
+            const unsigned char* text = sqlite3_column_text(stmt, column);
+            AppendJsonString(line, text ? text : (const unsigned char*)"", sqlite3_column_bytes(stmt, column));
+        }
+    }
+    line += "}\n";
+}
+
+// Collects plays into row groups and writes each column of a full group
+// together. Buffers are reused from group to group.
+class ColumnarWriter {
+public:
+    ColumnarWriter(FILE* file, int groupSize)
+        : out(file), rowGroupSize(groupSize > 0 ? groupSize : EXPORT_ROW_GROUP_SIZE),
+          rows(0), totalRows(0), offset(0), ok(true) {}
+    
+    bool Begin();
+    bool Add(sqlite3_stmt* stmt);
+    bool End();
+
+private:
+    struct Column {
+        std::vector<unsigned char> nulls;
+        std::vector<int64_t> values;
+        std::vector<uint32_t> offsets;     // Into bytes: one per row (text) or entry (dictionary)
+        std::string bytes;
+        std::unordered_map<std::string, uint32_t> entries;
+        std::vector<uint32_t> indices;
+    };
+    
+    void Write(const void* data, size_t size);
+    void WriteColumn(const ExportColumn& spec, Column& column);
+    bool WriteGroup();
+    
+    FILE* out;
+    int rowGroupSize;
+    int rows;
+    uint64_t totalRows;
+    uint64_t offset;
+    bool ok;
+    Column columns[EXPORT_COLUMN_COUNT];
+    std::vector<unsigned char> scratch;
+    std::vector<uint64_t> groupOffsets;
+};
+
+void ColumnarWriter::Write(const void* data, size_t size) {
+    if (ok && size > 0 && fwrite(data, 1, size, out) != size) ok = false;
+    offset += size;
+}
+
+bool ColumnarWriter::Begin() {
+    uint32_t version = EXPORT_COLUMNAR_VERSION;
+    uint32_t columnCount = EXPORT_COLUMN_COUNT;
+    Write(EXPORT_MAGIC, 4);
+    Write(&version, sizeof(version));
+    Write(&columnCount, sizeof(columnCount));
+    for (const ExportColumn& spec : exportColumns) {
+        unsigned char header[2] = { (unsigned char)spec.encoding, (unsigned char)strlen(spec.name) };
+        Write(header, sizeof(header));
+        Write(spec.name, header[1]);
+    }
+    return ok;
+}
+
+bool ColumnarWriter::Add(sqlite3_stmt* stmt) {
+    for (int i = 0; i < EXPORT_COLUMN_COUNT; i++) {
+        Column& column = columns[i];
+        if (rows % 8 == 0) column.nulls.push_back(0);
+        bool null = sqlite3_column_type(stmt, i) == SQLITE_NULL;
+        if (null) column.nulls.back() |= (unsigned char)(1 << (rows % 8));
+        
+        if (exportColumns[i].encoding == EncodeInt64) {
+            column.values.push_back(null ? 0 : sqlite3_column_int64(stmt, i));
+            continue;
+        }
+        
+        const char* text = null ? "" : (const char*)sqlite3_column_text(stmt, i);
+        int length = text ? sqlite3_column_bytes(stmt, i) : 0;
+        if (exportColumns[i].encoding == EncodeText) {
+            if (column.offsets.empty()) column.offsets.push_back(0);
+            column.bytes.append(text ? text : "", length);
+            column.offsets.push_back((uint32_t)column.bytes.size());
+        } else if (null) {
+            column.indices.push_back(0);
+        } else {
+            // New strings become the next dictionary entry
+            std::string value(text ? text : "", length);
+            auto found = column.entries.emplace(value, (uint32_t)column.entries.size());
+            if (found.second) {
+                if (column.offsets.empty()) column.offsets.push_back(0);
+                column.bytes += value;
+                column.offsets.push_back((uint32_t)column.bytes.size());
+            }
+            column.indices.push_back(found.first->second);
+        }
+    }
+    
+    totalRows++;
+    if (++rows == rowGroupSize) WriteGroup();
+    return ok;
+}
+
+void ColumnarWriter::WriteColumn(const ExportColumn& spec, Column& column) {
+    uint32_t nullBytes = (uint32_t)column.nulls.size();
+    uint32_t size = nullBytes;
+    uint32_t entryCount = 0;
+    uint8_t width = 1;
+    
+    if (spec.encoding == EncodeInt64) {
+        size += (uint32_t)(column.values.size() * sizeof(int64_t));
+    } else if (spec.encoding == EncodeText) {
+        size += (uint32_t)(column.offsets.size() * sizeof(uint32_t) + column.bytes.size());
+    } else {
+        if (column.offsets.empty()) column.offsets.push_back(0);
+        entryCount = (uint32_t)column.entries.size();
+        width = entryCount <= 0x100 ? 1 : entryCount <= 0x10000 ? 2 : 4;
+        size += (uint32_t)(sizeof(entryCount) + column.offsets.size() * sizeof(uint32_t) + column.bytes.size() +
+                           sizeof(width) + column.indices.size() * width);
+    }
+    
+    Write(&size, sizeof(size));
+    Write(column.nulls.data(), nullBytes);
+    if (spec.encoding == EncodeInt64) {
+        Write(column.values.data(), column.values.size() * sizeof(int64_t));
+        return;
+    }
+    if (spec.encoding == EncodeDictionary) {
+        Write(&entryCount, sizeof(entryCount));
+    }
+    Write(column.offsets.data(), column.offsets.size() * sizeof(uint32_t));
+    Write(column.bytes.data(), column.bytes.size());
+    if (spec.encoding == EncodeText) return;
+    
+    // Indices in the narrowest width that holds them
+    Write(&width, sizeof(width));
+    scratch.resize(column.indices.size() * width);
+    for (size_t row = 0; row < column.indices.size(); row++) {
+        uint32_t index = column.indices[row];
+        if (width == 1) scratch[row] = (unsigned char)index;
+        else if (width == 2) memcpy(&scratch[row * 2], &index, 2);
+        else memcpy(&scratch[row * 4], &index, 4);
+    }
+    Write(scratch.data(), scratch.size());
+}
+
+bool ColumnarWriter::WriteGroup() {
+    if (rows == 0) return ok;
+    
+    groupOffsets.push_back(offset);
+    uint32_t rowCount = (uint32_t)rows;
+    Write(&rowCount, sizeof(rowCount));
+    for (int i = 0; i < EXPORT_COLUMN_COUNT; i++) {
+        Column& column = columns[i];
+        WriteColumn(exportColumns[i], column);
+        column.nulls.clear();
+        column.values.clear();
+        column.offsets.clear();
+        column.bytes.clear();
+        column.entries.clear();
+        column.indices.clear();
+    }
+    rows = 0;
+    return ok;
+}
+
+bool ColumnarWriter::End() {
+    WriteGroup();
+    uint32_t groupCount = (uint32_t)groupOffsets.size();
+    Write(groupOffsets.data(), groupOffsets.size() * sizeof(uint64_t));
+    Write(&groupCount, sizeof(groupCount));
+    Write(&totalRows, sizeof(totalRows));
+    Write(EXPORT_MAGIC, 4);
+    return ok;
+}
+
+PlayExporter::PlayExporter() : db(NULL) {
+}
+
+PlayExporter::~PlayExporter() {
+    Close();
+}
+
+bool PlayExporter::Open(const char* path) {
+    Close();
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        Close();
+        return false;
+    }
+    
+    // Wait out the logger's commits rather than failing
+    sqlite3_busy_timeout(db, 2000);
+    return true;
+}
+
+void PlayExporter::Close() {
+    if (db) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+}
+
+bool PlayExporter::Export(FILE* out, const ExportOptions& options, uint64_t& rows, int64_t& lastId) {
+    rows = 0;
+    lastId = options.afterId;
+    if (!db) return false;
+    
+    // Page through by id, which also makes the last id a resumable position
+    std::string sql = "SELECT ";
+    for (int column = 0; column < EXPORT_COLUMN_COUNT; column++) {
+        if (column > 0) sql += ", ";
+        sql += exportColumns[column].name;
+    }
+    sql += " FROM play_history WHERE id > ?1 ORDER BY id LIMIT ?2;";
+    
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) return false;
+    
+    ColumnarWriter columnar(out, options.rowGroupSize);
+    std::string line;
+    bool ok = true;
+    if (options.format == ExportCsv) {
+        for (int column = 0; column < EXPORT_COLUMN_COUNT; column++) {
+            if (column > 0) line += ',';
+            line += exportColumns[column].name;
+        }
+        line += '\n';
+        ok = fwrite(line.data(), 1, line.size(), out) == line.size();
+    } else if (options.format == ExportColumnar) {
+        ok = columnar.Begin();
+    }
+    
+    int pageRows = EXPORT_PAGE_ROWS;
+    while (ok && pageRows == EXPORT_PAGE_ROWS) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, lastId);
+        sqlite3_bind_int(stmt, 2, EXPORT_PAGE_ROWS);
+        
+        int rc = SQLITE_DONE;
+        pageRows = 0;
+        while (ok && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            if (options.format == ExportColumnar) {
+                ok = columnar.Add(stmt);
+            } else {
+                line.clear();
+                if (options.format == ExportCsv) AppendCsvRow(line, stmt);
+                else AppendJsonRow(line, stmt);
+                ok = fwrite(line.data(), 1, line.size(), out) == line.size();
+            }
+            lastId = sqlite3_column_int64(stmt, 0);
+            rows++;
+            pageRows++;
+        }
+        ok = ok && rc == SQLITE_DONE;
+    }
+    sqlite3_finalize(stmt);
+    
+    if (ok && options.format == ExportColumnar) ok = columnar.End();
+    return ok && fflush(out) == 0;
+}
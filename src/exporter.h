@@ -0,0 +1,72 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "sqlite3.h"
+#include <cstdint>
+#include <cstdio>
+
+// Exported columns, in order: id, played_at_ms, utc_offset_min, filepath,
+// filename, title, artist, album, genre, track_number, year, duration_ms,
+// source. (played_at is left out; it follows from played_at_ms and
+// utc_offset_min.)
+enum ExportFormat {
+    ExportCsv,         // RFC 4180 quoting, with a header line; NULL is an empty field
+    ExportJsonLines,   // One object per play; NULL is null. Bytes that aren't
+                       // valid UTF-8 are read as Latin-1, so the output always is
+    ExportColumnar     // See below
+};
+
+// Columnar files hold the plays in row groups, each column of a group
+// stored together, with artist, album, genre and source dictionary-encoded
+// per row group. Integers are little-endian.
+//
+//   file:       "WNPC", uint32 version (1), uint32 column count,
+//               per column: uint8 encoding, uint8 name length, name;
+//               row groups; footer
+//   row group:  uint32 row count, per column: uint32 chunk size, chunk
+//   chunk:      null bitmap (1 bit per row, set for NULL, rounded up to
+//               whole bytes), then by encoding:
+//     0 int64:  int64 per row (0 for NULL)
+//     1 text:   uint32 offsets[rows + 1] into the bytes that follow
+//     2 dict:   uint32 entries, uint32 offsets[entries + 1], entry bytes,
+//               uint8 index width (1, 2 or 4), an index per row (0 for NULL)
+//   footer:     uint64 offset of each row group, uint32 row group count,
+//               uint64 row count, "WNPC"
+#define EXPORT_COLUMNAR_VERSION 1
+#define EXPORT_ROW_GROUP_SIZE 65536
+
+// Plays read per query. The statement is reset between pages, so a long
+// export doesn't hold the database's read lock (which would keep the
+// logger from committing in rollback journal mode) from start to end.
+#define EXPORT_PAGE_ROWS 10000
+
+struct ExportOptions {
+    ExportFormat format;
+    int64_t afterId;     // Only plays with a greater id (0 for all), e.g. the
+                         // last id of the previous export
+    int rowGroupSize;    // Columnar: plays per row group
+};
+
+// Streams plays out of a play history database (either layout) oldest
+// first, a row at a time, so memory use doesn't grow with the history
+// (columnar output holds one row group). Opens its own read-only
+// connection, so it can run alongside the logger.
+class PlayExporter {
+public:
+    PlayExporter();
+    ~PlayExporter();
+    
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return db != NULL; }
+    
+    // Write the plays after options.afterId to out. rows gets how many were
+    // written and lastId the id of the last (options.afterId if none), to
+    // pass as afterId next time. Fails on a read or write error.
+    bool Export(FILE* out, const ExportOptions& options, uint64_t& rows, int64_t& lastId);
+
+private:
+    sqlite3* db;
+};
+
+#endif // EXPORTER_H
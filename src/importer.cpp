@@ -0,0 +1,444 @@
+#include "importer.h"
+#include "playevent.h"
+#include "schema.h"
+#include "util.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Bytes read from a file at a time
+#define IMPORT_BUFFER_SIZE (1 << 20)
+
+// What a column of an imported file holds
+enum ImportField {
+    FieldPlayedAtMs,
+    FieldPlayedAtSeconds,
+    FieldPlayedAtText,
+    FieldUtcOffset,
+    FieldFilepath,
+    FieldFilename,
+    FieldTitle,
+    FieldArtist,
+    FieldAlbum,
+    FieldGenre,
+    FieldTrackNumber,
+    FieldYear,
+    FieldDurationMs,
+    FieldDurationSeconds,
+    FieldSource,
+    FieldRating,
+    FieldCount
+};
+
+struct ImportHeader {
+    const char* name;
+    ImportField field;
+};
+
+// Column names understood in a header line (ignoring case); others, such
+// as id or Last.fm's MusicBrainz ids, are ignored
+static const ImportHeader importHeaders[] = {
+    { "played_at_ms", FieldPlayedAtMs },
+    { "uts", FieldPlayedAtSeconds },
+    { "timestamp", FieldPlayedAtSeconds },
+    { "utc_time", FieldPlayedAtText },
+    { "date", FieldPlayedAtText },
+    { "utc_offset_min", FieldUtcOffset },
+    { "filepath", FieldFilepath },
+    { "filename", FieldFilename },
+    { "title", FieldTitle },
+    { "track", FieldTitle },
+    { "artist", FieldArtist },
+    { "album", FieldAlbum },
+    { "genre", FieldGenre },
+    { "track_number", FieldTrackNumber },
+    { "year", FieldYear },
+    { "duration_ms", FieldDurationMs },
+    { "source", FieldSource }
+};
+
+// Columns of the formats without a header line
+static const ImportField lastfmColumns[] = {
+    FieldArtist, FieldAlbum, FieldTitle, FieldPlayedAtText
+};
+static const ImportField scrobblerLogColumns[] = {
+    FieldArtist, FieldAlbum, FieldTitle, FieldTrackNumber, FieldDurationSeconds, FieldRating, FieldPlayedAtSeconds
+};
+
+static const char* stageSQL =
+    "INSERT OR IGNORE INTO temp.play_import (played_at_ms, title, utc_offset_min, filepath, filename, artist, album, genre, track_number, year, duration_ms, source) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+// Splits a file into records of fields, reading it a buffer at a time.
+// CSV fields may be quoted (RFC 4180, with line breaks inside quotes);
+// unquoted fields and line ends (LF or CRLF) are taken as they come.
+class RecordReader {
+public:
+    RecordReader(FILE* file) : file(file), buffer(IMPORT_BUFFER_SIZE), pos(0), end(0), delimiter(','), quoted(true), count(0) {}
+    
+    void SetTabSeparated() {
+        delimiter = '\t';
+        quoted = false;
+    }
+    
+    // Next byte to be read, or EOF
+    int Peek() {
+        if (pos == end && !Fill()) return EOF;
+        return (unsigned char)buffer[pos];
+    }
+    
+    // Read the next record into the fields; false at the end of the file
+    bool Next();
+    
+    bool Failed() const { return ferror(file) != 0; }
+    int GetCount() const { return count; }
+    
+    // Field i of the record, or NULL if the record is shorter or it is empty
+    const char* Get(int i) const {
+        return i < count && !fields[i].empty() ? fields[i].c_str() : NULL;
+    }
+
+private:
+    bool Fill() {
+        pos = 0;
+        end = fread(&buffer[0], 1, buffer.size(), file);
+        return end > 0;
+    }
+    
+    int Scan(std::string& field, bool inQuotes);
+    
+    FILE* file;
+    std::vector<char> buffer;
+    size_t pos;
+    size_t end;
+    char delimiter;
+    bool quoted;
+    
+    // Strings are reused from record to record, so they rarely allocate
+    std::vector<std::string> fields;
+    int count;
+};
+
+// Append bytes to field up to the next delimiter or line end (closing
+// quote inside quotes), returning that byte unread, or EOF
+int RecordReader::Scan(std::string& field, bool inQuotes) {
+    for (;;) {
+        const char* start = &buffer[0] + pos;
+        const char* stop = &buffer[0] + end;
+        const char* p = start;
+        if (inQuotes) {
+            while (p < stop && *p != '"') p++;
+        } else {
+            while (p < stop && *p != delimiter && *p != '\n' && *p != '\r') p++;
+        }
+        field.append(start, p - start);
+        pos = p - &buffer[0];
+        if (p < stop) return (unsigned char)*p;
+        if (!Fill()) return EOF;
+    }
+}
+
+bool RecordReader::Next() {
+    count = 0;
+    if (Peek() == EOF) return false;
+    
+    for (;;) {
+        if (count == (int)fields.size()) fields.emplace_back();
+        std::string& field = fields[count++];
+        field.clear();
+        
+        if (quoted && Peek() == '"') {
+            pos++;
+            while (Scan(field, true) != EOF) {
+                pos++;  // Closing quote, or the first of a doubled one
+                if (Peek() != '"') break;
+                field += '"';
+                pos++;
+            }
+        }
+        int c = Scan(field, false);
+        if (c == EOF) return true;
+        
+        pos++;
+        if (c == delimiter) continue;
+        if (c == '\r' && Peek() == '\n') pos++;
+        return true;
+    }
+}
+
+static bool ParseInt64(const char* text, int64_t& value) {
+    if (!text) return false;
+    char* end;
+    value = strtoll(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+static bool ReadNumber(const char*& p, int maxDigits, int& value) {
+    int digits = 0;
+    value = 0;
+    while (digits < maxDigits && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+        digits++;
+    }
+    return digits > 0;
+}
+
+static void SkipSeparators(const char*& p) {
+    while (*p == ' ' || *p == ',') p++;
+}
+
+// Days from 1970-01-01 to a date in the proleptic Gregorian calendar
+static int64_t DaysFromCivil(int64_t year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yearOfEra = year - era * 400;
+    int64_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Seconds since the epoch of "2020-01-31 12:34[:56]" (or with a T, and a
+// trailing Z) or Last.fm's "31 Jan 2020 12:34" (or "31 Jan 2020, 12:34")
+static bool ParseDateText(const char* p, int64_t& seconds) {
+    if (!p) return false;
+    
+    int year, month, day, hour, minute, second = 0;
+    int first;
+    if (!ReadNumber(p, 4, first)) return false;
+    if (*p == '-') {
+        year = first;
+        p++;
+        if (!ReadNumber(p, 2, month) || *p++ != '-' || !ReadNumber(p, 2, day)) return false;
+        if (*p != ' ' && *p != 'T') return false;
+        p++;
+    } else {
+        static const char* monthNames = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        day = first;
+        SkipSeparators(p);
+        month = 0;
+        for (int i = 0; i < 12 && month == 0; i++) {
+            if (strncmp(p, monthNames + i * 3, 3) == 0) month = i + 1;
+        }
+        if (month == 0) return false;
+        p += 3;
+        while ((*p >= 'a' && *p <= 'z') || *p == '.') p++;  // "January", "Sept."
+        SkipSeparators(p);
+        if (!ReadNumber(p, 4, year)) return false;
+        SkipSeparators(p);
+    }
+    
+    if (!ReadNumber(p, 2, hour) || *p++ != ':' || !ReadNumber(p, 2, minute)) return false;
+    if (*p == ':') {
+        p++;
+        if (!ReadNumber(p, 2, second)) return false;
+    }
+    if (*p == 'Z') p++;
+    if (*p != '\0' || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return false;
+    
+    seconds = DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+// Map a header line's names to columns; false if it names no play time
+static bool MapHeader(const RecordReader& reader, int* columns) {
+    for (int i = reader.GetCount() - 1; i >= 0; i--) {
+        const char* name = reader.Get(i);
+        if (!name) continue;
+        for (const ImportHeader& header : importHeaders) {
+            if (EqualsIgnoreCase(name, header.name)) columns[header.field] = i;
+        }
+    }
+    return columns[FieldPlayedAtMs] >= 0 || columns[FieldPlayedAtSeconds] >= 0 || columns[FieldPlayedAtText] >= 0;
+}
+
+static void BindText(sqlite3_stmt* stmt, int index, const char* text) {
+    if (text) {
+        sqlite3_bind_text(stmt, index, text, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, index);
+    }
+}
+
+static void BindInt64(sqlite3_stmt* stmt, int index, bool valid, int64_t value) {
+    if (valid) {
+        sqlite3_bind_int64(stmt, index, value);
+    } else {
+        sqlite3_bind_null(stmt, index);
+    }
+}
+
+PlayImporter::PlayImporter() : db(NULL), stmtStage(NULL), offsetQuarter(INT64_MIN), offsetMinutes(0) {
+}
+
+PlayImporter::~PlayImporter() {
+    Close();
+}
+
+bool PlayImporter::Open(const char* path) {
+    Close();
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+        Close();
+        return false;
+    }
+    sqlite3_busy_timeout(db, 5000);
+    
+    // Room for the indexes being built and the top of the staging table
+    sqlite3_exec(db, "PRAGMA cache_size=-65536; PRAGMA temp.cache_size=-65536;", NULL, NULL, NULL);
+    
+    if (!CreateSchema(db, false) || !CreateImportTable(db) ||
+        sqlite3_prepare_v3(db, stageSQL, -1, SQLITE_PREPARE_PERSISTENT, &stmtStage, NULL) != SQLITE_OK) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void PlayImporter::Close() {
+    if (stmtStage) {
+        sqlite3_finalize(stmtStage);
+        stmtStage = NULL;
+    }
+    if (db) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+}
+
+// The local offset only changes on a quarter hour, so it is looked up
+// once per quarter hour of plays rather than once per play
+int PlayImporter::GetUtcOffset(int64_t seconds) {
+    int64_t quarter = seconds / 900;
+    if (quarter != offsetQuarter) {
+        offsetQuarter = quarter;
+        offsetMinutes = GetUtcOffsetMinutes((time_t)seconds);
+    }
+    return offsetMinutes;
+}
+
+bool PlayImporter::ReadFile(const char* path, const ImportOptions& options, ImportStats& stats) {
+    if (!db) return false;
+    FILE* file = OpenFile(path, "rb");
+    if (!file) return false;
+    
+    RecordReader reader(file);
+    ImportFormat format = options.format;
+    if (format == ImportAuto && reader.Peek() == '#') format = ImportScrobblerLog;
+    
+    int columns[FieldCount];
+    for (int& column : columns) column = -1;
+    bool pending = false;     // A record read to tell the format that holds a play
+    bool localTimes = false;  // Times are local rather than UTC
+    
+    if (format == ImportScrobblerLog) {
+        reader.SetTabSeparated();
+        for (int i = 0; i < (int)(sizeof(scrobblerLogColumns) / sizeof(scrobblerLogColumns[0])); i++) {
+            columns[scrobblerLogColumns[i]] = i;
+        }
+    } else if (reader.Next() && !MapHeader(reader, columns)) {
+        // No header: a Last.fm export, whose first line is a play
+        if (format == ImportCsv) {
+            fclose(file);
+            return false;
+        }
+        for (int i = 0; i < (int)(sizeof(lastfmColumns) / sizeof(lastfmColumns[0])); i++) {
+            columns[lastfmColumns[i]] = i;
+        }
+        pending = true;
+    }
+    
+    // Stage the file in one transaction (on the temporary database only),
+    // so a file that fails part way adds nothing
+    bool ok = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) == SQLITE_OK;
+    char filename[PLAYEVENT_PATH_LEN];
+    
+    while (ok && (pending || reader.Next())) {
+        pending = false;
+        const char* first = reader.Get(0);
+        if (reader.GetCount() == 1 && !first) continue;  // Blank line
+        if (format == ImportScrobblerLog && first && first[0] == '#') {
+            if (strncmp(first, "#TZ/", 4) == 0) localTimes = strcmp(first, "#TZ/UTC") != 0;
+            continue;
+        }
+        stats.records++;
+        
+        const char* rating = columns[FieldRating] >= 0 ? reader.Get(columns[FieldRating]) : NULL;
+        if (rating && rating[0] == 'S') {
+            stats.skipped++;
+            continue;
+        }
+        
+        // The first usable time, finest first
+        int64_t playedAtMs = 0;
+        int64_t seconds = 0;
+        bool timed = false;
+        if (columns[FieldPlayedAtMs] >= 0 && ParseInt64(reader.Get(columns[FieldPlayedAtMs]), playedAtMs)) {
+            timed = true;
+        } else if ((columns[FieldPlayedAtSeconds] >= 0 && ParseInt64(reader.Get(columns[FieldPlayedAtSeconds]), seconds)) ||
+                   (columns[FieldPlayedAtText] >= 0 && ParseDateText(reader.Get(columns[FieldPlayedAtText]), seconds))) {
+            if (localTimes) seconds -= GetUtcOffset(seconds - GetUtcOffset(seconds) * 60) * 60;
+            playedAtMs = seconds * 1000;
+            timed = true;
+        }
+        
+        const char* title = columns[FieldTitle] >= 0 ? reader.Get(columns[FieldTitle]) : NULL;
+        const char* filepath = columns[FieldFilepath] >= 0 ? reader.Get(columns[FieldFilepath]) : NULL;
+        if (!timed || (!title && !filepath)) {
+            stats.rejected++;
+            continue;
+        }
+        
+        int64_t utcOffset = 0;
+        if (columns[FieldUtcOffset] < 0 || !ParseInt64(reader.Get(columns[FieldUtcOffset]), utcOffset)) {
+            utcOffset = GetUtcOffset(playedAtMs / 1000);
+        }
+        
+        const char* name = columns[FieldFilename] >= 0 ? reader.Get(columns[FieldFilename]) : NULL;
+        if (!name && filepath) {
+            GetFilenameFromPath(filepath, filename, sizeof(filename));
+            name = filename;
+        }
+        
+        int64_t durationMs = 0;
+        bool hasDuration = columns[FieldDurationMs] >= 0 && ParseInt64(reader.Get(columns[FieldDurationMs]), durationMs);
+        if (!hasDuration && columns[FieldDurationSeconds] >= 0 && ParseInt64(reader.Get(columns[FieldDurationSeconds]), durationMs)) {
+            durationMs *= 1000;
+            hasDuration = true;
+        }
+        
+        const char* source = options.source && options.source[0] ? options.source :
+                             columns[FieldSource] >= 0 ? reader.Get(columns[FieldSource]) : NULL;
+        
+        // The fields stay put until the next record is read, so no copies are needed
+        sqlite3_bind_int64(stmtStage, 1, playedAtMs);
+        sqlite3_bind_text(stmtStage, 2, title ? title : "", -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmtStage, 3, utcOffset);
+        sqlite3_bind_text(stmtStage, 4, filepath ? filepath : "", -1, SQLITE_STATIC);
+        BindText(stmtStage, 5, name);
+        BindText(stmtStage, 6, columns[FieldArtist] >= 0 ? reader.Get(columns[FieldArtist]) : NULL);
+        BindText(stmtStage, 7, columns[FieldAlbum] >= 0 ? reader.Get(columns[FieldAlbum]) : NULL);
+        BindText(stmtStage, 8, columns[FieldGenre] >= 0 ? reader.Get(columns[FieldGenre]) : NULL);
+        BindText(stmtStage, 9, columns[FieldTrackNumber] >= 0 ? reader.Get(columns[FieldTrackNumber]) : NULL);
+        BindText(stmtStage, 10, columns[FieldYear] >= 0 ? reader.Get(columns[FieldYear]) : NULL);
+        BindInt64(stmtStage, 11, hasDuration, durationMs);
+        BindText(stmtStage, 12, source);
+        
+        ok = sqlite3_step(stmtStage) == SQLITE_DONE;
+        if (ok && sqlite3_changes(db) == 0) stats.repeated++;
+        sqlite3_reset(stmtStage);
+    }
+    
+    ok = ok && !reader.Failed();
+    fclose(file);
+    return sqlite3_exec(db, ok ? "COMMIT;" : "ROLLBACK;", NULL, NULL, NULL) == SQLITE_OK && ok;
+}
+
+bool PlayImporter::Commit(ImportStats& stats) {
+    uint64_t imported = 0;
+    uint64_t known = 0;
+    if (!db || !ImportStagedPlays(db, imported, known)) return false;
+    
+    stats.imported += imported;
+    stats.known += known;
+    return true;
+}
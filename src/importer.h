@@ -0,0 +1,67 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include "sqlite3.h"
+#include <cstddef>
+#include <cstdint>
+
+enum ImportFormat {
+    ImportAuto,          // Told apart by the file's first line
+    ImportCsv,           // CSV with a header line naming the columns: those of
+                         // play_history (as written by winnp-export), or
+                         // Last.fm's uts (UTC seconds), utc_time or date, and track
+    ImportLastfm,        // Last.fm scrobble CSV without a header: artist, album,
+                         // title, date ("31 Jan 2020 12:34", UTC)
+    ImportScrobblerLog   // Audioscrobbler .scrobbler.log from a portable player:
+                         // tab-separated, '#' header lines, #TZ/UTC or #TZ/UNKNOWN
+                         // (local times)
+};
+
+struct ImportOptions {
+    ImportFormat format;
+    const char* source;  // Source recorded for every play (NULL: the file's own
+                         // source column, if any)
+};
+
+struct ImportStats {
+    uint64_t records;    // Records read from the files
+    uint64_t rejected;   // Records without a time (or a title or file) that can be read
+    uint64_t skipped;    // .scrobbler.log records of tracks skipped rather than played
+    uint64_t repeated;   // Plays repeated within the import (same time, file and title)
+    uint64_t known;      // Plays the history already had (same time, and file or title)
+    uint64_t imported;   // Plays added to the history
+};
+
+// Bulk-imports play histories kept elsewhere. Files are read a buffer at
+// a time into a staging table on the importer's own connection, then
+// Commit adds them to the history in one transaction, with the indexes
+// and rollups brought up to date in bulk rather than play by play. Plays
+// without a time zone (e.g. Last.fm's) get the local offset at their time.
+class PlayImporter {
+public:
+    PlayImporter();
+    ~PlayImporter();
+    
+    // Open (creating if necessary) the play history at path. A new history
+    // is flat; an existing one keeps its layout.
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return db != NULL; }
+    
+    // Stage the plays of the file at path. Fails on an unknown format or a
+    // read error, in which case none of the file's plays are staged.
+    bool ReadFile(const char* path, const ImportOptions& options, ImportStats& stats);
+    
+    // Add the staged plays the history doesn't have yet, in one transaction
+    bool Commit(ImportStats& stats);
+
+private:
+    int GetUtcOffset(int64_t seconds);
+    
+    sqlite3* db;
+    sqlite3_stmt* stmtStage;
+    int64_t offsetQuarter;     // Quarter hour (UTC) that offsetMinutes is for
+    int offsetMinutes;
+};
+
+#endif // IMPORTER_H
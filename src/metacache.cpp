@@ -0,0 +1,177 @@
+#include "metacache.h"
+#include "metasnapshot.h"
+#include "playevent.h"
+#include "util.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+void GetFileStamp(const char* filepath, FileStamp& stamp) {
+    stamp.valid = false;
+    stamp.size = 0;
+    stamp.mtime = 0;
+    if (!filepath || !filepath[0]) return;
+
+#ifdef _WIN32
+    // The path is UTF-8, which the narrow CRT calls would read in the ANSI
+    // code page. Past MAX_PATH, only the \\?\ form of a path opens.
+    size_t length = strlen(filepath);
+    wchar_t widePath[4 + PLAYEVENT_PATH_LEN];
+    size_t prefix = 0;
+    if (length >= _MAX_PATH && isalpha((unsigned char)filepath[0]) && filepath[1] == ':') {
+        memcpy(widePath, L"\\\\?\\", 4 * sizeof(wchar_t));
+        prefix = 4;
+    }
+    Utf8ToUtf16(filepath, length, (char16_t*)widePath + prefix, PLAYEVENT_PATH_LEN);
+    struct _stat64 info;
+    if (_wstat64(widePath, &info) != 0) return;
+#else
+    struct stat info;
+    if (stat(filepath, &info) != 0) return;
+#endif
+    stamp.valid = true;
+    stamp.size = (uint64_t)info.st_size;
+    stamp.mtime = (int64_t)info.st_mtime;
+}
+
+MetadataCache::MetadataCache(size_t capacity)
+    : capacity(capacity), snapshot(NULL), hits(0), misses(0), stale(0), evictions(0), snapshotHits(0) {
+}
+
+void MetadataCache::SetCapacity(size_t newCapacity) {
+    capacity = newCapacity;
+    while (entries.size() > capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+// Windows paths are case-insensitive and accept either separator
+void MetadataCache::NormalizePath(const char* filepath, std::string& key) {
+    key.assign(filepath ? filepath : "");
+    for (char& c : key) {
+        c = c == '/' ? '\\' : (char)tolower((unsigned char)c);
+    }
+}
+
+bool MetadataCache::Lookup(const char* filepath, const FileStamp* stamp, TrackMetadata& metadata) {
+    if (capacity == 0) {
+        misses++;
+        return false;
+    }
+    
+    NormalizePath(filepath, scratchKey);
+    auto found = index.find(scratchKey);
+    if (found == index.end()) {
+        return LookupSnapshot(filepath, stamp, metadata);
+    }
+    
+    std::list<Entry>::iterator entry = found->second;
+    if (stamp && stamp->valid && entry->stamp.valid &&
+        (stamp->size != entry->stamp.size || stamp->mtime != entry->stamp.mtime)) {
+        // File changed since it was cached (e.g. retagged)
+        index.erase(found);
+        entries.erase(entry);
+        stale++;
+        misses++;
+        return false;
+    }
+    
+    // Move to the front (most recently used)
+    entries.splice(entries.begin(), entries, entry);
+    metadata = entry->metadata;
+    hits++;
+    return true;
+}
+
+// Not cached this session: try the snapshot of earlier ones
+bool MetadataCache::LookupSnapshot(const char* filepath, const FileStamp* stamp, TrackMetadata& metadata) {
+    FileStamp snapshotStamp;
+    if (!snapshot || !snapshot->Find(scratchKey, snapshotStamp, metadata)) {
+        misses++;
+        return false;
+    }
+    if (stamp && stamp->valid && snapshotStamp.valid &&
+        (stamp->size != snapshotStamp.size || stamp->mtime != snapshotStamp.mtime)) {
+        stale++;
+        misses++;
+        return false;
+    }
+    
+    Store(filepath, &snapshotStamp, metadata);
+    hits++;
+    snapshotHits++;
+    return true;
+}
+
+void MetadataCache::Store(const char* filepath, const FileStamp* stamp, const TrackMetadata& metadata) {
+    if (capacity == 0) return;
+    
+    NormalizePath(filepath, scratchKey);
+    auto found = index.find(scratchKey);
+    if (found != index.end()) {
+        std::list<Entry>::iterator entry = found->second;
+        entry->metadata = metadata;
+        entry->stamp = stamp ? *stamp : FileStamp();
+        entries.splice(entries.begin(), entries, entry);
+        return;
+    }
+    
+    // Reuse the least recently used entry, and its index node, when full,
+    // so a full cache takes new files without allocating
+    if (entries.size() >= capacity) {
+        auto node = index.extract(entries.back().key);
+        entries.splice(entries.begin(), entries, std::prev(entries.end()));
+        evictions++;
+        
+        Entry& entry = entries.front();
+        entry.key = scratchKey;
+        entry.stamp = stamp ? *stamp : FileStamp();
+        entry.metadata = metadata;
+        node.key() = scratchKey;
+        node.mapped() = entries.begin();
+        index.insert(std::move(node));
+        return;
+    }
+    
+    entries.emplace_front();
+    Entry& entry = entries.front();
+    entry.key = scratchKey;
+    entry.stamp = stamp ? *stamp : FileStamp();
+    entry.metadata = metadata;
+    index[entry.key] = entries.begin();
+}
+
+void MetadataCache::Clear() {
+    entries.clear();
+    index.clear();
+}
+
+void MetadataCache::SetSnapshot(MetadataSnapshot* newSnapshot) {
+    snapshot = newSnapshot;
+}
+
+bool MetadataCache::SaveSnapshot(const char* path) {
+    MetadataSnapshotWriter writer;
+    for (const Entry& entry : entries) {
+        writer.Add(entry.key, entry.stamp, entry.metadata);
+    }
+    
+    // Keep what earlier sessions cached and this one didn't need
+    if (snapshot) {
+        std::string key;
+        FileStamp stamp;
+        TrackMetadata metadata;
+        for (size_t i = 0; i < snapshot->GetCount() && writer.GetCount() < capacity; i++) {
+            if (snapshot->Get(i, key, stamp, metadata) && index.find(key) == index.end()) {
+                writer.Add(key, stamp, metadata);
+            }
+        }
+        snapshot->Close();
+    }
+    return writer.Write(path);
+}
@@ -0,0 +1,92 @@
+#ifndef METACACHE_H
+#define METACACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+class MetadataSnapshot;
+
+// Parsed tags of a file, as stored in a play event
+struct TrackMetadata {
+    char artist[256];
+    char album[256];
+    char genre[128];
+    char trackNumber[32];
+    char year[32];
+    char title[512];
+    int durationMs;
+};
+
+// Size and modification time of a file, used to notice retagged files
+struct FileStamp {
+    bool valid;        // False if the file could not be examined (e.g. a stream URL)
+    uint64_t size;
+    int64_t mtime;
+};
+
+// Read the stamp of a file; stamp.valid is false on failure
+void GetFileStamp(const char* filepath, FileStamp& stamp);
+
+// Least-recently-used cache of track metadata keyed by normalized file path
+// (case-insensitive, either path separator). Not thread-safe; owned by the
+// polling thread.
+class MetadataCache {
+public:
+    explicit MetadataCache(size_t capacity = 1024);
+    
+    // Maximum number of entries (0 disables the cache)
+    void SetCapacity(size_t capacity);
+    size_t GetCapacity() const { return capacity; }
+    size_t GetSize() const { return entries.size(); }
+    
+    // Find metadata for a file. If stamp is given and valid and differs from
+    // the stamp stored with the entry, the entry is discarded as stale.
+    bool Lookup(const char* filepath, const FileStamp* stamp, TrackMetadata& metadata);
+    
+    // Add or replace the metadata for a file, evicting the least recently used entry if full
+    void Store(const char* filepath, const FileStamp* stamp, const TrackMetadata& metadata);
+    
+    void Clear();
+    
+    // Fall back on a snapshot saved by an earlier session (NULL for none).
+    // Entries found there are validated like the cache's own and then
+    // cached; they count as hits.
+    void SetSnapshot(MetadataSnapshot* snapshot);
+    
+    // Save the cached entries, and as many of the snapshot's as still fit,
+    // as the snapshot at path. Closes the snapshot, which is replaced.
+    bool SaveSnapshot(const char* path);
+    
+    // Counters since construction
+    uint64_t GetHits() const { return hits; }
+    uint64_t GetMisses() const { return misses; }
+    uint64_t GetStale() const { return stale; }
+    uint64_t GetEvictions() const { return evictions; }
+    uint64_t GetSnapshotHits() const { return snapshotHits; }
+
+private:
+    struct Entry {
+        std::string key;
+        FileStamp stamp;
+        TrackMetadata metadata;
+    };
+    
+    static void NormalizePath(const char* filepath, std::string& key);
+    bool LookupSnapshot(const char* filepath, const FileStamp* stamp, TrackMetadata& metadata);
+    
+    size_t capacity;
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    MetadataSnapshot* snapshot;
+    std::string scratchKey;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stale;
+    uint64_t evictions;
+    uint64_t snapshotHits;
+};
+
+#endif // METACACHE_H
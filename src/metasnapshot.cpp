@@ -0,0 +1,188 @@
+#include "metasnapshot.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#define METASNAPSHOT_MAGIC 0x434D4E57u  // "WNMC"
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// Size of an index entry in the file (hash, offset, size)
+#define METASNAPSHOT_INDEX_SIZE 16
+
+// Fixed part of an entry: file size, mtime, duration, stamp valid
+#define METASNAPSHOT_ENTRY_FIXED (8 + 8 + 4 + 1)
+
+// String fields of TrackMetadata, in entry order after the key
+#define METASNAPSHOT_STRING_FIELDS(X) X(artist) X(album) X(genre) X(trackNumber) X(year) X(title)
+
+static void PutString(std::vector<unsigned char>& out, const char* s, size_t length) {
+    uint16_t len = (uint16_t)(length < 0xFFFF ? length : 0xFFFF);
+    const unsigned char* bytes = (const unsigned char*)&len;
+    out.insert(out.end(), bytes, bytes + sizeof(len));
+    out.insert(out.end(), (const unsigned char*)s, (const unsigned char*)s + len);
+}
+
+static bool GetString(const unsigned char* in, size_t size, size_t& pos, const char*& s, size_t& length) {
+    uint16_t len;
+    if (pos + sizeof(len) > size) return false;
+    memcpy(&len, in + pos, sizeof(len));
+    pos += sizeof(len);
+    if (pos + len > size) return false;
+    s = (const char*)in + pos;
+    length = len;
+    pos += len;
+    return true;
+}
+
+bool MetadataSnapshot::Open(const char* path) {
+    count = 0;
+    if (!file.Open(path)) return false;
+    
+    SnapshotHeader header;
+    if (file.GetSize() < sizeof(header)) {
+        Close();
+        return false;
+    }
+    memcpy(&header, file.GetData(), sizeof(header));
+    if (header.magic != METASNAPSHOT_MAGIC || header.version != METASNAPSHOT_VERSION ||
+        header.count > (file.GetSize() - sizeof(header)) / METASNAPSHOT_INDEX_SIZE) {
+        Close();
+        return false;
+    }
+    count = header.count;
+    return true;
+}
+
+// Entry i's bytes, if they lie within the file
+bool MetadataSnapshot::GetEntry(size_t i, const unsigned char*& entry, uint32_t& entrySize) const {
+    const unsigned char* data = file.GetData();
+    size_t size = file.GetSize();
+    
+    uint32_t offset;
+    const unsigned char* indexEntry = data + sizeof(SnapshotHeader) + i * METASNAPSHOT_INDEX_SIZE;
+    memcpy(&offset, indexEntry + 8, sizeof(offset));
+    memcpy(&entrySize, indexEntry + 12, sizeof(entrySize));
+    if (offset > size || entrySize > size - offset || entrySize < METASNAPSHOT_ENTRY_FIXED) return false;
+    entry = data + offset;
+    return true;
+}
+
+// True if entry i is for key, compared in place
+bool MetadataSnapshot::MatchKey(size_t i, const std::string& key) const {
+    const unsigned char* entry;
+    uint32_t entrySize;
+    const char* s;
+    size_t length;
+    size_t pos = METASNAPSHOT_ENTRY_FIXED;
+    return GetEntry(i, entry, entrySize) && GetString(entry, entrySize, pos, s, length) &&
+           length == key.size() && memcmp(s, key.data(), length) == 0;
+}
+
+bool MetadataSnapshot::Read(size_t i, std::string* key, FileStamp& stamp, TrackMetadata& metadata) const {
+    const unsigned char* entry;
+    uint32_t entrySize;
+    if (!GetEntry(i, entry, entrySize)) return false;
+    
+    uint8_t valid;
+    memcpy(&stamp.size, entry, 8);
+    memcpy(&stamp.mtime, entry + 8, 8);
+    memcpy(&metadata.durationMs, entry + 16, 4);
+    memcpy(&valid, entry + 20, 1);
+    stamp.valid = valid != 0;
+    
+    size_t pos = METASNAPSHOT_ENTRY_FIXED;
+    const char* s;
+    size_t length;
+    if (!GetString(entry, entrySize, pos, s, length)) return false;
+    if (key) key->assign(s, length);
+#define GET_FIELD(name) \
+    if (!GetString(entry, entrySize, pos, s, length)) return false; \
+    CopyString(metadata.name, sizeof(metadata.name), s, length);
+    METASNAPSHOT_STRING_FIELDS(GET_FIELD)
+#undef GET_FIELD
+    return pos == entrySize;
+}
+
+bool MetadataSnapshot::Find(const std::string& key, FileStamp& stamp, TrackMetadata& metadata) const {
+    if (!IsOpen()) return false;
+    const unsigned char* index = file.GetData() + sizeof(SnapshotHeader);
+    uint64_t hash = HashString(key.c_str());
+    
+    // First index entry with this hash
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        uint64_t middleHash;
+        memcpy(&middleHash, index + middle * METASNAPSHOT_INDEX_SIZE, sizeof(middleHash));
+        if (middleHash < hash) low = middle + 1;
+        else high = middle;
+    }
+    
+    // Then the one whose key matches, in the unlikely event of a collision
+    for (size_t i = low; i < count; i++) {
+        uint64_t entryHash;
+        memcpy(&entryHash, index + i * METASNAPSHOT_INDEX_SIZE, sizeof(entryHash));
+        if (entryHash != hash) break;
+        if (MatchKey(i, key)) return Read(i, NULL, stamp, metadata);
+    }
+    return false;
+}
+
+bool MetadataSnapshot::Get(size_t i, std::string& key, FileStamp& stamp, TrackMetadata& metadata) const {
+    return IsOpen() && i < count && Read(i, &key, stamp, metadata);
+}
+
+void MetadataSnapshotWriter::Add(const std::string& key, const FileStamp& stamp, const TrackMetadata& metadata) {
+    size_t start = entries.size();
+    uint8_t valid = stamp.valid ? 1 : 0;
+    const unsigned char* bytes = (const unsigned char*)&stamp.size;
+    entries.insert(entries.end(), bytes, bytes + 8);
+    bytes = (const unsigned char*)&stamp.mtime;
+    entries.insert(entries.end(), bytes, bytes + 8);
+    bytes = (const unsigned char*)&metadata.durationMs;
+    entries.insert(entries.end(), bytes, bytes + 4);
+    entries.push_back(valid);
+    
+    PutString(entries, key.data(), key.size());
+#define PUT_FIELD(name) PutString(entries, metadata.name, strnlen(metadata.name, sizeof(metadata.name)));
+    METASNAPSHOT_STRING_FIELDS(PUT_FIELD)
+#undef PUT_FIELD
+    
+    IndexEntry entry = { HashString(key.c_str()), (uint32_t)start, (uint32_t)(entries.size() - start) };
+    index.push_back(entry);
+}
+
+bool MetadataSnapshotWriter::Write(const char* path) {
+    std::sort(index.begin(), index.end(), [](const IndexEntry& a, const IndexEntry& b) { return a.hash < b.hash; });
+    
+    std::string tempPath = std::string(path) + ".tmp";
+    FILE* out = OpenFile(tempPath.c_str(), "wb");
+    if (!out) return false;
+    
+    SnapshotHeader header = { METASNAPSHOT_MAGIC, METASNAPSHOT_VERSION, (uint32_t)index.size(), 0 };
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1;
+    
+    uint32_t base = (uint32_t)(sizeof(header) + index.size() * METASNAPSHOT_INDEX_SIZE);
+    for (const IndexEntry& entry : index) {
+        unsigned char record[METASNAPSHOT_INDEX_SIZE];
+        uint32_t offset = base + entry.offset;
+        memcpy(record, &entry.hash, 8);
+        memcpy(record + 8, &offset, 4);
+        memcpy(record + 12, &entry.size, 4);
+        written = written && fwrite(record, sizeof(record), 1, out) == 1;
+    }
+    written = written && (entries.empty() || fwrite(entries.data(), entries.size(), 1, out) == 1);
+    written = fclose(out) == 0 && written;
+    
+    if (!written || !RenameFile(tempPath.c_str(), path)) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef METASNAPSHOT_H
+#define METASNAPSHOT_H
+
+#include "metacache.h"
+#include "util.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Metadata cache entries saved between sessions, so the first play of a
+// file after Winamp restarts needn't ask Winamp for its tags. The file is
+// memory-mapped and only read as entries are looked up: opening checks
+// the header and nothing else, however many entries it holds.
+//
+// Layout (host byte order; the file never leaves the machine):
+//   header: "WNMC", uint32 version (1), uint32 entry count, uint32 0
+//   index:  per entry, uint64 FNV-1a hash of the key, uint32 offset of
+//           the entry from the start of the file, uint32 entry size;
+//           sorted by hash
+//   entry:  uint64 file size, int64 mtime, int32 duration ms,
+//           uint8 stamp valid, then the key (normalized path), artist,
+//           album, genre, track number, year and title, each as uint16
+//           length + bytes
+#define METASNAPSHOT_VERSION 1
+
+class MetadataSnapshot {
+public:
+    MetadataSnapshot() : count(0) {}
+    
+    // Map the snapshot at path; false if it is missing, of another version
+    // or too short for its index
+    bool Open(const char* path);
+    void Close() { file.Close(); count = 0; }
+    bool IsOpen() const { return file.IsOpen(); }
+    
+    size_t GetCount() const { return count; }
+    
+    // Find the entry for a key (as normalized by MetadataCache). Damaged
+    // entries are not found.
+    bool Find(const std::string& key, FileStamp& stamp, TrackMetadata& metadata) const;
+    
+    // Entry i in index order, e.g. to carry it over to the next snapshot
+    bool Get(size_t i, std::string& key, FileStamp& stamp, TrackMetadata& metadata) const;
+
+private:
+    bool GetEntry(size_t i, const unsigned char*& entry, uint32_t& entrySize) const;
+    bool MatchKey(size_t i, const std::string& key) const;
+    bool Read(size_t i, std::string* key, FileStamp& stamp, TrackMetadata& metadata) const;
+    
+    MappedFile file;
+    size_t count;
+};
+
+// Builds a snapshot in memory and writes it out in one go
+class MetadataSnapshotWriter {
+public:
+    void Add(const std::string& key, const FileStamp& stamp, const TrackMetadata& metadata);
+    size_t GetCount() const { return index.size(); }
+    
+    // Write to a temporary file beside path, then rename it over path, so
+    // readers see the old snapshot or the new one, never a mixture. A
+    // snapshot open on path must be closed first (Windows can't replace a
+    // mapped file).
+    bool Write(const char* path);
+
+private:
+    struct IndexEntry {
+        uint64_t hash;
+        uint32_t offset;   // Into entries until written
+        uint32_t size;
+    };
+    
+    std::vector<IndexEntry> index;
+    std::vector<unsigned char> entries;
+};
+
+#endif // METASNAPSHOT_H
@@ -0,0 +1,146 @@
+#include "metrics.h"
+#include <cmath>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const char* stageNames[MetricStageCount] = {
+    "tick", "metadata", "insert", "commit"
+};
+
+static const char* counterNames[MetricCounterCount] = {
+    "ticks", "changes", "repeats", "inserts", "failures"
+};
+
+const char* GetMetricStageName(MetricStage stage) {
+    return stage >= 0 && stage < MetricStageCount ? stageNames[stage] : "";
+}
+
+const char* GetMetricCounterName(MetricCounter counter) {
+    return counter >= 0 && counter < MetricCounterCount ? counterNames[counter] : "";
+}
+
+// Index of the highest set bit of a non-zero value (the plugin is 32-bit,
+// so no 64-bit bit scan there)
+static int HighestBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    if (_BitScanReverse(&index, (unsigned long)(value >> 32))) return (int)index + 32;
+    _BitScanReverse(&index, (unsigned long)value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+int LatencyHistogram::GetBucket(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS) return (int)ns;
+    int shift = HighestBit(ns) - 3;
+    return LATENCY_SUB_BUCKETS + shift * LATENCY_SUB_BUCKETS + (int)((ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::GetBucketLimit(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) return (uint64_t)bucket;
+    int shift = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+    uint64_t low = (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
+
+LatencyHistogram::LatencyHistogram() : count(0), totalNs(0), maxNs(0) {
+    for (std::atomic<uint64_t>& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+    buckets[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalNs.fetch_add(ns, std::memory_order_relaxed);
+    
+    uint64_t max = maxNs.load(std::memory_order_relaxed);
+    while (ns > max && !maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::GetQuantileNs(double q) const {
+    uint64_t total = GetCount();
+    if (total == 0) return 0;
+    
+    // Rank of the value wanted, counting from 1
+    uint64_t rank = (uint64_t)ceil(q * total);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // The bucket's limit can exceed the largest value actually seen
+            uint64_t limit = GetBucketLimit(bucket);
+            uint64_t max = GetMaxNs();
+            return limit < max ? limit : max;
+        }
+    }
+    return GetMaxNs();  // Counts moved on while reading
+}
+
+PlayMetrics::PlayMetrics() {
+    for (std::atomic<uint64_t>& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+}
+
+void PlayMetrics::Format(std::string& report) const {
+    char line[160];
+    for (int i = 0; i < MetricStageCount; i++) {
+        const LatencyHistogram& stage = stages[i];
+        snprintf(line, sizeof(line), "%-9s %10llu  p50 %9.1f us  p90 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+                 stageNames[i], (unsigned long long)stage.GetCount(), stage.GetQuantileNs(0.5) / 1000.0,
+                 stage.GetQuantileNs(0.9) / 1000.0, stage.GetQuantileNs(0.99) / 1000.0, stage.GetMaxNs() / 1000.0);
+        report += line;
+    }
+    for (int i = 0; i < MetricCounterCount; i++) {
+        snprintf(line, sizeof(line), "%-9s %10llu\n", counterNames[i], (unsigned long long)GetCounter((MetricCounter)i));
+        report += line;
+    }
+}
+
+// Source names are free text; quote them as CSV when needed
+static void WriteCsvText(FILE* file, const char* text) {
+    if (!strpbrk(text, ",\"\r\n")) {
+        fputs(text, file);
+        return;
+    }
+    fputc('"', file);
+    for (const char* c = text; *c; c++) {
+        if (*c == '"') fputc('"', file);
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool PlayMetrics::AppendCsv(FILE* file, int64_t recordedAtMs, const char* source) const {
+    if (!source) source = "";
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        fputs("recorded_at_ms,source,name,count,total_us,p50_us,p90_us,p99_us,max_us\n", file);
+    }
+    
+    for (int i = 0; i < MetricStageCount; i++) {
+        const LatencyHistogram& stage = stages[i];
+        fprintf(file, "%lld,", (long long)recordedAtMs);
+        WriteCsvText(file, source);
+        fprintf(file, ",%s,%llu,%llu,%llu,%llu,%llu,%llu\n", stageNames[i], (unsigned long long)stage.GetCount(),
+                (unsigned long long)(stage.GetTotalNs() / 1000), (unsigned long long)(stage.GetQuantileNs(0.5) / 1000),
+                (unsigned long long)(stage.GetQuantileNs(0.9) / 1000), (unsigned long long)(stage.GetQuantileNs(0.99) / 1000),
+                (unsigned long long)(stage.GetMaxNs() / 1000));
+    }
+    for (int i = 0; i < MetricCounterCount; i++) {
+        fprintf(file, "%lld,", (long long)recordedAtMs);
+        WriteCsvText(file, source);
+        fprintf(file, ",%s,%llu,,,,,\n", counterNames[i], (unsigned long long)GetCounter((MetricCounter)i));
+    }
+    return fflush(file) == 0 && !ferror(file);
+}
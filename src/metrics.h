@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Histogram buckets: values below LATENCY_SUB_BUCKETS get a bucket each,
+// and every power of two above is split into LATENCY_SUB_BUCKETS equal
+// buckets, so any value is known to within 1/8 (12.5%) up to 2^64 ns
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKET_COUNT (LATENCY_SUB_BUCKETS + (64 - 3) * LATENCY_SUB_BUCKETS)
+
+// Monotonic time in nanoseconds, for timing stages
+inline uint64_t MetricsNowNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// HDR-style histogram of latencies in nanoseconds. Lock-free: Record may
+// run on one thread while others read, each update a relaxed atomic add.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    
+    void Record(uint64_t ns);
+    
+    uint64_t GetCount() const { return count.load(std::memory_order_relaxed); }
+    uint64_t GetTotalNs() const { return totalNs.load(std::memory_order_relaxed); }
+    uint64_t GetMaxNs() const { return maxNs.load(std::memory_order_relaxed); }
+    
+    // Upper bound of the bucket holding quantile q (0 to 1); 0 if empty
+    uint64_t GetQuantileNs(double q) const;
+    
+    // Bucket a value falls in, and the largest value in a bucket
+    static int GetBucket(uint64_t ns);
+    static uint64_t GetBucketLimit(int bucket);
+
+private:
+    std::atomic<uint64_t> buckets[LATENCY_BUCKET_COUNT];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+};
+
+// Timed stages of logging a play
+enum MetricStage {
+    MetricTick,       // A whole poll of the player
+    MetricMetadata,   // Fetching a file's tags from the player
+    MetricInsert,     // Writing a play to the database (or handing it over)
+    MetricCommit,     // Committing a batch of plays
+    MetricStageCount
+};
+
+// Counted events
+enum MetricCounter {
+    MetricTicks,      // Polls of the player
+    MetricChanges,    // New tracks detected
+    MetricRepeats,    // Repeats of the same track detected
+    MetricInserts,    // Plays written
+    MetricFailures,   // Writes, commits, reconnects or spool clears that failed
+    MetricCounterCount
+};
+
+const char* GetMetricStageName(MetricStage stage);
+const char* GetMetricCounterName(MetricCounter counter);
+
+// The logger's instrumentation: a latency histogram per stage and a few
+// counters, all cumulative since construction. Cheap enough to leave on
+// (see winnp-replay --metrics); safe to read from any thread.
+class PlayMetrics {
+public:
+    PlayMetrics();
+    
+    void Record(MetricStage stage, uint64_t ns) { stages[stage].Record(ns); }
+    void Count(MetricCounter counter) { counters[counter].fetch_add(1, std::memory_order_relaxed); }
+    
+    const LatencyHistogram& GetStage(MetricStage stage) const { return stages[stage]; }
+    uint64_t GetCounter(MetricCounter counter) const { return counters[counter].load(std::memory_order_relaxed); }
+    
+    // Readable summary: a line per stage (count, p50/p90/p99/max) and counter
+    void Format(std::string& report) const;
+    
+    // Append a snapshot as CSV rows, as in the metrics table (with a header
+    // line if the file is empty)
+    bool AppendCsv(FILE* file, int64_t recordedAtMs, const char* source) const;
+
+private:
+    LatencyHistogram stages[MetricStageCount];
+    std::atomic<uint64_t> counters[MetricCounterCount];
+};
+
+// Times the enclosing scope into a stage; does nothing without metrics
+class StageTimer {
+public:
+    StageTimer(PlayMetrics* metrics, MetricStage stage)
+        : metrics(metrics), stage(stage), startNs(metrics ? MetricsNowNs() : 0) {}
+    
+    ~StageTimer() {
+        if (metrics) metrics->Record(stage, MetricsNowNs() - startNs);
+    }
+
+private:
+    PlayMetrics* metrics;
+    MetricStage stage;
+    uint64_t startNs;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,84 @@
+#ifndef PLAYERSOURCE_H
+#define PLAYERSOURCE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Play states reported by GetPlayState (same values as Winamp's IPC_ISPLAYING)
+#define PLAYSTATE_STOPPED 0
+#define PLAYSTATE_PLAYING 1
+#define PLAYSTATE_PAUSED 3
+
+// One field of a batched metadata lookup
+struct MetadataField {
+    const char* name;    // "artist", "album", ...
+    char* buffer;
+    size_t bufferSize;
+    uint32_t elapsedUs;  // Set by the lookup: time spent fetching this field
+};
+
+// Notifications a player source can raise
+enum PlayerEvent {
+    PlayerEventTrackStarted,  // A track started playing (possibly the same one again)
+    PlayerEventTitleChanged,  // The current title changed, e.g. stream metadata
+    PlayerEventStateChanged   // Playing, paused or stopped
+};
+
+// Receives player notifications, on whatever thread the source raises them
+typedef void (*PlayerEventProc)(PlayerEvent event, void* context);
+
+// The queries the logger makes of the media player. The Winamp plugin
+// implements this over IPC messages; other implementations can simulate
+// a player for testing. All text (titles, paths, metadata) is UTF-8.
+class PlayerSource {
+public:
+    virtual ~PlayerSource() {}
+    
+    // True if the player can be queried right now (e.g. its window exists)
+    virtual bool IsAvailable() = 0;
+    
+    // PLAYSTATE_* (IPC_ISPLAYING)
+    virtual int GetPlayState() = 0;
+    
+    // Current playlist index, or -1 (IPC_GETLISTPOS)
+    virtual int GetListPos() = 0;
+    
+    // Title/path of a playlist entry; buffer is left empty on failure
+    // (IPC_GETPLAYLISTTITLEW / IPC_GETPLAYLISTFILEW)
+    virtual void GetPlaylistTitle(int position, char* buffer, size_t bufferSize) = 0;
+    virtual void GetPlaylistFile(int position, char* buffer, size_t bufferSize) = 0;
+    
+    // Title of the current track by other means, if the playlist title is empty
+    virtual void GetFallbackTitle(char* buffer, size_t bufferSize) {
+        if (bufferSize > 0) buffer[0] = '\0';
+    }
+    
+    // Playback position (mode 0) or track length (mode 1) in ms (IPC_GETOUTPUTTIME)
+    virtual int GetOutputTime(int mode) = 0;
+    
+    // A metadata field ("artist", "album", ...) of a file (IPC_GET_EXTENDED_FILE_INFOW)
+    virtual void GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) = 0;
+    
+    // Call proc whenever playback may have changed, so the caller can check
+    // right away instead of waiting for the next poll. Returns false if the
+    // source can only be polled.
+    virtual bool SubscribeEvents(PlayerEventProc, void*) {
+        return false;
+    }
+    virtual void UnsubscribeEvents() {}
+    
+    // Several metadata fields of a file in one operation. Sources where each
+    // query is a round trip should override this to batch them; the default
+    // simply looks up and times each field in turn.
+    virtual void GetExtendedFileInfoBatch(const char* filepath, MetadataField* fields, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            auto start = std::chrono::steady_clock::now();
+            GetExtendedFileInfo(filepath, fields[i].name, fields[i].buffer, fields[i].bufferSize);
+            fields[i].elapsedUs = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    }
+};
+
+#endif // PLAYERSOURCE_H
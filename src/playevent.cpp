@@ -0,0 +1,56 @@
+#include "playevent.h"
+#include <cstring>
+
+PlayEvent& PlayEvent::operator=(const PlayEvent& other) {
+    if (this == &other) return *this;
+    playedAtMs = other.playedAtMs;
+    utcOffsetMin = other.utcOffsetMin;
+    durationMs = other.durationMs;
+    memcpy(fields, other.fields, sizeof(fields));
+    used = other.used;
+    memcpy(arena, other.arena, used);
+    return *this;
+}
+
+void PlayEvent::Clear() {
+    playedAtMs = 0;
+    utcOffsetMin = 0;
+    durationMs = 0;
+    
+    // Every field starts as the empty string at the start of the arena
+    memset(fields, 0, sizeof(fields));
+    arena[0] = '\0';
+    used = 1;
+}
+
+bool PlayEvent::SetText(PlayField field, const char* text, size_t length) {
+    if (!text || length == 0) {
+        fields[field].offset = 0;
+        fields[field].length = 0;
+        return true;
+    }
+    
+    // Leave room for the terminator, and don't split a UTF-8 sequence
+    size_t room = used < PLAYEVENT_ARENA_SIZE ? PLAYEVENT_ARENA_SIZE - used - 1 : 0;
+    bool fits = length <= room;
+    if (!fits) {
+        length = room;
+        while (length > 0 && ((unsigned char)text[length] & 0xC0) == 0x80) length--;
+        if (length == 0) {
+            fields[field].offset = 0;
+            fields[field].length = 0;
+            return false;
+        }
+    }
+    
+    memcpy(arena + used, text, length);
+    arena[used + length] = '\0';
+    fields[field].offset = used;
+    fields[field].length = (uint16_t)length;
+    used = (uint16_t)(used + length + 1);
+    return fits;
+}
+
+bool PlayEvent::SetText(PlayField field, const char* text) {
+    return SetText(field, text, text ? strlen(text) : 0);
+}
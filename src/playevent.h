@@ -0,0 +1,74 @@
+#ifndef PLAYEVENT_H
+#define PLAYEVENT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Sizes of the buffers used when querying Winamp, in bytes of UTF-8. Paths
+// may be longer than MAX_PATH (\\?\ paths, long path aware systems).
+#define PLAYEVENT_PATH_LEN 2048
+#define PLAYEVENT_TITLE_LEN 2048
+#define PLAYEVENT_SOURCE_LEN 64
+
+// Text one play can hold, all fields together with their terminators:
+// room for every field at the size Winamp gives it to us
+#define PLAYEVENT_ARENA_SIZE 8192
+
+// Text fields of a play, in the order they are stored in records
+enum PlayField {
+    PlayFilepath,
+    PlayFilename,
+    PlayTitle,
+    PlayArtist,
+    PlayAlbum,
+    PlayGenre,
+    PlayTrackNumber,
+    PlayYear,
+    PlaySource,         // Instance (e.g. zone) that logged the play; empty if unnamed
+    PlayFieldCount
+};
+
+// A single play, fully gathered on the polling thread and then handed
+// to the writer thread. Never modified once it has been queued.
+//
+// Each text field is stored once, as UTF-8 in the event's own arena with
+// its length (and a terminator, for C strings), so filling, copying and
+// binding an event never allocates or measures strings. Clear readies an
+// event for reuse; copies take only the part of the arena in use.
+struct PlayEvent {
+    int64_t playedAtMs;                     // UTC milliseconds since the Unix epoch
+    int utcOffsetMin;                       // Local time zone offset when played
+    int durationMs;
+    
+    PlayEvent() { Clear(); }
+    PlayEvent(const PlayEvent& other) { *this = other; }
+    PlayEvent& operator=(const PlayEvent& other);
+    
+    // Zero the numbers and empty every field
+    void Clear();
+    
+    // Set a field, once per event (setting it again takes more of the
+    // arena). Text that doesn't fit in what is left of the arena is cut at
+    // a character boundary; returns false if so.
+    bool SetText(PlayField field, const char* text, size_t length);
+    bool SetText(PlayField field, const char* text);
+    
+    // A field's text, NUL-terminated, and its length in bytes
+    const char* GetText(PlayField field) const { return arena + fields[field].offset; }
+    size_t GetLength(PlayField field) const { return fields[field].length; }
+
+private:
+    struct TextView {
+        uint16_t offset;
+        uint16_t length;
+    };
+    
+    TextView fields[PlayFieldCount];
+    uint16_t used;                          // Arena bytes in use (at least the shared empty string)
+    char arena[PLAYEVENT_ARENA_SIZE];
+};
+
+// Receives play events (e.g. to store them); returns false on failure
+typedef bool (*PlayEventSink)(const PlayEvent& event);
+
+#endif // PLAYEVENT_H
@@ -0,0 +1,73 @@
+#include "pollschedule.h"
+
+// Sampling near the end starts at this percentage of the track, and then
+// runs every TRACK_END_STEP_PERCENT (92, 95, 98) or until the end of the track,
+// whichever comes first
+#define TRACK_END_START_PERCENT 92
+#define TRACK_END_STEP_PERCENT 3
+
+static const char* pollReasonNames[PollReasonCount] = {
+    "idle", "no-length", "mid-track", "track-end"
+};
+
+const char* GetPollReasonName(PollReason reason) {
+    return reason >= 0 && reason < PollReasonCount ? pollReasonNames[reason] : "";
+}
+
+PollScheduler::PollScheduler() {
+    PollScheduleConfig defaults = { 2000, 500, 2000, 100 };
+    config = defaults;
+    for (int i = 0; i < PollReasonCount; i++) {
+        decisions[i] = 0;
+    }
+}
+
+void PollScheduler::SetConfig(const PollScheduleConfig& newConfig) {
+    config = newConfig;
+    if (config.minMs == 0) config.minMs = 1;
+    if (config.playingMs < config.minMs) config.playingMs = config.minMs;
+    if (config.midTrackMs < config.playingMs) config.midTrackMs = config.playingMs;
+    if (config.idleMs < config.minMs) config.idleMs = config.minMs;
+}
+
+static int64_t Clamp(int64_t value, int64_t low, int64_t high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+unsigned int PollScheduler::Next(bool idle, int positionMs, int lengthMs) {
+    PollReason reason;
+    int64_t interval;
+    
+    if (idle) {
+        reason = PollReasonIdle;
+        interval = config.idleMs;
+    } else if (lengthMs <= 0 || positionMs < 0) {
+        reason = PollReasonNoLength;
+        interval = config.playingMs;
+    } else {
+        int64_t step = Clamp((int64_t)lengthMs * TRACK_END_STEP_PERCENT / 100, config.minMs, config.playingMs);
+        int64_t trackEnd = (int64_t)lengthMs * TRACK_END_START_PERCENT / 100;
+        
+        if (positionMs < trackEnd) {
+            // Sleep until sampling near the end begins, within bounds
+            reason = PollReasonMidTrack;
+            interval = Clamp(trackEnd - positionMs, step, config.midTrackMs);
+            
+            // On tracks only a few steps long that would carry past the end
+            if (positionMs + interval >= lengthMs) interval = trackEnd - positionMs;
+        } else {
+            reason = PollReasonTrackEnd;
+            interval = step;
+        }
+        
+        // Never sleep past the end of the track, even below minMs: wake as it
+        // ends, while the next play is still in its first 5% (and before a
+        // stop or skip can end it unseen). Past the end with the same track
+        // still there, look again soon.
+        int64_t untilEnd = (int64_t)lengthMs - positionMs;
+        if (interval > untilEnd) interval = untilEnd > 0 ? untilEnd : config.minMs;
+    }
+    
+    decisions[reason]++;
+    return (unsigned int)interval;
+}
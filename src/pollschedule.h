@@ -0,0 +1,48 @@
+#ifndef POLLSCHEDULE_H
+#define POLLSCHEDULE_H
+
+#include <cstdint>
+
+// Why a poll interval was chosen
+enum PollReason {
+    PollReasonIdle,      // Stopped or paused
+    PollReasonNoLength,  // Playing something without a length (e.g. a stream)
+    PollReasonMidTrack,  // Well before the end of the track
+    PollReasonTrackEnd,  // Close to the end, where repeats must be caught
+    PollReasonCount
+};
+
+// Name of a reason ("idle", "no-length", ...)
+const char* GetPollReasonName(PollReason reason);
+
+// Bounds of the adaptive schedule, in milliseconds
+struct PollScheduleConfig {
+    unsigned int idleMs;      // While stopped or paused
+    unsigned int playingMs;   // Without a track length, and the slowest rate near the end
+    unsigned int midTrackMs;  // Longest wait mid-track
+    unsigned int minMs;       // Shortest wait near the end of very short tracks, except to wake at the end
+};
+
+// Picks the time until the next poll from what the last poll saw, for when
+// the player can't notify us of changes. Near the end of a track it samples
+// often enough that repeat detection sees both the last 10% of one play and
+// the first 5% of the next; elsewhere it backs off.
+class PollScheduler {
+public:
+    PollScheduler();
+    
+    void SetConfig(const PollScheduleConfig& config);
+    const PollScheduleConfig& GetConfig() const { return config; }
+    
+    // Interval until the next poll, given the last observed state
+    unsigned int Next(bool idle, int positionMs, int lengthMs);
+    
+    // Number of intervals chosen for each reason
+    uint64_t GetDecisions(PollReason reason) const { return decisions[reason]; }
+
+private:
+    PollScheduleConfig config;
+    uint64_t decisions[PollReasonCount];
+};
+
+#endif // POLLSCHEDULE_H
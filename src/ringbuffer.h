@@ -0,0 +1,135 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+// What Push does when the ring is full
+enum OverflowPolicy {
+    OverflowDropNewest,  // Reject the incoming item (wait-free)
+    OverflowDropOldest,  // Discard the oldest unread item to make room (waits only for a Pop already copying it)
+    OverflowBlock        // Yield until the consumer frees a slot
+};
+
+// Fixed-capacity single-producer/single-consumer ring buffer.
+// Slots are preallocated and items are copied in and out, so neither side
+// allocates or takes a lock. Exactly one thread may call Push and exactly
+// one (other) thread may call Pop.
+//
+// Indices are free-running counters; a slot is (index & (Capacity - 1)).
+// Each slot carries a sequence number saying who owns it (as in Vyukov's
+// bounded queue): the slot for index i is free for the producer when its
+// sequence is i, and holds item i for the consumer when it is i + 1. The
+// consumer claims an item by CAS on tail before copying it out, and hands
+// the slot back (sequence i + Capacity) afterwards. Under DropOldest the
+// producer discards the oldest item by winning the same CAS, which makes
+// the slot its own; if the consumer won it instead, the producer waits for
+// that copy to finish. Either way, only the owner of a slot touches it.
+template <typename T, size_t Capacity>
+class SpscRingBuffer {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    explicit SpscRingBuffer(OverflowPolicy policy = OverflowDropNewest)
+        : policy(policy), head(0), tail(0), droppedNewest(0), droppedOldest(0) {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+    
+    // Producer only. Returns false if the item was dropped.
+    bool Push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[h & (Capacity - 1)];
+        
+        // Full while the slot still holds (or hands out) item h - Capacity
+        while (slot.sequence.load(std::memory_order_acquire) != h) {
+            switch (policy) {
+            case OverflowDropNewest:
+                droppedNewest.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case OverflowDropOldest: {
+                size_t oldest = h - Capacity;
+                if (tail.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel)) {
+                    droppedOldest.fetch_add(1, std::memory_order_relaxed);
+                    Publish(slot, h, item);
+                    return true;
+                }
+                // The consumer is copying the oldest item out; the slot is
+                // ours as soon as it is done
+                std::this_thread::yield();
+                break;
+            }
+            case OverflowBlock:
+                std::this_thread::yield();
+                break;
+            }
+        }
+        
+        Publish(slot, h, item);
+        return true;
+    }
+    
+    // Consumer only. Returns false if the ring is empty.
+    bool Pop(T& item) {
+        for (;;) {
+            size_t t = tail.load(std::memory_order_acquire);
+            Slot& slot = slots[t & (Capacity - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == t + 1) {
+                if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                    item = slot.item;
+                    slot.sequence.store(t + Capacity, std::memory_order_release);
+                    return true;
+                }
+                // The producer dropped this item; try the next one
+            } else if ((ptrdiff_t)(sequence - (t + 1)) < 0) {
+                return false;
+            }
+            // Otherwise tail moved on since we read it
+        }
+    }
+    
+    bool Empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+    
+    size_t Size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        return head.load(std::memory_order_acquire) - t;
+    }
+    
+    static constexpr size_t GetCapacity() { return Capacity; }
+    OverflowPolicy GetPolicy() const { return policy; }
+    unsigned long GetDroppedNewest() const { return droppedNewest.load(std::memory_order_relaxed); }
+    unsigned long GetDroppedOldest() const { return droppedOldest.load(std::memory_order_relaxed); }
+    
+    // Only safe while neither side is active
+    void SetPolicy(OverflowPolicy newPolicy) { policy = newPolicy; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+    
+    // Fill a slot the producer owns and hand it to the consumer
+    void Publish(Slot& slot, size_t h, const T& item) {
+        slot.item = item;
+        slot.sequence.store(h + 1, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+    }
+    
+    OverflowPolicy policy;
+    Slot slots[Capacity];
+    alignas(64) std::atomic<size_t> head;   // Next slot to write (producer)
+    alignas(64) std::atomic<size_t> tail;   // Next slot to read (consumer, or producer when dropping)
+    alignas(64) std::atomic<unsigned long> droppedNewest;
+    std::atomic<unsigned long> droppedOldest;
+};
+
+#endif // RINGBUFFER_H
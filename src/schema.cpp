@@ -0,0 +1,768 @@
+#include "schema.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Schema versions (PRAGMA user_version)
+//   0: played_at stored as local time TEXT
+//   1: played_at_ms (UTC epoch ms) + utc_offset_min; played_at derived from them
+//   2: source (the instance that logged the play)
+//   3: covering indexes for statistics replace the played_at_ms indexes
+//   4: rollup tables (plays per day, per artist per day, per track)
+#define SCHEMA_VERSION 4
+
+// Everything the statistics queries read from a play, led by its time, so
+// a time window is one index range and the rows themselves are never read
+#define FLAT_STATS_INDEX_SQL \
+    "CREATE INDEX IF NOT EXISTS idx_play_stats ON play_history(played_at_ms, utc_offset_min, duration_ms, artist, album, genre, title);"
+#define NORMALIZED_STATS_INDEX_SQL \
+    "CREATE INDEX IF NOT EXISTS idx_plays_stats ON plays(played_at_ms, utc_offset_min, duration_ms, track_id);"
+
+// Local calendar day of a play, numbered from 1970-01-01
+#define LOCAL_DAY(ms, offset) "((" ms " / 1000 + " offset " * 60) / 86400)"
+
+// Add a play to the rollups in the same statement (and so transaction) as
+// the play itself. The flat layout keys artists and tracks by name, the
+// normalized one by artist id (and title), so each rollup row stays one
+// lookup away from the play that updates it.
+#define UPSERT_ROLLUP(key) " ON CONFLICT(" key ") DO UPDATE SET plays = plays + 1, play_ms = play_ms + excluded.play_ms;"
+#define MERGE_ROLLUP(key) " ON CONFLICT(" key ") DO UPDATE SET plays = plays + excluded.plays, play_ms = play_ms + excluded.play_ms;"
+#define ROLLUP_TABLES_SQL(artist, type) \
+    "CREATE TABLE IF NOT EXISTS rollup_days (" \
+    "    day INTEGER PRIMARY KEY," \
+    "    plays INTEGER NOT NULL," \
+    "    play_ms INTEGER NOT NULL" \
+    ");" \
+    "CREATE TABLE IF NOT EXISTS rollup_artist_days (" \
+    "    day INTEGER NOT NULL," \
+    "    " artist " " type " NOT NULL," \
+    "    plays INTEGER NOT NULL," \
+    "    play_ms INTEGER NOT NULL," \
+    "    PRIMARY KEY(day, " artist ")" \
+    ") WITHOUT ROWID;" \
+    "CREATE TABLE IF NOT EXISTS rollup_tracks (" \
+    "    " artist " " type " NOT NULL," \
+    "    title TEXT NOT NULL," \
+    "    plays INTEGER NOT NULL," \
+    "    play_ms INTEGER NOT NULL," \
+    "    PRIMARY KEY(" artist ", title)" \
+    ") WITHOUT ROWID;" \
+    "CREATE INDEX IF NOT EXISTS idx_rollup_tracks_plays ON rollup_tracks(plays DESC, title);"
+
+// Legacy "%Y-%m-%d %H:%M:%S" local time text from the integer columns
+#define PLAYED_AT_TEXT(ms, offset) "strftime('%Y-%m-%d %H:%M:%S', " ms " / 1000 + " offset " * 60, 'unixepoch')"
+
+// Version 0 local time text to UTC ms / offset in minutes, using this
+// machine's time zone rules (including DST) for the date in question
+#define LOCAL_TEXT_TO_MS(text) "COALESCE(CAST(strftime('%s', " text ", 'utc') AS INTEGER) * 1000, 0)"
+#define LOCAL_TEXT_TO_OFFSET(text) "COALESCE((strftime('%s', " text ") - strftime('%s', " text ", 'utc')) / 60, 0)"
+
+// Flat layout; played_at keeps its original position for SELECT * readers
+static const char* flatSchemaSQL =
+    "CREATE TABLE IF NOT EXISTS play_history ("
+    "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "    played_at TEXT GENERATED ALWAYS AS (" PLAYED_AT_TEXT("played_at_ms", "utc_offset_min") ") VIRTUAL,"
+    "    filepath TEXT,"
+    "    filename TEXT,"
+    "    title TEXT,"
+    "    artist TEXT,"
+    "    album TEXT,"
+    "    genre TEXT,"
+    "    track_number TEXT,"
+    "    year TEXT,"
+    "    duration_ms INTEGER,"
+    "    played_at_ms INTEGER NOT NULL,"
+    "    utc_offset_min INTEGER NOT NULL DEFAULT 0,"
+    "    source TEXT"
+    ");"
+    FLAT_STATS_INDEX_SQL;
+
+// Rollups of the flat table; also the version 3 -> 4 step
+static const char* flatRollupSQL =
+    ROLLUP_TABLES_SQL("artist", "TEXT")
+    "CREATE TRIGGER IF NOT EXISTS play_history_rollup AFTER INSERT ON play_history BEGIN"
+    "    INSERT INTO rollup_days VALUES ("
+    "        " LOCAL_DAY("NEW.played_at_ms", "NEW.utc_offset_min") ", 1, COALESCE(NEW.duration_ms, 0))" UPSERT_ROLLUP("day")
+    "    INSERT INTO rollup_artist_days VALUES ("
+    "        " LOCAL_DAY("NEW.played_at_ms", "NEW.utc_offset_min") ", COALESCE(NEW.artist, ''), 1, COALESCE(NEW.duration_ms, 0))" UPSERT_ROLLUP("day, artist")
+    "    INSERT INTO rollup_tracks VALUES ("
+    "        COALESCE(NEW.artist, ''), COALESCE(NEW.title, ''), 1, COALESCE(NEW.duration_ms, 0))" UPSERT_ROLLUP("artist, title")
+    "END;";
+
+// Add the flat plays with ids above ?1 to the rollups in bulk
+static const char* mergeFlatRollupSQL =
+    "INSERT INTO rollup_days"
+    "    SELECT " LOCAL_DAY("played_at_ms", "utc_offset_min") ", COUNT(*), SUM(COALESCE(duration_ms, 0))"
+    "    FROM play_history WHERE id > ?1 GROUP BY 1" MERGE_ROLLUP("day")
+    "INSERT INTO rollup_artist_days"
+    "    SELECT " LOCAL_DAY("played_at_ms", "utc_offset_min") ", COALESCE(artist, ''), COUNT(*), SUM(COALESCE(duration_ms, 0))"
+    "    FROM play_history WHERE id > ?1 GROUP BY 1, 2" MERGE_ROLLUP("day, artist")
+    "INSERT INTO rollup_tracks"
+    "    SELECT COALESCE(artist, ''), COALESCE(title, ''), COUNT(*), SUM(COALESCE(duration_ms, 0))"
+    "    FROM play_history WHERE id > ?1 GROUP BY 1, 2" MERGE_ROLLUP("artist, title");
+
+// Give a table rebuilt from another the other's AUTOINCREMENT high-water
+// mark, which dropping it would lose, so that ids of plays deleted from
+// the end are still never handed out again
+#define CARRY_SEQUENCE_SQL(from, to) \
+    "UPDATE sqlite_sequence SET seq = (SELECT seq FROM sqlite_sequence WHERE name = '" from "')" \
+    "    WHERE name = '" to "' AND seq < (SELECT seq FROM sqlite_sequence WHERE name = '" from "');" \
+    "INSERT INTO sqlite_sequence(name, seq) SELECT '" to "', seq FROM sqlite_sequence" \
+    "    WHERE name = '" from "' AND NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = '" to "');"
+
+// Rebuild a version 0 flat table with integer timestamps (indexed by the
+// version 3 step)
+static const char* upgradeFlatSQL =
+    "ALTER TABLE play_history RENAME TO play_history_v0;"
+    "DROP INDEX IF EXISTS idx_played_at;"
+    "CREATE TABLE play_history ("
+    "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "    played_at TEXT GENERATED ALWAYS AS (" PLAYED_AT_TEXT("played_at_ms", "utc_offset_min") ") VIRTUAL,"
+    "    filepath TEXT,"
+    "    filename TEXT,"
+    "    title TEXT,"
+    "    artist TEXT,"
+    "    album TEXT,"
+    "    genre TEXT,"
+    "    track_number TEXT,"
+    "    year TEXT,"
+    "    duration_ms INTEGER,"
+    "    played_at_ms INTEGER NOT NULL,"
+    "    utc_offset_min INTEGER NOT NULL DEFAULT 0"
+    ");"
+    "INSERT INTO play_history(id, filepath, filename, title, artist, album, genre, track_number, year, duration_ms,"
+    "                         played_at_ms, utc_offset_min)"
+    "    SELECT id, filepath, filename, title, artist, album, genre, track_number, year, duration_ms,"
+    "           " LOCAL_TEXT_TO_MS("played_at") ", " LOCAL_TEXT_TO_OFFSET("played_at")
+    "    FROM play_history_v0 ORDER BY id;"
+    CARRY_SEQUENCE_SQL("play_history_v0", "play_history")
+    "DROP TABLE play_history_v0;";
+
+// Version 1 -> 2: where each play came from (NULL for earlier plays)
+static const char* addSourceFlatSQL =
+    "ALTER TABLE play_history ADD COLUMN source TEXT;";
+
+// Version 2 -> 3
+static const char* statsIndexFlatSQL =
+    "DROP INDEX IF EXISTS idx_played_at_ms;"
+    FLAT_STATS_INDEX_SQL;
+
+// Dimension tables hold each distinct string once; missing tags are stored
+// as '' so that every play joins to exactly one row of each
+static const char* normalizedTablesSQL =
+    "CREATE TABLE IF NOT EXISTS artists ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS albums ("
+    "    id INTEGER PRIMARY KEY,"
+    "    artist_id INTEGER NOT NULL REFERENCES artists(id),"
+    "    name TEXT NOT NULL,"
+    "    UNIQUE(artist_id, name)"
+    ");"
+    "CREATE TABLE IF NOT EXISTS genres ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS files ("
+    "    id INTEGER PRIMARY KEY,"
+    "    filepath TEXT NOT NULL UNIQUE,"
+    "    filename TEXT NOT NULL"
+    ");"
+    "CREATE TABLE IF NOT EXISTS tracks ("
+    "    id INTEGER PRIMARY KEY,"
+    "    file_id INTEGER NOT NULL REFERENCES files(id),"
+    "    title TEXT NOT NULL,"
+    "    artist_id INTEGER NOT NULL REFERENCES artists(id),"
+    "    album_id INTEGER NOT NULL REFERENCES albums(id),"
+    "    genre_id INTEGER NOT NULL REFERENCES genres(id),"
+    "    track_number TEXT NOT NULL,"
+    "    year TEXT NOT NULL,"
+    "    UNIQUE(file_id, title, artist_id, album_id, genre_id, track_number, year)"
+    ");"
+    "CREATE TABLE IF NOT EXISTS sources ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS plays ("
+    "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "    played_at_ms INTEGER NOT NULL,"
+    "    utc_offset_min INTEGER NOT NULL DEFAULT 0,"
+    "    track_id INTEGER NOT NULL REFERENCES tracks(id),"
+    "    duration_ms INTEGER,"
+    "    source_id INTEGER REFERENCES sources(id)"
+    ");"
+    NORMALIZED_STATS_INDEX_SQL
+    "CREATE INDEX IF NOT EXISTS idx_plays_track ON plays(track_id);"
+    "CREATE INDEX IF NOT EXISTS idx_tracks_artist ON tracks(artist_id);";
+
+// The original columns (plus the integer timestamp), so existing readers
+// and writers keep working. Writers may give either played_at_ms or the
+// legacy local time text.
+static const char* normalizedViewSQL =
+    "CREATE VIEW IF NOT EXISTS play_history AS"
+    "    SELECT p.id AS id, " PLAYED_AT_TEXT("p.played_at_ms", "p.utc_offset_min") " AS played_at,"
+    "           f.filepath AS filepath, f.filename AS filename,"
+    "           t.title AS title, ar.name AS artist, al.name AS album, g.name AS genre,"
+    "           t.track_number AS track_number, t.year AS year, p.duration_ms AS duration_ms,"
+    "           p.played_at_ms AS played_at_ms, p.utc_offset_min AS utc_offset_min, s.name AS source"
+    "    FROM plays p"
+    "    JOIN tracks t ON t.id = p.track_id"
+    "    JOIN files f ON f.id = t.file_id"
+    "    JOIN artists ar ON ar.id = t.artist_id"
+    "    JOIN albums al ON al.id = t.album_id"
+    "    JOIN genres g ON g.id = t.genre_id"
+    "    LEFT JOIN sources s ON s.id = p.source_id;"
+    "CREATE TRIGGER IF NOT EXISTS play_history_insert INSTEAD OF INSERT ON play_history BEGIN"
+    "    INSERT OR IGNORE INTO artists(name) VALUES (COALESCE(NEW.artist, ''));"
+    "    INSERT OR IGNORE INTO albums(artist_id, name) VALUES ("
+    "        (SELECT id FROM artists WHERE name = COALESCE(NEW.artist, '')), COALESCE(NEW.album, ''));"
+    "    INSERT OR IGNORE INTO genres(name) VALUES (COALESCE(NEW.genre, ''));"
+    "    INSERT OR IGNORE INTO files(filepath, filename) VALUES (COALESCE(NEW.filepath, ''), COALESCE(NEW.filename, ''));"
+    "    INSERT OR IGNORE INTO tracks(file_id, title, artist_id, album_id, genre_id, track_number, year) VALUES ("
+    "        (SELECT id FROM files WHERE filepath = COALESCE(NEW.filepath, '')),"
+    "        COALESCE(NEW.title, ''),"
+    "        (SELECT id FROM artists WHERE name = COALESCE(NEW.artist, '')),"
+    "        (SELECT al.id FROM albums al JOIN artists ar ON ar.id = al.artist_id"
+    "            WHERE ar.name = COALESCE(NEW.artist, '') AND al.name = COALESCE(NEW.album, '')),"
+    "        (SELECT id FROM genres WHERE name = COALESCE(NEW.genre, '')),"
+    "        COALESCE(NEW.track_number, ''), COALESCE(NEW.year, ''));"
+    "    INSERT OR IGNORE INTO sources(name) SELECT NEW.source WHERE NEW.source IS NOT NULL;"
+    "    INSERT INTO plays(id, played_at_ms, utc_offset_min, track_id, duration_ms, source_id) VALUES ("
+    "        NEW.id,"
+    "        COALESCE(NEW.played_at_ms, " LOCAL_TEXT_TO_MS("NEW.played_at") "),"
+    "        CASE WHEN NEW.played_at_ms IS NULL THEN " LOCAL_TEXT_TO_OFFSET("NEW.played_at")
+    "             ELSE COALESCE(NEW.utc_offset_min, 0) END,"
+    "        (SELECT t.id FROM tracks t"
+    "            JOIN files f ON f.id = t.file_id"
+    "            JOIN artists ar ON ar.id = t.artist_id"
+    "            JOIN albums al ON al.id = t.album_id"
+    "            JOIN genres g ON g.id = t.genre_id"
+    "            WHERE f.filepath = COALESCE(NEW.filepath, '') AND t.title = COALESCE(NEW.title, '')"
+    "              AND ar.name = COALESCE(NEW.artist, '') AND al.name = COALESCE(NEW.album, '')"
+    "              AND g.name = COALESCE(NEW.genre, '') AND t.track_number = COALESCE(NEW.track_number, '')"
+    "              AND t.year = COALESCE(NEW.year, '')),"
+    "        NEW.duration_ms,"
+    "        (SELECT id FROM sources WHERE name = NEW.source));"
+    "END;";
+
+// Rollups of normalized plays (and the version 3 -> 4 step). Plays reach
+// them through the plays table, so inserts through the view and into plays
+// directly are both counted
+static const char* normalizedRollupSQL =
+    ROLLUP_TABLES_SQL("artist_id", "INTEGER")
+    "CREATE TRIGGER IF NOT EXISTS plays_rollup AFTER INSERT ON plays BEGIN"
+    "    INSERT INTO rollup_days VALUES ("
+    "        " LOCAL_DAY("NEW.played_at_ms", "NEW.utc_offset_min") ", 1, COALESCE(NEW.duration_ms, 0))" UPSERT_ROLLUP("day")
+    "    INSERT INTO rollup_artist_days"
+    "        SELECT " LOCAL_DAY("NEW.played_at_ms", "NEW.utc_offset_min") ", artist_id, 1, COALESCE(NEW.duration_ms, 0)"
+    "        FROM tracks WHERE id = NEW.track_id" UPSERT_ROLLUP("day, artist_id")
+    "    INSERT INTO rollup_tracks"
+    "        SELECT artist_id, title, 1, COALESCE(NEW.duration_ms, 0)"
+    "        FROM tracks WHERE id = NEW.track_id" UPSERT_ROLLUP("artist_id, title")
+    "END;";
+
+static const char* mergeNormalizedRollupSQL =
+    "INSERT INTO rollup_days"
+    "    SELECT " LOCAL_DAY("played_at_ms", "utc_offset_min") ", COUNT(*), SUM(COALESCE(duration_ms, 0))"
+    "    FROM plays WHERE id > ?1 GROUP BY 1" MERGE_ROLLUP("day")
+    "INSERT INTO rollup_artist_days"
+    "    SELECT " LOCAL_DAY("p.played_at_ms", "p.utc_offset_min") ", t.artist_id, COUNT(*), SUM(COALESCE(p.duration_ms, 0))"
+    "    FROM plays p JOIN tracks t ON t.id = p.track_id WHERE p.id > ?1 GROUP BY 1, 2" MERGE_ROLLUP("day, artist_id")
+    "INSERT INTO rollup_tracks"
+    "    SELECT t.artist_id, t.title, SUM(w.plays), SUM(w.ms) FROM ("
+    "        SELECT track_id, COUNT(*) AS plays, SUM(COALESCE(duration_ms, 0)) AS ms FROM plays WHERE id > ?1 GROUP BY track_id) w"
+    "    JOIN tracks t ON t.id = w.track_id WHERE true GROUP BY 1, 2" MERGE_ROLLUP("artist_id, title");
+
+static const char* clearRollupSQL =
+    "DELETE FROM rollup_days;"
+    "DELETE FROM rollup_artist_days;"
+    "DELETE FROM rollup_tracks;";
+
+// Rebuild version 0 plays (from a normalized database created before
+// integer timestamps) in place; the view and trigger are recreated after
+static const char* upgradeNormalizedSQL =
+    "DROP TRIGGER IF EXISTS play_history_insert;"
+    "DROP VIEW IF EXISTS play_history;"
+    "DROP INDEX IF EXISTS idx_plays_played_at;"
+    "DROP INDEX IF EXISTS idx_plays_track;"
+    "ALTER TABLE plays RENAME TO plays_v0;"
+    "CREATE TABLE plays ("
+    "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "    played_at_ms INTEGER NOT NULL,"
+    "    utc_offset_min INTEGER NOT NULL DEFAULT 0,"
+    "    track_id INTEGER NOT NULL REFERENCES tracks(id),"
+    "    duration_ms INTEGER"
+    ");"
+    "INSERT INTO plays(id, played_at_ms, utc_offset_min, track_id, duration_ms)"
+    "    SELECT id, " LOCAL_TEXT_TO_MS("played_at") ", " LOCAL_TEXT_TO_OFFSET("played_at") ", track_id, duration_ms"
+    "    FROM plays_v0 ORDER BY id;"
+    CARRY_SEQUENCE_SQL("plays_v0", "plays")
+    "DROP TABLE plays_v0;";
+
+// Version 1 -> 2 for normalized plays; again the view and trigger are
+// recreated after
+static const char* addSourceNormalizedSQL =
+    "DROP TRIGGER IF EXISTS play_history_insert;"
+    "DROP VIEW IF EXISTS play_history;"
+    "CREATE TABLE IF NOT EXISTS sources ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "ALTER TABLE plays ADD COLUMN source_id INTEGER REFERENCES sources(id);";
+
+// Version 2 -> 3 (CreateNormalized adds the new index)
+static const char* statsIndexNormalizedSQL =
+    "DROP INDEX IF EXISTS idx_plays_played_at_ms;";
+
+// Set-based copy of flat plays (a table with play_history's columns) into
+// the normalized tables; much faster than going through the insert trigger
+#define NORMALIZE_PLAYS_SQL(source, id, order) \
+    "INSERT OR IGNORE INTO artists(name) SELECT DISTINCT COALESCE(artist, '') FROM " source ";" \
+    "INSERT OR IGNORE INTO albums(artist_id, name)" \
+    "    SELECT DISTINCT ar.id, COALESCE(h.album, '') FROM " source " h" \
+    "    JOIN artists ar ON ar.name = COALESCE(h.artist, '');" \
+    "INSERT OR IGNORE INTO genres(name) SELECT DISTINCT COALESCE(genre, '') FROM " source ";" \
+    "INSERT OR IGNORE INTO files(filepath, filename)" \
+    "    SELECT COALESCE(filepath, ''), COALESCE(MAX(filename), '') FROM " source " GROUP BY COALESCE(filepath, '');" \
+    "INSERT OR IGNORE INTO tracks(file_id, title, artist_id, album_id, genre_id, track_number, year)" \
+    "    SELECT DISTINCT f.id, COALESCE(h.title, ''), ar.id, al.id, g.id, COALESCE(h.track_number, ''), COALESCE(h.year, '')" \
+    "    FROM " source " h" \
+    "    JOIN files f ON f.filepath = COALESCE(h.filepath, '')" \
+    "    JOIN artists ar ON ar.name = COALESCE(h.artist, '')" \
+    "    JOIN albums al ON al.artist_id = ar.id AND al.name = COALESCE(h.album, '')" \
+    "    JOIN genres g ON g.name = COALESCE(h.genre, '');" \
+    "INSERT OR IGNORE INTO sources(name) SELECT DISTINCT source FROM " source " WHERE source IS NOT NULL;" \
+    "INSERT INTO plays(id, played_at_ms, utc_offset_min, track_id, duration_ms, source_id)" \
+    "    SELECT " id ", h.played_at_ms, h.utc_offset_min, t.id, h.duration_ms, s.id FROM " source " h" \
+    "    JOIN files f ON f.filepath = COALESCE(h.filepath, '')" \
+    "    JOIN artists ar ON ar.name = COALESCE(h.artist, '')" \
+    "    JOIN albums al ON al.artist_id = ar.id AND al.name = COALESCE(h.album, '')" \
+    "    JOIN genres g ON g.name = COALESCE(h.genre, '')" \
+    "    JOIN tracks t ON t.file_id = f.id AND t.title = COALESCE(h.title, '') AND t.artist_id = ar.id" \
+    "        AND t.album_id = al.id AND t.genre_id = g.id" \
+    "        AND t.track_number = COALESCE(h.track_number, '') AND t.year = COALESCE(h.year, '')" \
+    "    LEFT JOIN sources s ON s.name = h.source" \
+    "    ORDER BY " order ";"
+
+// Migrate a flat table renamed to play_history_flat, keeping play ids
+static const char* migrateSQL =
+    NORMALIZE_PLAYS_SQL("play_history_flat", "h.id", "h.id")
+    CARRY_SEQUENCE_SQL("play_history_flat", "plays")
+    "DROP TABLE play_history_flat;";
+
+// Staging table for bulk imports, private to the importing connection. Its
+// key drops repeats within the import itself (same time, file and title;
+// '' for a missing one) and keeps the plays in time order.
+static const char* importTableSQL =
+    "CREATE TEMP TABLE IF NOT EXISTS play_import ("
+    "    played_at_ms INTEGER NOT NULL,"
+    "    filepath TEXT NOT NULL,"
+    "    title TEXT NOT NULL,"
+    "    utc_offset_min INTEGER NOT NULL,"
+    "    filename TEXT,"
+    "    artist TEXT,"
+    "    album TEXT,"
+    "    genre TEXT,"
+    "    track_number TEXT,"
+    "    year TEXT,"
+    "    duration_ms INTEGER,"
+    "    source TEXT,"
+    "    PRIMARY KEY(played_at_ms, filepath, title)"
+    ") WITHOUT ROWID;";
+
+// Leave out staged plays the history already has: the same time, and the
+// same file or title (a missing one matches nothing). Only plays within
+// its time span can match, so older history being imported costs no lookups.
+#define DROP_KNOWN_IMPORTS_SQL(plays) \
+    "DELETE FROM temp.play_import" \
+    "    WHERE played_at_ms BETWEEN (SELECT MIN(played_at_ms) FROM " plays ") AND (SELECT MAX(played_at_ms) FROM " plays ")" \
+    "    AND EXISTS (SELECT 1 FROM play_history h WHERE h.played_at_ms = play_import.played_at_ms" \
+    "                AND ((play_import.filepath <> '' AND h.filepath = play_import.filepath) OR" \
+    "                     (play_import.title <> '' AND h.title = play_import.title)));"
+
+#define IMPORT_COLUMNS \
+    "played_at_ms, utc_offset_min, filepath, filename, title, artist, album, genre, track_number, year, duration_ms, source"
+#define STAGED_COLUMNS \
+    "played_at_ms, utc_offset_min, NULLIF(filepath, ''), filename, title, artist, album, genre, track_number, year, duration_ms, source"
+
+// The rollup triggers are dropped during an import (and the rollups
+// updated in bulk after), as is the statistics index for a large import
+// (and built again after)
+static const char* importFlatSQL =
+    DROP_KNOWN_IMPORTS_SQL("play_history")
+    "DROP TRIGGER IF EXISTS play_history_rollup;";
+static const char* importFlatIndexSQL =
+    "DROP INDEX IF EXISTS idx_play_stats;";
+static const char* insertImportFlatSQL =
+    "INSERT INTO play_history(" IMPORT_COLUMNS ") SELECT " STAGED_COLUMNS " FROM temp.play_import;";
+
+static const char* importNormalizedSQL =
+    DROP_KNOWN_IMPORTS_SQL("plays")
+    "DROP TRIGGER IF EXISTS plays_rollup;";
+static const char* importNormalizedIndexSQL =
+    "DROP INDEX IF EXISTS idx_plays_stats;"
+    "DROP INDEX IF EXISTS idx_plays_track;";
+static const char* insertImportNormalizedSQL =
+    NORMALIZE_PLAYS_SQL("temp.play_import", "NULL", "h.played_at_ms");
+
+// The staged plays as the rollups see them, in time order, and the rollup
+// rows they add up to, merged into those already there
+static const char* readStagedRollupSQL =
+    "SELECT played_at_ms, utc_offset_min, COALESCE(artist, ''), title, COALESCE(duration_ms, 0) FROM temp.play_import;";
+static const char* mergeDayRollupSQL =
+    "INSERT INTO rollup_days VALUES (?1, ?2, ?3)" MERGE_ROLLUP("day");
+static const char* mergeFlatArtistDayRollupSQL =
+    "INSERT INTO rollup_artist_days VALUES (?1, ?2, ?3, ?4)" MERGE_ROLLUP("day, artist");
+static const char* mergeFlatTrackRollupSQL =
+    "INSERT INTO rollup_tracks VALUES (?1, ?2, ?3, ?4)" MERGE_ROLLUP("artist, title");
+static const char* mergeNormalizedArtistDayRollupSQL =
+    "INSERT INTO rollup_artist_days VALUES (?1, (SELECT id FROM artists WHERE name = ?2), ?3, ?4)" MERGE_ROLLUP("day, artist_id");
+static const char* mergeNormalizedTrackRollupSQL =
+    "INSERT INTO rollup_tracks VALUES ((SELECT id FROM artists WHERE name = ?1), ?2, ?3, ?4)" MERGE_ROLLUP("artist_id, title");
+
+// An import adding more than this fraction of the plays already there
+// rebuilds the play indexes rather than updating them play by play
+#define IMPORT_REINDEX_FRACTION 4
+
+// Snapshots of the logger's instrumentation, cumulative since it started:
+// a row per stage (count, total and quantiles in microseconds) and per
+// counter (count alone)
+static const char* metricsSQL =
+    "CREATE TABLE IF NOT EXISTS metrics ("
+    "    recorded_at_ms INTEGER NOT NULL,"
+    "    source TEXT,"
+    "    name TEXT NOT NULL,"
+    "    count INTEGER NOT NULL,"
+    "    total_us INTEGER,"
+    "    p50_us INTEGER,"
+    "    p90_us INTEGER,"
+    "    p99_us INTEGER,"
+    "    max_us INTEGER"
+    ");";
+
+// The flat rollups are keyed by artist name; the normalized ones replace them
+static const char* dropFlatRollupSQL =
+    "DROP TABLE IF EXISTS rollup_days;"
+    "DROP TABLE IF EXISTS rollup_artist_days;"
+    "DROP TABLE IF EXISTS rollup_tracks;";
+
+SchemaLayout GetSchemaLayout(sqlite3* db) {
+    SchemaLayout layout = SchemaNone;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT type FROM sqlite_master WHERE name = 'play_history';", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* type = (const char*)sqlite3_column_text(stmt, 0);
+            layout = type && strcmp(type, "view") == 0 ? SchemaNormalized : SchemaFlat;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return layout;
+}
+
+static bool CreateNormalized(sqlite3* db) {
+    return sqlite3_exec(db, normalizedTablesSQL, NULL, NULL, NULL) == SQLITE_OK &&
+           sqlite3_exec(db, normalizedViewSQL, NULL, NULL, NULL) == SQLITE_OK &&
+           sqlite3_exec(db, normalizedRollupSQL, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+// Run each statement of sql in turn, with id bound to ?1 where used
+static bool ExecWithId(sqlite3* db, const char* sql, int64_t id) {
+    while (*sql) {
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, &sql) != SQLITE_OK) return false;
+        if (!stmt) continue;  // Trailing whitespace
+        
+        if (sqlite3_bind_parameter_count(stmt) > 0) sqlite3_bind_int64(stmt, 1, id);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) return false;
+    }
+    return true;
+}
+
+// Add the plays with ids above afterId to the rollups
+static bool MergeRollups(sqlite3* db, SchemaLayout layout, int64_t afterId) {
+    return ExecWithId(db, layout == SchemaNormalized ? mergeNormalizedRollupSQL : mergeFlatRollupSQL, afterId);
+}
+
+// Plays and milliseconds played of one rollup row
+struct RollupSum {
+    int64_t plays;
+    int64_t ms;
+};
+
+typedef std::unordered_map<std::string, RollupSum> RollupSums;
+
+// Merge rollup rows keyed by text (an artist, or an artist and a title
+// split by a NUL) into a rollup table, in key order; day is bound first
+// if given. The sums are emptied.
+static bool MergeRollupSums(sqlite3_stmt* stmt, const int64_t* day, RollupSums& sums) {
+    std::vector<std::pair<std::string, RollupSum>> rows(sums.begin(), sums.end());
+    sums.clear();
+    std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, RollupSum>& a,
+                                           const std::pair<std::string, RollupSum>& b) { return a.first < b.first; });
+    
+    for (const auto& row : rows) {
+        int index = 1;
+        if (day) sqlite3_bind_int64(stmt, index++, *day);
+        const std::string& key = row.first;
+        size_t split = key.find('\0');
+        sqlite3_bind_text(stmt, index++, key.data(), (int)std::min(split, key.size()), SQLITE_STATIC);
+        if (split != std::string::npos) {
+            sqlite3_bind_text(stmt, index++, key.data() + split + 1, (int)(key.size() - split - 1), SQLITE_STATIC);
+        }
+        sqlite3_bind_int64(stmt, index++, row.second.plays);
+        sqlite3_bind_int64(stmt, index, row.second.ms);
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) return false;
+    }
+    return true;
+}
+
+// Add the staged plays to the rollups in one pass over them. They come in
+// time order, so each local day's artists are added up and merged before
+// the next day's; tracks are merged at the end. Much faster than grouping
+// the new plays of the history once per rollup, which sorts them each time.
+static bool MergeStagedRollups(sqlite3* db, SchemaLayout layout) {
+    bool normalized = layout == SchemaNormalized;
+    sqlite3_stmt* read = NULL;
+    sqlite3_stmt* mergeDay = NULL;
+    sqlite3_stmt* mergeArtistDay = NULL;
+    sqlite3_stmt* mergeTrack = NULL;
+    bool ok = sqlite3_prepare_v2(db, readStagedRollupSQL, -1, &read, NULL) == SQLITE_OK &&
+              sqlite3_prepare_v2(db, mergeDayRollupSQL, -1, &mergeDay, NULL) == SQLITE_OK &&
+              sqlite3_prepare_v2(db, normalized ? mergeNormalizedArtistDayRollupSQL : mergeFlatArtistDayRollupSQL,
+                                 -1, &mergeArtistDay, NULL) == SQLITE_OK &&
+              sqlite3_prepare_v2(db, normalized ? mergeNormalizedTrackRollupSQL : mergeFlatTrackRollupSQL,
+                                 -1, &mergeTrack, NULL) == SQLITE_OK;
+    
+    std::vector<std::pair<int64_t, RollupSum>> days;
+    RollupSums artists;
+    RollupSums tracks;
+    std::string key;
+    int64_t day = INT64_MIN;
+    int rc = SQLITE_DONE;
+    while (ok && (rc = sqlite3_step(read)) == SQLITE_ROW) {
+        int64_t playedAtMs = sqlite3_column_int64(read, 0);
+        int64_t playDay = (playedAtMs / 1000 + sqlite3_column_int64(read, 1) * 60) / 86400;
+        int64_t ms = sqlite3_column_int64(read, 4);
+        
+        // Local days only go back when time zones do, and are merged again then
+        if (playDay != day) {
+            ok = MergeRollupSums(mergeArtistDay, &day, artists);
+            day = playDay;
+            if (days.empty() || days.back().first != day) days.push_back(std::make_pair(day, RollupSum{ 0, 0 }));
+        }
+        days.back().second.plays++;
+        days.back().second.ms += ms;
+        
+        key.assign((const char*)sqlite3_column_text(read, 2), sqlite3_column_bytes(read, 2));
+        RollupSum& artist = artists[key];
+        artist.plays++;
+        artist.ms += ms;
+        
+        key += '\0';
+        key.append((const char*)sqlite3_column_text(read, 3), sqlite3_column_bytes(read, 3));
+        RollupSum& track = tracks[key];
+        track.plays++;
+        track.ms += ms;
+    }
+    ok = ok && rc == SQLITE_DONE && MergeRollupSums(mergeArtistDay, &day, artists) && MergeRollupSums(mergeTrack, NULL, tracks);
+    
+    for (size_t i = 0; ok && i < days.size(); i++) {
+        sqlite3_bind_int64(mergeDay, 1, days[i].first);
+        sqlite3_bind_int64(mergeDay, 2, days[i].second.plays);
+        sqlite3_bind_int64(mergeDay, 3, days[i].second.ms);
+        ok = sqlite3_step(mergeDay) == SQLITE_DONE;
+        sqlite3_reset(mergeDay);
+    }
+    
+    sqlite3_finalize(read);
+    sqlite3_finalize(mergeDay);
+    sqlite3_finalize(mergeArtistDay);
+    sqlite3_finalize(mergeTrack);
+    return ok;
+}
+
+// Refill the rollups of a database in the given layout from its plays
+static bool FillRollups(sqlite3* db, SchemaLayout layout) {
+    return sqlite3_exec(db, clearRollupSQL, NULL, NULL, NULL) == SQLITE_OK && MergeRollups(db, layout, INT64_MIN);
+}
+
+// Commit if every step succeeded, otherwise roll the whole change back
+static bool EndTransaction(sqlite3* db, bool ok) {
+    if (!ok || sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return false;
+    }
+    return true;
+}
+
+static int64_t QueryInt64(sqlite3* db, const char* sql) {
+    int64_t value = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+static int GetSchemaVersion(sqlite3* db) {
+    int version = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+static bool SetSchemaVersion(sqlite3* db) {
+    char pragma[64];
+    snprintf(pragma, sizeof(pragma), "PRAGMA user_version=%d;", SCHEMA_VERSION);
+    return sqlite3_exec(db, pragma, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+// Bring an existing database up to SCHEMA_VERSION in place, one version
+// at a time
+static bool UpgradeSchema(sqlite3* db, SchemaLayout layout) {
+    int version = GetSchemaVersion(db);
+    if (version >= SCHEMA_VERSION) return true;
+    
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) return false;
+    
+    // Another instance may have upgraded it while we waited for the lock
+    version = GetSchemaVersion(db);
+    if (version >= SCHEMA_VERSION) return EndTransaction(db, true);
+    
+    const char* steps[SCHEMA_VERSION];
+    if (layout == SchemaFlat) {
+        steps[0] = upgradeFlatSQL;
+        steps[1] = addSourceFlatSQL;
+        steps[2] = statsIndexFlatSQL;
+        steps[3] = flatRollupSQL;
+    } else {
+        steps[0] = upgradeNormalizedSQL;
+        steps[1] = addSourceNormalizedSQL;
+        steps[2] = statsIndexNormalizedSQL;
+        steps[3] = normalizedRollupSQL;
+    }
+    
+    bool ok = true;
+    for (int step = version; ok && step < SCHEMA_VERSION; step++) {
+        ok = sqlite3_exec(db, steps[step], NULL, NULL, NULL) == SQLITE_OK;
+    }
+    if (layout == SchemaNormalized) {
+        ok = ok && CreateNormalized(db);
+    }
+    
+    // Rollups created by this upgrade start from the existing plays
+    if (version < 4) {
+        ok = ok && FillRollups(db, layout);
+    }
+    
+    return EndTransaction(db, ok && SetSchemaVersion(db));
+}
+
+bool MigrateToNormalized(sqlite3* db) {
+    if (GetSchemaLayout(db) != SchemaFlat || !UpgradeSchema(db, SchemaFlat)) return false;
+    
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) return false;
+    
+    // Copy the plays before creating the rollup trigger, and then fill the
+    // rollups in one pass rather than one play at a time
+    bool ok = sqlite3_exec(db, "ALTER TABLE play_history RENAME TO play_history_flat;", NULL, NULL, NULL) == SQLITE_OK &&
+              sqlite3_exec(db, dropFlatRollupSQL, NULL, NULL, NULL) == SQLITE_OK &&
+              sqlite3_exec(db, normalizedTablesSQL, NULL, NULL, NULL) == SQLITE_OK &&
+              sqlite3_exec(db, migrateSQL, NULL, NULL, NULL) == SQLITE_OK &&
+              CreateNormalized(db) &&
+              FillRollups(db, SchemaNormalized);
+    
+    return EndTransaction(db, ok);
+}
+
+bool RebuildRollups(sqlite3* db) {
+    SchemaLayout layout = GetSchemaLayout(db);
+    if (layout == SchemaNone || !UpgradeSchema(db, layout)) return false;
+    
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) return false;
+    return EndTransaction(db, FillRollups(db, layout));
+}
+
+bool CreateMetricsTable(sqlite3* db) {
+    return sqlite3_exec(db, metricsSQL, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+bool CreateImportTable(sqlite3* db) {
+    return sqlite3_exec(db, importTableSQL, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+bool ImportStagedPlays(sqlite3* db, uint64_t& imported, uint64_t& known) {
+    imported = known = 0;
+    SchemaLayout layout = GetSchemaLayout(db);
+    if (layout == SchemaNone || !UpgradeSchema(db, layout)) return false;
+    
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) return false;
+    
+    bool normalized = layout == SchemaNormalized;
+    int64_t lastId = QueryInt64(db, normalized ? "SELECT MAX(id) FROM plays;" : "SELECT MAX(id) FROM play_history;");
+    int64_t staged = QueryInt64(db, "SELECT COUNT(*) FROM temp.play_import;");
+    
+    bool ok = sqlite3_exec(db, normalized ? importNormalizedSQL : importFlatSQL, NULL, NULL, NULL) == SQLITE_OK;
+    known = ok ? (uint64_t)sqlite3_changes(db) : 0;
+    
+    if (ok && staged - (int64_t)known > lastId / IMPORT_REINDEX_FRACTION) {
+        ok = sqlite3_exec(db, normalized ? importNormalizedIndexSQL : importFlatIndexSQL, NULL, NULL, NULL) == SQLITE_OK;
+    }
+    ok = ok && sqlite3_exec(db, normalized ? insertImportNormalizedSQL : insertImportFlatSQL, NULL, NULL, NULL) == SQLITE_OK;
+    
+    // Put back what was dropped, and count the plays (those still staged) in
+    // the rollups
+    if (normalized) {
+        ok = ok && CreateNormalized(db);
+    } else {
+        ok = ok && sqlite3_exec(db, flatSchemaSQL, NULL, NULL, NULL) == SQLITE_OK &&
+             sqlite3_exec(db, flatRollupSQL, NULL, NULL, NULL) == SQLITE_OK;
+    }
+    ok = ok && MergeStagedRollups(db, layout) &&
+         sqlite3_exec(db, "DELETE FROM temp.play_import;", NULL, NULL, NULL) == SQLITE_OK;
+    
+    if (!EndTransaction(db, ok)) {
+        known = 0;
+        return false;
+    }
+    imported = (uint64_t)(staged - (int64_t)known);
+    return true;
+}
+
+bool CreateSchema(sqlite3* db, bool normalized) {
+    SchemaLayout layout = GetSchemaLayout(db);
+    
+    if (layout == SchemaNone) {
+        bool created = normalized ? CreateNormalized(db) :
+                       sqlite3_exec(db, flatSchemaSQL, NULL, NULL, NULL) == SQLITE_OK &&
+                       sqlite3_exec(db, flatRollupSQL, NULL, NULL, NULL) == SQLITE_OK;
+        return created && SetSchemaVersion(db);
+    }
+    
+    if (!UpgradeSchema(db, layout)) return false;
+    
+    if (layout == SchemaFlat) {
+        if (sqlite3_exec(db, flatSchemaSQL, NULL, NULL, NULL) != SQLITE_OK ||
+            sqlite3_exec(db, flatRollupSQL, NULL, NULL, NULL) != SQLITE_OK) return false;
+        return normalized ? MigrateToNormalized(db) : true;
+    }
+    return CreateNormalized(db);
+}
@@ -0,0 +1,48 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include "sqlite3.h"
+#include <cstdint>
+
+// How play history is stored
+enum SchemaLayout {
+    SchemaNone,        // No play_history yet
+    SchemaFlat,        // play_history table with every string on every row
+    SchemaNormalized   // Interned artists/albums/genres/files/tracks, plays of track ids,
+                       // and a play_history view (with an insert trigger) for compatibility
+};
+
+// Layout of an open database
+SchemaLayout GetSchemaLayout(sqlite3* db);
+
+// Create the play history schema if needed. An existing flat database is
+// migrated when normalized is requested; a normalized one is never flattened.
+bool CreateSchema(sqlite3* db, bool normalized);
+
+// Convert a flat play_history table into the normalized layout, keeping
+// play ids. Runs in a single transaction.
+bool MigrateToNormalized(sqlite3* db);
+
+// Regenerate the rollup tables (plays and play time per local day, per
+// artist per day and per track) from the plays. They are kept up to date
+// as plays are inserted, so this is only needed after plays have been
+// edited or deleted by other means. Runs in a single transaction.
+bool RebuildRollups(sqlite3* db);
+
+// Create the metrics table, where the logger records its instrumentation
+// when asked to (winnp_metrics_ms); not part of the play history schema
+bool CreateMetricsTable(sqlite3* db);
+
+// Bulk import: create the connection's temp.play_import table (play_history's
+// columns less id; title NOT NULL, with '' for none), fill it, then move
+// its plays into the play history with ImportStagedPlays. Repeats within
+// the staged plays (same played_at_ms and title) are ignored on insert.
+bool CreateImportTable(sqlite3* db);
+
+// In a single transaction, add the staged plays the history doesn't have
+// yet (same time and file or title) and empty the staging table. known
+// gets how many were already there. A large import drops the play indexes
+// and builds them again after, rather than updating them play by play.
+bool ImportStagedPlays(sqlite3* db, uint64_t& imported, uint64_t& known);
+
+#endif // SCHEMA_H
@@ -0,0 +1,495 @@
+#include "simplayer.h"
+#include "playevent.h"
+#include "util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+SimulatedPlayerSource::SimulatedPlayerSource(Clock& clock)
+    : clock(clock), mode(SimSequential), rng(1), playState(PLAYSTATE_STOPPED), current(0),
+      positionMs(0), lastSyncMs(clock.MonotonicMs()), startedPlays(0), queryCount(0),
+      eventProc(NULL), eventContext(NULL), pendingEvents(0), wideText(false) {
+}
+
+void SimulatedPlayerSource::AddTrack(const SimTrack& track) {
+    playlist.push_back(track);
+}
+
+void SimulatedPlayerSource::ClearPlaylist() {
+    Stop();
+    playlist.clear();
+    current = 0;
+}
+
+void SimulatedPlayerSource::Sync() {
+    uint64_t now = clock.MonotonicMs();
+    if (playState == PLAYSTATE_PLAYING && !playlist.empty()) {
+        positionMs += now - lastSyncMs;
+        
+        // Roll over into following tracks, keeping the remainder
+        while (playState == PLAYSTATE_PLAYING) {
+            int lengthMs = playlist[current].lengthMs;
+            if (lengthMs <= 0) {
+                playState = PLAYSTATE_STOPPED;
+                positionMs = 0;
+                Raise(PlayerEventStateChanged);
+                break;
+            }
+            if (positionMs < (uint64_t)lengthMs) break;
+            
+            uint64_t remainder = positionMs - lengthMs;
+            StartTrack(NextIndex());
+            positionMs = remainder;
+        }
+    }
+    lastSyncMs = now;
+}
+
+void SimulatedPlayerSource::StartTrack(int index) {
+    if (playlist.empty()) {
+        playState = PLAYSTATE_STOPPED;
+        return;
+    }
+    current = index;
+    positionMs = 0;
+    playState = PLAYSTATE_PLAYING;
+    startedPlays++;
+    Raise(PlayerEventTrackStarted);
+}
+
+void SimulatedPlayerSource::Raise(PlayerEvent event) {
+    pendingEvents |= 1u << event;
+}
+
+void SimulatedPlayerSource::DeliverEvents() {
+    Sync();
+    unsigned int events = pendingEvents;
+    pendingEvents = 0;
+    if (!eventProc) return;
+    
+    for (int event = PlayerEventTrackStarted; event <= PlayerEventStateChanged; event++) {
+        if (events & (1u << event)) eventProc((PlayerEvent)event, eventContext);
+    }
+}
+
+uint64_t SimulatedPlayerSource::GetMsUntilTrackEnd() {
+    Sync();
+    if (playState != PLAYSTATE_PLAYING || playlist.empty()) return UINT64_MAX;
+    return (uint64_t)playlist[current].lengthMs - positionMs;
+}
+
+bool SimulatedPlayerSource::SubscribeEvents(PlayerEventProc proc, void* context) {
+    eventProc = proc;
+    eventContext = context;
+    pendingEvents = 0;
+    return proc != NULL;
+}
+
+void SimulatedPlayerSource::UnsubscribeEvents() {
+    eventProc = NULL;
+    eventContext = NULL;
+}
+
+int SimulatedPlayerSource::NextIndex() {
+    int count = (int)playlist.size();
+    switch (mode) {
+    case SimShuffle:
+        // xorshift32
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return (int)(rng % (uint32_t)count);
+    case SimRepeatOne:
+        return current;
+    default:
+        return (current + 1) % count;
+    }
+}
+
+void SimulatedPlayerSource::Play(int index) {
+    Sync();
+    if (index < 0 || index >= (int)playlist.size()) index = current;
+    StartTrack(index);
+}
+
+void SimulatedPlayerSource::Pause() {
+    Sync();
+    if (playState == PLAYSTATE_PLAYING) {
+        playState = PLAYSTATE_PAUSED;
+        Raise(PlayerEventStateChanged);
+    }
+}
+
+void SimulatedPlayerSource::Resume() {
+    Sync();
+    if (playState == PLAYSTATE_PAUSED) {
+        playState = PLAYSTATE_PLAYING;
+        Raise(PlayerEventStateChanged);
+    }
+}
+
+void SimulatedPlayerSource::Stop() {
+    Sync();
+    if (playState != PLAYSTATE_STOPPED) Raise(PlayerEventStateChanged);
+    playState = PLAYSTATE_STOPPED;
+    positionMs = 0;
+}
+
+void SimulatedPlayerSource::Next() {
+    Sync();
+    if (playlist.empty()) return;
+    StartTrack(mode == SimShuffle ? NextIndex() : (current + 1) % (int)playlist.size());
+}
+
+void SimulatedPlayerSource::Previous() {
+    Sync();
+    if (playlist.empty()) return;
+    int count = (int)playlist.size();
+    StartTrack((current + count - 1) % count);
+}
+
+void SimulatedPlayerSource::Seek(int seekMs) {
+    Sync();
+    if (playlist.empty() || playState == PLAYSTATE_STOPPED) return;
+    int lengthMs = playlist[current].lengthMs;
+    if (seekMs < 0) seekMs = 0;
+    if (seekMs >= lengthMs) seekMs = lengthMs > 0 ? lengthMs - 1 : 0;
+    positionMs = (uint64_t)seekMs;
+}
+
+void SimulatedPlayerSource::SetMode(SimPlayMode newMode, unsigned int seed) {
+    mode = newMode;
+    rng = seed ? seed : 1;
+}
+
+bool SimulatedPlayerSource::IsAvailable() {
+    return true;
+}
+
+int SimulatedPlayerSource::GetPlayState() {
+    queryCount++;
+    Sync();
+    return playState;
+}
+
+int SimulatedPlayerSource::GetListPos() {
+    queryCount++;
+    Sync();
+    return playlist.empty() ? -1 : current;
+}
+
+void SimulatedPlayerSource::GetPlaylistTitle(int position, char* buffer, size_t bufferSize) {
+    queryCount++;
+    buffer[0] = '\0';
+    if (position < 0 || position >= (int)playlist.size()) return;
+    
+    // Winamp's playlist titles are "Artist - Title"
+    const SimTrack& track = playlist[position];
+    if (track.artist.empty()) {
+        CopyText(track.title.c_str(), buffer, bufferSize);
+    } else {
+        snprintf(buffer, bufferSize, "%s - %s", track.artist.c_str(), track.title.c_str());
+        if (wideText) CopyText(buffer, buffer, bufferSize);
+    }
+}
+
+void SimulatedPlayerSource::GetPlaylistFile(int position, char* buffer, size_t bufferSize) {
+    queryCount++;
+    buffer[0] = '\0';
+    if (position < 0 || position >= (int)playlist.size()) return;
+    CopyText(playlist[position].filepath.c_str(), buffer, bufferSize);
+}
+
+int SimulatedPlayerSource::GetOutputTime(int outputMode) {
+    queryCount++;
+    Sync();
+    if (playlist.empty() || playState == PLAYSTATE_STOPPED) return outputMode == 0 ? 0 : -1;
+    return outputMode == 0 ? (int)positionMs : playlist[current].lengthMs;
+}
+
+const SimTrack* SimulatedPlayerSource::FindTrack(const char* filepath) const {
+    // The current entry is by far the most likely to be asked about
+    if (!playlist.empty() && playlist[current].filepath == filepath) return &playlist[current];
+    for (const SimTrack& track : playlist) {
+        if (track.filepath == filepath) return &track;
+    }
+    return NULL;
+}
+
+void SimulatedPlayerSource::GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) {
+    queryCount++;
+    buffer[0] = '\0';
+    char widePath[PLAYEVENT_PATH_LEN];
+    if (wideText) {
+        CopyText(filepath, widePath, sizeof(widePath));
+        filepath = widePath;
+    }
+    const SimTrack* track = FindTrack(filepath);
+    if (!track) return;
+    
+    if (strcmp(field, "artist") == 0) CopyText(track->artist.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "album") == 0) CopyText(track->album.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "genre") == 0) CopyText(track->genre.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "track") == 0) CopyText(track->trackNumber.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "year") == 0) CopyText(track->year.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "title") == 0) CopyText(track->title.c_str(), buffer, bufferSize);
+    else if (strcmp(field, "length") == 0) snprintf(buffer, bufferSize, "%d", track->lengthMs);
+}
+
+// Text as the logger receives it; in wide mode converted to UTF-16 and
+// back (text may be buffer itself)
+void SimulatedPlayerSource::CopyText(const char* text, char* buffer, size_t bufferSize) {
+    if (!wideText) {
+        CopyString(buffer, bufferSize, text);
+        return;
+    }
+    size_t length = strlen(text);
+    wideScratch.resize(length + 1);
+    size_t units = Utf8ToUtf16(text, length, &wideScratch[0], wideScratch.size());
+    Utf16ToUtf8(wideScratch.data(), units, buffer, bufferSize);
+}
+
+// Parse "<number>[ms|s|m|h|d]" into milliseconds
+static bool ParseDuration(const std::string& text, int64_t& ms) {
+    char* end = NULL;
+    double value = strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) return false;
+    
+    std::string unit(end);
+    double scale;
+    if (unit.empty() || unit == "ms") scale = 1;
+    else if (unit == "s") scale = 1000;
+    else if (unit == "m") scale = 60 * 1000;
+    else if (unit == "h") scale = 60 * 60 * 1000;
+    else if (unit == "d") scale = 24 * 60 * 60 * 1000;
+    else return false;
+    
+    ms = (int64_t)(value * scale);
+    return true;
+}
+
+static bool ParseInteger(const std::string& text, int64_t& value) {
+    char* end = NULL;
+    value = strtoll(text.c_str(), &end, 10);
+    return end != text.c_str() && *end == '\0';
+}
+
+// "<path>|<title>|<artist>|<album>|<genre>|<track>|<year>"
+static void ParseTrackSpec(const std::string& spec, SimTrack& track) {
+    std::string* fields[] = { &track.filepath, &track.title, &track.artist, &track.album,
+                              &track.genre, &track.trackNumber, &track.year };
+    size_t start = 0;
+    for (std::string* field : fields) {
+        if (start > spec.size()) break;
+        size_t bar = spec.find('|', start);
+        *field = spec.substr(start, bar == std::string::npos ? std::string::npos : bar - start);
+        start = bar == std::string::npos ? spec.size() + 1 : bar + 1;
+    }
+}
+
+bool Scenario::Load(const char* path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return Parse(text.str(), error);
+}
+
+bool Scenario::Parse(const std::string& text, std::string& error) {
+    steps.clear();
+    std::vector<size_t> openLoops;
+    std::istringstream lines(text);
+    std::string line;
+    int lineNumber = 0;
+    
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command)) continue;
+        
+        ScenarioStep step = ScenarioStep();
+        std::string arg, arg2, arg3;
+        bool ok = true;
+        
+        if (command == "track") {
+            step.op = ScenarioStep::AddTrack;
+            ok = (bool)(words >> arg) && ParseDuration(arg, step.value);
+            std::string spec;
+            std::getline(words >> std::ws, spec);
+            while (!spec.empty() && (spec.back() == '\r' || spec.back() == ' ')) spec.pop_back();
+            ParseTrackSpec(spec, step.track);
+            step.track.lengthMs = (int)step.value;
+            ok = ok && step.value > 0 && !step.track.filepath.empty();
+        } else if (command == "generate") {
+            step.op = ScenarioStep::Generate;
+            ok = (bool)(words >> arg >> arg2 >> arg3) && ParseInteger(arg, step.value) &&
+                 ParseDuration(arg2, step.value2) && ParseDuration(arg3, step.value3) &&
+                 step.value > 0 && step.value2 > 0 && step.value3 >= step.value2;
+        } else if (command == "mode") {
+            step.op = ScenarioStep::Mode;
+            ok = (bool)(words >> arg);
+            if (arg == "sequential") step.value = SimSequential;
+            else if (arg == "shuffle") step.value = SimShuffle;
+            else if (arg == "repeat-one") step.value = SimRepeatOne;
+            else ok = false;
+            step.value2 = 1;
+            if (words >> arg2) ok = ok && ParseInteger(arg2, step.value2);
+        } else if (command == "play") {
+            step.op = ScenarioStep::Play;
+            step.value = -1;
+            if (words >> arg) ok = ParseInteger(arg, step.value);
+        } else if (command == "pause") {
+            step.op = ScenarioStep::Pause;
+        } else if (command == "resume") {
+            step.op = ScenarioStep::Resume;
+        } else if (command == "stop") {
+            step.op = ScenarioStep::Stop;
+        } else if (command == "next") {
+            step.op = ScenarioStep::Next;
+        } else if (command == "prev") {
+            step.op = ScenarioStep::Previous;
+        } else if (command == "seek") {
+            step.op = ScenarioStep::Seek;
+            ok = (bool)(words >> arg) && ParseDuration(arg, step.value);
+        } else if (command == "wait") {
+            step.op = ScenarioStep::Wait;
+            ok = (bool)(words >> arg) && ParseDuration(arg, step.value);
+        } else if (command == "loop") {
+            step.op = ScenarioStep::Loop;
+            ok = (bool)(words >> arg) && ParseInteger(arg, step.value);
+            openLoops.push_back(steps.size());
+        } else if (command == "end") {
+            step.op = ScenarioStep::EndLoop;
+            ok = !openLoops.empty();
+            if (ok) {
+                step.jump = openLoops.back();
+                steps[openLoops.back()].jump = steps.size();
+                openLoops.pop_back();
+            }
+        } else {
+            ok = false;
+        }
+        
+        if (!ok) {
+            error = "line " + std::to_string(lineNumber) + ": invalid command: " + line;
+            return false;
+        }
+        steps.push_back(step);
+    }
+    
+    if (!openLoops.empty()) {
+        error = "loop without end";
+        return false;
+    }
+    return true;
+}
+
+// Synthetic playlist: a few tracks per album, a few albums per artist
+static void GeneratePlaylist(SimulatedPlayerSource& player, int64_t count, int64_t minMs, int64_t maxMs, uint32_t& rng) {
+    static const char* genres[] = { "Rock", "Pop", "Jazz", "Electronic", "Classical", "Hip-Hop", "Folk", "Metal" };
+    size_t base = player.GetTrackCount();
+    
+    for (int64_t i = 0; i < count; i++) {
+        size_t n = base + (size_t)i;
+        size_t albumIndex = n / 10;
+        size_t artistIndex = albumIndex / 3;
+        
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        
+        SimTrack track;
+        track.artist = "Artist " + std::to_string(artistIndex);
+        track.album = "Album " + std::to_string(albumIndex);
+        track.genre = genres[artistIndex % (sizeof(genres) / sizeof(genres[0]))];
+        track.trackNumber = std::to_string(n % 10 + 1);
+        track.year = std::to_string(1960 + artistIndex % 65);
+        track.title = "Track " + std::to_string(n);
+        track.filepath = "C:\\Music\\" + track.artist + "\\" + track.album + "\\" + track.trackNumber + " - " + track.title + ".mp3";
+        track.lengthMs = (int)(minMs + (int64_t)(rng % (uint32_t)(maxMs - minMs + 1)));
+        player.AddTrack(track);
+    }
+}
+
+void RunScenario(const Scenario& scenario, SimulatedPlayerSource& player, ManualClock& clock, ManualTimer& timer) {
+    const std::vector<ScenarioStep>& steps = scenario.GetSteps();
+    std::vector<std::pair<size_t, int64_t>> loops;  // (loop step, iterations left)
+    uint32_t rng = 0x9E3779B9;
+    
+    for (size_t i = 0; i < steps.size(); i++) {
+        const ScenarioStep& step = steps[i];
+        switch (step.op) {
+        case ScenarioStep::AddTrack:
+            player.AddTrack(step.track);
+            break;
+        case ScenarioStep::Generate:
+            GeneratePlaylist(player, step.value, step.value2, step.value3, rng);
+            break;
+        case ScenarioStep::Mode:
+            player.SetMode((SimPlayMode)step.value, (unsigned int)step.value2);
+            break;
+        case ScenarioStep::Play:
+            player.Play((int)step.value);
+            break;
+        case ScenarioStep::Pause:
+            player.Pause();
+            break;
+        case ScenarioStep::Resume:
+            player.Resume();
+            break;
+        case ScenarioStep::Stop:
+            player.Stop();
+            break;
+        case ScenarioStep::Next:
+            player.Next();
+            break;
+        case ScenarioStep::Previous:
+            player.Previous();
+            break;
+        case ScenarioStep::Seek:
+            player.Seek((int)step.value);
+            break;
+        case ScenarioStep::Wait: {
+            // The poll timer keeps its own schedule regardless of commands
+            // (stopping at each track change to deliver its events)
+            uint64_t remaining = (uint64_t)step.value;
+            while (remaining > 0) {
+                uint64_t advance = timer.GetMsUntilTick();
+                if (advance > remaining) advance = remaining;
+                uint64_t untilTrackEnd = player.GetMsUntilTrackEnd();
+                if (advance > untilTrackEnd) advance = untilTrackEnd;
+                clock.Advance(advance);
+                remaining -= advance;
+                player.DeliverEvents();
+                timer.Advance(advance);
+            }
+            break;
+        }
+        case ScenarioStep::Loop:
+            if (step.value <= 0) {
+                i = step.jump;
+            } else {
+                loops.push_back(std::make_pair(i, step.value));
+            }
+            break;
+        case ScenarioStep::EndLoop:
+            if (--loops.back().second > 0) {
+                i = loops.back().first;
+            } else {
+                loops.pop_back();
+            }
+            break;
+        }
+        player.DeliverEvents();
+        timer.Advance(0);
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef SIMPLAYER_H
+#define SIMPLAYER_H
+
+#include "playersource.h"
+#include "timing.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A playlist entry of the simulated player
+struct SimTrack {
+    std::string filepath;
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::string genre;
+    std::string trackNumber;
+    std::string year;
+    int lengthMs;
+};
+
+// What the simulated player does when a track ends
+enum SimPlayMode {
+    SimSequential,  // Next entry, wrapping at the end of the playlist
+    SimShuffle,     // Random entry
+    SimRepeatOne    // Same entry again
+};
+
+// Scriptable stand-in for Winamp. Playback position follows the clock it
+// is given; tracks end and advance on their own as the clock moves on.
+// Every start of a track (explicit or automatic) counts as one play, so a
+// replay can check the detector against the ground truth.
+//
+// Events are queued as they happen and handed to the subscriber by
+// DeliverEvents, never from inside a query, the way Winamp's notifications
+// arrive separately from the logger's own IPC calls.
+class SimulatedPlayerSource : public PlayerSource {
+public:
+    explicit SimulatedPlayerSource(Clock& clock);
+    
+    // Playlist
+    void AddTrack(const SimTrack& track);
+    void ClearPlaylist();
+    size_t GetTrackCount() const { return playlist.size(); }
+    
+    // Transport controls
+    void Play(int index);       // Start an entry from the beginning
+    void Pause();
+    void Resume();
+    void Stop();
+    void Next();
+    void Previous();
+    void Seek(int positionMs);
+    void SetMode(SimPlayMode mode, unsigned int seed);
+    
+    // Bring playback up to the clock and raise any queued events
+    void DeliverEvents();
+    
+    // Virtual time until the current track ends on its own (UINT64_MAX if
+    // not playing), so a driver can step the clock to each track change
+    uint64_t GetMsUntilTrackEnd();
+    
+    // Hand all text over through UTF-16 and back, as the Winamp source
+    // does with Winamp's wide IPC messages
+    void SetWideText(bool wide) { wideText = wide; }
+    
+    // Ground truth and call counts
+    uint64_t GetStartedPlays() const { return startedPlays; }
+    uint64_t GetQueryCount() const { return queryCount; }
+    const SimTrack* GetCurrentTrack() const { return playlist.empty() ? NULL : &playlist[current]; }
+    
+    // PlayerSource
+    bool IsAvailable() override;
+    int GetPlayState() override;
+    int GetListPos() override;
+    void GetPlaylistTitle(int position, char* buffer, size_t bufferSize) override;
+    void GetPlaylistFile(int position, char* buffer, size_t bufferSize) override;
+    int GetOutputTime(int mode) override;
+    void GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) override;
+    bool SubscribeEvents(PlayerEventProc proc, void* context) override;
+    void UnsubscribeEvents() override;
+
+private:
+    void Sync();                // Bring the position up to the clock
+    void StartTrack(int index);
+    int NextIndex();
+    void Raise(PlayerEvent event);
+    const SimTrack* FindTrack(const char* filepath) const;
+    void CopyText(const char* text, char* buffer, size_t bufferSize);
+    
+    Clock& clock;
+    std::vector<SimTrack> playlist;
+    SimPlayMode mode;
+    uint32_t rng;
+    int playState;
+    int current;
+    uint64_t positionMs;
+    uint64_t lastSyncMs;
+    uint64_t startedPlays;
+    uint64_t queryCount;
+    PlayerEventProc eventProc;
+    void* eventContext;
+    unsigned int pendingEvents;  // Bit per PlayerEvent
+    bool wideText;
+    std::u16string wideScratch;
+};
+
+// One command of a scenario file
+struct ScenarioStep {
+    enum Op { AddTrack, Generate, Mode, Play, Pause, Resume, Stop, Next, Previous, Seek, Wait, Loop, EndLoop };
+    Op op;
+    int64_t value;       // Index, duration or count, depending on op
+    int64_t value2;      // Generate: min length; Mode: seed
+    int64_t value3;      // Generate: max length
+    size_t jump;         // Loop <-> EndLoop partner
+    SimTrack track;      // AddTrack
+};
+
+// A parsed scenario file. Syntax, one command per line ('#' starts a comment;
+// durations take an optional ms/s/m/h/d suffix and default to ms):
+//
+//   track <length> <path>|<title>|<artist>|<album>|<genre>|<track>|<year>
+//   generate <count> <min length> <max length>   Synthetic playlist entries
+//   mode sequential|shuffle|repeat-one [seed]
+//   play [index] | pause | resume | stop | next | prev | seek <position>
+//   wait <duration>                              Let virtual time pass
+//   loop <count> ... end                         Repeat a block (may nest)
+class Scenario {
+public:
+    bool Load(const char* path, std::string& error);
+    bool Parse(const std::string& text, std::string& error);
+    
+    const std::vector<ScenarioStep>& GetSteps() const { return steps; }
+
+private:
+    std::vector<ScenarioStep> steps;
+};
+
+// Execute a scenario against a simulated player, advancing the virtual
+// clock and a started timer together so the timer ticks on schedule. Player
+// events are delivered after every command and at every track change.
+void RunScenario(const Scenario& scenario, SimulatedPlayerSource& player, ManualClock& clock, ManualTimer& timer);
+
+#endif // SIMPLAYER_H
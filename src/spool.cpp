@@ -0,0 +1,231 @@
+#include "spool.h"
+#include "util.h"
+#include <cstring>
+
+// Record layout: header, then a payload of
+//   int64 played_at_ms, int32 utc_offset_min, int32 duration_ms,
+//   then each text field, in PlayField order, as uint16 length + bytes
+//   (no terminator).
+// Integers are in host byte order; a spool never leaves the machine.
+#define SPOOL_MAGIC 0x50534E57u  // "WNSP"
+#define SPOOL_MAX_PAYLOAD (PLAY_RECORD_MAX_SIZE - sizeof(SpoolHeader))
+
+// Bytes read from the file at a time; room for two whole records
+#define SPOOL_READ_BUFFER_SIZE (2 * PLAY_RECORD_MAX_SIZE)
+
+struct SpoolHeader {
+    uint32_t magic;
+    uint32_t size;   // Payload bytes
+    uint32_t crc;    // CRC-32 of the payload
+};
+
+// CRC-32 (IEEE 802.3, as used by zip)
+struct Crc32Table {
+    uint32_t entries[256];
+    
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+static uint32_t Crc32(const unsigned char* data, size_t size) {
+    static const Crc32Table table;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static size_t PutString(unsigned char* out, const char* s, size_t length) {
+    uint16_t len = (uint16_t)length;
+    memcpy(out, &len, sizeof(len));
+    memcpy(out + sizeof(len), s, len);
+    return sizeof(len) + len;
+}
+
+static bool GetString(const unsigned char* in, size_t size, size_t& pos, PlayEvent& event, PlayField field) {
+    uint16_t len;
+    if (pos + sizeof(len) > size) return false;
+    memcpy(&len, in + pos, sizeof(len));
+    pos += sizeof(len);
+    if (pos + len > size) return false;
+    event.SetText(field, (const char*)in + pos, len);
+    pos += len;
+    return true;
+}
+
+static size_t EncodeEvent(const PlayEvent& event, unsigned char* out) {
+    size_t n = 0;
+    memcpy(out + n, &event.playedAtMs, sizeof(event.playedAtMs));
+    n += sizeof(event.playedAtMs);
+    memcpy(out + n, &event.utcOffsetMin, sizeof(event.utcOffsetMin));
+    n += sizeof(event.utcOffsetMin);
+    memcpy(out + n, &event.durationMs, sizeof(event.durationMs));
+    n += sizeof(event.durationMs);
+    for (int field = 0; field < PlayFieldCount; field++) {
+        n += PutString(out + n, event.GetText((PlayField)field), event.GetLength((PlayField)field));
+    }
+    return n;
+}
+
+static bool DecodeEvent(const unsigned char* in, size_t size, PlayEvent& event) {
+    event.Clear();
+    size_t pos = sizeof(event.playedAtMs) + sizeof(event.utcOffsetMin) + sizeof(event.durationMs);
+    if (pos > size) return false;
+    memcpy(&event.playedAtMs, in, sizeof(event.playedAtMs));
+    memcpy(&event.utcOffsetMin, in + sizeof(event.playedAtMs), sizeof(event.utcOffsetMin));
+    memcpy(&event.durationMs, in + sizeof(event.playedAtMs) + sizeof(event.utcOffsetMin), sizeof(event.durationMs));
+    for (int field = 0; field < PlayFieldCount; field++) {
+        if (!GetString(in, size, pos, event, (PlayField)field)) return false;
+    }
+    return pos == size;
+}
+
+size_t EncodePlayRecord(const PlayEvent& event, unsigned char* record) {
+    unsigned char* payload = record + sizeof(SpoolHeader);
+    size_t size = EncodeEvent(event, payload);
+    
+    SpoolHeader header = { SPOOL_MAGIC, (uint32_t)size, Crc32(payload, size) };
+    memcpy(record, &header, sizeof(header));
+    return sizeof(header) + size;
+}
+
+bool DecodePlayRecord(const unsigned char* record, size_t size, PlayEvent& event) {
+    SpoolHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, record, sizeof(header));
+    
+    const unsigned char* payload = record + sizeof(header);
+    return header.magic == SPOOL_MAGIC && header.size == size - sizeof(header) &&
+           Crc32(payload, header.size) == header.crc && DecodeEvent(payload, header.size, event);
+}
+
+PlaySpool::PlaySpool() : file(NULL), recordCount(0), damagedBytes(0), failedAppends(0), failedClears(0) {
+}
+
+PlaySpool::~PlaySpool() {
+    Close();
+}
+
+bool PlaySpool::Open(const char* path) {
+    Close();
+    file = OpenFile(path, "a+b");
+    if (!file) return false;
+    
+    readBuffer.resize(SPOOL_READ_BUFFER_SIZE);
+    if (!ReadAll(NULL, recordCount)) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void PlaySpool::Close() {
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+    recordCount = 0;
+}
+
+bool PlaySpool::Append(const PlayEvent& event) {
+    if (!file) return false;
+    
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    size_t total = EncodePlayRecord(event, record);
+    
+    // One write per record; the OS has it once fflush returns
+    if (fwrite(record, 1, total, file) != total || fflush(file) != 0) {
+        clearerr(file);
+        failedAppends++;
+        return false;
+    }
+    recordCount++;
+    return true;
+}
+
+bool PlaySpool::Replay(PlayEventSink sink) {
+    uint64_t records = 0;
+    return file && ReadAll(sink, records);
+}
+
+// Read the file through a fixed buffer, passing intact records to sink (if
+// any). A damaged record is skipped by searching for the next record
+// header. The buffer is refilled whenever less than a whole record is
+// left in it, so any intact record is always read whole.
+bool PlaySpool::ReadAll(PlayEventSink sink, uint64_t& records) {
+    records = 0;
+    if (fseek(file, 0, SEEK_SET) != 0) return false;
+    
+    unsigned char* data = readBuffer.data();
+    const uint32_t magic = SPOOL_MAGIC;
+    uint64_t damaged = 0;
+    size_t pos = 0;
+    size_t filled = 0;
+    bool atEnd = false;
+    bool readOk = true;
+    PlayEvent event;
+    for (;;) {
+        if (!atEnd && filled - pos < PLAY_RECORD_MAX_SIZE) {
+            memmove(data, data + pos, filled - pos);
+            filled -= pos;
+            pos = 0;
+            filled += fread(data + filled, 1, SPOOL_READ_BUFFER_SIZE - filled, file);
+            if (filled < SPOOL_READ_BUFFER_SIZE) {
+                atEnd = true;
+                readOk = !ferror(file);
+            }
+        }
+        if (pos == filled || !readOk) break;
+        
+        SpoolHeader header;
+        if (pos + sizeof(header) <= filled) {
+            memcpy(&header, data + pos, sizeof(header));
+            if (header.size <= SPOOL_MAX_PAYLOAD && pos + sizeof(header) + header.size <= filled &&
+                DecodePlayRecord(data + pos, sizeof(header) + header.size, event)) {
+                if (sink && !sink(event)) {
+                    fseek(file, 0, SEEK_END);
+                    return false;
+                }
+                records++;
+                pos += sizeof(header) + header.size;
+                continue;
+            }
+        }
+        
+        // Resynchronise at the next occurrence of the magic number. Short of
+        // the end, keep the last few bytes, which may begin one.
+        size_t next = pos + 1;
+        while (next + sizeof(magic) <= filled && memcmp(data + next, &magic, sizeof(magic)) != 0) next++;
+        if (next + sizeof(magic) > filled) next = atEnd ? filled : filled - (sizeof(magic) - 1);
+        damaged += next - pos;
+        pos = next;
+    }
+    
+    clearerr(file);
+    fseek(file, 0, SEEK_END);
+    if (!readOk) return false;
+    if (!sink) damagedBytes += damaged;
+    return true;
+}
+
+bool PlaySpool::Clear() {
+    if (!file) return false;
+    
+    // Cut the file down where it is, so it stays open for the next append
+    // whatever happens
+    if (fflush(file) != 0 || !TruncateFile(file)) {
+        clearerr(file);
+        failedClears++;
+        return false;
+    }
+    recordCount = 0;
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "playevent.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Largest record: header, then the numbers and each field's length and text
+#define PLAY_RECORD_MAX_SIZE (12 + 16 + 2 * PlayFieldCount + PLAYEVENT_ARENA_SIZE)
+
+// Encode an event as one checksummed record, as stored in the spool and
+// handed between instances. record must hold PLAY_RECORD_MAX_SIZE bytes;
+// returns the record's size.
+size_t EncodePlayRecord(const PlayEvent& event, unsigned char* record);
+
+// Decode a record of exactly size bytes; false if it is damaged
+bool DecodePlayRecord(const unsigned char* record, size_t size, PlayEvent& event);
+
+// Append-only file of play events not yet known to be in the database.
+// Each event is one checksummed record written with a single sequential
+// write, so a crash or a full disk can at worst damage the record being
+// written; damaged records are skipped when the spool is read back.
+class PlaySpool {
+public:
+    PlaySpool();
+    ~PlaySpool();
+    
+    // Open (creating if necessary) the spool at path and count the records
+    // already in it, e.g. left over from a session without a database
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return file != NULL; }
+    
+    // Append an event and flush it to the operating system
+    bool Append(const PlayEvent& event);
+    
+    // Pass every intact record, oldest first, to sink. Returns false as soon
+    // as sink does, leaving the spool as it was.
+    bool Replay(PlayEventSink sink);
+    
+    // Discard every record, once they are safely stored elsewhere. On
+    // failure the records stay, the spool stays open and the failure is
+    // counted.
+    bool Clear();
+    
+    // Records currently in the spool
+    uint64_t GetRecordCount() const { return recordCount; }
+    
+    // Bytes of damaged records skipped since the spool was opened, and
+    // appends (e.g. disk full) and clears that failed
+    uint64_t GetDamagedBytes() const { return damagedBytes; }
+    uint64_t GetFailedAppends() const { return failedAppends; }
+    uint64_t GetFailedClears() const { return failedClears; }
+
+private:
+    bool ReadAll(PlayEventSink sink, uint64_t& records);
+    
+    FILE* file;
+    std::vector<unsigned char> readBuffer;  // Allocated once, by Open
+    uint64_t recordCount;
+    uint64_t damagedBytes;
+    uint64_t failedAppends;
+    uint64_t failedClears;
+};
+
+#endif // SPOOL_H
@@ -0,0 +1,322 @@
+#include "stats.h"
+#include <cstring>
+
+// Time zone offsets range from UTC-12 to UTC+14, so a window of local
+// times is within this of the same window in UTC
+#define MAX_UTC_OFFSET_MS (14 * 3600000LL)
+
+// Shared pieces of the queries: a play's local time in seconds since the
+// epoch, and the time window (?1 and ?2 in UTC, narrowed to ?4 and ?5 in
+// local time for local windows)
+#define LOCAL_SECONDS "(played_at_ms / 1000 + utc_offset_min * 60)"
+#define IN_WINDOW "played_at_ms >= ?1 AND played_at_ms < ?2" \
+    " AND played_at_ms + utc_offset_min * 60000 >= ?4 AND played_at_ms + utc_offset_min * 60000 < ?5"
+
+// Totals from the daily rollup, for days ?1 up to ?2
+#define ROLLUP_DAY_QUERIES \
+    "SELECT '', SUM(plays), SUM(play_ms) FROM rollup_days WHERE day >= ?1 AND day < ?2;", \
+    "SELECT date(day * 86400, 'unixepoch'), plays, play_ms FROM rollup_days WHERE day >= ?1 AND day < ?2 ORDER BY day;"
+
+// Queries over the play times alone, for either layout's table of plays
+#define TIME_QUERIES(table) \
+    "SELECT " LOCAL_SECONDS " / 3600 % 24, COUNT(*) FROM " table " WHERE " IN_WINDOW " GROUP BY 1;", \
+    "SELECT (" LOCAL_SECONDS " / 86400 + 4) % 7, COUNT(*) FROM " table " WHERE " IN_WINDOW " GROUP BY 1;", \
+    "SELECT '', COUNT(*), SUM(duration_ms) FROM " table " WHERE " IN_WINDOW ";", \
+    "SELECT date(day * 86400, 'unixepoch'), plays, ms FROM (" \
+    "    SELECT " LOCAL_SECONDS " / 86400 AS day, COUNT(*) AS plays, SUM(duration_ms) AS ms" \
+    "    FROM " table " WHERE " IN_WINDOW " GROUP BY day) ORDER BY day;"
+
+// Top-N over the flat table: group the window's index entries directly
+static const char* flatSQL[] = {
+    "SELECT artist, '', COUNT(*), SUM(duration_ms) FROM play_history"
+    "    WHERE " IN_WINDOW " AND artist <> '' GROUP BY artist ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT album, artist, COUNT(*), SUM(duration_ms) FROM play_history"
+    "    WHERE " IN_WINDOW " AND album <> '' GROUP BY artist, album ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT genre, '', COUNT(*), SUM(duration_ms) FROM play_history"
+    "    WHERE " IN_WINDOW " AND genre <> '' GROUP BY genre ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT title, artist, COUNT(*), SUM(duration_ms) FROM play_history"
+    "    WHERE " IN_WINDOW " AND title <> '' GROUP BY artist, title ORDER BY 3 DESC, 1 LIMIT ?3;",
+    TIME_QUERIES("play_history"),
+    "SELECT artist, '', SUM(plays), SUM(play_ms) FROM rollup_tracks"
+    "    WHERE artist <> '' GROUP BY artist ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT artist, '', SUM(plays), SUM(play_ms) FROM rollup_artist_days"
+    "    WHERE day >= ?1 AND day < ?2 AND artist <> '' GROUP BY artist ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT title, artist, plays, play_ms FROM rollup_tracks"
+    "    WHERE title <> '' ORDER BY plays DESC, title LIMIT ?3;",
+    ROLLUP_DAY_QUERIES
+};
+
+// Top-N over the normalized tables: count plays per track first, so each
+// track's names are looked up once rather than once per play
+#define PLAYS_PER_TRACK \
+    "WITH w AS (SELECT track_id, COUNT(*) AS plays, SUM(duration_ms) AS ms FROM plays" \
+    "    WHERE " IN_WINDOW " GROUP BY track_id) "
+
+static const char* normalizedSQL[] = {
+    PLAYS_PER_TRACK
+    "SELECT ar.name, '', SUM(w.plays), SUM(w.ms) FROM w"
+    "    JOIN tracks t ON t.id = w.track_id JOIN artists ar ON ar.id = t.artist_id"
+    "    WHERE ar.name <> '' GROUP BY t.artist_id ORDER BY 3 DESC, 1 LIMIT ?3;",
+    PLAYS_PER_TRACK
+    "SELECT al.name, ar.name, SUM(w.plays), SUM(w.ms) FROM w"
+    "    JOIN tracks t ON t.id = w.track_id JOIN albums al ON al.id = t.album_id JOIN artists ar ON ar.id = al.artist_id"
+    "    WHERE al.name <> '' GROUP BY t.album_id ORDER BY 3 DESC, 1 LIMIT ?3;",
+    PLAYS_PER_TRACK
+    "SELECT g.name, '', SUM(w.plays), SUM(w.ms) FROM w"
+    "    JOIN tracks t ON t.id = w.track_id JOIN genres g ON g.id = t.genre_id"
+    "    WHERE g.name <> '' GROUP BY t.genre_id ORDER BY 3 DESC, 1 LIMIT ?3;",
+    PLAYS_PER_TRACK
+    "SELECT t.title, ar.name, SUM(w.plays), SUM(w.ms) FROM w"
+    "    JOIN tracks t ON t.id = w.track_id JOIN artists ar ON ar.id = t.artist_id"
+    "    WHERE t.title <> '' GROUP BY t.artist_id, t.title ORDER BY 3 DESC, 1 LIMIT ?3;",
+    TIME_QUERIES("plays"),
+    "WITH w AS (SELECT artist_id, SUM(plays) AS plays, SUM(play_ms) AS ms FROM rollup_tracks GROUP BY artist_id) "
+    "SELECT ar.name, '', w.plays, w.ms FROM w JOIN artists ar ON ar.id = w.artist_id"
+    "    WHERE ar.name <> '' ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "WITH w AS (SELECT artist_id, SUM(plays) AS plays, SUM(play_ms) AS ms FROM rollup_artist_days"
+    "    WHERE day >= ?1 AND day < ?2 GROUP BY artist_id) "
+    "SELECT ar.name, '', w.plays, w.ms FROM w JOIN artists ar ON ar.id = w.artist_id"
+    "    WHERE ar.name <> '' ORDER BY 3 DESC, 1 LIMIT ?3;",
+    "SELECT r.title, ar.name, r.plays, r.play_ms FROM rollup_tracks r JOIN artists ar ON ar.id = r.artist_id"
+    "    WHERE r.title <> '' ORDER BY r.plays DESC, r.title LIMIT ?3;",
+    ROLLUP_DAY_QUERIES
+};
+
+static const char* queryNames[] = {
+    "top artists", "top albums", "top genres", "top tracks",
+    "hour histogram", "weekday histogram", "total", "daily totals",
+    "top artists (rollup)", "top artists (daily rollup)", "top tracks (rollup)", "total (rollup)", "daily totals (rollup)"
+};
+
+PlayStats::PlayStats() : db(NULL), layout(SchemaNone), hasRollups(false), rollupsEnabled(true) {
+    memset(statements, 0, sizeof(statements));
+}
+
+PlayStats::~PlayStats() {
+    Close();
+}
+
+bool PlayStats::Open(const char* path) {
+    Close();
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        Close();
+        return false;
+    }
+    
+    // Wait out the logger's commits rather than failing
+    sqlite3_busy_timeout(db, 2000);
+    layout = GetSchemaLayout(db);
+    if (layout == SchemaNone) {
+        Close();
+        return false;
+    }
+    
+    // Databases not yet upgraded by the plugin have no rollups
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE name = 'rollup_tracks';", -1, &stmt, NULL) == SQLITE_OK) {
+        hasRollups = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return true;
+}
+
+void PlayStats::Close() {
+    for (sqlite3_stmt*& stmt : statements) {
+        if (stmt) {
+            sqlite3_finalize(stmt);
+            stmt = NULL;
+        }
+    }
+    if (db) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+    layout = SchemaNone;
+    hasRollups = false;
+}
+
+const char* PlayStats::GetSQL(Query query) const {
+    return layout == SchemaNormalized ? normalizedSQL[query] : flatSQL[query];
+}
+
+// Widen a window bound by up to a time zone's offset, short of overflowing
+static int64_t AddClamped(int64_t ms, int64_t delta) {
+    if (delta < 0) return ms < INT64_MIN - delta ? INT64_MIN : ms + delta;
+    return ms > INT64_MAX - delta ? INT64_MAX : ms + delta;
+}
+
+// Local day of a window bound that falls on midnight (unbounded stays so)
+static int64_t GetDay(int64_t ms) {
+    return ms == INT64_MIN || ms == INT64_MAX ? ms : ms / 86400000;
+}
+
+static bool IsAllTime(const StatsWindow& window) {
+    return window.fromMs == INT64_MIN && window.toMs == INT64_MAX;
+}
+
+static bool IsMidnight(int64_t ms) {
+    return ms == INT64_MIN || ms == INT64_MAX || ms % 86400000 == 0;
+}
+
+// Rollups count plays by local day, so they cover all time and whole local
+// days but not windows that start or end mid-day
+bool PlayStats::CanUseRollups(const StatsWindow& window) const {
+    if (!hasRollups || !rollupsEnabled) return false;
+    return IsAllTime(window) || (window.local && IsMidnight(window.fromMs) && IsMidnight(window.toMs));
+}
+
+// Fetch a query's statement (prepared on first use) with the window bound
+sqlite3_stmt* PlayStats::Prepare(Query query, const StatsWindow& window) {
+    if (!db) return NULL;
+    
+    sqlite3_stmt*& stmt = statements[query];
+    if (!stmt && sqlite3_prepare_v3(db, GetSQL(query), -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+        return NULL;
+    }
+    sqlite3_reset(stmt);
+    
+    if (query >= QueryRollupTopArtist) {
+        sqlite3_bind_int64(stmt, 1, GetDay(window.fromMs));
+        sqlite3_bind_int64(stmt, 2, GetDay(window.toMs));
+    } else if (window.local) {
+        sqlite3_bind_int64(stmt, 1, AddClamped(window.fromMs, -MAX_UTC_OFFSET_MS));
+        sqlite3_bind_int64(stmt, 2, AddClamped(window.toMs, MAX_UTC_OFFSET_MS));
+        sqlite3_bind_int64(stmt, 4, window.fromMs);
+        sqlite3_bind_int64(stmt, 5, window.toMs);
+    } else {
+        sqlite3_bind_int64(stmt, 1, window.fromMs);
+        sqlite3_bind_int64(stmt, 2, window.toMs);
+        sqlite3_bind_int64(stmt, 4, INT64_MIN);
+        sqlite3_bind_int64(stmt, 5, INT64_MAX);
+    }
+    return stmt;
+}
+
+static std::string GetText(sqlite3_stmt* stmt, int column) {
+    const char* text = (const char*)sqlite3_column_text(stmt, column);
+    return text ? text : "";
+}
+
+bool PlayStats::GetTop(StatsGroup group, const StatsWindow& window, int limit, std::vector<StatsEntry>& entries) {
+    entries.clear();
+    if (group < 0 || group >= StatsGroupCount) return false;
+    
+    Query query = (Query)(QueryTopArtist + group);
+    // Over all time, the per-track rollup has fewer rows to add up than the
+    // per-day one
+    if (CanUseRollups(window)) {
+        bool all = IsAllTime(window);
+        if (group == StatsByArtist) query = all ? QueryRollupTopArtist : QueryRollupDayTopArtist;
+        if (group == StatsByTrack && all) query = QueryRollupTopTrack;
+    }
+    
+    sqlite3_stmt* stmt = Prepare(query, window);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 3, limit);
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        StatsEntry entry;
+        entry.name = GetText(stmt, 0);
+        entry.artist = GetText(stmt, 1);
+        entry.plays = (uint64_t)sqlite3_column_int64(stmt, 2);
+        entry.playTimeMs = sqlite3_column_int64(stmt, 3);
+        entries.push_back(entry);
+    }
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// Fill a histogram from (bucket, count) rows
+static bool ReadHistogram(sqlite3_stmt* stmt, uint64_t* plays, int buckets) {
+    memset(plays, 0, sizeof(plays[0]) * buckets);
+    if (!stmt) return false;
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int bucket = sqlite3_column_int(stmt, 0);
+        if (bucket >= 0 && bucket < buckets) {
+            plays[bucket] = (uint64_t)sqlite3_column_int64(stmt, 1);
+        }
+    }
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool PlayStats::GetHourHistogram(const StatsWindow& window, uint64_t (&plays)[24]) {
+    return ReadHistogram(Prepare(QueryHours, window), plays, 24);
+}
+
+bool PlayStats::GetWeekdayHistogram(const StatsWindow& window, uint64_t (&plays)[7]) {
+    return ReadHistogram(Prepare(QueryWeekdays, window), plays, 7);
+}
+
+// Read (day, plays, play time) rows
+static bool ReadTotals(sqlite3_stmt* stmt, std::vector<StatsTotal>& totals) {
+    totals.clear();
+    if (!stmt) return false;
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        StatsTotal total;
+        total.day = GetText(stmt, 0);
+        total.plays = (uint64_t)sqlite3_column_int64(stmt, 1);
+        total.playTimeMs = sqlite3_column_int64(stmt, 2);
+        totals.push_back(total);
+    }
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool PlayStats::GetTotal(const StatsWindow& window, StatsTotal& total) {
+    std::vector<StatsTotal> totals;
+    bool ok = ReadTotals(Prepare(CanUseRollups(window) ? QueryRollupTotal : QueryTotal, window), totals) && totals.size() == 1;
+    total = ok ? totals[0] : StatsTotal();
+    return ok;
+}
+
+bool PlayStats::GetDailyTotals(const StatsWindow& window, std::vector<StatsTotal>& days) {
+    return ReadTotals(Prepare(CanUseRollups(window) ? QueryRollupDaily : QueryDaily, window), days);
+}
+
+// True if a plan step touches the table of plays (a whole word of detail)
+static bool ReadsTable(const char* detail, const char* table) {
+    size_t length = strlen(table);
+    for (const char* found = strstr(detail, table); found; found = strstr(found + 1, table)) {
+        bool start = found == detail || found[-1] == ' ';
+        bool end = found[length] == '\0' || found[length] == ' ';
+        if (start && end) return true;
+    }
+    return false;
+}
+
+bool PlayStats::CheckQueryPlans(std::string& report) {
+    report.clear();
+    if (!db) return false;
+    
+    const char* table = layout == SchemaNormalized ? "plays" : "play_history";
+    bool allCovered = true;
+    int queryCount = hasRollups ? QueryCount : QueryRollupTopArtist;
+    for (int query = 0; query < queryCount; query++) {
+        std::string sql = std::string("EXPLAIN QUERY PLAN ") + GetSQL((Query)query);
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+            report += std::string(queryNames[query]) + ": " + sqlite3_errmsg(db) + "\n";
+            allCovered = false;
+            continue;
+        }
+        
+        report += std::string(queryNames[query]) + ":\n";
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* detail = (const char*)sqlite3_column_text(stmt, 3);
+            if (!detail) continue;
+            
+            // Plays must come from an index range, never the rows themselves
+            bool covered = !ReadsTable(detail, table) || strstr(detail, "USING COVERING INDEX") != NULL;
+            allCovered = allCovered && covered;
+            report += std::string(covered ? "  " : "! ") + detail + "\n";
+        }
+        sqlite3_finalize(stmt);
+    }
+    return allCovered;
+}
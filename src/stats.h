@@ -0,0 +1,101 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "schema.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Half-open range of play times in milliseconds since the Unix epoch: UTC,
+// or local (each play's own local time) for ranges of calendar days
+struct StatsWindow {
+    int64_t fromMs;
+    int64_t toMs;
+    bool local;
+    
+    static StatsWindow All() { return StatsWindow{ INT64_MIN, INT64_MAX, false }; }
+    
+    // Local days firstDay up to (not including) endDay, numbered from 1970-01-01
+    static StatsWindow LocalDays(int64_t firstDay, int64_t endDay) {
+        return StatsWindow{ firstDay * 86400000, endDay * 86400000, true };
+    }
+};
+
+// What a top-N list ranks
+enum StatsGroup {
+    StatsByArtist,
+    StatsByAlbum,    // Per artist, so same-named albums stay apart
+    StatsByGenre,
+    StatsByTrack,    // Artist and title, whatever file it was played from
+    StatsGroupCount
+};
+
+// One row of a top-N list. Plays with the grouped tag empty are left out.
+struct StatsEntry {
+    std::string name;      // Artist, album, genre or title
+    std::string artist;    // For albums and tracks
+    uint64_t plays;
+    int64_t playTimeMs;    // Total length of the tracks played (not time actually listened)
+};
+
+// Totals for a window, or for one local calendar day of it
+struct StatsTotal {
+    std::string day;       // YYYY-MM-DD (local time when played); empty for a whole window
+    uint64_t plays;
+    int64_t playTimeMs;
+};
+
+// Read-only statistics over the play history, for dashboards and reports.
+// Opens its own connection, so it can run alongside the logger (best with
+// WAL). Every query reads only the covering index on play time; check
+// with CheckQueryPlans. Hours and days are in the local time of each play.
+//
+// Where the rollup tables can answer a query they are read instead of the
+// plays: totals and top artists over all time or whole local days, and top
+// tracks over all time.
+class PlayStats {
+public:
+    PlayStats();
+    ~PlayStats();
+    
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return db != NULL; }
+    
+    // Read the plays even where rollups could answer (e.g. to compare)
+    void UseRollups(bool use) { rollupsEnabled = use; }
+    
+    // Most played artists/albums/genres/tracks, most plays first
+    bool GetTop(StatsGroup group, const StatsWindow& window, int limit, std::vector<StatsEntry>& entries);
+    
+    // Plays by local hour of day (0-23) and weekday (0 = Sunday)
+    bool GetHourHistogram(const StatsWindow& window, uint64_t (&plays)[24]);
+    bool GetWeekdayHistogram(const StatsWindow& window, uint64_t (&plays)[7]);
+    
+    // Plays and play time over the window, and per local day (oldest first)
+    bool GetTotal(const StatsWindow& window, StatsTotal& total);
+    bool GetDailyTotals(const StatsWindow& window, std::vector<StatsTotal>& days);
+    
+    // Ask SQLite how it would run each query and check that plays are only
+    // read through the covering index (older databases may lack it). The
+    // report lists each query's plan.
+    bool CheckQueryPlans(std::string& report);
+
+private:
+    enum Query { QueryTopArtist, QueryTopAlbum, QueryTopGenre, QueryTopTrack,
+                 QueryHours, QueryWeekdays, QueryTotal, QueryDaily,
+                 QueryRollupTopArtist, QueryRollupDayTopArtist, QueryRollupTopTrack, QueryRollupTotal, QueryRollupDaily,
+                 QueryCount };
+    
+    sqlite3_stmt* Prepare(Query query, const StatsWindow& window);
+    const char* GetSQL(Query query) const;
+    bool CanUseRollups(const StatsWindow& window) const;
+    
+    sqlite3* db;
+    SchemaLayout layout;
+    bool hasRollups;
+    bool rollupsEnabled;
+    sqlite3_stmt* statements[QueryCount];
+};
+
+#endif // STATS_H
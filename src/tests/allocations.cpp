@@ -0,0 +1,137 @@
+#include "test.h"
+#include "metacache.h"
+#include "simplayer.h"
+#include "tracker.h"
+#include "writer.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+// Heap allocations made through operator new, on any thread, for the whole
+// of winnp-tests (SQLite's own allocations, through malloc, aren't counted)
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static std::atomic<int> sunkPlays(0);
+
+static bool SinkPlay(const PlayEvent&) {
+    sunkPlays++;
+    return true;
+}
+
+static SimTrack MakeTrack(const char* filepath, const char* title) {
+    SimTrack track;
+    track.filepath = filepath;
+    track.title = title;
+    track.artist = "Artist";
+    track.album = "Album";
+    track.genre = "Genre";
+    track.trackNumber = "1";
+    track.year = "2001";
+    track.lengthMs = 60000;
+    return track;
+}
+
+// Without which the others would pass whatever happens
+TEST(allocations, are_counted) {
+    uint64_t before = allocations.load();
+    void* p = ::operator new(sizeof(int));  // A new-expression could be optimised out
+    CHECK(allocations.load() == before + 1);
+    ::operator delete(p);
+}
+
+TEST(allocations, none_in_a_warm_tick) {
+    ManualClock clock(1735689600);
+    SimulatedPlayerSource player(clock);
+    player.AddTrack(MakeTrack("C:\\Music\\a.mp3", "Song A"));
+    player.AddTrack(MakeTrack("C:\\Music\\b.mp3", "Song B"));
+    MetadataCache cache(16);
+    TrackTracker tracker(player, clock, SinkPlay);
+    tracker.SetMetadataCache(&cache, false);
+    
+    // Both tracks played once, so their tags are cached
+    player.Play(0);
+    for (int i = 0; i < 240; i++) {
+        clock.Advance(500);
+        player.DeliverEvents();
+        tracker.Tick();
+    }
+    
+    // Playing on, through track changes served from the cache
+    int playsBefore = sunkPlays;
+    uint64_t before = allocations.load();
+    for (int i = 0; i < 2400; i++) {
+        clock.Advance(500);
+        player.DeliverEvents();
+        tracker.Tick();
+    }
+    CHECK(allocations.load() == before);
+    CHECK(sunkPlays - playsBefore == 20);
+}
+
+TEST(allocations, none_in_a_cache_hit) {
+    std::string path = GetTestPath("hit.mp3");
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file) fclose(file);
+    
+    ManualClock clock(1735689600);
+    SimulatedPlayerSource player(clock);
+    player.AddTrack(MakeTrack(path.c_str(), "Song A"));
+    MetadataCache cache(16);
+    TrackTracker tracker(player, clock, SinkPlay);
+    PlayEvent event;
+    
+    // With and without checking the file, after the miss that fills it
+    for (int validate = 0; validate < 2; validate++) {
+        tracker.SetMetadataCache(&cache, validate != 0);
+        tracker.BuildPlayEvent("Song A", path.c_str(), event);
+        uint64_t hitsBefore = cache.GetHits();
+        uint64_t before = allocations.load();
+        for (int i = 0; i < 1000; i++) {
+            tracker.BuildPlayEvent("Song A", path.c_str(), event);
+        }
+        CHECK(allocations.load() == before);
+        CHECK(cache.GetHits() - hitsBefore == 1000);
+    }
+    remove(path.c_str());
+}
+
+TEST(allocations, none_in_an_enqueue) {
+    WriterConfig config = {};
+    config.sink = SinkPlay;
+    config.policy = OverflowBlock;
+    CHECK(StartWriter(config));
+    
+    // Once the writer has written its first play
+    PlayEvent event;
+    event.SetText(PlayFilepath, "C:\\Music\\a.mp3");
+    event.SetText(PlayTitle, "Song A");
+    int playsBefore = sunkPlays;
+    CHECK(EnqueuePlayEvent(event));
+    while (sunkPlays == playsBefore) std::this_thread::yield();
+    
+    // On the caller's side and the writer's, while it drains them
+    uint64_t before = allocations.load();
+    for (int i = 0; i < 1000; i++) {
+        EnqueuePlayEvent(event);
+    }
+    StopWriter();
+    CHECK(allocations.load() == before);
+    CHECK(sunkPlays - playsBefore == 1001);
+}
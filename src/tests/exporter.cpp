@@ -0,0 +1,129 @@
+#include "test.h"
+#include "exporter.h"
+#include "importer.h"
+#include "schema.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static bool Exec(const std::string& path, const char* sql) {
+    sqlite3* db = NULL;
+    bool ok = sqlite3_open(path.c_str(), &db) == SQLITE_OK && CreateSchema(db, false) &&
+              sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_close(db);
+    return ok;
+}
+
+// Every play at path but its id, one per line in time order, as SQL literals
+static std::string DumpPlays(const std::string& path) {
+    static const char* sql =
+        "SELECT group_concat(play, char(10)) FROM (SELECT"
+        "    quote(played_at_ms) || ',' || quote(utc_offset_min) || ',' || quote(filepath) || ',' || quote(filename) || ',' ||"
+        "    quote(title) || ',' || quote(artist) || ',' || quote(album) || ',' || quote(genre) || ',' ||"
+        "    quote(track_number) || ',' || quote(year) || ',' || quote(duration_ms) || ',' || quote(source) AS play"
+        "    FROM play_history ORDER BY played_at_ms, filepath);";
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    std::string plays;
+    if (sqlite3_open(path.c_str(), &db) == SQLITE_OK && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) plays = (const char*)sqlite3_column_text(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return plays;
+}
+
+static bool ExportFile(const std::string& dbPath, const std::string& path, ExportFormat format, int64_t afterId,
+                       uint64_t& rows, int64_t& lastId) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    ExportOptions options = { format, afterId, EXPORT_ROW_GROUP_SIZE };
+    PlayExporter exporter;
+    bool exported = exporter.Open(dbPath.c_str()) && exporter.Export(out, options, rows, lastId);
+    exporter.Close();
+    return fclose(out) == 0 && exported;
+}
+
+// The ids of the CSV plays in the file at path, first and last, and how many
+static bool ReadCsvIds(const std::string& path, int64_t& firstId, int64_t& lastId, uint64_t& count) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    char line[1024];
+    count = 0;
+    bool header = fgets(line, sizeof(line), file) != NULL && strncmp(line, "id,", 3) == 0;
+    while (fgets(line, sizeof(line), file)) {
+        int64_t id = strtoll(line, NULL, 10);
+        if (count++ == 0) firstId = id;
+        lastId = id;
+    }
+    fclose(file);
+    return header;
+}
+
+TEST(exporter, round_trips_csv_through_the_importer) {
+    std::string sourcePath = GetTestPath("export-source.db");
+    CHECK(Exec(sourcePath,
+               "INSERT INTO play_history(played_at_ms, utc_offset_min, filepath, filename, title, artist, album, genre,"
+               "                         track_number, year, duration_ms, source) VALUES"
+               "    (1709280000000, 60, 'C:\\Music\\a.mp3', 'a.mp3', 'Hello, \"World\"', 'Artist', 'Album', 'Pop', '1', '2001', 5000, 'kitchen'),"
+               "    (1709280300000, -300, 'C:\\Music\\b.mp3', 'b.mp3', 'Two' || char(13, 10) || 'Lines', 'Art' || char(10) || 'ist', NULL, NULL, NULL, NULL, NULL, NULL),"
+               "    (1709280600000, 0, 'D:\\坂本龍一\\01.flac', '01.flac', '戦場のメリークリスマス', '坂本龍一', '🎹', 'サウンドトラック', '1', '1983', 301000, NULL),"
+               "    (1709280900000, 0, NULL, NULL, 'Radio', 'Station', NULL, NULL, NULL, NULL, NULL, 'radio');"));
+    std::string csvPath = GetTestPath("export.csv");
+    uint64_t rows = 0;
+    int64_t lastId = 0;
+    CHECK(ExportFile(sourcePath, csvPath, ExportCsv, 0, rows, lastId));
+    CHECK(rows == 4);
+    CHECK(lastId == 4);
+    
+    std::string copyPath = GetTestPath("export-copy.db");
+    ImportOptions options = { ImportCsv, NULL };
+    ImportStats stats = {};
+    PlayImporter importer;
+    CHECK(importer.Open(copyPath.c_str()) && importer.ReadFile(csvPath.c_str(), options, stats) && importer.Commit(stats));
+    importer.Close();
+    CHECK(stats.imported == 4);
+    CHECK(!DumpPlays(sourcePath).empty());
+    CHECK(DumpPlays(copyPath) == DumpPlays(sourcePath));
+}
+
+TEST(exporter, exports_only_plays_after_the_last_id) {
+    // A few plays past a page, and then a few past another
+    std::string dbPath = GetTestPath("export-pages.db");
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d)"
+             "    INSERT INTO play_history(played_at_ms, utc_offset_min, filepath, title, artist, duration_ms)"
+             "    SELECT 1700000000000 + (i + (SELECT COUNT(*) FROM play_history)) * 60000, 0, 'C:\\' || i || '.mp3', 'T' || i, 'A', 1000"
+             "    FROM n;",
+             EXPORT_PAGE_ROWS + 5);
+    CHECK(Exec(dbPath, sql));
+    
+    std::string path = GetTestPath("export-pages.csv");
+    uint64_t rows = 0;
+    int64_t lastId = 0;
+    CHECK(ExportFile(dbPath, path, ExportCsv, 0, rows, lastId));
+    CHECK(rows == EXPORT_PAGE_ROWS + 5);
+    CHECK(lastId == EXPORT_PAGE_ROWS + 5);
+    int64_t firstId = 0;
+    int64_t fileLastId = 0;
+    uint64_t count = 0;
+    CHECK(ReadCsvIds(path, firstId, fileLastId, count));
+    CHECK(count == rows && firstId == 1 && fileLastId == lastId);
+    
+    // From the saved id on, only the new plays, across the next page
+    CHECK(Exec(dbPath, sql));
+    int64_t savedId = lastId;
+    CHECK(ExportFile(dbPath, path, ExportCsv, savedId, rows, lastId));
+    CHECK(rows == EXPORT_PAGE_ROWS + 5);
+    CHECK(lastId == savedId + EXPORT_PAGE_ROWS + 5);
+    CHECK(ReadCsvIds(path, firstId, fileLastId, count));
+    CHECK(count == rows && firstId == savedId + 1 && fileLastId == lastId);
+    
+    // And nothing when there is nothing new
+    savedId = lastId;
+    CHECK(ExportFile(dbPath, path, ExportCsv, savedId, rows, lastId));
+    CHECK(rows == 0);
+    CHECK(lastId == savedId);
+}
@@ -0,0 +1,190 @@
+#include "test.h"
+#include "importer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+static bool WriteTextFile(const std::string& path, const char* text) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool written = fputs(text, file) >= 0;
+    return fclose(file) == 0 && written;
+}
+
+static int64_t QueryInt(const std::string& path, const char* sql) {
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    int64_t value = -1;
+    if (sqlite3_open(path.c_str(), &db) == SQLITE_OK && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return value;
+}
+
+static std::string QueryText(const std::string& path, const char* sql) {
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    std::string value;
+    if (sqlite3_open(path.c_str(), &db) == SQLITE_OK && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+            value = (const char*)sqlite3_column_text(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return value;
+}
+
+// Import one file of text into the history at dbPath
+static bool ImportText(const std::string& dbPath, const char* name, const char* text, ImportFormat format, ImportStats& stats) {
+    std::string path = GetTestPath(name);
+    ImportOptions options = { format, NULL };
+    PlayImporter importer;
+    return WriteTextFile(path, text) && importer.Open(dbPath.c_str()) &&
+           importer.ReadFile(path.c_str(), options, stats) && importer.Commit(stats);
+}
+
+// Run with the local time zone set to zone (POSIX TZ syntax)
+static void SetTimeZone(const char* zone) {
+#ifdef _WIN32
+    _putenv_s("TZ", zone ? zone : "");
+    _tzset();
+#else
+    if (zone) setenv("TZ", zone, 1);
+    else unsetenv("TZ");
+    tzset();
+#endif
+}
+
+TEST(importer, reads_quoted_csv) {
+    std::string dbPath = GetTestPath("csv.db");
+    ImportStats stats = {};
+    CHECK(ImportText(dbPath, "plays.csv",
+                     "id,played_at_ms,utc_offset_min,filepath,title,artist,duration_ms,source\r\n"
+                     "1,1709280000000,60,C:\\a.mp3,\"Hello, \"\"World\"\"\",Artist,5000,kitchen\r\n"
+                     "2,1709280300000,60,C:\\b.mp3,\"Two\r\nLines\",\"Art\nist\",,\r\n"
+                     "3,,60,C:\\c.mp3,No time,Artist,,\r\n",
+                     ImportAuto, stats));
+    CHECK(stats.records == 3);
+    CHECK(stats.rejected == 1);
+    CHECK(stats.imported == 2);
+    CHECK(QueryText(dbPath, "SELECT title FROM play_history WHERE played_at_ms = 1709280000000;") == "Hello, \"World\"");
+    CHECK(QueryText(dbPath, "SELECT played_at FROM play_history WHERE played_at_ms = 1709280000000;") == "2024-03-01 09:00:00");
+    CHECK(QueryText(dbPath, "SELECT source FROM play_history WHERE played_at_ms = 1709280000000;") == "kitchen");
+    CHECK(QueryText(dbPath, "SELECT filename FROM play_history WHERE played_at_ms = 1709280000000;") == "a.mp3");
+    CHECK(QueryText(dbPath, "SELECT title FROM play_history WHERE played_at_ms = 1709280300000;") == "Two\r\nLines");
+    CHECK(QueryText(dbPath, "SELECT artist FROM play_history WHERE played_at_ms = 1709280300000;") == "Art\nist");
+    CHECK(QueryInt(dbPath, "SELECT COUNT(*) FROM play_history WHERE duration_ms IS NULL AND source IS NULL;") == 1);
+}
+
+TEST(importer, reads_lastfm_exports) {
+    SetTimeZone("JST-9");
+    std::string dbPath = GetTestPath("lastfm.db");
+    ImportStats stats = {};
+    CHECK(ImportText(dbPath, "scrobbles.csv",
+                     "Artist A,Album,\"Song, One\",31 Jan 2020 12:34\n"
+                     "Artist B,,Song Two,\"1 Feb 2020, 00:05\"\n"
+                     "Artist C,Album,Song Three,30 Feb 2020 25:00\n",
+                     ImportAuto, stats));
+    SetTimeZone(NULL);
+    CHECK(stats.records == 3);
+    CHECK(stats.rejected == 1);
+    CHECK(stats.imported == 2);
+    
+    // The dates are UTC, and the plays get the local offset at the time
+    CHECK(QueryInt(dbPath, "SELECT played_at_ms FROM play_history WHERE title = 'Song, One';") == 1580474040000LL);
+    CHECK(QueryInt(dbPath, "SELECT played_at_ms FROM play_history WHERE title = 'Song Two';") == 1580515500000LL);
+    CHECK(QueryInt(dbPath, "SELECT utc_offset_min FROM play_history WHERE title = 'Song Two';") == 540);
+    CHECK(QueryText(dbPath, "SELECT played_at FROM play_history WHERE title = 'Song Two';") == "2020-02-01 09:05:00");
+    CHECK(QueryInt(dbPath, "SELECT COUNT(*) FROM play_history WHERE album IS NULL;") == 1);
+}
+
+TEST(importer, reads_scrobbler_logs) {
+    SetTimeZone("JST-9");
+    std::string dbPath = GetTestPath("scrobbler.db");
+    ImportStats stats = {};
+    
+    // Local times: 1580474040 is 2020-01-31 12:34 on the player's clock,
+    // 03:34 UTC in Japan
+    CHECK(ImportText(dbPath, "local.scrobbler.log",
+                     "#AUDIOSCROBBLER/1.1\n"
+                     "#TZ/UNKNOWN\n"
+                     "#CLIENT/Rockbox\n"
+                     "Artist A\tAlbum\tLocal\t3\t215\tL\t1580474040\n"
+                     "Artist A\tAlbum\tSkipped\t4\t190\tS\t1580474300\n",
+                     ImportAuto, stats));
+    CHECK(ImportText(dbPath, "utc.scrobbler.log",
+                     "#AUDIOSCROBBLER/1.1\n"
+                     "#TZ/UTC\n"
+                     "Artist B\t\tUniversal\t\t180\tL\t1580474040\n",
+                     ImportScrobblerLog, stats));
+    SetTimeZone(NULL);
+    CHECK(stats.records == 3);
+    CHECK(stats.skipped == 1);
+    CHECK(stats.imported == 2);
+    CHECK(QueryInt(dbPath, "SELECT played_at_ms FROM play_history WHERE title = 'Local';") == (1580474040LL - 9 * 3600) * 1000);
+    CHECK(QueryText(dbPath, "SELECT played_at FROM play_history WHERE title = 'Local';") == "2020-01-31 12:34:00");
+    CHECK(QueryInt(dbPath, "SELECT played_at_ms FROM play_history WHERE title = 'Universal';") == 1580474040000LL);
+    CHECK(QueryInt(dbPath, "SELECT duration_ms FROM play_history WHERE title = 'Local';") == 215000);
+    CHECK(QueryText(dbPath, "SELECT track_number FROM play_history WHERE title = 'Local';") == "3");
+}
+
+TEST(importer, leaves_out_known_plays) {
+    static const char* scrobbles =
+        "Artist A,Album,Song One,31 Jan 2020 12:34\n"
+        "Artist A,Album,Song One,31 Jan 2020 12:34\n"
+        "Artist B,Album,Song Two,31 Jan 2020 12:40\n"
+        "Artist C,Album,Song Three,31 Jan 2020 12:45\n";
+    std::string dbPath = GetTestPath("known.db");
+    ImportStats stats = {};
+    CHECK(ImportText(dbPath, "first.csv", scrobbles, ImportLastfm, stats));
+    CHECK(stats.records == 4);
+    CHECK(stats.repeated == 1);
+    CHECK(stats.imported == 3);
+    CHECK(QueryInt(dbPath, "SELECT SUM(plays) FROM rollup_days;") == 3);
+    
+    // The same file again adds nothing, and so do its plays among others
+    ImportStats again = {};
+    CHECK(ImportText(dbPath, "again.csv", scrobbles, ImportLastfm, again));
+    CHECK(again.known == 3);
+    CHECK(again.imported == 0);
+    ImportStats more = {};
+    CHECK(ImportText(dbPath, "more.csv",
+                     "Artist B,Album,Song Two,31 Jan 2020 12:40\n"
+                     "Artist D,Album,Song Four,31 Jan 2020 12:50\n",
+                     ImportLastfm, more));
+    CHECK(more.known == 1);
+    CHECK(more.imported == 1);
+    CHECK(QueryInt(dbPath, "SELECT COUNT(*) FROM play_history;") == 4);
+    CHECK(QueryInt(dbPath, "SELECT SUM(plays) FROM rollup_days;") == 4);
+}
+
+TEST(importer, keeps_plays_of_different_files_at_one_time) {
+    std::string dbPath = GetTestPath("files.db");
+    ImportStats stats = {};
+    CHECK(ImportText(dbPath, "files.csv",
+                     "played_at_ms,filepath,title\n"
+                     "1709280000000,C:\\a\\intro.mp3,Intro\n"
+                     "1709280000000,C:\\b\\intro.mp3,Intro\n"
+                     "1709280000000,C:\\b\\intro.mp3,Intro\n"
+                     "1709280600000,C:\\c.mp3,\n"
+                     "1709280600000,C:\\d.mp3,\n",
+                     ImportCsv, stats));
+    CHECK(stats.repeated == 1);
+    CHECK(stats.imported == 4);
+    
+    // Known by file, even with no title to go on; plays without a file are
+    // still stored without one
+    ImportStats again = {};
+    CHECK(ImportText(dbPath, "again.csv",
+                     "played_at_ms,filepath,title\n"
+                     "1709280600000,C:\\d.mp3,\n"
+                     "1709280600000,,Other\n",
+                     ImportCsv, again));
+    CHECK(again.known == 1);
+    CHECK(again.imported == 1);
+    CHECK(QueryInt(dbPath, "SELECT COUNT(*) FROM play_history WHERE filepath IS NULL;") == 1);
+}
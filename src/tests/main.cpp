@@ -0,0 +1,85 @@
+// winnp-tests: unit tests of the logging core.
+//
+//   winnp-tests [suite...]
+//
+// Runs every test of the named suites (all suites if none are named) and
+// exits with 1 if any check failed.
+
+#include "test.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+struct TestCase {
+    const char* suite;
+    const char* name;
+    TestProc proc;
+};
+
+// Function-local so registrations from other files find it constructed
+static std::vector<TestCase>& GetTests() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+static int failedChecks = 0;
+static std::filesystem::path scratchDirectory;
+
+TestRegistration::TestRegistration(const char* suite, const char* name, TestProc proc) {
+    GetTests().push_back(TestCase{ suite, name, proc });
+}
+
+void FailTest(const char* file, int line, const char* expression) {
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+    failedChecks++;
+}
+
+std::string GetTestPath(const char* name) {
+    std::filesystem::path path = scratchDirectory / name;
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    return path.string();
+}
+
+static bool IsSelected(const char* suite, int argc, char** argv) {
+    if (argc < 2) return true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], suite) == 0) return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    std::error_code error;
+    long long stamp = (long long)std::chrono::steady_clock::now().time_since_epoch().count();
+    scratchDirectory = std::filesystem::temp_directory_path(error) / ("winnp-tests-" + std::to_string(stamp));
+    if (error || !std::filesystem::create_directories(scratchDirectory, error)) {
+        fprintf(stderr, "cannot create a scratch directory\n");
+        return 1;
+    }
+    
+    int run = 0;
+    int failedTests = 0;
+    for (const TestCase& test : GetTests()) {
+        if (!IsSelected(test.suite, argc, argv)) continue;
+        
+        int failedBefore = failedChecks;
+        auto start = std::chrono::steady_clock::now();
+        test.proc();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        bool passed = failedChecks == failedBefore;
+        printf("%-6s %s.%s (%.3f s)\n", passed ? "ok" : "FAILED", test.suite, test.name, seconds);
+        run++;
+        if (!passed) failedTests++;
+    }
+    
+    std::filesystem::remove_all(scratchDirectory, error);
+    if (run == 0) {
+        fprintf(stderr, "no tests selected\n");
+        return 1;
+    }
+    printf("%d tests, %d failed\n", run, failedTests);
+    return failedTests > 0 ? 1 : 0;
+}
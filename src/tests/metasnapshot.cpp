@@ -0,0 +1,227 @@
+#include "test.h"
+#include "metacache.h"
+#include "metasnapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::string MakeKey(int i) {
+    char key[64];
+    snprintf(key, sizeof(key), "c:\\music\\%05d.mp3", i);
+    return key;
+}
+
+static void MakeMetadata(int i, TrackMetadata& metadata) {
+    memset(&metadata, 0, sizeof(metadata));
+    snprintf(metadata.artist, sizeof(metadata.artist), "Artist %d", i % 37);
+    snprintf(metadata.album, sizeof(metadata.album), "Album %d", i % 101);
+    snprintf(metadata.genre, sizeof(metadata.genre), "%s", i % 2 ? "Pop" : "");
+    snprintf(metadata.trackNumber, sizeof(metadata.trackNumber), "%d", i % 20 + 1);
+    snprintf(metadata.year, sizeof(metadata.year), "%d", 1960 + i % 60);
+    snprintf(metadata.title, sizeof(metadata.title), "Song %d ♪", i);
+    metadata.durationMs = 1000 * i + 7;
+}
+
+static bool SameMetadata(const TrackMetadata& a, const TrackMetadata& b) {
+    return strcmp(a.artist, b.artist) == 0 && strcmp(a.album, b.album) == 0 && strcmp(a.genre, b.genre) == 0 &&
+           strcmp(a.trackNumber, b.trackNumber) == 0 && strcmp(a.year, b.year) == 0 &&
+           strcmp(a.title, b.title) == 0 && a.durationMs == b.durationMs;
+}
+
+// Write a snapshot of count entries to path
+static bool WriteSnapshot(const std::string& path, int count) {
+    MetadataSnapshotWriter writer;
+    for (int i = 0; i < count; i++) {
+        FileStamp stamp = { i % 5 != 0, (uint64_t)i * 1000, 1700000000 + i };
+        TrackMetadata metadata;
+        MakeMetadata(i, metadata);
+        writer.Add(MakeKey(i), stamp, metadata);
+    }
+    return writer.Write(path.c_str());
+}
+
+static bool ReadBytes(const std::string& path, std::vector<unsigned char>& bytes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    bytes.clear();
+    unsigned char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) bytes.insert(bytes.end(), buffer, buffer + read);
+    fclose(file);
+    return true;
+}
+
+static bool WriteBytes(const std::string& path, const unsigned char* bytes, size_t size) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool written = size == 0 || fwrite(bytes, size, 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
+
+// Entries of a damaged snapshot at path are either found whole or not at
+// all; returns how many were found
+static int CountIntactEntries(const std::string& path, int count, bool& garbled) {
+    MetadataSnapshot snapshot;
+    garbled = false;
+    if (!snapshot.Open(path.c_str())) return 0;
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        FileStamp stamp;
+        TrackMetadata metadata;
+        TrackMetadata expected;
+        MakeMetadata(i, expected);
+        if (!snapshot.Find(MakeKey(i), stamp, metadata)) continue;
+        found++;
+        garbled = garbled || !SameMetadata(metadata, expected) || stamp.size != (uint64_t)i * 1000;
+    }
+    snapshot.Close();
+    return found;
+}
+
+TEST(metasnapshot, round_trips_entries) {
+    std::string path = GetTestPath("snapshot.wnmc");
+    CHECK(WriteSnapshot(path, 1000));
+    
+    MetadataSnapshot snapshot;
+    CHECK(snapshot.Open(path.c_str()));
+    CHECK(snapshot.GetCount() == 1000);
+    for (int i = 0; i < 1000; i++) {
+        FileStamp stamp;
+        TrackMetadata metadata;
+        TrackMetadata expected;
+        MakeMetadata(i, expected);
+        CHECK(snapshot.Find(MakeKey(i), stamp, metadata));
+        CHECK(SameMetadata(metadata, expected));
+        CHECK(stamp.valid == (i % 5 != 0) && stamp.size == (uint64_t)i * 1000 && stamp.mtime == 1700000000 + i);
+    }
+    FileStamp stamp;
+    TrackMetadata metadata;
+    CHECK(!snapshot.Find("c:\\music\\missing.mp3", stamp, metadata));
+    
+    // Every entry once in index order, keys included
+    std::string key;
+    int seen = 0;
+    for (size_t i = 0; i < snapshot.GetCount(); i++) {
+        if (snapshot.Get(i, key, stamp, metadata) && key.compare(0, 9, "c:\\music\\") == 0) seen++;
+    }
+    CHECK(seen == 1000);
+    CHECK(!snapshot.Get(1000, key, stamp, metadata));
+    snapshot.Close();
+    
+    // An empty snapshot is valid too
+    CHECK(WriteSnapshot(path, 0));
+    CHECK(snapshot.Open(path.c_str()));
+    CHECK(snapshot.GetCount() == 0);
+    CHECK(!snapshot.Find(MakeKey(0), stamp, metadata));
+    snapshot.Close();
+}
+
+TEST(metasnapshot, rejects_truncated_files) {
+    std::string path = GetTestPath("truncated.wnmc");
+    CHECK(WriteSnapshot(path, 200));
+    std::vector<unsigned char> bytes;
+    CHECK(ReadBytes(path, bytes));
+    
+    // Cut anywhere: the header, the index, an entry or the last byte
+    size_t header = 16;
+    size_t index = header + 200 * 16;
+    const size_t lengths[] = { 0, 3, header - 1, header, index - 1, index, index + 10, bytes.size() / 2, bytes.size() - 1 };
+    for (size_t length : lengths) {
+        std::string cutPath = GetTestPath("truncated-cut.wnmc");
+        CHECK(WriteBytes(cutPath, bytes.data(), length));
+        bool garbled;
+        int found = CountIntactEntries(cutPath, 200, garbled);
+        CHECK(!garbled);
+        CHECK(found < 200);
+        if (length < index) CHECK(found == 0);
+    }
+    
+    MetadataSnapshot snapshot;
+    CHECK(!snapshot.Open(GetTestPath("no-such.wnmc").c_str()));
+}
+
+TEST(metasnapshot, rejects_corrupt_files) {
+    std::string path = GetTestPath("corrupt.wnmc");
+    CHECK(WriteSnapshot(path, 200));
+    std::vector<unsigned char> bytes;
+    CHECK(ReadBytes(path, bytes));
+    std::string damagedPath = GetTestPath("corrupt-damaged.wnmc");
+    MetadataSnapshot snapshot;
+    
+    // Another format, another version, or more entries than the file holds
+    std::vector<unsigned char> damaged = bytes;
+    damaged[0] = 'X';
+    CHECK(WriteBytes(damagedPath, damaged.data(), damaged.size()));
+    CHECK(!snapshot.Open(damagedPath.c_str()));
+    damaged = bytes;
+    damaged[4] = METASNAPSHOT_VERSION + 1;
+    CHECK(WriteBytes(damagedPath, damaged.data(), damaged.size()));
+    CHECK(!snapshot.Open(damagedPath.c_str()));
+    damaged = bytes;
+    memset(&damaged[8], 0xFF, 4);
+    CHECK(WriteBytes(damagedPath, damaged.data(), damaged.size()));
+    CHECK(!snapshot.Open(damagedPath.c_str()));
+    
+    // Index entries pointing past the end or claiming too much, and an entry
+    // whose strings run past it: those entries are lost, the rest kept
+    damaged = bytes;
+    memset(&damaged[16 + 8], 0xFF, 4);
+    memset(&damaged[16 + 16 + 12], 0xFF, 4);
+    uint32_t offset;
+    memcpy(&offset, &damaged[16 + 32 + 8], sizeof(offset));
+    memset(&damaged[offset + 21], 0xFF, 2);
+    CHECK(WriteBytes(damagedPath, damaged.data(), damaged.size()));
+    bool garbled;
+    CHECK(CountIntactEntries(damagedPath, 200, garbled) == 197);
+    CHECK(!garbled);
+    
+    // A byte changed anywhere is read safely. (Entries carry no checksum, so
+    // a changed byte within a string reads as a changed string.)
+    for (size_t at = 0; at < bytes.size(); at += 7) {
+        damaged = bytes;
+        damaged[at] ^= 0x5A;
+        CHECK(WriteBytes(damagedPath, damaged.data(), damaged.size()));
+        CHECK(CountIntactEntries(damagedPath, 200, garbled) <= 200);
+    }
+}
+
+TEST(metasnapshot, falls_back_to_the_live_fetch) {
+    // A cache over a damaged snapshot misses, so the caller asks the player
+    std::string path = GetTestPath("fallback.wnmc");
+    CHECK(WriteSnapshot(path, 10));
+    std::vector<unsigned char> bytes;
+    CHECK(ReadBytes(path, bytes));
+    CHECK(WriteBytes(path, bytes.data(), bytes.size() - 40));
+    
+    MetadataSnapshot snapshot;
+    CHECK(snapshot.Open(path.c_str()));
+    MetadataCache cache(16);
+    cache.SetSnapshot(&snapshot);
+    int hits = 0;
+    for (int i = 0; i < 10; i++) {
+        TrackMetadata metadata;
+        TrackMetadata expected;
+        MakeMetadata(i, expected);
+        std::string filepath = "C:/Music/" + MakeKey(i).substr(9);
+        if (cache.Lookup(filepath.c_str(), NULL, metadata)) {
+            CHECK(SameMetadata(metadata, expected));
+            hits++;
+            continue;
+        }
+        
+        // The live fetch, stored for next time
+        FileStamp stamp = { i % 5 != 0, (uint64_t)i * 1000, 1700000000 + i };
+        cache.Store(filepath.c_str(), &stamp, expected);
+        CHECK(cache.Lookup(filepath.c_str(), NULL, metadata));
+        CHECK(SameMetadata(metadata, expected));
+    }
+    CHECK(hits > 0 && hits < 10);
+    CHECK(cache.GetSnapshotHits() == (uint64_t)hits);
+    
+    // Saving replaces the damaged snapshot with a whole one
+    CHECK(cache.SaveSnapshot(path.c_str()));
+    bool garbled;
+    CHECK(CountIntactEntries(path, 10, garbled) == 10);
+    CHECK(!garbled);
+}
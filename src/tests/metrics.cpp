@@ -0,0 +1,68 @@
+#include "test.h"
+#include "metrics.h"
+
+TEST(metrics, keeps_small_values_exact) {
+    for (uint64_t ns = 0; ns < 2 * LATENCY_SUB_BUCKETS; ns++) {
+        CHECK(LatencyHistogram::GetBucket(ns) == (int)ns);
+        CHECK(LatencyHistogram::GetBucketLimit((int)ns) == ns);
+    }
+}
+
+TEST(metrics, splits_powers_of_two_into_eighths) {
+    // 16 and 17 share a bucket, as do 30 and 31; 32 starts a bucket of four
+    CHECK(LatencyHistogram::GetBucket(16) == 16);
+    CHECK(LatencyHistogram::GetBucket(17) == 16);
+    CHECK(LatencyHistogram::GetBucketLimit(16) == 17);
+    CHECK(LatencyHistogram::GetBucket(30) == 23);
+    CHECK(LatencyHistogram::GetBucket(31) == 23);
+    CHECK(LatencyHistogram::GetBucketLimit(23) == 31);
+    CHECK(LatencyHistogram::GetBucket(32) == 24);
+    CHECK(LatencyHistogram::GetBucketLimit(24) == 35);
+    CHECK(LatencyHistogram::GetBucket(1023) == 63);
+    CHECK(LatencyHistogram::GetBucketLimit(63) == 1023);
+    CHECK(LatencyHistogram::GetBucket(1024) == 64);
+    CHECK(LatencyHistogram::GetBucketLimit(64) == 1151);
+    CHECK(LatencyHistogram::GetBucket((uint64_t)1 << 63) == LATENCY_BUCKET_COUNT - LATENCY_SUB_BUCKETS);
+    CHECK(LatencyHistogram::GetBucket(UINT64_MAX) == LATENCY_BUCKET_COUNT - 1);
+    CHECK(LatencyHistogram::GetBucketLimit(LATENCY_BUCKET_COUNT - 1) == UINT64_MAX);
+    
+    // Buckets tile the whole range: each limit is the last value of its
+    // bucket, the next value opens the next one, and no bucket spans more
+    // than an eighth of its lowest value
+    uint64_t low = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+        uint64_t limit = LatencyHistogram::GetBucketLimit(bucket);
+        CHECK(limit >= low);
+        CHECK(LatencyHistogram::GetBucket(low) == bucket);
+        CHECK(LatencyHistogram::GetBucket(limit) == bucket);
+        CHECK(limit - low <= low / LATENCY_SUB_BUCKETS);
+        if (bucket + 1 < LATENCY_BUCKET_COUNT) {
+            CHECK(LatencyHistogram::GetBucket(limit + 1) == bucket + 1);
+        }
+        low = limit + 1;
+    }
+    CHECK(low == 0);  // The last limit was UINT64_MAX
+}
+
+TEST(metrics, reads_quantiles_from_bucket_limits) {
+    LatencyHistogram histogram;
+    CHECK(histogram.GetQuantileNs(0.5) == 0);
+    
+    for (uint64_t ns = 1; ns <= 100; ns++) histogram.Record(ns);
+    CHECK(histogram.GetCount() == 100);
+    CHECK(histogram.GetTotalNs() == 5050);
+    CHECK(histogram.GetMaxNs() == 100);
+    
+    // The 50th value (50) is in bucket 48-51; the 99th (99) in 96-103,
+    // which is cut to the largest value seen
+    CHECK(histogram.GetQuantileNs(0.5) == 51);
+    CHECK(histogram.GetQuantileNs(0.99) == 100);
+    CHECK(histogram.GetQuantileNs(1.0) == 100);
+    CHECK(histogram.GetQuantileNs(0.0) == 1);
+    CHECK(histogram.GetQuantileNs(0.25) == 25);
+    
+    // One slow value far above the rest
+    histogram.Record(UINT64_MAX / 2);
+    CHECK(histogram.GetQuantileNs(0.5) == 51);
+    CHECK(histogram.GetQuantileNs(1.0) == UINT64_MAX / 2);
+}
@@ -0,0 +1,99 @@
+#include "test.h"
+
+// The elected writer and its pipe exist only on Windows
+#ifdef _WIN32
+
+#include "win32pipe.h"
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static std::atomic<int> receivedPlays(0);
+static std::atomic<bool> acceptPlays(true);
+static char receivedTitle[64];
+
+static bool ReceivePlay(const PlayEvent& event) {
+    if (!acceptPlays.load()) return false;
+    snprintf(receivedTitle, sizeof(receivedTitle), "%s", event.GetText(PlayTitle));
+    receivedPlays++;
+    return true;
+}
+
+static void MakePlay(const char* title, PlayEvent& event) {
+    event.Clear();
+    event.playedAtMs = 1709280000000LL;
+    event.durationMs = 180000;
+    event.SetText(PlayFilepath, "C:\\Music\\song.mp3");
+    event.SetText(PlayTitle, title);
+}
+
+// Wait up to timeoutMs for the pipe to own its database
+static bool WaitForOwner(const SharedWriterPipe& pipe, int timeoutMs) {
+    for (int waited = 0; !pipe.IsOwner() && waited < timeoutMs; waited += 50) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return pipe.IsOwner();
+}
+
+TEST(pipe, elects_one_owner_and_forwards_plays) {
+    receivedPlays = 0;
+    acceptPlays = true;
+    std::string dbPath = GetTestPath("pipe-forward.db");
+    SharedWriterPipe first;
+    SharedWriterPipe second;
+    CHECK(first.Start(dbPath.c_str(), ReceivePlay));
+    CHECK(first.IsOwner());
+    
+    // The same database, however its path is cased, has its one owner
+    std::string upperPath = dbPath;
+    for (char& c : upperPath) c = (char)toupper((unsigned char)c);
+    CHECK(second.Start(upperPath.c_str(), ReceivePlay));
+    CHECK(!second.IsOwner());
+    
+    PlayEvent event;
+    MakePlay("Forwarded", event);
+    CHECK(second.Forward(event));
+    CHECK(receivedPlays == 1);
+    CHECK(strcmp(receivedTitle, "Forwarded") == 0);
+    
+    // A play the owner can't make durable is refused, to stay spooled
+    acceptPlays = false;
+    CHECK(!second.Forward(event));
+    CHECK(receivedPlays == 1);
+    acceptPlays = true;
+    
+    second.Stop();
+    first.Stop();
+}
+
+TEST(pipe, hands_over_when_the_owner_stops) {
+    receivedPlays = 0;
+    acceptPlays = true;
+    std::string dbPath = GetTestPath("pipe-handover.db");
+    SharedWriterPipe first;
+    SharedWriterPipe second;
+    CHECK(first.Start(dbPath.c_str(), ReceivePlay));
+    CHECK(second.Start(dbPath.c_str(), ReceivePlay));
+    CHECK(first.IsOwner() && !second.IsOwner());
+    
+    // The other instance is elected at its next try, and takes plays
+    first.Stop();
+    CHECK(WaitForOwner(second, 5000));
+    
+    PlayEvent event;
+    MakePlay("After", event);
+    SharedWriterPipe third;
+    CHECK(third.Start(dbPath.c_str(), ReceivePlay));
+    CHECK(!third.IsOwner());
+    CHECK(third.Forward(event));
+    CHECK(receivedPlays == 1);
+    CHECK(strcmp(receivedTitle, "After") == 0);
+    third.Stop();
+    second.Stop();
+}
+
+#endif // _WIN32
@@ -0,0 +1,61 @@
+#include "test.h"
+#include "pollschedule.h"
+
+// Follow the schedule through one play of lengthMs from startMs, as the
+// plugin would; true if a poll saw 90% or more of it and the first poll
+// past its end came within the first 5% of the next play
+static bool PollsThroughEnd(PollScheduler& scheduler, int lengthMs, int startMs) {
+    bool sawEnd = false;
+    int64_t positionMs = startMs;
+    while (positionMs < lengthMs) {
+        if (positionMs * 100 >= (int64_t)lengthMs * 90) sawEnd = true;
+        positionMs += scheduler.Next(false, (int)positionMs, lengthMs);
+    }
+    return sawEnd && (positionMs - lengthMs) * 100 < (int64_t)lengthMs * 5;
+}
+
+TEST(pollschedule, sees_the_end_of_every_length) {
+    PollScheduler scheduler;
+    for (int lengthMs = 150; lengthMs <= 10000; lengthMs += 7) {
+        for (int startMs = 0; startMs < lengthMs; startMs += lengthMs / 13 + 1) {
+            CHECK(PollsThroughEnd(scheduler, lengthMs, startMs));
+        }
+    }
+    CHECK(PollsThroughEnd(scheduler, 3 * 60 * 1000, 0));
+    CHECK(PollsThroughEnd(scheduler, 7 * 60 * 1000, 12345));
+}
+
+TEST(pollschedule, wakes_as_the_track_ends) {
+    PollScheduler scheduler;
+    
+    // Not minMs past the end: a stop or skip then could hide the next play
+    CHECK(scheduler.Next(false, 179600, 180000) == 400);
+    CHECK(scheduler.Next(false, 179950, 180000) == 50);
+    CHECK(scheduler.Next(false, 1900, 2000) == 100);
+    CHECK(scheduler.Next(false, 1980, 2000) == 20);
+    
+    // Still there at (or past) its end: look again soon
+    CHECK(scheduler.Next(false, 180000, 180000) == 100);
+    CHECK(scheduler.Next(false, 180300, 180000) == 100);
+}
+
+TEST(pollschedule, backs_off_elsewhere) {
+    PollScheduler scheduler;
+    CHECK(scheduler.Next(true, 0, 0) == 2000);
+    CHECK(scheduler.Next(false, 1000, 0) == 500);
+    CHECK(scheduler.Next(false, -1, 180000) == 500);
+    CHECK(scheduler.Next(false, 1000, 180000) == 2000);
+    CHECK(scheduler.Next(false, 165000, 180000) == 600);
+    CHECK(scheduler.Next(false, 170000, 180000) == 500);
+    CHECK(scheduler.GetDecisions(PollReasonIdle) == 1);
+    CHECK(scheduler.GetDecisions(PollReasonNoLength) == 2);
+    CHECK(scheduler.GetDecisions(PollReasonMidTrack) == 2);
+    CHECK(scheduler.GetDecisions(PollReasonTrackEnd) == 1);
+    
+    // Bounds are kept in order
+    PollScheduleConfig config = { 0, 50, 10, 0 };
+    scheduler.SetConfig(config);
+    CHECK(scheduler.GetConfig().minMs == 1);
+    CHECK(scheduler.GetConfig().midTrackMs == 50);
+    CHECK(scheduler.GetConfig().idleMs == 1);
+}
@@ -0,0 +1,124 @@
+#include "test.h"
+#include "ringbuffer.h"
+#include <atomic>
+#include <thread>
+
+TEST(ringbuffer, keeps_order) {
+    SpscRingBuffer<int, 8> ring;
+    int item = 0;
+    CHECK(ring.Empty());
+    CHECK(!ring.Pop(item));
+    
+    // Several laps, so the indices wrap
+    for (int lap = 0; lap < 5; lap++) {
+        for (int i = 0; i < 6; i++) CHECK(ring.Push(lap * 10 + i));
+        CHECK(ring.Size() == 6);
+        for (int i = 0; i < 6; i++) {
+            CHECK(ring.Pop(item));
+            CHECK(item == lap * 10 + i);
+        }
+    }
+    CHECK(ring.Empty());
+}
+
+TEST(ringbuffer, drops_newest_when_full) {
+    SpscRingBuffer<int, 4> ring(OverflowDropNewest);
+    for (int i = 0; i < 4; i++) CHECK(ring.Push(i));
+    CHECK(!ring.Push(4));
+    CHECK(!ring.Push(5));
+    CHECK(ring.GetDroppedNewest() == 2);
+    CHECK(ring.GetDroppedOldest() == 0);
+    
+    int item = 0;
+    for (int i = 0; i < 4; i++) {
+        CHECK(ring.Pop(item));
+        CHECK(item == i);
+    }
+    CHECK(!ring.Pop(item));
+}
+
+TEST(ringbuffer, drops_oldest_when_full) {
+    SpscRingBuffer<int, 4> ring(OverflowDropOldest);
+    for (int i = 0; i < 7; i++) CHECK(ring.Push(i));
+    CHECK(ring.GetDroppedOldest() == 3);
+    CHECK(ring.GetDroppedNewest() == 0);
+    CHECK(ring.Size() == 4);
+    
+    int item = 0;
+    for (int i = 3; i < 7; i++) {
+        CHECK(ring.Pop(item));
+        CHECK(item == i);
+    }
+    CHECK(ring.Empty());
+}
+
+// An item large enough that a copy racing with an overwrite would show up
+// as words from two different items
+struct WideItem {
+    size_t words[32];
+};
+
+// Push count numbered items from another thread while this one pops them,
+// checking each arrives whole and after the one before it. Returns how
+// many arrived.
+static size_t RunTwoThreads(SpscRingBuffer<WideItem, 16>& ring, size_t count, bool& ordered, bool& whole) {
+    std::atomic<bool> producing(true);
+    std::thread producer([&] {
+        WideItem item;
+        for (size_t i = 1; i <= count; i++) {
+            for (size_t& word : item.words) word = i;
+            ring.Push(item);
+        }
+        producing.store(false, std::memory_order_release);
+    });
+    
+    size_t received = 0;
+    size_t last = 0;
+    ordered = true;
+    whole = true;
+    WideItem item;
+    for (;;) {
+        bool done = !producing.load(std::memory_order_acquire);
+        if (!ring.Pop(item)) {
+            if (done) break;
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t word : item.words) {
+            if (word != item.words[0]) whole = false;
+        }
+        if (item.words[0] <= last) ordered = false;
+        last = item.words[0];
+        received++;
+    }
+    producer.join();
+    return received;
+}
+
+TEST(ringbuffer, two_threads_drop_newest) {
+    SpscRingBuffer<WideItem, 16> ring(OverflowDropNewest);
+    bool ordered, whole;
+    size_t received = RunTwoThreads(ring, 200000, ordered, whole);
+    CHECK(ordered);
+    CHECK(whole);
+    CHECK(received + ring.GetDroppedNewest() == 200000);
+}
+
+TEST(ringbuffer, two_threads_drop_oldest) {
+    SpscRingBuffer<WideItem, 16> ring(OverflowDropOldest);
+    bool ordered, whole;
+    size_t received = RunTwoThreads(ring, 200000, ordered, whole);
+    CHECK(ordered);
+    CHECK(whole);
+    CHECK(received + ring.GetDroppedOldest() == 200000);
+    CHECK(ring.GetDroppedNewest() == 0);
+}
+
+TEST(ringbuffer, two_threads_block) {
+    SpscRingBuffer<WideItem, 16> ring(OverflowBlock);
+    bool ordered, whole;
+    size_t received = RunTwoThreads(ring, 200000, ordered, whole);
+    CHECK(ordered);
+    CHECK(whole);
+    CHECK(received == 200000);
+}
@@ -0,0 +1,287 @@
+#include "test.h"
+#include "schema.h"
+#include <string>
+
+static bool Exec(sqlite3* db, const char* sql) {
+    return sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+static int64_t QueryInt(sqlite3* db, const char* sql) {
+    int64_t value = -1;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+static std::string QueryText(sqlite3* db, const char* sql) {
+    std::string value;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+            value = (const char*)sqlite3_column_text(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+static sqlite3* OpenTestDatabase(const char* name) {
+    sqlite3* db = NULL;
+    std::string path = GetTestPath(name);
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+// The original table, from before schema versions
+static const char* flatV0SQL =
+    "CREATE TABLE play_history ("
+    "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "    played_at TEXT NOT NULL,"
+    "    filepath TEXT, filename TEXT, title TEXT, artist TEXT, album TEXT, genre TEXT,"
+    "    track_number TEXT, year TEXT, duration_ms INTEGER"
+    ");"
+    "CREATE INDEX idx_played_at ON play_history(played_at);"
+    "INSERT INTO play_history(played_at, filepath, filename, title, artist, duration_ms) VALUES"
+    "    ('2024-03-01 08:00:00', 'C:\\a.mp3', 'a.mp3', 'A', 'Artist 1', 1000),"
+    "    ('2024-03-01 09:30:00', 'C:\\b.mp3', 'b.mp3', 'B', 'Artist 1', 2000),"
+    "    ('2024-07-15 23:59:59', 'C:\\c.mp3', 'c.mp3', 'C', 'Artist 2', 3000);";
+
+// The first normalized layout, also with local time text
+static const char* normalizedV0SQL =
+    "CREATE TABLE artists (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE);"
+    "CREATE TABLE albums (id INTEGER PRIMARY KEY, artist_id INTEGER NOT NULL, name TEXT NOT NULL, UNIQUE(artist_id, name));"
+    "CREATE TABLE genres (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE);"
+    "CREATE TABLE files (id INTEGER PRIMARY KEY, filepath TEXT NOT NULL UNIQUE, filename TEXT NOT NULL);"
+    "CREATE TABLE tracks (id INTEGER PRIMARY KEY, file_id INTEGER NOT NULL, title TEXT NOT NULL,"
+    "    artist_id INTEGER NOT NULL, album_id INTEGER NOT NULL, genre_id INTEGER NOT NULL,"
+    "    track_number TEXT NOT NULL, year TEXT NOT NULL,"
+    "    UNIQUE(file_id, title, artist_id, album_id, genre_id, track_number, year));"
+    "CREATE TABLE plays (id INTEGER PRIMARY KEY AUTOINCREMENT, played_at TEXT NOT NULL,"
+    "    track_id INTEGER NOT NULL, duration_ms INTEGER);"
+    "CREATE INDEX idx_plays_played_at ON plays(played_at);"
+    "CREATE INDEX idx_plays_track ON plays(track_id);"
+    "CREATE VIEW play_history AS"
+    "    SELECT p.id AS id, p.played_at AS played_at, f.filepath AS filepath, t.title AS title, ar.name AS artist"
+    "    FROM plays p JOIN tracks t ON t.id = p.track_id JOIN files f ON f.id = t.file_id"
+    "    JOIN artists ar ON ar.id = t.artist_id;"
+    "INSERT INTO artists VALUES (1, 'Artist 1');"
+    "INSERT INTO albums VALUES (1, 1, '');"
+    "INSERT INTO genres VALUES (1, '');"
+    "INSERT INTO files VALUES (1, 'C:\\a.mp3', 'a.mp3');"
+    "INSERT INTO tracks VALUES (1, 1, 'A', 1, 1, 1, '', '');"
+    "INSERT INTO plays(id, played_at, track_id, duration_ms) VALUES"
+    "    (5, '2024-03-01 08:00:00', 1, 1000),"
+    "    (9, '2024-03-01 09:30:00', 1, 2000);";
+
+TEST(schema, creates_current_version) {
+    sqlite3* db = OpenTestDatabase("new.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(CreateSchema(db, false));
+    CHECK(GetSchemaLayout(db) == SchemaFlat);
+    CHECK(QueryInt(db, "PRAGMA user_version;") == 4);
+    CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, utc_offset_min, title, artist, duration_ms, source)"
+                   "    VALUES (1709280000000, 60, 'A', 'Artist', 5000, 'kitchen');"));
+    CHECK(QueryText(db, "SELECT played_at FROM play_history;") == "2024-03-01 09:00:00");
+    CHECK(QueryInt(db, "SELECT plays FROM rollup_tracks WHERE artist = 'Artist' AND title = 'A';") == 1);
+    
+    // Opening again leaves it as it is
+    CHECK(CreateSchema(db, false));
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM play_history;") == 1);
+    sqlite3_close(db);
+}
+
+TEST(schema, upgrades_flat_version_0) {
+    sqlite3* db = OpenTestDatabase("flat-v0.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, flatV0SQL));
+    CHECK(CreateSchema(db, false));
+    CHECK(QueryInt(db, "PRAGMA user_version;") == 4);
+    
+    // Same plays, ids and local times, now with integer timestamps
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM play_history;") == 3);
+    CHECK(QueryText(db, "SELECT played_at FROM play_history WHERE id = 3;") == "2024-07-15 23:59:59");
+    CHECK(QueryText(db, "SELECT group_concat(title, '') FROM (SELECT title FROM play_history ORDER BY played_at_ms);") == "ABC");
+    CHECK(QueryInt(db, "SELECT played_at_ms FROM play_history WHERE id = 2;") -
+          QueryInt(db, "SELECT played_at_ms FROM play_history WHERE id = 1;") == 5400000);
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = 'idx_played_at';") == 0);
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = 'idx_play_stats';") == 1);
+    
+    // Later columns and the rollups of the existing plays
+    CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, title, source) VALUES (0, 'D', 'zone');"));
+    CHECK(QueryInt(db, "SELECT SUM(plays) FROM rollup_days;") == 4);
+    CHECK(QueryInt(db, "SELECT plays FROM rollup_tracks WHERE artist = 'Artist 1' AND title = 'B';") == 1);
+    CHECK(QueryInt(db, "SELECT play_ms FROM rollup_tracks WHERE artist = 'Artist 2';") == 3000);
+    sqlite3_close(db);
+}
+
+TEST(schema, upgrades_normalized_version_0) {
+    sqlite3* db = OpenTestDatabase("normalized-v0.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, normalizedV0SQL));
+    CHECK(GetSchemaLayout(db) == SchemaNormalized);
+    CHECK(CreateSchema(db, true));
+    CHECK(QueryInt(db, "PRAGMA user_version;") == 4);
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM play_history;") == 2);
+    CHECK(QueryText(db, "SELECT played_at FROM play_history WHERE id = 9;") == "2024-03-01 09:30:00");
+    CHECK(QueryText(db, "SELECT filepath FROM play_history WHERE id = 5;") == "C:\\a.mp3");
+    CHECK(QueryInt(db, "SELECT plays FROM rollup_tracks WHERE title = 'A';") == 2);
+    
+    // Writers of the legacy text still work through the view
+    CHECK(Exec(db, "INSERT INTO play_history(played_at, filepath, title, artist, source)"
+                   "    VALUES ('2024-03-02 10:00:00', 'C:\\b.mp3', 'B', 'Artist 1', 'zone');"));
+    CHECK(QueryText(db, "SELECT played_at FROM play_history WHERE title = 'B';") == "2024-03-02 10:00:00");
+    CHECK(QueryText(db, "SELECT source FROM play_history WHERE title = 'B';") == "zone");
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM play_history WHERE id > 9;") == 1);
+    sqlite3_close(db);
+}
+
+TEST(schema, migrates_flat_to_normalized) {
+    sqlite3* db = OpenTestDatabase("migrate.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, flatV0SQL));
+    CHECK(CreateSchema(db, false));
+    CHECK(Exec(db, "DELETE FROM play_history WHERE id = 2;"));
+    CHECK(CreateSchema(db, true));
+    CHECK(GetSchemaLayout(db) == SchemaNormalized);
+    
+    // Ids, text and times are kept; the rollups are rebuilt from the plays
+    CHECK(QueryText(db, "SELECT group_concat(id || title, ',') FROM (SELECT id, title FROM play_history ORDER BY id);") == "1A,3C");
+    CHECK(QueryText(db, "SELECT played_at FROM play_history WHERE id = 1;") == "2024-03-01 08:00:00");
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM artists WHERE name IN ('Artist 1', 'Artist 2');") == 2);
+    CHECK(QueryInt(db, "SELECT SUM(plays) FROM rollup_days;") == 2);
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = 'play_history_flat';") == 0);
+    sqlite3_close(db);
+}
+
+TEST(schema, never_reuses_ids_of_deleted_plays) {
+    // The last play deleted before each rebuild
+    sqlite3* db = OpenTestDatabase("ids-flat.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, flatV0SQL));
+    CHECK(Exec(db, "DELETE FROM play_history WHERE id = 3;"));
+    CHECK(CreateSchema(db, false));
+    CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, title) VALUES (0, 'D');"));
+    CHECK(QueryInt(db, "SELECT id FROM play_history WHERE title = 'D';") == 4);
+    
+    CHECK(Exec(db, "DELETE FROM play_history WHERE id = 4;"));
+    CHECK(CreateSchema(db, true));
+    CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, title) VALUES (0, 'E');"));
+    CHECK(QueryInt(db, "SELECT id FROM play_history WHERE title = 'E';") == 5);
+    sqlite3_close(db);
+    
+    db = OpenTestDatabase("ids-normalized.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, normalizedV0SQL));
+    CHECK(Exec(db, "DELETE FROM plays WHERE id = 9;"));
+    CHECK(CreateSchema(db, true));
+    CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, title) VALUES (0, 'B');"));
+    CHECK(QueryInt(db, "SELECT id FROM play_history WHERE title = 'B';") == 10);
+    sqlite3_close(db);
+}
+
+TEST(schema, refuses_legacy_text_in_the_flat_table) {
+    sqlite3* db = OpenTestDatabase("legacy-flat.db");
+    CHECK(db != NULL);
+    if (!db) return;
+    CHECK(Exec(db, flatV0SQL));
+    CHECK(CreateSchema(db, false));
+    
+    // played_at is generated, so writers must give played_at_ms instead
+    // (or use the normalized layout, whose view still takes the text)
+    CHECK(!Exec(db, "INSERT INTO play_history(played_at, title) VALUES ('2024-03-02 10:00:00', 'D');"));
+    CHECK(QueryInt(db, "SELECT COUNT(*) FROM play_history;") == 3);
+    sqlite3_close(db);
+}
+
+// Rows of the rollups that differ from those grouped from play_history
+// itself (in either direction), with the artists of the normalized layout
+// by name
+static int64_t CountRollupDifferences(sqlite3* db) {
+    bool normalized = GetSchemaLayout(db) == SchemaNormalized;
+    std::string day = "(played_at_ms / 1000 + utc_offset_min * 60) / 86400";
+    std::string sums = "COUNT(*), SUM(COALESCE(duration_ms, 0)) FROM play_history";
+    const std::string pairs[3][2] = {
+        { "SELECT day, plays, play_ms FROM rollup_days",
+          "SELECT " + day + ", " + sums + " GROUP BY 1" },
+        { normalized ? "SELECT r.day, a.name, r.plays, r.play_ms FROM rollup_artist_days r JOIN artists a ON a.id = r.artist_id"
+                     : "SELECT day, artist, plays, play_ms FROM rollup_artist_days",
+          "SELECT " + day + ", COALESCE(artist, ''), " + sums + " GROUP BY 1, 2" },
+        { normalized ? "SELECT a.name, r.title, r.plays, r.play_ms FROM rollup_tracks r JOIN artists a ON a.id = r.artist_id"
+                     : "SELECT artist, title, plays, play_ms FROM rollup_tracks",
+          "SELECT COALESCE(artist, ''), COALESCE(title, ''), " + sums + " GROUP BY 1, 2" }
+    };
+    int64_t differences = 0;
+    for (const auto& pair : pairs) {
+        std::string sql = "SELECT (SELECT COUNT(*) FROM (" + pair[0] + " EXCEPT " + pair[1] + ")) + "
+                          "(SELECT COUNT(*) FROM (" + pair[1] + " EXCEPT " + pair[0] + "));";
+        int64_t count = QueryInt(db, sql.c_str());
+        differences += count < 0 ? 1 : count;
+    }
+    return differences;
+}
+
+// Plays on either side of local midnight, without an artist or a length,
+// and the same track again
+static const char* rollupPlaysSQL =
+    "INSERT INTO play_history(played_at_ms, utc_offset_min, filepath, filename, title, artist, album, duration_ms) VALUES"
+    "    (1709247000000, 60, 'C:\\a.mp3', 'a.mp3', 'A', 'Artist 1', 'One', 1000),"
+    "    (1709251200000, 60, 'C:\\a.mp3', 'a.mp3', 'A', 'Artist 1', 'One', 1000),"
+    "    (1709251200000, -300, 'C:\\b.mp3', 'b.mp3', 'B', 'Artist 2', 'Two', 2000),"
+    "    (1709290000000, 60, 'C:\\c.mp3', 'c.mp3', 'C', NULL, NULL, NULL),"
+    "    (1709300000000, 0, 'C:\\d.mp3', 'd.mp3', 'D', 'Artist 2', 'Two', 4000);";
+
+// Staged plays for ImportStagedPlays: one already in the history, new ones
+// on a day it has and on one it doesn't
+static const char* rollupImportSQL =
+    "INSERT INTO temp.play_import(played_at_ms, filepath, title, utc_offset_min, filename, artist, album, duration_ms) VALUES"
+    "    (1709251200000, 'C:\\a.mp3', 'A', 60, 'a.mp3', 'Artist 1', 'One', 1000),"
+    "    (1709252000000, 'C:\\b.mp3', 'B', 60, 'b.mp3', 'Artist 2', 'Two', 2500),"
+    "    (1709262000000, 'C:\\e.mp3', 'E', 60, 'e.mp3', NULL, NULL, 500),"
+    "    (1712000000000, 'C:\\a.mp3', 'A', 120, 'a.mp3', 'Artist 1', 'One', NULL),"
+    "    (1712000300000, '', 'Stream', 120, NULL, 'Artist 3', NULL, 0);";
+
+TEST(schema, keeps_rollups_equal_to_the_plays) {
+    const char* names[] = { "rollups-flat.db", "rollups-normalized.db" };
+    for (int normalized = 0; normalized < 2; normalized++) {
+        sqlite3* db = OpenTestDatabase(names[normalized]);
+        CHECK(db != NULL);
+        if (!db) return;
+        
+        // Through the table's trigger, or the view's INSTEAD OF trigger
+        CHECK(CreateSchema(db, normalized != 0));
+        CHECK(Exec(db, rollupPlaysSQL));
+        CHECK(QueryInt(db, "SELECT SUM(plays) FROM rollup_days;") == 5);
+        CHECK(QueryInt(db, "SELECT COUNT(*) FROM rollup_days;") == 2);
+        CHECK(CountRollupDifferences(db) == 0);
+        
+        // The rollups merged in bulk after an import
+        uint64_t imported = 0;
+        uint64_t known = 0;
+        CHECK(CreateImportTable(db));
+        CHECK(Exec(db, rollupImportSQL));
+        CHECK(ImportStagedPlays(db, imported, known));
+        CHECK(imported == 4);
+        CHECK(known == 1);
+        CHECK(QueryInt(db, "SELECT SUM(plays) FROM rollup_days;") == 9);
+        CHECK(CountRollupDifferences(db) == 0);
+        
+        // And the triggers are back for plays after it
+        CHECK(Exec(db, "INSERT INTO play_history(played_at_ms, utc_offset_min, title, artist, duration_ms)"
+                       "    VALUES (1712000600000, 120, 'F', 'Artist 3', 700);"));
+        CHECK(CountRollupDifferences(db) == 0);
+        CHECK(QueryInt(db, "SELECT SUM(plays) FROM rollup_days;") == 10);
+        sqlite3_close(db);
+    }
+}
@@ -0,0 +1,182 @@
+#include "test.h"
+#include "spool.h"
+#include "util.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::vector<std::string> replayed;
+static int failAfter = -1;
+
+static bool CollectTitle(const PlayEvent& event) {
+    if (failAfter >= 0 && (int)replayed.size() >= failAfter) return false;
+    replayed.push_back(event.GetText(PlayTitle));
+    return true;
+}
+
+static void MakePlay(int i, PlayEvent& event) {
+    char title[32];
+    snprintf(title, sizeof(title), "Song %d", i);
+    event.Clear();
+    event.playedAtMs = 1735689600000LL + i * 1000;
+    event.utcOffsetMin = 60;
+    event.durationMs = 180000;
+    event.SetText(PlayFilepath, "C:\\Music\\song.mp3");
+    event.SetText(PlayFilename, "song.mp3");
+    event.SetText(PlayTitle, title);
+    event.SetText(PlayArtist, "Artist");
+}
+
+// Replay a spool into replayed
+static bool ReplaySpool(PlaySpool& spool) {
+    replayed.clear();
+    failAfter = -1;
+    return spool.Replay(CollectTitle);
+}
+
+TEST(spool, encodes_every_field) {
+    PlayEvent event, decoded;
+    MakePlay(7, event);
+    event.SetText(PlayAlbum, "Album");
+    event.SetText(PlayGenre, "Genre");
+    event.SetText(PlayTrackNumber, "3");
+    event.SetText(PlayYear, "1999");
+    event.SetText(PlaySource, "kitchen");
+    
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    size_t size = EncodePlayRecord(event, record);
+    CHECK(DecodePlayRecord(record, size, decoded));
+    CHECK(decoded.playedAtMs == event.playedAtMs);
+    CHECK(decoded.utcOffsetMin == 60);
+    CHECK(decoded.durationMs == 180000);
+    for (int field = 0; field < PlayFieldCount; field++) {
+        CHECK(strcmp(decoded.GetText((PlayField)field), event.GetText((PlayField)field)) == 0);
+    }
+    
+    // Any damage is caught by the checksum or the size
+    record[size / 2] ^= 1;
+    CHECK(!DecodePlayRecord(record, size, decoded));
+    record[size / 2] ^= 1;
+    CHECK(!DecodePlayRecord(record, size - 1, decoded));
+}
+
+TEST(spool, replays_in_order_after_reopening) {
+    std::string path = GetTestPath("order.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    PlayEvent event;
+    for (int i = 0; i < 100; i++) {
+        MakePlay(i, event);
+        CHECK(spool.Append(event));
+    }
+    CHECK(spool.GetRecordCount() == 100);
+    spool.Close();
+    
+    CHECK(spool.Open(path.c_str()));
+    CHECK(spool.GetRecordCount() == 100);
+    CHECK(ReplaySpool(spool));
+    CHECK(replayed.size() == 100);
+    CHECK(replayed.size() == 100 && replayed[0] == "Song 0" && replayed[99] == "Song 99");
+}
+
+TEST(spool, clear_empties_it) {
+    std::string path = GetTestPath("clear.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    PlayEvent event;
+    MakePlay(1, event);
+    CHECK(spool.Append(event));
+    CHECK(spool.Clear());
+    CHECK(spool.GetRecordCount() == 0);
+    CHECK(ReplaySpool(spool));
+    CHECK(replayed.empty());
+    
+    // Still usable afterwards
+    MakePlay(2, event);
+    CHECK(spool.Append(event));
+    spool.Close();
+    CHECK(spool.Open(path.c_str()));
+    CHECK(spool.GetRecordCount() == 1);
+}
+
+TEST(spool, failed_replay_leaves_it) {
+    std::string path = GetTestPath("failed.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    PlayEvent event;
+    for (int i = 0; i < 5; i++) {
+        MakePlay(i, event);
+        CHECK(spool.Append(event));
+    }
+    replayed.clear();
+    failAfter = 2;
+    CHECK(!spool.Replay(CollectTitle));
+    CHECK(replayed.size() == 2);
+    CHECK(spool.GetRecordCount() == 5);
+    CHECK(ReplaySpool(spool));
+    CHECK(replayed.size() == 5);
+}
+
+TEST(spool, skips_damaged_records) {
+    std::string path = GetTestPath("damaged.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    PlayEvent event;
+    for (int i = 0; i < 3; i++) {
+        MakePlay(i, event);
+        CHECK(spool.Append(event));
+    }
+    spool.Close();
+    
+    // Damage the middle record, and leave a torn record at the end, as a
+    // crash during a write would
+    FILE* file = OpenFile(path.c_str(), "r+b");
+    CHECK(file != NULL);
+    if (!file) return;
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    size_t size = EncodePlayRecord(event, record);
+    fseek(file, (long)(size + size / 2), SEEK_SET);
+    fputc(0xFF, file);
+    fseek(file, 0, SEEK_END);
+    fwrite(record, 1, size / 2, file);
+    fclose(file);
+    
+    CHECK(spool.Open(path.c_str()));
+    CHECK(spool.GetRecordCount() == 2);
+    CHECK(spool.GetDamagedBytes() > 0);
+    CHECK(ReplaySpool(spool));
+    CHECK(replayed.size() == 2 && replayed[0] == "Song 0" && replayed[1] == "Song 2");
+}
+
+TEST(spool, reads_records_across_buffer_refills) {
+    std::string path = GetTestPath("large.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    
+    // Records of about 5 KB, so the file is many times the read buffer and
+    // records straddle every refill
+    std::string album(5000, 'x');
+    PlayEvent event;
+    for (int i = 0; i < 60; i++) {
+        MakePlay(i, event);
+        event.SetText(PlayAlbum, album.c_str());
+        CHECK(spool.Append(event));
+    }
+    spool.Close();
+    
+    // Damage one record in the middle of the file
+    FILE* file = OpenFile(path.c_str(), "r+b");
+    CHECK(file != NULL);
+    if (!file) return;
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    size_t size = EncodePlayRecord(event, record);
+    fseek(file, (long)(size * 30 + 100), SEEK_SET);
+    fputc(0xFF, file);
+    fclose(file);
+    
+    CHECK(spool.Open(path.c_str()));
+    CHECK(spool.GetRecordCount() == 59);
+    CHECK(spool.GetDamagedBytes() == size);
+    CHECK(ReplaySpool(spool));
+    CHECK(replayed.size() == 59 && replayed[29] == "Song 29" && replayed[30] == "Song 31" && replayed[58] == "Song 59");
+}
@@ -0,0 +1,53 @@
+#include "test.h"
+#include "schema.h"
+#include "stats.h"
+#include <cstring>
+#include <string>
+
+// A new, empty history in the given layout
+static std::string CreateHistory(const char* name, bool normalized) {
+    std::string path = GetTestPath(name);
+    sqlite3* db = NULL;
+    bool created = sqlite3_open(path.c_str(), &db) == SQLITE_OK && CreateSchema(db, normalized);
+    sqlite3_close(db);
+    return created ? path : std::string();
+}
+
+static bool Exec(const std::string& path, const char* sql) {
+    sqlite3* db = NULL;
+    bool ok = sqlite3_open(path.c_str(), &db) == SQLITE_OK && sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_close(db);
+    return ok;
+}
+
+// Whether every statistics query reads plays only through a covering index
+static bool PlansCovered(const std::string& path, std::string& report) {
+    PlayStats stats;
+    bool covered = stats.Open(path.c_str()) && stats.CheckQueryPlans(report);
+    stats.Close();
+    return covered;
+}
+
+TEST(stats, reads_flat_plays_through_the_covering_index) {
+    std::string path = CreateHistory("plans-flat.db", false);
+    CHECK(!path.empty());
+    std::string report;
+    CHECK(PlansCovered(path, report));
+    CHECK(strstr(report.c_str(), "top artists (rollup):") != NULL);
+    CHECK(strstr(report.c_str(), "\n! ") == NULL);
+    
+    // Without it, the check must fail
+    CHECK(Exec(path, "DROP INDEX idx_play_stats;"));
+    CHECK(!PlansCovered(path, report));
+    CHECK(strstr(report.c_str(), "\n! ") != NULL);
+}
+
+TEST(stats, reads_normalized_plays_through_the_covering_index) {
+    std::string path = CreateHistory("plans-normalized.db", true);
+    CHECK(!path.empty());
+    std::string report;
+    CHECK(PlansCovered(path, report));
+    
+    CHECK(Exec(path, "DROP INDEX idx_plays_stats;"));
+    CHECK(!PlansCovered(path, report));
+}
@@ -0,0 +1,33 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <string>
+
+// Minimal harness for the core's tests. Each TEST registers itself under a
+// suite; winnp-tests runs the suites named on its command line (all of
+// them by default), and CTest runs each suite as a test of its own.
+
+typedef void (*TestProc)();
+
+struct TestRegistration {
+    TestRegistration(const char* suite, const char* name, TestProc proc);
+};
+
+// Record a failed check; the test carries on
+void FailTest(const char* file, int line, const char* expression);
+
+// A path in this run's scratch directory (removed when the run ends); any
+// file already there is deleted
+std::string GetTestPath(const char* name);
+
+#define TEST(suite, name) \
+    static void suite##_##name(); \
+    static TestRegistration suite##_##name##_registration(#suite, #name, suite##_##name); \
+    static void suite##_##name()
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) FailTest(__FILE__, __LINE__, #expression); \
+    } while (0)
+
+#endif // TEST_H
@@ -0,0 +1,155 @@
+#include "test.h"
+#include "simplayer.h"
+#include "tracker.h"
+#include <cstring>
+
+static int loggedPlays = 0;
+static PlayEvent lastPlay;
+
+static bool CollectPlay(const PlayEvent& event) {
+    loggedPlays++;
+    lastPlay = event;
+    return true;
+}
+
+static SimTrack MakeTrack(const char* filepath, const char* title, const char* artist, int lengthMs) {
+    SimTrack track;
+    track.filepath = filepath;
+    track.title = title;
+    track.artist = artist;
+    track.album = "Album";
+    track.genre = "Genre";
+    track.trackNumber = "1";
+    track.year = "2001";
+    track.lengthMs = lengthMs;
+    return track;
+}
+
+// A tracker over a simulated player with three 60 s tracks
+struct TrackerFixture {
+    ManualClock clock;
+    SimulatedPlayerSource player;
+    TrackTracker tracker;
+    
+    TrackerFixture() : clock(1735689600), player(clock), tracker(player, clock, CollectPlay) {
+        loggedPlays = 0;
+        player.AddTrack(MakeTrack("C:\\Music\\a.mp3", "Song A", "Artist A", 60000));
+        player.AddTrack(MakeTrack("C:\\Music\\b.mp3", "Song B", "Artist B", 60000));
+        player.AddTrack(MakeTrack("C:\\Music\\c.mp3", "Song C", "Artist C", 60000));
+    }
+    
+    // Let time pass, ticking every tickMs (a multiple of 500 ms)
+    void Run(uint64_t ms, uint64_t tickMs = 500) {
+        for (uint64_t elapsed = 500; elapsed <= ms; elapsed += 500) {
+            clock.Advance(500);
+            player.DeliverEvents();
+            if (elapsed % tickMs == 0) tracker.Tick();
+        }
+    }
+    
+    // Pass on notifications as the plugin does, ticking right away
+    static void OnPlayerEvent(PlayerEvent event, void* context) {
+        TrackTracker* tracker = (TrackTracker*)context;
+        tracker->NotifyPlayerEvent(event);
+        tracker->Tick();
+    }
+};
+
+TEST(tracker, logs_each_track_once) {
+    TrackerFixture f;
+    f.player.Play(0);
+    f.Run(30000);
+    CHECK(loggedPlays == 1);
+    CHECK(strcmp(lastPlay.GetText(PlayFilepath), "C:\\Music\\a.mp3") == 0);
+    CHECK(strcmp(lastPlay.GetText(PlayFilename), "a.mp3") == 0);
+    CHECK(strcmp(lastPlay.GetText(PlayTitle), "Song A") == 0);
+    CHECK(strcmp(lastPlay.GetText(PlayArtist), "Artist A") == 0);
+    CHECK(strcmp(lastPlay.GetText(PlayYear), "2001") == 0);
+    CHECK(lastPlay.durationMs == 60000);
+    CHECK(lastPlay.playedAtMs == 1735689600000LL + 500);
+}
+
+TEST(tracker, logs_track_changes) {
+    TrackerFixture f;
+    f.player.Play(0);
+    f.Run(10000);
+    f.player.Next();
+    f.Run(10000);
+    CHECK(loggedPlays == 2);
+    CHECK(strcmp(lastPlay.GetText(PlayTitle), "Song B") == 0);
+    
+    // Running off the end of a track starts the next one
+    f.Run(60000);
+    CHECK(loggedPlays == 3);
+    CHECK(strcmp(lastPlay.GetText(PlayTitle), "Song C") == 0);
+}
+
+TEST(tracker, ignores_pause_and_seek) {
+    TrackerFixture f;
+    f.player.Play(0);
+    f.Run(5000);
+    f.player.Pause();
+    f.Run(20000);
+    CHECK(f.tracker.IsIdle());
+    f.player.Resume();
+    f.Run(5000);
+    f.player.Seek(40000);
+    f.Run(5000);
+    f.player.Seek(1000);
+    f.Run(5000);
+    CHECK(loggedPlays == 1);
+}
+
+TEST(tracker, logs_repeats_of_one_track) {
+    TrackerFixture f;
+    f.player.SetMode(SimRepeatOne, 1);
+    f.player.Play(1);
+    f.Run(60000 * 3 - 1000);
+    CHECK(loggedPlays == 3);
+    CHECK(f.player.GetStartedPlays() == 3);
+}
+
+TEST(tracker, logs_restarts_only_from_near_the_end) {
+    TrackerFixture f;
+    f.player.SubscribeEvents(TrackerFixture::OnPlayerEvent, &f.tracker);
+    f.player.Play(0);
+    f.Run(20000);
+    CHECK(loggedPlays == 1);
+    
+    // Stopped and played again, or played again while playing, mid-track
+    f.player.Stop();
+    f.Run(5000);
+    f.player.Play(0);
+    f.Run(20000);
+    f.player.Play(0);
+    f.Run(5000);
+    CHECK(loggedPlays == 1);
+    
+    // Repeated with ticks too far apart for any to see the end coming
+    f.player.SetMode(SimRepeatOne, 1);
+    f.Run(60000 * 2, 15000);
+    CHECK(loggedPlays == 3);
+    CHECK(f.player.GetStartedPlays() == 5);
+}
+
+TEST(tracker, records_source_name) {
+    TrackerFixture f;
+    f.tracker.SetSourceName("kitchen");
+    f.player.Play(2);
+    f.Run(1000);
+    CHECK(loggedPlays == 1);
+    CHECK(strcmp(lastPlay.GetText(PlaySource), "kitchen") == 0);
+}
+
+TEST(tracker, serves_repeat_plays_from_cache) {
+    TrackerFixture f;
+    MetadataCache cache(16);
+    f.tracker.SetMetadataCache(&cache, false);
+    f.player.SetMode(SimRepeatOne, 1);
+    f.player.Play(0);
+    f.Run(60000 * 4 - 1000);
+    CHECK(loggedPlays == 4);
+    CHECK(f.tracker.GetMetadataStats().fetches == 1);
+    CHECK(cache.GetHits() == 3);
+    CHECK(strcmp(lastPlay.GetText(PlayAlbum), "Album") == 0);
+}
@@ -0,0 +1,203 @@
+#include "test.h"
+#include "database.h"
+#include "metacache.h"
+#include "schema.h"
+#include "simplayer.h"
+#include "spool.h"
+#include "tracker.h"
+#include "util.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Text in many scripts, as in tools/scenarios/unicode.txt
+static const char* corpus[] = {
+    "戦場のメリークリスマス",              // Japanese
+    "红豆",                                // Chinese
+    "팔레트 (Feat. G-DRAGON)",             // Korean
+    "وحدن بيبقوا",                         // Arabic, right to left
+    "שני משוגעים",                         // Hebrew, right to left
+    "🔥🔥 Fire 👩‍🎤",                       // Emoji with a zero-width joiner
+    "🇯🇵 Tokyo Nights",                     // A flag (regional indicators)
+    "Ágætis byrjun",                       // Latin with diacritics
+    "Ѳеѡдоръ Пѣснь",                       // Cyrillic, pre-reform
+    "𝄞 𠮷野家 の歌",                        // Outside the Basic Multilingual Plane
+};
+static const size_t corpusSize = sizeof(corpus) / sizeof(corpus[0]);
+
+// Folders nested as in unicode.txt; 15 of them are well past MAX_PATH
+static std::string MakeLongPath(int folders) {
+    std::string path = "E:";
+    for (int i = 1; i <= folders; i++) {
+        path += "\\音楽ライブラリ・アーカイブ第" + std::to_string(i) + "巻";
+    }
+    return path + "\\99 とても長いパスの曲.flac";
+}
+
+static int loggedPlays = 0;
+static PlayEvent lastPlay;
+
+static bool CollectPlay(const PlayEvent& event) {
+    loggedPlays++;
+    lastPlay = event;
+    return true;
+}
+
+// True if text is whole UTF-8 characters
+static bool IsWholeUtf8(const char* text) {
+    size_t length = strlen(text);
+    char16_t wide[PLAYEVENT_PATH_LEN * 2];
+    char back[PLAYEVENT_PATH_LEN * 2];
+    size_t units = Utf8ToUtf16(text, length, wide, sizeof(wide) / sizeof(wide[0]));
+    for (size_t i = 0; i < units; i++) {
+        if (wide[i] == 0xFFFD) return false;
+    }
+    return Utf16ToUtf8(wide, units, back, sizeof(back)) == length;
+}
+
+TEST(unicode, converts_to_utf16_and_back) {
+    char16_t wide[256];
+    char back[512];
+    for (const char* text : corpus) {
+        size_t length = strlen(text);
+        size_t units = Utf8ToUtf16(text, length, wide, sizeof(wide) / sizeof(wide[0]));
+        CHECK(units > 0 && units <= length);
+        CHECK(Utf16ToUtf8(wide, units, back, sizeof(back)) == length);
+        CHECK(strcmp(back, text) == 0);
+    }
+    
+    // Characters past U+FFFF take a surrogate pair each
+    CHECK(Utf8ToUtf16("𝄞", strlen("𝄞"), wide, 4) == 2);
+    CHECK(wide[0] == 0xD834 && wide[1] == 0xDD1E);
+    
+    // Cut short at a character, never inside one
+    CHECK(Utf16ToUtf8(wide, 2, back, 4) == 0);
+    CHECK(Utf8ToUtf16("红豆", strlen("红豆"), wide, 2) == 1);
+}
+
+TEST(unicode, logs_text_intact_through_utf16) {
+    ManualClock clock(1735689600);
+    SimulatedPlayerSource player(clock);
+    player.SetWideText(true);
+    TrackTracker tracker(player, clock, CollectPlay);
+    std::string longPath = MakeLongPath(15);
+    CHECK(longPath.size() > 260 && longPath.size() < PLAYEVENT_PATH_LEN);
+    
+    for (size_t i = 0; i < corpusSize; i++) {
+        SimTrack track;
+        track.filepath = i == 0 ? longPath : std::string("C:\\Music\\") + corpus[i] + ".mp3";
+        track.title = corpus[i];
+        track.artist = corpus[(i + 1) % corpusSize];
+        track.album = corpus[(i + 2) % corpusSize];
+        track.lengthMs = 60000;
+        player.AddTrack(track);
+    }
+    
+    player.Play(0);
+    loggedPlays = 0;
+    for (size_t i = 0; i < corpusSize; i++) {
+        const SimTrack* track = player.GetCurrentTrack();
+        CHECK(track != NULL);
+        if (!track) return;
+        for (int tick = 0; tick < 4; tick++) {
+            clock.Advance(500);
+            player.DeliverEvents();
+            tracker.Tick();
+        }
+        CHECK(loggedPlays == (int)i + 1);
+        CHECK(lastPlay.GetText(PlayFilepath) == track->filepath);
+        CHECK(lastPlay.GetText(PlayTitle) == track->title);
+        CHECK(lastPlay.GetText(PlayArtist) == track->artist);
+        CHECK(lastPlay.GetText(PlayAlbum) == track->album);
+        player.Next();
+    }
+    
+    // The file name is split from the long path whole
+    player.Play(0);
+    clock.Advance(500);
+    player.DeliverEvents();
+    tracker.Tick();
+    CHECK(strcmp(lastPlay.GetText(PlayFilename), "99 とても長いパスの曲.flac") == 0);
+}
+
+TEST(unicode, cuts_paths_too_long_to_keep_at_a_character) {
+    ManualClock clock(1735689600);
+    SimulatedPlayerSource player(clock);
+    player.SetWideText(true);
+    TrackTracker tracker(player, clock, CollectPlay);
+    SimTrack track;
+    track.filepath = MakeLongPath(80);
+    track.title = "長い";
+    track.lengthMs = 60000;
+    CHECK(track.filepath.size() >= PLAYEVENT_PATH_LEN);
+    player.AddTrack(track);
+    
+    player.Play(0);
+    loggedPlays = 0;
+    clock.Advance(500);
+    player.DeliverEvents();
+    tracker.Tick();
+    CHECK(loggedPlays == 1);
+    const char* logged = lastPlay.GetText(PlayFilepath);
+    CHECK(strlen(logged) < PLAYEVENT_PATH_LEN && strlen(logged) > PLAYEVENT_PATH_LEN - 4);
+    CHECK(track.filepath.compare(0, strlen(logged), logged) == 0);
+    CHECK(IsWholeUtf8(logged));
+}
+
+TEST(unicode, stores_text_intact) {
+    std::string spoolPath = GetTestPath("unicode.spool");
+    std::string dbPath = GetTestPath("unicode.db");
+    PlaySpool spool;
+    DatabaseOptions options = { false, false, NULL, -1, 0 };
+    CHECK(spool.Open(spoolPath.c_str()));
+    CHECK(OpenDatabase(dbPath.c_str(), options));
+    std::string longPath = MakeLongPath(15);
+    
+    // Through a spool record, and into the database from there
+    PlayEvent event, decoded;
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    for (size_t i = 0; i < corpusSize; i++) {
+        event.Clear();
+        event.playedAtMs = 1735689600000LL + (int64_t)i * 1000;
+        event.SetText(PlayFilepath, longPath.c_str());
+        event.SetText(PlayTitle, corpus[i]);
+        event.SetText(PlaySource, corpus[(i + 3) % corpusSize]);
+        size_t size = EncodePlayRecord(event, record);
+        CHECK(DecodePlayRecord(record, size, decoded));
+        CHECK(strcmp(decoded.GetText(PlayTitle), corpus[i]) == 0);
+        CHECK(spool.Append(event));
+    }
+    CHECK(spool.Replay(WritePlayEvent));
+    CloseDatabase();
+    spool.Close();
+    
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    CHECK(sqlite3_open(dbPath.c_str(), &db) == SQLITE_OK);
+    CHECK(sqlite3_prepare_v2(db, "SELECT filepath, title, source FROM play_history ORDER BY played_at_ms;", -1, &stmt, NULL) == SQLITE_OK);
+    size_t rows = 0;
+    while (stmt && sqlite3_step(stmt) == SQLITE_ROW && rows < corpusSize) {
+        CHECK(longPath == (const char*)sqlite3_column_text(stmt, 0));
+        CHECK(strcmp((const char*)sqlite3_column_text(stmt, 1), corpus[rows]) == 0);
+        CHECK(strcmp((const char*)sqlite3_column_text(stmt, 2), corpus[(rows + 3) % corpusSize]) == 0);
+        rows++;
+    }
+    CHECK(rows == corpusSize);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
+
+TEST(unicode, stamps_files_with_unicode_names) {
+    std::string path = GetTestPath("🎧 Пѣснь 红豆.mp3");
+    FILE* file = OpenFile(path.c_str(), "wb");
+    CHECK(file != NULL);
+    if (!file) return;
+    fwrite("ID3", 1, 3, file);
+    fclose(file);
+    
+    FileStamp stamp;
+    GetFileStamp(path.c_str(), stamp);
+    CHECK(stamp.valid);
+    CHECK(stamp.size == 3);
+    remove(path.c_str());
+}
@@ -0,0 +1,421 @@
+#include "test.h"
+#include "database.h"
+#include "schema.h"
+#include "writer.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static std::atomic<int> storedPlays(0);
+static std::atomic<int> committedPlays(0);
+static int openBatch = 0;
+static bool sinkFails = false;
+
+static bool CountPlay(const PlayEvent&) {
+    if (sinkFails) return false;
+    storedPlays++;
+    openBatch++;
+    return true;
+}
+
+static bool BeginCountedBatch() {
+    openBatch = 0;
+    return true;
+}
+
+static bool CommitCountedBatch() {
+    committedPlays += openBatch;
+    openBatch = 0;
+    return true;
+}
+
+static bool RollbackCountedBatch() {
+    openBatch = 0;
+    return true;
+}
+
+static void MakePlay(int i, const char* source, PlayEvent& event) {
+    char title[32];
+    snprintf(title, sizeof(title), "Song %d", i);
+    event.Clear();
+    event.playedAtMs = 1735689600000LL + i * 1000;
+    event.durationMs = 180000;
+    event.SetText(PlayFilepath, "C:\\Music\\song.mp3");
+    event.SetText(PlayTitle, title);
+    event.SetText(PlaySource, source);
+}
+
+// A writer with batches that stay open for a long time unless something
+// closes them
+static WriterConfig MakeCountingWriter() {
+    storedPlays = 0;
+    committedPlays = 0;
+    sinkFails = false;
+    WriterConfig config = {};
+    config.sink = CountPlay;
+    config.beginBatch = BeginCountedBatch;
+    config.commitBatch = CommitCountedBatch;
+    config.rollbackBatch = RollbackCountedBatch;
+    config.policy = OverflowBlock;
+    config.batchSize = 64;
+    config.batchMs = 60000;
+    return config;
+}
+
+TEST(writer, accepts_forwarded_plays_once_committed) {
+    CHECK(StartWriter(MakeCountingWriter()));
+    PlayEvent event;
+    MakePlay(1, "zone", event);
+    
+    // Without a spool the batch is committed before the sender hears back
+    CHECK(AcceptForwardedPlayEvent(event));
+    CHECK(committedPlays == 1);
+    
+    // This instance's own plays still wait for the batch
+    CHECK(EnqueuePlayEvent(event));
+    CHECK(AcceptForwardedPlayEvent(event));
+    CHECK(committedPlays == 3);
+    StopWriter();
+}
+
+TEST(writer, refuses_forwarded_plays_it_cannot_store) {
+    CHECK(StartWriter(MakeCountingWriter()));
+    sinkFails = true;
+    PlayEvent event;
+    MakePlay(1, "zone", event);
+    CHECK(!AcceptForwardedPlayEvent(event));
+    CHECK(committedPlays == 0);
+    StopWriter();
+    CHECK(!AcceptForwardedPlayEvent(event));
+}
+
+TEST(writer, accepts_forwarded_plays_once_spooled) {
+    std::string path = GetTestPath("forwarded.spool");
+    PlaySpool spool;
+    CHECK(spool.Open(path.c_str()));
+    WriterConfig config = MakeCountingWriter();
+    config.spool = &spool;
+    CHECK(StartWriter(config));
+    
+    // Durable in the spool, so the batch can stay open
+    PlayEvent event;
+    MakePlay(1, "zone", event);
+    CHECK(AcceptForwardedPlayEvent(event));
+    CHECK(committedPlays == 0);
+    StopWriter();
+    CHECK(committedPlays == 1);
+    spool.Close();
+}
+
+// Wait up to a second for the writer to reach count
+static bool WaitForCount(const std::atomic<int>& counter, int count) {
+    for (int i = 0; i < 1000 && counter < count; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return counter == count;
+}
+
+// Give the writer a moment to do anything it was going to do anyway
+static void LetWriterSettle() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+TEST(writer, commits_a_full_batch_at_once) {
+    ManualClock clock;
+    WriterConfig config = MakeCountingWriter();
+    config.clock = &clock;
+    config.batchSize = 3;
+    CHECK(StartWriter(config));
+    
+    // The clock never moves, so only the count can close the batch
+    PlayEvent event;
+    for (int i = 0; i < 5; i++) {
+        MakePlay(i, "", event);
+        CHECK(EnqueuePlayEvent(event));
+    }
+    CHECK(WaitForCount(storedPlays, 5));
+    CHECK(WaitForCount(committedPlays, 3));
+    LetWriterSettle();
+    CHECK(committedPlays == 3);
+    StopWriter();
+    CHECK(committedPlays == 5);
+}
+
+TEST(writer, commits_an_old_batch) {
+    ManualClock clock;
+    WriterConfig config = MakeCountingWriter();
+    config.clock = &clock;
+    config.batchMs = 1000;
+    CHECK(StartWriter(config));
+    
+    // Far fewer plays than batchSize, so only the age can close the batch
+    PlayEvent event;
+    MakePlay(1, "", event);
+    CHECK(EnqueuePlayEvent(event));
+    MakePlay(2, "", event);
+    CHECK(EnqueuePlayEvent(event));
+    CHECK(WaitForCount(storedPlays, 2));
+    clock.Advance(999);
+    WakeWriter();
+    LetWriterSettle();
+    CHECK(committedPlays == 0);
+    clock.Advance(1);
+    WakeWriter();
+    CHECK(WaitForCount(committedPlays, 2));
+    
+    // The next batch starts its own timer
+    MakePlay(3, "", event);
+    CHECK(EnqueuePlayEvent(event));
+    CHECK(WaitForCount(storedPlays, 3));
+    clock.Advance(500);
+    WakeWriter();
+    LetWriterSettle();
+    CHECK(committedPlays == 2);
+    clock.Advance(500);
+    WakeWriter();
+    CHECK(WaitForCount(committedPlays, 3));
+    StopWriter();
+}
+
+static int64_t CountRows(const char* path, const char* sql) {
+    sqlite3* db = NULL;
+    int64_t count = -1;
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_open(path, &db) == SQLITE_OK && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return count;
+}
+
+static std::atomic<int> checkpoints(0);
+
+static bool CountCheckpoint() {
+    bool done = CheckpointDatabase();
+    if (done) checkpoints++;
+    return done;
+}
+
+static int64_t GetFileSize(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return -1;
+    fseek(file, 0, SEEK_END);
+    int64_t size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+TEST(writer, checkpoints_once_the_player_is_idle) {
+    // WAL with SQLite's own checkpoints off, so only the writer's move
+    // pages into the database file
+    std::string dbPath = GetTestPath("checkpoint.db");
+    DatabaseOptions options = { false, true, "normal", 0, 0 };
+    CHECK(OpenDatabase(dbPath.c_str(), options));
+    CHECK(IsWalEnabled());
+    CHECK(CheckpointDatabase());
+    int64_t emptySize = GetFileSize(dbPath);
+    
+    ManualClock clock;
+    WriterConfig config = {};
+    config.sink = WritePlayEvent;
+    config.beginBatch = BeginBatch;
+    config.commitBatch = CommitBatch;
+    config.rollbackBatch = RollbackBatch;
+    config.checkpoint = CountCheckpoint;
+    config.clock = &clock;
+    config.policy = OverflowBlock;
+    config.batchSize = 200;
+    config.batchMs = 1000;
+    checkpoints = 0;
+    NotifyPlayerIdle(false);
+    CHECK(StartWriter(config));
+    
+    // Nothing while the player plays, even once the batch is committed
+    PlayEvent event;
+    for (int i = 0; i < 200; i++) {
+        MakePlay(i, "", event);
+        CHECK(EnqueuePlayEvent(event));
+    }
+    LetWriterSettle();
+    CHECK(checkpoints == 0);
+    CHECK(GetFileSize(dbPath) == emptySize);
+    
+    // Then once when it stops, and not again until more is written
+    NotifyPlayerIdle(true);
+    CHECK(WaitForCount(checkpoints, 1));
+    CHECK(GetFileSize(dbPath) > emptySize);
+    NotifyPlayerIdle(false);
+    NotifyPlayerIdle(true);
+    LetWriterSettle();
+    CHECK(checkpoints == 1);
+    
+    // A batch still open waits for its commit
+    NotifyPlayerIdle(false);
+    MakePlay(200, "", event);
+    CHECK(EnqueuePlayEvent(event));
+    NotifyPlayerIdle(true);
+    LetWriterSettle();
+    CHECK(checkpoints == 1);
+    clock.Advance(1000);
+    WakeWriter();
+    CHECK(WaitForCount(checkpoints, 2));
+    StopWriter();
+    NotifyPlayerIdle(false);
+    CloseDatabase();
+    CHECK(CountRows(dbPath.c_str(), "SELECT COUNT(*) FROM play_history;") == 201);
+}
+
+// A slow database: every play takes a while, so the queue fills up
+static int64_t lastSlowPlay = 0;
+static bool slowPlaysOrdered = true;
+
+static bool StoreSlowly(const PlayEvent& event) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    if (event.playedAtMs <= lastSlowPlay) slowPlaysOrdered = false;
+    lastSlowPlay = event.playedAtMs;
+    storedPlays++;
+    return true;
+}
+
+// Push count plays as fast as possible through a writer with a slow sink
+static void FeedSlowWriter(OverflowPolicy policy, int count, unsigned long& dropped) {
+    WriterConfig config = MakeCountingWriter();
+    config.sink = StoreSlowly;
+    config.beginBatch = NULL;
+    config.commitBatch = NULL;
+    config.rollbackBatch = NULL;
+    config.policy = policy;
+    lastSlowPlay = 0;
+    slowPlaysOrdered = true;
+    
+    unsigned long droppedBefore = GetDroppedEventCount();
+    CHECK(StartWriter(config));
+    PlayEvent event;
+    for (int i = 0; i < count; i++) {
+        MakePlay(i, "", event);
+        EnqueuePlayEvent(event);
+    }
+    StopWriter();
+    dropped = GetDroppedEventCount() - droppedBefore;
+}
+
+TEST(writer, slow_sink_blocking_loses_nothing) {
+    unsigned long dropped = 0;
+    FeedSlowWriter(OverflowBlock, 5000, dropped);
+    CHECK(dropped == 0);
+    CHECK(storedPlays == 5000);
+    CHECK(slowPlaysOrdered);
+}
+
+TEST(writer, slow_sink_dropping_counts_every_play) {
+    unsigned long dropped = 0;
+    FeedSlowWriter(OverflowDropNewest, 5000, dropped);
+    CHECK(dropped > 0);
+    CHECK(storedPlays + (int)dropped == 5000);
+    CHECK(slowPlaysOrdered);
+    
+    FeedSlowWriter(OverflowDropOldest, 5000, dropped);
+    CHECK(dropped > 0);
+    CHECK(storedPlays + (int)dropped == 5000);
+    CHECK(slowPlaysOrdered);
+}
+
+#ifndef _WIN32
+
+// One instance of the plugin: write plays through its own writer and
+// spool into the shared database, as the plugin does. Exits with 0 if
+// every play was written.
+static void RunWriterProcess(const std::string& dbPath, int process, int plays) {
+    char source[32];
+    snprintf(source, sizeof(source), "process %d", process);
+    std::string spoolPath = dbPath + "." + std::to_string(process) + ".spool";
+    
+    DatabaseOptions options = { false, true, "normal", -1, 10000 };
+    PlaySpool spool;
+    if (!OpenDatabase(dbPath.c_str(), options) || !spool.Open(spoolPath.c_str())) _exit(2);
+    
+    WriterConfig config = {};
+    config.sink = WritePlayEvent;
+    config.replaySink = WriteSpooledPlayEvent;
+    config.beginBatch = BeginBatch;
+    config.commitBatch = CommitBatch;
+    config.rollbackBatch = RollbackBatch;
+    config.spool = &spool;
+    config.policy = OverflowBlock;
+    config.batchSize = 32;
+    config.batchMs = 50;
+    config.retryMs = 100;
+    // The counters are the whole process's, including earlier tests
+    unsigned long lostBefore = GetLostEventCount();
+    unsigned long droppedBefore = GetDroppedEventCount();
+    if (!StartWriter(config)) _exit(3);
+    
+    PlayEvent event;
+    for (int i = 0; i < plays; i++) {
+        MakePlay(i, source, event);
+        EnqueuePlayEvent(event);
+    }
+    StopWriter();
+    
+    bool allWritten = GetLostEventCount() == lostBefore && GetDroppedEventCount() == droppedBefore && spool.GetRecordCount() == 0;
+    spool.Close();
+    CloseDatabase();
+    _exit(allWritten ? 0 : 1);
+}
+
+// Run processes writers at once against a fresh database; returns plays
+// written per second, or 0 if any of them failed
+static double RunWriterProcesses(const std::string& dbPath, int processes, int plays) {
+    // Create the schema first, so the writers only ever insert
+    DatabaseOptions options = { false, true, "normal", -1, 10000 };
+    if (!OpenDatabase(dbPath.c_str(), options)) return 0;
+    CloseDatabase();
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int process = 0; process < processes; process++) {
+        pid_t pid = fork();
+        if (pid == 0) RunWriterProcess(dbPath, process, plays);
+        if (pid < 0) return 0;
+    }
+    
+    bool allWritten = true;
+    for (int process = 0; process < processes; process++) {
+        int status = 0;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) allWritten = false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return allWritten ? processes * plays / seconds : 0;
+}
+
+TEST(writer, several_processes_share_one_database) {
+    const int plays = 2000;
+    const int processes = 4;
+    
+    std::string onePath = GetTestPath("one-writer.db");
+    double oneRate = RunWriterProcesses(onePath, 1, plays);
+    CHECK(oneRate > 0);
+    CHECK(CountRows(onePath.c_str(), "SELECT COUNT(*) FROM play_history;") == plays);
+    
+    // No play is lost or written twice, whichever process wins the lock
+    std::string sharedPath = GetTestPath("shared.db");
+    double sharedRate = RunWriterProcesses(sharedPath, processes, plays);
+    CHECK(sharedRate > 0);
+    CHECK(CountRows(sharedPath.c_str(), "SELECT COUNT(*) FROM play_history;") == processes * plays);
+    CHECK(CountRows(sharedPath.c_str(), "SELECT COUNT(DISTINCT source) FROM play_history;") == processes);
+    CHECK(CountRows(sharedPath.c_str(), "SELECT COUNT(*) FROM (SELECT source, title FROM play_history GROUP BY source, title HAVING COUNT(*) > 1);") == 0);
+    
+    // Waiting for the lock must not cost much more than the writes: a writer
+    // that slept on a busy lock instead of retrying would fall far below this
+    printf("       1 process: %.0f plays/s, %d processes: %.0f plays/s\n", oneRate, processes, sharedRate);
+    CHECK(sharedRate >= oneRate / 4);
+}
+
+#endif // _WIN32
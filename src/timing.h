@@ -0,0 +1,126 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+// Source of time for the logging core, so tests and replays can run on a
+// virtual clock instead of the wall clock
+class Clock {
+public:
+    virtual ~Clock() {}
+    
+    // Milliseconds from an arbitrary fixed point; never goes backwards
+    virtual uint64_t MonotonicMs() = 0;
+    
+    // Wall-clock UTC milliseconds since the Unix epoch, used to timestamp plays
+    virtual int64_t NowMs() = 0;
+};
+
+// The real clock
+class SystemClock : public Clock {
+public:
+    uint64_t MonotonicMs() override {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    int64_t NowMs() override {
+        return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Virtual clock that only moves when told to, for deterministic replays
+class ManualClock : public Clock {
+public:
+    explicit ManualClock(time_t epoch = 0) : epoch(epoch), elapsedMs(0) {}
+    
+    uint64_t MonotonicMs() override { return elapsedMs.load(std::memory_order_relaxed); }
+    int64_t NowMs() override { return (int64_t)epoch * 1000 + (int64_t)MonotonicMs(); }
+    
+    void Advance(uint64_t ms) { elapsedMs.fetch_add(ms, std::memory_order_relaxed); }
+
+private:
+    time_t epoch;
+    std::atomic<uint64_t> elapsedMs;  // Read by the writer thread while a test moves it
+};
+
+// Called on every timer tick
+typedef void (*TickProc)(void* context);
+
+// Periodic timer that drives polling
+class TickTimer {
+public:
+    virtual ~TickTimer() {}
+    
+    // Start calling proc(context) every intervalMs
+    virtual bool Start(unsigned int intervalMs, TickProc proc, void* context) = 0;
+    
+    // Change the period of a running timer
+    virtual bool SetInterval(unsigned int intervalMs) = 0;
+    
+    // Run a tick as soon as possible, then carry on at the usual period.
+    // May be called from any thread.
+    virtual bool TickNow() = 0;
+    
+    // Stop the timer, waiting for a tick in progress to finish
+    virtual void Stop() = 0;
+};
+
+// TickTimer on a ManualClock's timeline: the driver advances it along with
+// the clock and it ticks when due, for deterministic replays
+class ManualTimer : public TickTimer {
+public:
+    ManualTimer() : proc(NULL), context(NULL), intervalMs(0), dueInMs(0), ticks(0), running(false) {}
+    
+    bool Start(unsigned int startIntervalMs, TickProc tickProc, void* tickContext) override {
+        proc = tickProc;
+        context = tickContext;
+        running = tickProc != NULL;
+        return SetInterval(startIntervalMs);
+    }
+    
+    bool SetInterval(unsigned int newIntervalMs) override {
+        intervalMs = newIntervalMs ? newIntervalMs : 1;
+        dueInMs = intervalMs;
+        return running;
+    }
+    
+    bool TickNow() override {
+        dueInMs = 0;
+        return running;
+    }
+    
+    void Stop() override { running = false; }
+    
+    // Time until the next tick (UINT64_MAX if stopped)
+    uint64_t GetMsUntilTick() const { return running ? dueInMs : UINT64_MAX; }
+    
+    // Let time pass (no further than GetMsUntilTick), ticking if due
+    void Advance(uint64_t ms) {
+        if (!running) return;
+        dueInMs -= ms < dueInMs ? ms : dueInMs;
+        if (dueInMs == 0) {
+            // Reload first, so the tick may reschedule itself
+            dueInMs = intervalMs;
+            ticks++;
+            proc(context);
+        }
+    }
+    
+    uint64_t GetTicks() const { return ticks; }
+    unsigned int GetInterval() const { return intervalMs; }
+
+private:
+    TickProc proc;
+    void* context;
+    unsigned int intervalMs;
+    uint64_t dueInMs;
+    uint64_t ticks;
+    bool running;
+};
+
+#endif // TIMING_H
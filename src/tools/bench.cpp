@@ -0,0 +1,920 @@
+// winnp-bench: time the logging core on reproducible synthetic workloads
+// and print the results as JSON, so versions can be compared.
+//
+//   winnp-bench [--only tick|metadata|insert|log|query|layout|import] [--sizes <n>[,<n>...]] [--dir <path>] [--seed <n>] [--output <path>]
+//
+// tick: detector ticks while stopped, while a track plays (also with the
+// instrumentation on), and when every tick finds a new track. metadata:
+// building a play from the player, and through the metadata cache on hits
+// (with and without checking the file) and misses; saving and opening a
+// 100000-entry snapshot of the cache, and a cold cache's hits in it.
+// insert: writes in rollback journal and WAL mode, committing every 1, 8,
+// 64 and 512 plays, and the INSERT prepared for every play against the
+// cached statement the plugin reuses. log: plays from tick to database, through the writer.
+// query: the statistics queries over histories of each size (default
+// 100000, 1000000, 5000000 and 10000000 plays) whose artists and albums
+// follow Zipf distributions, as a listener's do. Histories are kept in
+// --dir (default the current directory) and reused by later runs with the
+// same seed.
+// layout: the same histories written in the normalized layout too, with
+// each file's size ("bytes") and the top artists read from its plays.
+// import: a Last.fm export of the largest size's plays imported into an
+// empty flat history and an empty normalized one (the file is kept in
+// --dir too); ops_per_s is the rows imported per second. On one core 10M
+// plays take about 50 s flat and 110 s normalized, which pays to look up
+// every artist, album and title.
+//
+// Each result gives the operations timed, the wall time, the time per
+// operation and the heap allocations per operation; "rows" is the history
+// size for queries. Queries with a target latency also give it
+// ("target_ns_per_op") and whether it was met ("pass").
+
+#include "database.h"
+#include "importer.h"
+#include "metacache.h"
+#include "metasnapshot.h"
+#include "schema.h"
+#include "simplayer.h"
+#include "spool.h"
+#include "stats.h"
+#include "tracker.h"
+#include "util.h"
+#include "writer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+// Synthetic library: artists by popularity, each with 1 to
+// BENCH_MAX_ALBUMS albums of BENCH_ALBUM_TRACKS tracks
+#define BENCH_ARTISTS 5000
+#define BENCH_MAX_ALBUMS 8
+#define BENCH_ALBUM_TRACKS 10
+
+// Zipf exponent of artist and album popularity
+#define BENCH_ZIPF_EXPONENT 1.0
+
+// Histories cover the 10 years up to 2025-01-01 00:00:00 UTC
+#define BENCH_END_MS 1735689600000LL
+#define BENCH_SPAN_MS (3652LL * 86400000)
+
+// Files the metadata benchmarks play
+#define BENCH_FILES 64
+
+// Entries in the metadata snapshot benchmarked
+#define BENCH_SNAPSHOT_ENTRIES 100000
+
+typedef std::chrono::steady_clock BenchClock;
+
+// Heap allocations made through operator new, on any thread (SQLite's own
+// allocations, through malloc, aren't counted)
+static std::atomic<uint64_t> allocations(0);
+static uint64_t caseAllocations = 0;
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// Start timing a case, and counting its allocations
+static BenchClock::time_point StartCase() {
+    caseAllocations = allocations.load();
+    return BenchClock::now();
+}
+
+static double ElapsedSeconds(BenchClock::time_point start) {
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+struct BenchResult {
+    std::string name;
+    uint64_t rows;
+    uint64_t ops;
+    double seconds;
+    uint64_t allocations;
+    uint64_t bytes;      // Database file size, for the cases that give one
+    double targetNs;     // Most time an operation should take, 0 if none
+};
+
+static std::vector<BenchResult> results;
+
+static bool MeetsTarget(const BenchResult& result) {
+    return result.ops && result.seconds * 1e9 / result.ops <= result.targetNs;
+}
+
+// Record a result; with targetNs, whether each operation took at most that
+static void Report(const char* name, uint64_t rows, uint64_t ops, double seconds, double targetNs = 0) {
+    uint64_t caseAllocs = allocations.load() - caseAllocations;
+    results.push_back(BenchResult{ name, rows, ops, seconds, caseAllocs, 0, targetNs });
+    if (rows) fprintf(stderr, "%-32s %10llu rows %10llu ops %10.3f s %12.1f ns/op %8.2f allocs/op", name,
+                      (unsigned long long)rows, (unsigned long long)ops, seconds, ops ? seconds * 1e9 / ops : 0.0,
+                      ops ? (double)caseAllocs / ops : 0.0);
+    else fprintf(stderr, "%-32s %26llu ops %10.3f s %12.1f ns/op %8.2f allocs/op", name, (unsigned long long)ops,
+                 seconds, ops ? seconds * 1e9 / ops : 0.0, ops ? (double)caseAllocs / ops : 0.0);
+    if (targetNs > 0) fprintf(stderr, "  target %.0f ns/op %s", targetNs, MeetsTarget(results.back()) ? "pass" : "FAIL");
+    fprintf(stderr, "\n");
+}
+
+// splitmix64: small, fast and the same everywhere
+static uint64_t NextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double NextUnit(uint64_t& state) {
+    return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Cumulative Zipf distribution over ranks 1..count
+static void BuildZipf(std::vector<double>& cdf, int count) {
+    cdf.resize(count);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1, BENCH_ZIPF_EXPONENT);
+        cdf[i] = sum;
+    }
+    for (double& p : cdf) p /= sum;
+}
+
+static int PickZipf(const std::vector<double>& cdf, uint64_t& state) {
+    size_t index = std::upper_bound(cdf.begin(), cdf.end(), NextUnit(state)) - cdf.begin();
+    return (int)(index < cdf.size() ? index : cdf.size() - 1);
+}
+
+static const char* genres[] = { "Rock", "Pop", "Jazz", "Electronic", "Hip-Hop", "Classical",
+                                "Folk", "Metal", "Soul", "Reggae", "Blues", "Country" };
+
+// A track of the synthetic library. Artist n's albums and tracks, genre,
+// year and lengths all follow from n, so a history is a function of the seed.
+struct BenchTrack {
+    int artist;
+    int album;
+    int track;
+};
+
+class BenchLibrary {
+public:
+    BenchLibrary() {
+        BuildZipf(artistCdf, BENCH_ARTISTS);
+        for (int count = 1; count <= BENCH_MAX_ALBUMS; count++) {
+            BuildZipf(albumCdfs[count - 1], count);
+        }
+    }
+    
+    void Pick(uint64_t& state, BenchTrack& track) const {
+        track.artist = PickZipf(artistCdf, state);
+        track.album = PickZipf(albumCdfs[GetAlbumCount(track.artist) - 1], state);
+        track.track = (int)(NextRandom(state) % BENCH_ALBUM_TRACKS);
+    }
+    
+    static int GetAlbumCount(int artist) { return 1 + (int)((artist * 2654435761u) >> 16) % BENCH_MAX_ALBUMS; }
+    static int GetLengthMs(const BenchTrack& t) { return 120000 + (t.artist * 7919 + t.album * 104729 + t.track * 15485863) % 300000; }
+    
+    static void Fill(const BenchTrack& t, PlayEvent& event) {
+        char text[PLAYEVENT_PATH_LEN];
+        event.Clear();
+        event.SetText(PlayFilepath, text, snprintf(text, sizeof(text), "D:\\Music\\Artist %04d\\Album %d\\%02d.mp3",
+                                                   t.artist, t.album + 1, t.track + 1));
+        event.SetText(PlayFilename, text, snprintf(text, sizeof(text), "%02d.mp3", t.track + 1));
+        event.SetText(PlayTitle, text, snprintf(text, sizeof(text), "Song %d-%d-%d", t.artist, t.album + 1, t.track + 1));
+        event.SetText(PlayArtist, text, snprintf(text, sizeof(text), "Artist %04d", t.artist));
+        event.SetText(PlayAlbum, text, snprintf(text, sizeof(text), "Album %04d-%d", t.artist, t.album + 1));
+        event.SetText(PlayGenre, genres[t.artist % (sizeof(genres) / sizeof(genres[0]))]);
+        event.SetText(PlayTrackNumber, text, snprintf(text, sizeof(text), "%d", t.track + 1));
+        event.SetText(PlayYear, text, snprintf(text, sizeof(text), "%d", 1960 + (t.artist + t.album) % 65));
+        event.SetText(PlaySource, "bench");
+        event.durationMs = GetLengthMs(t);
+    }
+
+private:
+    std::vector<double> artistCdf;
+    std::vector<double> albumCdfs[BENCH_MAX_ALBUMS];
+};
+
+static void MakeSimTrack(const PlayEvent& event, const char* filepath, SimTrack& track) {
+    track.filepath = filepath ? filepath : event.GetText(PlayFilepath);
+    track.title = event.GetText(PlayTitle);
+    track.artist = event.GetText(PlayArtist);
+    track.album = event.GetText(PlayAlbum);
+    track.genre = event.GetText(PlayGenre);
+    track.trackNumber = event.GetText(PlayTrackNumber);
+    track.year = event.GetText(PlayYear);
+    track.lengthMs = event.durationMs;
+}
+
+static uint64_t benchPlays = 0;
+
+static bool CountPlay(const PlayEvent&) {
+    benchPlays++;
+    return true;
+}
+
+static void RunTicks(const char* name, TrackTracker& tracker, ManualClock& clock, uint64_t ticks, uint64_t stepMs) {
+    auto start = StartCase();
+    for (uint64_t i = 0; i < ticks; i++) {
+        clock.Advance(stepMs);
+        tracker.Tick();
+    }
+    Report(name, 0, ticks, ElapsedSeconds(start));
+}
+
+static void BenchTicks(const BenchLibrary& library, uint64_t seed) {
+    uint64_t state = seed;
+    BenchTrack pick;
+    PlayEvent event;
+    SimTrack track;
+    
+    // Steady state: polling a stopped player, and one long track (restarted
+    // before it runs out)
+    {
+        ManualClock clock(BENCH_END_MS / 1000);
+        SimulatedPlayerSource player(clock);
+        library.Pick(state, pick);
+        BenchLibrary::Fill(pick, event);
+        MakeSimTrack(event, NULL, track);
+        track.lengthMs = 2000000000;
+        player.AddTrack(track);
+        
+        TrackTracker tracker(player, clock, CountPlay);
+        RunTicks("tick.stopped", tracker, clock, 2000000, 500);
+        player.Play(0);
+        RunTicks("tick.playing", tracker, clock, 2000000, 500);
+        
+        PlayMetrics metrics;
+        tracker.SetMetrics(&metrics);
+        player.Play(0);
+        RunTicks("tick.playing.instrumented", tracker, clock, 2000000, 500);
+    }
+    
+    // Every tick finds a new track, fetching its tags from the player
+    {
+        ManualClock clock(BENCH_END_MS / 1000);
+        SimulatedPlayerSource player(clock);
+        for (int i = 0; i < 1000; i++) {
+            library.Pick(state, pick);
+            BenchLibrary::Fill(pick, event);
+            MakeSimTrack(event, NULL, track);
+            track.lengthMs = 500;
+            player.AddTrack(track);
+        }
+        player.Play(0);
+        
+        TrackTracker tracker(player, clock, CountPlay);
+        RunTicks("tick.change", tracker, clock, 200000, 500);
+    }
+}
+
+static void BuildPlays(const char* name, TrackTracker& tracker, const std::vector<SimTrack>& tracks, uint64_t count) {
+    PlayEvent event;
+    auto start = StartCase();
+    for (uint64_t i = 0; i < count; i++) {
+        const SimTrack& track = tracks[i % tracks.size()];
+        tracker.BuildPlayEvent(track.title.c_str(), track.filepath.c_str(), event);
+    }
+    Report(name, 0, count, ElapsedSeconds(start));
+}
+
+// Building a play's event from the player or the cache. The files exist
+// (empty, in dir), so a validating cache has something to check.
+static void BenchMetadata(const BenchLibrary& library, uint64_t seed, const std::string& dir) {
+    uint64_t state = seed;
+    BenchTrack pick;
+    PlayEvent event;
+    std::vector<SimTrack> tracks(BENCH_FILES);
+    ManualClock clock(BENCH_END_MS / 1000);
+    SimulatedPlayerSource player(clock);
+    
+    for (int i = 0; i < BENCH_FILES; i++) {
+        char path[PLAYEVENT_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/winnp-bench-%02d.mp3", dir.c_str(), i);
+        FILE* file = fopen(path, "wb");
+        if (file) fclose(file);
+        
+        library.Pick(state, pick);
+        BenchLibrary::Fill(pick, event);
+        MakeSimTrack(event, path, tracks[i]);
+        player.AddTrack(tracks[i]);
+    }
+    
+    TrackTracker tracker(player, clock, CountPlay);
+    BuildPlays("metadata.fetch", tracker, tracks, 200000);
+    
+    MetadataCache cache(1024);
+    tracker.SetMetadataCache(&cache, true);
+    BuildPlays("metadata.cache_hit.validated", tracker, tracks, 200000);
+    tracker.SetMetadataCache(&cache, false);
+    BuildPlays("metadata.cache_hit", tracker, tracks, 2000000);
+    
+    // A snapshot of a large library's tags (plus the files played here, as
+    // cached above), as the last session would have left it
+    std::string snapshotPath = dir + "/winnp-bench.tags";
+    MetadataSnapshot snapshot;
+    cache.SaveSnapshot(snapshotPath.c_str());
+    snapshot.Open(snapshotPath.c_str());
+    MetadataCache large(BENCH_SNAPSHOT_ENTRIES + BENCH_FILES);
+    large.SetSnapshot(&snapshot);
+    FileStamp stamp = { true, 5000000, 1700000000 };
+    TrackMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    for (int i = 0; i < BENCH_SNAPSHOT_ENTRIES; i++) {
+        char path[PLAYEVENT_PATH_LEN];
+        snprintf(path, sizeof(path), "D:\\Library\\%06d.mp3", i);
+        snprintf(metadata.title, sizeof(metadata.title), "Song %d", i);
+        large.Store(path, &stamp, metadata);
+    }
+    auto start = StartCase();
+    bool saved = large.SaveSnapshot(snapshotPath.c_str());
+    Report("metadata.snapshot_save", 0, BENCH_SNAPSHOT_ENTRIES + BENCH_FILES, ElapsedSeconds(start));
+    
+    // Opening at startup, however large, and a cold cache's first plays
+    if (saved) {
+        const int opens = 10000;
+        start = StartCase();
+        for (int i = 0; i < opens; i++) {
+            snapshot.Open(snapshotPath.c_str());
+            snapshot.Close();
+        }
+        Report("metadata.snapshot_open", 0, opens, ElapsedSeconds(start));
+        
+        snapshot.Open(snapshotPath.c_str());
+        MetadataCache cold(1024);
+        cold.SetSnapshot(&snapshot);
+        tracker.SetMetadataCache(&cold, true);
+        PlayEvent built;
+        const int rounds = 2000;
+        start = StartCase();
+        for (int round = 0; round < rounds; round++) {
+            cold.Clear();
+            for (const SimTrack& track : tracks) {
+                tracker.BuildPlayEvent(track.title.c_str(), track.filepath.c_str(), built);
+            }
+        }
+        Report("metadata.snapshot_hit.validated", 0, (uint64_t)rounds * tracks.size(), ElapsedSeconds(start));
+        if (cold.GetSnapshotHits() != (uint64_t)rounds * tracks.size()) {
+            fprintf(stderr, "metadata.snapshot_hit: only %llu hits\n", (unsigned long long)cold.GetSnapshotHits());
+        }
+        snapshot.Close();
+    }
+    remove(snapshotPath.c_str());
+    
+    // Cycling through more files than the cache holds misses every time
+    cache.SetCapacity(BENCH_FILES / 2);
+    tracker.SetMetadataCache(&cache, false);
+    BuildPlays("metadata.cache_miss", tracker, tracks, 200000);
+    
+    for (const SimTrack& track : tracks) {
+        remove(track.filepath.c_str());
+    }
+}
+
+static void RemoveDatabase(const std::string& path) {
+    remove(path.c_str());
+    remove((path + "-journal").c_str());
+    remove((path + "-wal").c_str());
+    remove((path + "-shm").c_str());
+}
+
+static bool EnqueueCountedPlay(const PlayEvent& event) {
+    benchPlays++;
+    return EnqueuePlayEvent(event);
+}
+
+// The whole path as the plugin runs it, after a warm-up: every tick finds
+// a new track (with its tags cached), and the play goes through the
+// writer's queue and the spool to the database (WAL, committing every 64
+// plays). Once warm this should make no allocations of its own.
+static void BenchLogging(const BenchLibrary& library, uint64_t seed, const std::string& dir) {
+    uint64_t state = seed;
+    BenchTrack pick;
+    PlayEvent event;
+    SimTrack track;
+    ManualClock clock(BENCH_END_MS / 1000);
+    SimulatedPlayerSource player(clock);
+    for (int i = 0; i < BENCH_FILES; i++) {
+        library.Pick(state, pick);
+        BenchLibrary::Fill(pick, event);
+        MakeSimTrack(event, NULL, track);
+        track.lengthMs = 500;
+        player.AddTrack(track);
+    }
+    player.Play(0);
+    
+    MetadataCache cache(1024);
+    TrackTracker tracker(player, clock, EnqueueCountedPlay);
+    tracker.SetMetadataCache(&cache, false);
+    
+    std::string path = dir + "/winnp-bench-log.db";
+    std::string spoolPath = dir + "/winnp-bench-log.spool";
+    RemoveDatabase(path);
+    remove(spoolPath.c_str());
+    DatabaseOptions options = { false, true, "normal", -1, 5000 };
+    PlaySpool spool;
+    if (!OpenDatabase(path.c_str(), options) || !spool.Open(spoolPath.c_str())) {
+        fprintf(stderr, "%s: cannot open database and spool\n", path.c_str());
+        CloseDatabase();
+        return;
+    }
+    
+    WriterConfig writerConfig = {};
+    writerConfig.sink = WritePlayEvent;
+    writerConfig.replaySink = WriteSpooledPlayEvent;
+    writerConfig.beginBatch = BeginBatch;
+    writerConfig.commitBatch = CommitBatch;
+    writerConfig.rollbackBatch = RollbackBatch;
+    writerConfig.spool = &spool;
+    writerConfig.policy = OverflowBlock;
+    writerConfig.batchSize = 64;
+    writerConfig.batchMs = 1000;
+    if (StartWriter(writerConfig)) {
+        for (int i = 0; i < 2000; i++) {
+            clock.Advance(500);
+            tracker.Tick();
+        }
+        
+        const uint64_t ticks = 50000;
+        uint64_t playsBefore = benchPlays;
+        auto start = StartCase();
+        for (uint64_t i = 0; i < ticks; i++) {
+            clock.Advance(500);
+            tracker.Tick();
+        }
+        StopWriter();
+        Report("log.steady", 0, benchPlays - playsBefore, ElapsedSeconds(start));
+    }
+    CloseDatabase();
+    spool.Close();
+    RemoveDatabase(path);
+    remove(spoolPath.c_str());
+}
+
+// Bind a play to the INSERT the plugin uses
+static void BindBenchPlay(sqlite3_stmt* stmt, const PlayEvent& event) {
+    sqlite3_bind_int64(stmt, 1, event.playedAtMs);
+    sqlite3_bind_int(stmt, 2, event.utcOffsetMin);
+    for (int field = PlayFilepath; field <= PlayYear; field++) {
+        sqlite3_bind_text(stmt, 3 + field, event.GetText((PlayField)field), (int)event.GetLength((PlayField)field), SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 11, event.durationMs);
+    sqlite3_bind_text(stmt, 12, event.GetText(PlaySource), (int)event.GetLength(PlaySource), SQLITE_STATIC);
+}
+
+// The cost of parsing the INSERT on every play, as the plugin once did,
+// against resetting the statement it now keeps for the connection. All in
+// one transaction, so the disk doesn't drown the difference.
+static void BenchPrepare(const std::vector<PlayEvent>& events, const std::string& path) {
+    static const char* insertSQL =
+        "INSERT INTO play_history (played_at_ms, utc_offset_min, filepath, filename, title, artist, album, genre, track_number, year, duration_ms, source) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    const uint64_t count = 20000;
+    
+    for (int cached = 0; cached < 2; cached++) {
+        RemoveDatabase(path);
+        sqlite3* db = NULL;
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK || !CreateSchema(db, false) ||
+            sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+            fprintf(stderr, "%s: cannot open database\n", path.c_str());
+            sqlite3_close(db);
+            return;
+        }
+        
+        sqlite3_stmt* stmt = NULL;
+        bool written = true;
+        auto start = StartCase();
+        if (cached) {
+            written = sqlite3_prepare_v3(db, insertSQL, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) == SQLITE_OK;
+        }
+        for (uint64_t i = 0; i < count && written; i++) {
+            if (cached) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+            } else if (sqlite3_prepare_v2(db, insertSQL, -1, &stmt, NULL) != SQLITE_OK) {
+                written = false;
+                break;
+            }
+            BindBenchPlay(stmt, events[i % events.size()]);
+            written = sqlite3_step(stmt) == SQLITE_DONE;
+            if (!cached) {
+                sqlite3_finalize(stmt);
+                stmt = NULL;
+            }
+        }
+        sqlite3_finalize(stmt);
+        double seconds = ElapsedSeconds(start);
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+        sqlite3_close(db);
+        
+        if (!written) {
+            fprintf(stderr, "%s: write failed\n", path.c_str());
+            break;
+        }
+        Report(cached ? "insert.prepare.cached" : "insert.prepare.per_call", 0, count, seconds);
+    }
+}
+
+// Plays as the plugin writes them, with SQLite's default synchronous level
+static void BenchInserts(const BenchLibrary& library, uint64_t seed, const std::string& dir) {
+    static const int batchSizes[] = { 1, 8, 64, 512 };
+    std::string path = dir + "/winnp-bench-insert.db";
+    uint64_t state = seed;
+    BenchTrack pick;
+    std::vector<PlayEvent> events(1024);
+    for (PlayEvent& event : events) {
+        library.Pick(state, pick);
+        BenchLibrary::Fill(pick, event);
+    }
+    
+    for (int wal = 0; wal < 2; wal++) {
+        for (int batchSize : batchSizes) {
+            RemoveDatabase(path);
+            DatabaseOptions options = { false, wal != 0, NULL, -1, 5000 };
+            if (!OpenDatabase(path.c_str(), options)) {
+                fprintf(stderr, "%s: cannot open database\n", path.c_str());
+                return;
+            }
+            
+            // Enough commits to time, without waiting minutes on fsyncs
+            uint64_t count = batchSize == 1 ? 2000 : (uint64_t)batchSize * 400;
+            int64_t playedAtMs = BENCH_END_MS;
+            bool written = true;
+            auto start = StartCase();
+            for (uint64_t i = 0; i < count && written; i += batchSize) {
+                written = batchSize == 1 || BeginBatch();
+                for (int j = 0; j < batchSize && written; j++) {
+                    PlayEvent& event = events[(i + j) % events.size()];
+                    event.playedAtMs = playedAtMs;
+                    playedAtMs += event.durationMs;
+                    written = WritePlayEvent(event);
+                }
+                if (batchSize > 1) written = written ? CommitBatch() : (RollbackBatch(), false);
+            }
+            double seconds = ElapsedSeconds(start);
+            CloseDatabase();
+            
+            if (!written) {
+                fprintf(stderr, "%s: write failed\n", path.c_str());
+                break;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "insert.%s.batch%d", wal ? "wal" : "rollback", batchSize);
+            Report(name, 0, count, seconds);
+        }
+    }
+    BenchPrepare(events, path);
+    RemoveDatabase(path);
+}
+
+// Write a history of count plays spread over BENCH_SPAN_MS, in order, as
+// fast as the write path allows; the same seed gives the same plays in
+// either layout
+static bool GenerateHistory(const BenchLibrary& library, uint64_t seed, const std::string& path, uint64_t count,
+                            bool normalized) {
+    RemoveDatabase(path);
+    DatabaseOptions options = { normalized, true, "off", -1, 5000 };
+    if (!OpenDatabase(path.c_str(), options)) return false;
+    
+    uint64_t state = seed;
+    BenchTrack pick;
+    PlayEvent event;
+    int64_t startMs = BENCH_END_MS - BENCH_SPAN_MS;
+    bool written = true;
+    auto start = StartCase();
+    for (uint64_t i = 0; i < count && written; i += 10000) {
+        written = BeginBatch();
+        for (uint64_t j = i; j < count && j < i + 10000 && written; j++) {
+            library.Pick(state, pick);
+            BenchLibrary::Fill(pick, event);
+            event.playedAtMs = startMs + (int64_t)((double)j * BENCH_SPAN_MS / count);
+            written = WritePlayEvent(event);
+        }
+        written = written ? CommitBatch() : (RollbackBatch(), false);
+    }
+    double seconds = ElapsedSeconds(start);
+    CloseDatabase();
+    if (written) Report(normalized ? "history.generate.normalized" : "history.generate", count, count, seconds);
+    return written;
+}
+
+// Write a Last.fm scrobble export of count plays, newest first and a
+// minute apart, as Last.fm's own exports are ordered
+static bool WriteScrobbles(const BenchLibrary& library, uint64_t seed, const std::string& path, uint64_t count) {
+    static const char* monthNames[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    
+    uint64_t state = seed;
+    BenchTrack pick;
+    PlayEvent event;
+    bool written = true;
+    for (uint64_t i = 0; i < count && written; i++) {
+        library.Pick(state, pick);
+        BenchLibrary::Fill(pick, event);
+        
+        // Civil date of the minute (days from 1970-01-01, as in the importer)
+        int64_t minutes = BENCH_END_MS / 60000 - (int64_t)i;
+        int64_t days = minutes / 1440 + 719468;
+        int64_t era = days / 146097;
+        int64_t dayOfEra = days - era * 146097;
+        int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int64_t monthIndex = (5 * dayOfYear + 2) / 153;
+        int day = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+        int month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+        int64_t year = yearOfEra + era * 400 + (month <= 2);
+        
+        written = fprintf(file, "%s,%s,%s,%d %s %lld %02d:%02d\n", event.GetText(PlayArtist), event.GetText(PlayAlbum),
+                          event.GetText(PlayTitle), day, monthNames[month - 1], (long long)year,
+                          (int)(minutes % 1440 / 60), (int)(minutes % 60)) > 0;
+    }
+    return fclose(file) == 0 && written;
+}
+
+// Importing a scrobble export of rows plays into an empty history of each
+// layout, from reading the file to the rollups; ops is the plays imported
+static void BenchImport(const BenchLibrary& library, uint64_t seed, const std::string& dir, uint64_t rows) {
+    char file[64];
+    snprintf(file, sizeof(file), "/winnp-bench-scrobbles-%llu-%llu.csv", (unsigned long long)rows, (unsigned long long)seed);
+    std::string csvPath = dir + file;
+    FILE* existing = fopen(csvPath.c_str(), "rb");
+    if (existing) fclose(existing);
+    else if (!WriteScrobbles(library, seed, csvPath, rows)) {
+        fprintf(stderr, "%s: cannot write scrobbles\n", csvPath.c_str());
+        remove(csvPath.c_str());
+        return;
+    }
+    
+    std::string path = dir + "/winnp-bench-import.db";
+    for (int normalized = 0; normalized < 2; normalized++) {
+        RemoveDatabase(path);
+        if (normalized) {
+            sqlite3* db = NULL;
+            bool created = sqlite3_open(path.c_str(), &db) == SQLITE_OK && CreateSchema(db, true);
+            sqlite3_close(db);
+            if (!created) {
+                fprintf(stderr, "%s: cannot create history\n", path.c_str());
+                break;
+            }
+        }
+        
+        PlayImporter importer;
+        ImportOptions options = { ImportLastfm, "lastfm" };
+        ImportStats stats = {};
+        auto start = StartCase();
+        bool imported = importer.Open(path.c_str()) && importer.ReadFile(csvPath.c_str(), options, stats) && importer.Commit(stats);
+        double seconds = ElapsedSeconds(start);
+        importer.Close();
+        if (!imported) {
+            fprintf(stderr, "%s: import failed\n", path.c_str());
+            break;
+        }
+        Report(normalized ? "import.normalized" : "import.flat", rows, stats.imported, seconds);
+    }
+    RemoveDatabase(path);
+}
+
+static uint64_t CountPlays(const std::string& path) {
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    uint64_t count = 0;
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM play_history", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        count = (uint64_t)sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return count;
+}
+
+// Path of the history of rows plays in the given layout, written first if
+// it is not there yet; empty if it cannot be
+static std::string GetHistory(const BenchLibrary& library, uint64_t seed, const std::string& dir, uint64_t rows,
+                              bool normalized) {
+    char file[64];
+    snprintf(file, sizeof(file), "/winnp-bench-%s%llu-%llu.db", normalized ? "normalized-" : "", (unsigned long long)rows,
+             (unsigned long long)seed);
+    std::string path = dir + file;
+    if (CountPlays(path) != rows && !GenerateHistory(library, seed, path, rows, normalized)) {
+        fprintf(stderr, "%s: cannot write history\n", path.c_str());
+        return std::string();
+    }
+    return path;
+}
+
+static uint64_t GetDatabaseBytes(const std::string& path) {
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    uint64_t bytes = 0;
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size()", -1, &stmt,
+                           NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        bytes = (uint64_t)sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return bytes;
+}
+
+static void BenchQueries(const BenchLibrary& library, uint64_t seed, const std::string& dir, uint64_t rows) {
+    std::string path = GetHistory(library, seed, dir, rows, false);
+    if (path.empty()) return;
+    
+    PlayStats stats;
+    if (!stats.Open(path.c_str())) {
+        fprintf(stderr, "%s: cannot open history\n", path.c_str());
+        return;
+    }
+    
+    StatsWindow all = StatsWindow::All();
+    int64_t endDay = BENCH_END_MS / 86400000;
+    StatsWindow month = StatsWindow::LocalDays(endDay - 30, endDay);
+    StatsWindow year = StatsWindow::LocalDays(endDay - 365, endDay);
+    std::vector<StatsEntry> entries;
+    std::vector<StatsTotal> days;
+    StatsTotal total;
+    uint64_t hours[24];
+    uint64_t weekdays[7];
+    
+    // Each query runs a few times; the first also warms the page cache. The
+    // targets (0 for none) are per query: 150 ms over a month and 1 s over a
+    // year, and 150 ms over all time where the rollups answer it.
+    static const char* queryNames[] = { "top_artists", "top_albums", "top_genres", "top_tracks", "top_artists_30d",
+                                        "hours", "weekdays", "total", "daily_30d", "top_artists_365d", "daily_365d" };
+    static const double rollupTargetMs[] = { 150, 0, 0, 150, 150, 0, 0, 150, 150, 1000, 1000 };
+    static const double rawTargetMs[] = { 0, 0, 0, 0, 150, 0, 0, 0, 150, 1000, 1000 };
+    const int runs = 3;
+    for (int raw = 0; raw < 2; raw++) {
+        stats.UseRollups(raw == 0);
+        for (int i = 0; i < (int)(sizeof(queryNames) / sizeof(queryNames[0])); i++) {
+            bool ok = true;
+            auto start = StartCase();
+            for (int run = 0; run < runs && ok; run++) {
+                switch (i) {
+                case 0: ok = stats.GetTop(StatsByArtist, all, 10, entries); break;
+                case 1: ok = stats.GetTop(StatsByAlbum, all, 10, entries); break;
+                case 2: ok = stats.GetTop(StatsByGenre, all, 10, entries); break;
+                case 3: ok = stats.GetTop(StatsByTrack, all, 10, entries); break;
+                case 4: ok = stats.GetTop(StatsByArtist, month, 10, entries); break;
+                case 5: ok = stats.GetHourHistogram(all, hours); break;
+                case 6: ok = stats.GetWeekdayHistogram(all, weekdays); break;
+                case 7: ok = stats.GetTotal(all, total); break;
+                case 8: ok = stats.GetDailyTotals(month, days); break;
+                case 9: ok = stats.GetTop(StatsByArtist, year, 10, entries); break;
+                case 10: ok = stats.GetDailyTotals(year, days); break;
+                }
+            }
+            double seconds = ElapsedSeconds(start);
+            
+            char name[64];
+            snprintf(name, sizeof(name), "query.%s%s", raw ? "raw." : "", queryNames[i]);
+            if (!ok) {
+                fprintf(stderr, "%s: query failed\n", name);
+                continue;
+            }
+            Report(name, rows, runs, seconds, (raw ? rawTargetMs[i] : rollupTargetMs[i]) * 1e6);
+        }
+    }
+    stats.Close();
+}
+
+// The same history in each layout: its file size, and the top artists
+// read from the plays through play_history (the rollups are the same
+// tables in both)
+static void BenchLayouts(const BenchLibrary& library, uint64_t seed, const std::string& dir, uint64_t rows) {
+    const int runs = 3;
+    for (int normalized = 0; normalized < 2; normalized++) {
+        std::string path = GetHistory(library, seed, dir, rows, normalized != 0);
+        PlayStats stats;
+        if (path.empty() || !stats.Open(path.c_str())) {
+            fprintf(stderr, "%s: cannot open history\n", path.c_str());
+            return;
+        }
+        stats.UseRollups(false);
+        
+        std::vector<StatsEntry> entries;
+        bool ok = true;
+        auto start = StartCase();
+        for (int run = 0; run < runs && ok; run++) {
+            ok = stats.GetTop(StatsByArtist, StatsWindow::All(), 10, entries);
+        }
+        double seconds = ElapsedSeconds(start);
+        stats.Close();
+        
+        const char* name = normalized ? "layout.normalized.top_artists" : "layout.flat.top_artists";
+        if (!ok) {
+            fprintf(stderr, "%s: query failed\n", name);
+            continue;
+        }
+        Report(name, rows, runs, seconds);
+        results.back().bytes = GetDatabaseBytes(path);
+        fprintf(stderr, "%-32s %10llu rows %10.1f MB\n", normalized ? "layout.normalized.size" : "layout.flat.size",
+                (unsigned long long)rows, results.back().bytes / 1048576.0);
+    }
+}
+
+static bool ParseSizes(const char* text, std::vector<uint64_t>& sizes) {
+    sizes.clear();
+    while (*text) {
+        char* end;
+        unsigned long long size = strtoull(text, &end, 10);
+        if (end == text || size == 0 || (*end && *end != ',')) return false;
+        sizes.push_back(size);
+        text = *end ? end + 1 : end;
+    }
+    return !sizes.empty();
+}
+
+static void WriteJson(FILE* out, uint64_t seed) {
+    fprintf(out, "{\n  \"sqlite\": \"%s\",\n  \"pointer_bits\": %d,\n  \"seed\": %llu,\n  \"results\": [",
+            sqlite3_libversion(), (int)sizeof(void*) * 8, (unsigned long long)seed);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"rows\": %llu, \"ops\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.1f, "
+                "\"ops_per_s\": %.1f, \"allocs_per_op\": %.3f",
+                i ? "," : "", result.name.c_str(), (unsigned long long)result.rows, (unsigned long long)result.ops,
+                result.seconds, result.ops ? result.seconds * 1e9 / result.ops : 0.0,
+                result.seconds > 0 ? result.ops / result.seconds : 0.0,
+                result.ops ? (double)result.allocations / result.ops : 0.0);
+        if (result.bytes) fprintf(out, ", \"bytes\": %llu", (unsigned long long)result.bytes);
+        if (result.targetNs > 0) {
+            fprintf(out, ", \"target_ns_per_op\": %.1f, \"pass\": %s", result.targetNs, MeetsTarget(result) ? "true" : "false");
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static int Usage() {
+    fprintf(stderr, "usage: winnp-bench [--only tick|metadata|insert|log|query|layout|import] [--sizes <n>[,<n>...]] [--dir <path>] [--seed <n>] [--output <path>]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    const char* only = NULL;
+    const char* outputPath = NULL;
+    std::string dir = ".";
+    uint64_t seed = 1;
+    std::vector<uint64_t> sizes = { 100000, 1000000, 5000000, 10000000 };
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) only = argv[++i];
+        else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            if (!ParseSizes(argv[++i], sizes)) return Usage();
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) outputPath = argv[++i];
+        else return Usage();
+    }
+    if (only && strcmp(only, "tick") != 0 && strcmp(only, "metadata") != 0 &&
+        strcmp(only, "insert") != 0 && strcmp(only, "log") != 0 && strcmp(only, "query") != 0 &&
+        strcmp(only, "layout") != 0 && strcmp(only, "import") != 0) {
+        return Usage();
+    }
+    
+    BenchLibrary library;
+    if (!only || strcmp(only, "tick") == 0) BenchTicks(library, seed);
+    if (!only || strcmp(only, "metadata") == 0) BenchMetadata(library, seed, dir);
+    if (!only || strcmp(only, "insert") == 0) BenchInserts(library, seed, dir);
+    if (!only || strcmp(only, "log") == 0) BenchLogging(library, seed, dir);
+    if (!only || strcmp(only, "query") == 0) {
+        for (uint64_t rows : sizes) {
+            BenchQueries(library, seed, dir, rows);
+        }
+    }
+    if (!only || strcmp(only, "layout") == 0) {
+        for (uint64_t rows : sizes) {
+            BenchLayouts(library, seed, dir, rows);
+        }
+    }
+    if (!only || strcmp(only, "import") == 0) {
+        BenchImport(library, seed, dir, *std::max_element(sizes.begin(), sizes.end()));
+    }
+    
+    FILE* out = outputPath ? fopen(outputPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: cannot write results\n", outputPath);
+        return 1;
+    }
+    WriteJson(out, seed);
+    if (outputPath) fclose(out);
+    return 0;
+}
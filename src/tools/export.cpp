@@ -0,0 +1,115 @@
+// winnp-export: stream plays out of a play history database.
+//
+//   winnp-export <database> [--format csv|jsonl|columnar] [--output <path>]
+//                [--after-id <n>] [--state <path>] [--row-group <n>]
+//
+// Writes CSV to standard output by default. --after-id exports only plays
+// logged after the play with that id. --state does the same with the id
+// kept in a file: read from it if it exists, and replaced by the id of the
+// last play exported once the export has succeeded, so a nightly job moves
+// only the new plays.
+
+#include "exporter.h"
+#include "util.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static int Usage() {
+    fprintf(stderr, "usage: winnp-export <database> [--format csv|jsonl|columnar] [--output <path>]\n"
+                    "                    [--after-id <n>] [--state <path>] [--row-group <n>]\n");
+    return 2;
+}
+
+static bool ParseFormat(const char* name, ExportFormat& format) {
+    if (strcmp(name, "csv") == 0) format = ExportCsv;
+    else if (strcmp(name, "jsonl") == 0) format = ExportJsonLines;
+    else if (strcmp(name, "columnar") == 0) format = ExportColumnar;
+    else return false;
+    return true;
+}
+
+static bool ReadState(const char* path, int64_t& lastId) {
+    FILE* file = OpenFile(path, "r");
+    if (!file) return true;  // First run
+    
+    long long id = 0;
+    bool ok = fscanf(file, "%lld", &id) == 1;
+    fclose(file);
+    if (ok) lastId = id;
+    return ok;
+}
+
+// Write to a temporary file first so a crash can't leave the state empty
+static bool WriteState(const char* path, int64_t lastId) {
+    std::string temp = std::string(path) + ".tmp";
+    FILE* file = OpenFile(temp.c_str(), "w");
+    if (!file) return false;
+    
+    bool ok = fprintf(file, "%lld\n", (long long)lastId) > 0;
+    ok = fclose(file) == 0 && ok;
+    remove(path);
+    return ok && rename(temp.c_str(), path) == 0;
+}
+
+int main(int argc, char** argv) {
+    const char* dbPath = NULL;
+    const char* outputPath = NULL;
+    const char* statePath = NULL;
+    ExportOptions options = { ExportCsv, 0, EXPORT_ROW_GROUP_SIZE };
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!ParseFormat(argv[++i], options.format)) return Usage();
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) outputPath = argv[++i];
+        else if (strcmp(argv[i], "--after-id") == 0 && i + 1 < argc) options.afterId = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) statePath = argv[++i];
+        else if (strcmp(argv[i], "--row-group") == 0 && i + 1 < argc) options.rowGroupSize = atoi(argv[++i]);
+        else if (!dbPath && argv[i][0] != '-') dbPath = argv[i];
+        else return Usage();
+    }
+    if (!dbPath) return Usage();
+    if (!outputPath && options.format == ExportColumnar) {
+        fprintf(stderr, "columnar export needs --output\n");
+        return 2;
+    }
+    
+    if (statePath && !ReadState(statePath, options.afterId)) {
+        fprintf(stderr, "%s: cannot read the last exported id\n", statePath);
+        return 1;
+    }
+    
+    PlayExporter exporter;
+    if (!exporter.Open(dbPath)) {
+        fprintf(stderr, "%s: cannot open play history\n", dbPath);
+        return 1;
+    }
+    
+    FILE* out = outputPath ? OpenFile(outputPath, "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: cannot create\n", outputPath);
+        return 1;
+    }
+    static char buffer[1 << 16];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+    
+    auto start = std::chrono::steady_clock::now();
+    uint64_t rows = 0;
+    int64_t lastId = 0;
+    bool ok = exporter.Export(out, options, rows, lastId);
+    if (outputPath) ok = fclose(out) == 0 && ok;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    if (!ok) {
+        fprintf(stderr, "%s: export failed\n", dbPath);
+        return 1;
+    }
+    if (statePath && !WriteState(statePath, lastId)) {
+        fprintf(stderr, "%s: cannot save the last exported id\n", statePath);
+        return 1;
+    }
+    fprintf(stderr, "exported %llu plays (last id %lld) in %.2f s\n", (unsigned long long)rows, (long long)lastId, seconds);
+    return 0;
+}
@@ -0,0 +1,246 @@
+// winnp-replay: run a scenario through the track detector against a
+// simulated Winamp on a virtual clock, and report throughput and whether
+// every play was detected exactly once.
+//
+//   winnp-replay <scenario> [--tick <ms>] [--events] [--adaptive] [--db <path> [--spool <path>]] [--batch <n>] [--cache <n>] [--normalized] [--metrics] [--wide]
+//
+// With --events the detector also runs on each player notification, and
+// the periodic tick (default 5000 ms) is only a fallback. With --adaptive
+// the tick interval follows the play state and track position instead.
+// With --spool, plays bound for the database pass through a spool file.
+// --metrics turns on the plugin's instrumentation and prints it; comparing
+// the wall time with and without it gives its cost per tick. --wide hands
+// all text over as UTF-16, as Winamp's wide IPC messages do.
+//
+// Every play's text is also checked against the track that was playing,
+// so names that don't survive the trip (truncated, mangled) are reported.
+
+#include "database.h"
+#include "pollschedule.h"
+#include "simplayer.h"
+#include "spool.h"
+#include "tracker.h"
+#include "writer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static uint64_t detectedPlays = 0;
+static uint64_t playerEvents = 0;
+static uint64_t alteredPlays = 0;
+static bool writeToDatabase = false;
+static SimulatedPlayerSource* replayPlayer = NULL;
+
+// What the timer and event callbacks act on
+struct Replay {
+    TrackTracker* tracker;
+    ManualTimer* timer;
+    PollScheduler* scheduler;  // NULL for a fixed interval
+};
+
+// True if the play's text is exactly that of the track playing
+static bool MatchesTrack(const PlayEvent& event, const SimTrack& track) {
+    return track.filepath == event.GetText(PlayFilepath) &&
+           (track.title.empty() || track.title == event.GetText(PlayTitle)) &&
+           track.artist == event.GetText(PlayArtist) && track.album == event.GetText(PlayAlbum) &&
+           track.genre == event.GetText(PlayGenre) && track.trackNumber == event.GetText(PlayTrackNumber) &&
+           track.year == event.GetText(PlayYear);
+}
+
+static bool CountPlayEvent(const PlayEvent& event) {
+    detectedPlays++;
+    const SimTrack* track = replayPlayer->GetCurrentTrack();
+    if (track && !MatchesTrack(event, *track)) {
+        if (alteredPlays == 0) {
+            fprintf(stderr, "text altered: \"%s\" logged as \"%s\"\n", track->filepath.c_str(), event.GetText(PlayFilepath));
+        }
+        alteredPlays++;
+    }
+    return writeToDatabase ? EnqueuePlayEvent(event) : true;
+}
+
+// Same as the plugin's PollTick
+static void ReplayTick(void* context) {
+    Replay* replay = (Replay*)context;
+    replay->tracker->Tick();
+    if (replay->scheduler) {
+        TrackTracker* tracker = replay->tracker;
+        unsigned int next = replay->scheduler->Next(tracker->IsIdle(), tracker->GetPositionMs(), tracker->GetLengthMs());
+        if (next != replay->timer->GetInterval()) replay->timer->SetInterval(next);
+    }
+}
+
+static void ReplayPlayerEvent(PlayerEvent event, void* context) {
+    Replay* replay = (Replay*)context;
+    replay->tracker->NotifyPlayerEvent(event);
+    replay->timer->TickNow();
+    playerEvents++;
+}
+
+static int Usage() {
+    fprintf(stderr, "usage: winnp-replay <scenario> [--tick <ms>] [--events] [--adaptive] [--db <path> [--spool <path>]] [--batch <n>] [--cache <n>] [--normalized] [--metrics] [--wide]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    const char* scenarioPath = NULL;
+    const char* dbPath = NULL;
+    const char* spoolPath = NULL;
+    unsigned int tickMs = 0;
+    int batchSize = 512;
+    int cacheSize = 0;
+    bool normalized = false;
+    bool events = false;
+    bool adaptive = false;
+    bool instrument = false;
+    bool wide = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) tickMs = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) dbPath = argv[++i];
+        else if (strcmp(argv[i], "--spool") == 0 && i + 1 < argc) spoolPath = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batchSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) cacheSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--normalized") == 0) normalized = true;
+        else if (strcmp(argv[i], "--events") == 0) events = true;
+        else if (strcmp(argv[i], "--adaptive") == 0) adaptive = true;
+        else if (strcmp(argv[i], "--metrics") == 0) instrument = true;
+        else if (strcmp(argv[i], "--wide") == 0) wide = true;
+        else if (!scenarioPath && argv[i][0] != '-') scenarioPath = argv[i];
+        else return Usage();
+    }
+    if (!scenarioPath || (spoolPath && !dbPath)) return Usage();
+    if (tickMs == 0) tickMs = events ? 5000 : 500;
+    
+    Scenario scenario;
+    std::string error;
+    if (!scenario.Load(scenarioPath, error)) {
+        fprintf(stderr, "%s: %s\n", scenarioPath, error.c_str());
+        return 1;
+    }
+    
+    // 2025-01-01 00:00:00 UTC
+    ManualClock clock(1735689600);
+    SimulatedPlayerSource player(clock);
+    player.SetWideText(wide);
+    replayPlayer = &player;
+    TrackTracker tracker(player, clock, CountPlayEvent);
+    MetadataCache cache(cacheSize > 0 ? (size_t)cacheSize : 0);
+    if (cacheSize > 0) {
+        tracker.SetMetadataCache(&cache, false);
+    }
+    PlayMetrics metrics;
+    if (instrument) {
+        tracker.SetMetrics(&metrics);
+    }
+    ManualTimer timer;
+    PollScheduler scheduler;
+    Replay replay = { &tracker, &timer, adaptive ? &scheduler : NULL };
+    if (events) {
+        player.SubscribeEvents(ReplayPlayerEvent, &replay);
+    }
+    
+    PlaySpool spool;
+    if (dbPath) {
+        DatabaseOptions options = { normalized, true, "normal", -1, 5000 };
+        if (!OpenDatabase(dbPath, options)) {
+            fprintf(stderr, "%s: cannot open database\n", dbPath);
+            return 1;
+        }
+        if (spoolPath && !spool.Open(spoolPath)) {
+            fprintf(stderr, "%s: cannot open spool\n", spoolPath);
+            CloseDatabase();
+            return 1;
+        }
+        
+        // Block rather than drop: a replay produces plays far faster than real time
+        WriterConfig writerConfig = {};
+        writerConfig.sink = WritePlayEvent;
+        writerConfig.replaySink = WriteSpooledPlayEvent;
+        writerConfig.beginBatch = BeginBatch;
+        writerConfig.commitBatch = CommitBatch;
+        writerConfig.rollbackBatch = RollbackBatch;
+        writerConfig.spool = spoolPath ? &spool : NULL;
+        writerConfig.policy = OverflowBlock;
+        writerConfig.batchSize = batchSize;
+        writerConfig.batchMs = 1000;
+        writerConfig.metrics = instrument ? &metrics : NULL;
+        if (!StartWriter(writerConfig)) {
+            CloseDatabase();
+            return 1;
+        }
+        writeToDatabase = true;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    timer.Start(tickMs, ReplayTick, &replay);
+    RunScenario(scenario, player, clock, timer);
+    if (writeToDatabase) {
+        StopWriter();
+        CloseDatabase();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    uint64_t ticks = timer.GetTicks();
+    uint64_t expected = player.GetStartedPlays();
+    
+    printf("virtual time:   %.1f days\n", clock.MonotonicMs() / 86400000.0);
+    printf("wall time:      %.3f s\n", seconds);
+    printf("ticks:          %llu (%.0f/s)\n", (unsigned long long)ticks, seconds > 0 ? ticks / seconds : 0.0);
+    if (events) {
+        printf("player events:  %llu\n", (unsigned long long)playerEvents);
+    }
+    if (adaptive) {
+        printf("poll schedule: ");
+        for (int i = 0; i < PollReasonCount; i++) {
+            printf(" %llu %s", (unsigned long long)scheduler.GetDecisions((PollReason)i), GetPollReasonName((PollReason)i));
+        }
+        printf("\n");
+    }
+    const TickStats& tickStats = tracker.GetTickStats();
+    printf("fast-path ticks: %llu of %llu while playing\n", (unsigned long long)tickStats.fastPath,
+           (unsigned long long)tickStats.playing);
+    printf("player queries: %llu\n", (unsigned long long)player.GetQueryCount());
+    printf("plays started:  %llu\n", (unsigned long long)expected);
+    printf("plays detected: %llu (%.0f/s)\n", (unsigned long long)detectedPlays, seconds > 0 ? detectedPlays / seconds : 0.0);
+    if (writeToDatabase) {
+        printf("events dropped: %lu\n", GetDroppedEventCount());
+        if (spoolPath) {
+            printf("events lost:    %lu\n", GetLostEventCount());
+        }
+    }
+    
+    if (cacheSize > 0) {
+        printf("metadata cache: %llu hits, %llu misses, %llu evictions\n", (unsigned long long)cache.GetHits(),
+               (unsigned long long)cache.GetMisses(), (unsigned long long)cache.GetEvictions());
+    }
+    
+    const MetadataStats& metadata = tracker.GetMetadataStats();
+    if (metadata.fetches > 0) {
+        printf("metadata fetch: %.2f us avg, %u us max\n", (double)metadata.totalUs / metadata.fetches, metadata.maxUs);
+        for (int i = 0; i < METADATA_FIELD_COUNT; i++) {
+            const FieldTiming& field = metadata.fields[i];
+            printf("  %-7s       %.2f us avg, %u us max\n", GetMetadataFieldName(i),
+                   field.calls ? (double)field.totalUs / field.calls : 0.0, field.maxUs);
+        }
+    }
+    
+    if (instrument) {
+        std::string report;
+        metrics.Format(report);
+        printf("metrics:\n%s", report.c_str());
+    }
+    
+    if (detectedPlays != expected) {
+        printf("MISMATCH: %lld plays %s\n", (long long)(detectedPlays > expected ? detectedPlays - expected : expected - detectedPlays),
+               detectedPlays > expected ? "double-counted" : "missed");
+        return 1;
+    }
+    if (alteredPlays > 0) {
+        printf("MISMATCH: %llu plays with altered text\n", (unsigned long long)alteredPlays);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+// winnp-stats: print listening statistics from a play history database,
+// with how long each query took.
+//
+//   winnp-stats <database> [--days <n>] [--top <n>] [--daily] [--raw] [--plans] [--rebuild]
+//
+// --days limits everything to the last n local days, today included
+// (default: all time), --daily adds a line per day, --raw reads the plays
+// even where the rollups could answer, and --plans prints how SQLite runs
+// each query, failing if any reads play rows rather than the covering
+// index. --rebuild regenerates the rollups from the plays instead.
+
+#include "stats.h"
+#include "util.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef std::chrono::steady_clock StatsClock;
+
+static double ElapsedMs(StatsClock::time_point start) {
+    return std::chrono::duration<double, std::milli>(StatsClock::now() - start).count();
+}
+
+static int Usage() {
+    fprintf(stderr, "usage: winnp-stats <database> [--days <n>] [--top <n>] [--daily] [--raw] [--plans] [--rebuild]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    const char* dbPath = NULL;
+    int days = 0;
+    int top = 10;
+    bool daily = false;
+    bool plans = false;
+    bool raw = false;
+    bool rebuild = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) days = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--daily") == 0) daily = true;
+        else if (strcmp(argv[i], "--plans") == 0) plans = true;
+        else if (strcmp(argv[i], "--raw") == 0) raw = true;
+        else if (strcmp(argv[i], "--rebuild") == 0) rebuild = true;
+        else if (!dbPath && argv[i][0] != '-') dbPath = argv[i];
+        else return Usage();
+    }
+    if (!dbPath) return Usage();
+    
+    if (rebuild) {
+        sqlite3* db = NULL;
+        bool rebuilt = sqlite3_open_v2(dbPath, &db, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK &&
+                       sqlite3_busy_timeout(db, 5000) == SQLITE_OK;
+        auto start = StatsClock::now();
+        rebuilt = rebuilt && RebuildRollups(db);
+        if (rebuilt) printf("rollups rebuilt (%.1f ms)\n", ElapsedMs(start));
+        else fprintf(stderr, "%s: cannot rebuild rollups: %s\n", dbPath, db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        return rebuilt ? 0 : 1;
+    }
+    
+    PlayStats stats;
+    if (!stats.Open(dbPath)) {
+        fprintf(stderr, "%s: cannot open play history\n", dbPath);
+        return 1;
+    }
+    stats.UseRollups(!raw);
+    
+    if (plans) {
+        std::string report;
+        bool covered = stats.CheckQueryPlans(report);
+        printf("%s", report.c_str());
+        printf(covered ? "all queries read plays from the covering index\n" : "some queries read play rows (see !)\n");
+        return covered ? 0 : 1;
+    }
+    
+    StatsWindow window = StatsWindow::All();
+    if (days > 0) {
+        time_t now = time(NULL);
+        int64_t today = ((int64_t)now + GetUtcOffsetMinutes(now) * 60) / 86400;
+        window = StatsWindow::LocalDays(today + 1 - days, today + 1);
+    }
+    
+    auto start = StatsClock::now();
+    StatsTotal total;
+    if (!stats.GetTotal(window, total)) {
+        fprintf(stderr, "%s: query failed\n", dbPath);
+        return 1;
+    }
+    printf("plays: %llu, %.1f hours (%.1f ms)\n", (unsigned long long)total.plays, total.playTimeMs / 3600000.0, ElapsedMs(start));
+    
+    const char* groupNames[StatsGroupCount] = { "artists", "albums", "genres", "tracks" };
+    for (int group = 0; group < StatsGroupCount; group++) {
+        std::vector<StatsEntry> entries;
+        start = StatsClock::now();
+        stats.GetTop((StatsGroup)group, window, top, entries);
+        printf("\ntop %s (%.1f ms)\n", groupNames[group], ElapsedMs(start));
+        for (const StatsEntry& entry : entries) {
+            printf("  %6llu  %s%s%s\n", (unsigned long long)entry.plays, entry.name.c_str(),
+                   entry.artist.empty() ? "" : " - ", entry.artist.c_str());
+        }
+    }
+    
+    uint64_t hours[24];
+    start = StatsClock::now();
+    stats.GetHourHistogram(window, hours);
+    printf("\nplays by hour (%.1f ms)\n", ElapsedMs(start));
+    for (int hour = 0; hour < 24; hour++) {
+        printf("  %02d  %llu\n", hour, (unsigned long long)hours[hour]);
+    }
+    
+    const char* weekdayNames[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    uint64_t weekdays[7];
+    start = StatsClock::now();
+    stats.GetWeekdayHistogram(window, weekdays);
+    printf("\nplays by weekday (%.1f ms)\n", ElapsedMs(start));
+    for (int weekday = 0; weekday < 7; weekday++) {
+        printf("  %s  %llu\n", weekdayNames[weekday], (unsigned long long)weekdays[weekday]);
+    }
+    
+    if (daily) {
+        std::vector<StatsTotal> totals;
+        start = StatsClock::now();
+        stats.GetDailyTotals(window, totals);
+        printf("\nplay time by day (%.1f ms)\n", ElapsedMs(start));
+        for (const StatsTotal& day : totals) {
+            printf("  %s  %5llu plays  %6.1f hours\n", day.day.c_str(), (unsigned long long)day.plays, day.playTimeMs / 3600000.0);
+        }
+    }
+    return 0;
+}
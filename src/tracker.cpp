@@ -0,0 +1,253 @@
+#include "tracker.h"
+#include "util.h"
+#include <cstdlib>
+#include <cstring>
+
+// How far the playback position may fall behind the clock between ticks
+// (output latency, timer jitter) and still count as the same play
+#define POSITION_SLACK_MS 1000
+
+static const char* metadataFieldNames[METADATA_FIELD_COUNT] = {
+    "artist", "album", "genre", "track", "year", "length", "title"
+};
+
+const char* GetMetadataFieldName(int index) {
+    return index >= 0 && index < METADATA_FIELD_COUNT ? metadataFieldNames[index] : "";
+}
+
+TrackTracker::TrackTracker(PlayerSource& source, Clock& clock, PlayEventEmitter emit)
+    : source(source), clock(clock), emit(emit), metadataCache(NULL), validateCache(false), metrics(NULL) {
+    sourceName[0] = '\0';
+    memset(&metadataStats, 0, sizeof(metadataStats));
+    memset(&tickStats, 0, sizeof(tickStats));
+    Reset();
+}
+
+void TrackTracker::Reset() {
+    idle = true;
+    currentTitleHash = 0;
+    currentTitle[0] = '\0';
+    lastFilepathHash = 0;
+    knownPlay = false;
+    lastListPos = -1;
+    lastPositionPercent = 0;
+    positionMs = -1;
+    lengthMs = -1;
+    lastTickMs = 0;
+    trackStarted = false;
+}
+
+void TrackTracker::NotifyPlayerEvent(PlayerEvent event) {
+    if (event == PlayerEventTrackStarted) {
+        trackStarted = true;
+    }
+}
+
+void TrackTracker::SetMetadataCache(MetadataCache* cache, bool validate) {
+    metadataCache = cache;
+    validateCache = validate;
+}
+
+void TrackTracker::SetSourceName(const char* name) {
+    CopyString(sourceName, sizeof(sourceName), name ? name : "");
+}
+
+void TrackTracker::SetMetrics(PlayMetrics* tickMetrics) {
+    metrics = tickMetrics;
+}
+
+void TrackTracker::FetchMetadata(const char* filepath, TrackMetadata& metadata) {
+    char lengthStr[32] = "";
+    MetadataField fields[METADATA_FIELD_COUNT] = {
+        { metadataFieldNames[0], metadata.artist, sizeof(metadata.artist), 0 },
+        { metadataFieldNames[1], metadata.album, sizeof(metadata.album), 0 },
+        { metadataFieldNames[2], metadata.genre, sizeof(metadata.genre), 0 },
+        { metadataFieldNames[3], metadata.trackNumber, sizeof(metadata.trackNumber), 0 },
+        { metadataFieldNames[4], metadata.year, sizeof(metadata.year), 0 },
+        { metadataFieldNames[5], lengthStr, sizeof(lengthStr), 0 },
+        { metadataFieldNames[6], metadata.title, sizeof(metadata.title), 0 },
+    };
+    
+    // All fields in one batch
+    uint64_t startNs = MetricsNowNs();
+    source.GetExtendedFileInfoBatch(filepath, fields, METADATA_FIELD_COUNT);
+    uint64_t elapsedNs = MetricsNowNs() - startNs;
+    uint32_t elapsedUs = (uint32_t)(elapsedNs / 1000);
+    if (metrics) metrics->Record(MetricMetadata, elapsedNs);
+    
+    metadataStats.fetches++;
+    metadataStats.totalUs += elapsedUs;
+    if (elapsedUs > metadataStats.maxUs) metadataStats.maxUs = elapsedUs;
+    for (int i = 0; i < METADATA_FIELD_COUNT; i++) {
+        FieldTiming& timing = metadataStats.fields[i];
+        timing.calls++;
+        timing.totalUs += fields[i].elapsedUs;
+        if (fields[i].elapsedUs > timing.maxUs) timing.maxUs = fields[i].elapsedUs;
+    }
+    
+    // Parse duration (length is in milliseconds as string, or might be in seconds)
+    metadata.durationMs = 0;
+    if (strlen(lengthStr) > 0) {
+        metadata.durationMs = atoi(lengthStr);
+        // If it looks like seconds (< 10000), convert to ms
+        if (metadata.durationMs > 0 && metadata.durationMs < 10000) {
+            metadata.durationMs *= 1000;
+        }
+    }
+}
+
+void TrackTracker::BuildPlayEvent(const char* title, const char* filepath, PlayEvent& event) {
+    event.Clear();
+    if (!filepath) filepath = "";
+    
+    // Timestamp as UTC, keeping the local offset so local time can be recovered
+    event.playedAtMs = clock.NowMs();
+    event.utcOffsetMin = GetUtcOffsetMinutes((time_t)(event.playedAtMs / 1000));
+    
+    // The filename is the end of the path
+    size_t filepathLength = strlen(filepath);
+    const char* filename = FindFilename(filepath);
+    event.SetText(PlayFilepath, filepath, filepathLength);
+    event.SetText(PlayFilename, filename, filepathLength - (size_t)(filename - filepath));
+    event.SetText(PlaySource, sourceName);
+    
+    // Get extended metadata, from the cache if this file has been played before
+    TrackMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    
+    if (filepathLength > 0) {
+        FileStamp stamp = FileStamp();
+        if (metadataCache && validateCache) {
+            GetFileStamp(filepath, stamp);
+        }
+        
+        if (!metadataCache || !metadataCache->Lookup(filepath, &stamp, metadata)) {
+            FetchMetadata(filepath, metadata);
+            if (metadataCache) {
+                metadataCache->Store(filepath, &stamp, metadata);
+            }
+        }
+    }
+    
+    event.SetText(PlayArtist, metadata.artist);
+    event.SetText(PlayAlbum, metadata.album);
+    event.SetText(PlayGenre, metadata.genre);
+    event.SetText(PlayTrackNumber, metadata.trackNumber);
+    event.SetText(PlayYear, metadata.year);
+    event.durationMs = metadata.durationMs;
+    
+    // Use title from parameter if metadata title is empty
+    event.SetText(PlayTitle, metadata.title[0] ? metadata.title : title);
+}
+
+void TrackTracker::Tick() {
+    StageTimer timer(metrics, MetricTick);
+    if (metrics) metrics->Count(MetricTicks);
+    if (!source.IsAvailable()) return;
+    
+    // Check if the player is playing
+    int playState = source.GetPlayState();
+    bool wasIdle = idle;
+    idle = playState != PLAYSTATE_PLAYING;
+    if (idle) return;
+    
+    bool restarted = trackStarted.exchange(false);
+    uint64_t now = clock.MonotonicMs();
+    
+    // How far the last play had got when the player said it started again:
+    // had it kept playing since the last tick, at least as far as the clock
+    // has moved on (notifications may come long after the last tick saw it)
+    int reachedPercent = lastPositionPercent;
+    if (restarted && !wasIdle && positionMs >= 0 && lengthMs > 0) {
+        int64_t reachedMs = (int64_t)positionMs + (int64_t)(now - lastTickMs);
+        reachedPercent = reachedMs >= lengthMs ? 100 : (int)(reachedMs * 100 / lengthMs);
+    }
+    
+    // Cheap signals first: playlist entry, then position and length (also
+    // needed for repeat detection)
+    int position = source.GetListPos();
+    int currentPosMs = source.GetOutputTime(0);
+    int trackLengthMs = source.GetOutputTime(1);
+    
+    int currentPercent = 0;
+    if (trackLengthMs > 0 && currentPosMs >= 0) {
+        currentPercent = (int)(((long long)currentPosMs * 100) / trackLengthMs);
+    }
+    
+    // The same entry with the same length, playing on at the pace of the
+    // clock with no restart reported, is still the play already logged, so
+    // there's no need to fetch and compare its title and path. Streams (no
+    // length) always take the full path since their titles change.
+    bool samePlay = knownPlay && !restarted && position >= 0 && position == lastListPos &&
+                    trackLengthMs > 0 && trackLengthMs == lengthMs && positionMs >= 0 &&
+                    (int64_t)currentPosMs >= (int64_t)positionMs + (int64_t)(now - lastTickMs) - POSITION_SLACK_MS;
+    
+    lastListPos = position;
+    positionMs = currentPosMs;
+    lengthMs = trackLengthMs;
+    lastTickMs = now;
+    tickStats.playing++;
+    
+    if (samePlay) {
+        tickStats.fastPath++;
+        lastPositionPercent = currentPercent;
+        return;
+    }
+    
+    // Get current track info
+    char title[PLAYEVENT_TITLE_LEN] = "";
+    char filepath[PLAYEVENT_PATH_LEN] = "";
+    
+    if (position >= 0) {
+        source.GetPlaylistTitle(position, title, sizeof(title));
+        source.GetPlaylistFile(position, filepath, sizeof(filepath));
+    }
+    
+    // Fallback: get title some other way (e.g. from the window caption)
+    if (title[0] == '\0') {
+        source.GetFallbackTitle(title, sizeof(title));
+    }
+    
+    uint64_t titleHash = title[0] ? HashString(title) : 0;
+    uint64_t filepathHash = filepath[0] ? HashString(filepath) : 0;
+    
+    // A different hash is a different title; the same hash is confirmed
+    // against the title itself, so a collision can't merge two plays
+    bool sameTitle = titleHash && titleHash == currentTitleHash && strcmp(title, currentTitle) == 0;
+    
+    bool shouldLog = false;
+    
+    // Check if track has changed
+    if (titleHash && !sameTitle) {
+        shouldLog = true;
+        if (metrics) metrics->Count(MetricChanges);
+    }
+    // Check for repeat: same track, was at 90%+, now at <5%. Stopping and
+    // starting it again, or starting it again mid-track, is the same play.
+    else if (filepathHash && filepathHash == lastFilepathHash &&
+             reachedPercent >= 90 && currentPercent < 5) {
+        shouldLog = true;
+        if (metrics) metrics->Count(MetricRepeats);
+    }
+    
+    if (shouldLog && titleHash) {
+        currentTitleHash = titleHash;
+        CopyString(currentTitle, sizeof(currentTitle), title);
+        lastFilepathHash = filepathHash;
+        sameTitle = true;
+        
+        PlayEvent event;
+        BuildPlayEvent(title, filepath, event);
+        emit(event);
+    }
+    
+    // Update last position (only if we got a valid reading)
+    if (trackLengthMs > 0) {
+        lastPositionPercent = currentPercent;
+        if (filepathHash) {
+            lastFilepathHash = filepathHash;
+        }
+    }
+    
+    knownPlay = sameTitle;
+}
@@ -0,0 +1,112 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include "metacache.h"
+#include "metrics.h"
+#include "playevent.h"
+#include "playersource.h"
+#include "timing.h"
+#include <atomic>
+
+// Metadata fields fetched for every play
+#define METADATA_FIELD_COUNT 7
+
+// Accumulated timings of metadata lookups
+struct FieldTiming {
+    uint64_t calls;
+    uint64_t totalUs;
+    uint32_t maxUs;
+};
+
+struct MetadataStats {
+    uint64_t fetches;        // Batched lookups (one per logged play)
+    uint64_t totalUs;        // Wall time of the whole batch, including any marshalling
+    uint32_t maxUs;
+    FieldTiming fields[METADATA_FIELD_COUNT];  // Per field, in GetMetadataFieldName order
+};
+
+// How ticks that found the player playing were resolved
+struct TickStats {
+    uint64_t playing;   // Ticks that found the player playing
+    uint64_t fastPath;  // ...of which were settled without fetching the title and path
+};
+
+// Name of metadata field i ("artist", "album", ...)
+const char* GetMetadataFieldName(int index);
+
+// Receives each detected play; returns false if the event was dropped
+typedef bool (*PlayEventEmitter)(const PlayEvent& event);
+
+// Track change detection. Each Tick polls the player source and emits a
+// PlayEvent when a new track starts or the current track repeats.
+class TrackTracker {
+public:
+    TrackTracker(PlayerSource& source, Clock& clock, PlayEventEmitter emit);
+    
+    // Poll the player once
+    void Tick();
+    
+    // Forget the current track, e.g. after the player restarts
+    void Reset();
+    
+    // Note a player notification. Safe to call from any thread; the next
+    // Tick takes it into account (the same track starting again is a repeat
+    // only once it had played to near its end, which polling alone must
+    // see for itself but a notification can show between ticks).
+    void NotifyPlayerEvent(PlayerEvent event);
+    
+    // True if the last tick found the player stopped or paused
+    bool IsIdle() const { return idle; }
+    
+    // Position and length of the current track at the last tick (-1 if unknown)
+    int GetPositionMs() const { return positionMs; }
+    int GetLengthMs() const { return lengthMs; }
+    
+    // Gather time and extended metadata for a track into a play event
+    void BuildPlayEvent(const char* title, const char* filepath, PlayEvent& event);
+    
+    // Tick counts since construction (read on the polling thread)
+    const TickStats& GetTickStats() const { return tickStats; }
+    
+    // Metadata lookup timings since construction (read on the polling thread)
+    const MetadataStats& GetMetadataStats() const { return metadataStats; }
+    
+    // Serve repeat plays from a metadata cache (NULL to disable). With
+    // validate set, each file's size/mtime is checked against the cache.
+    void SetMetadataCache(MetadataCache* cache, bool validate);
+    
+    // Name of this instance (e.g. its zone), recorded with every play
+    void SetSourceName(const char* name);
+    
+    // Time ticks and metadata fetches, and count ticks, changes and
+    // repeats, into metrics (NULL to stop)
+    void SetMetrics(PlayMetrics* metrics);
+
+private:
+    // Ask the player for a file's tags
+    void FetchMetadata(const char* filepath, TrackMetadata& metadata);
+    
+    PlayerSource& source;
+    Clock& clock;
+    PlayEventEmitter emit;
+    
+    bool idle;
+    uint64_t currentTitleHash;              // Title of the last logged play (0 = none)
+    char currentTitle[PLAYEVENT_TITLE_LEN]; // ...and the title itself, should two hashes collide
+    uint64_t lastFilepathHash;              // Track filepath for repeat detection (0 = none)
+    bool knownPlay;                         // The last tick saw the last logged play
+    int lastListPos;
+    int lastPositionPercent;                // Track position percentage (0-100)
+    int positionMs;
+    int lengthMs;
+    uint64_t lastTickMs;
+    TickStats tickStats;
+    std::atomic<bool> trackStarted;         // Player reported a track start since the last tick
+    MetadataStats metadataStats;
+    MetadataCache* metadataCache;
+    bool validateCache;
+    PlayMetrics* metrics;
+    char sourceName[PLAYEVENT_SOURCE_LEN];
+};
+
+#endif // TRACKER_H
@@ -0,0 +1,278 @@
+#include "util.h"
+#include <cctype>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void CopyString(char* dest, size_t destSize, const char* src) {
+    CopyString(dest, destSize, src, (size_t)-1);
+}
+
+void CopyString(char* dest, size_t destSize, const char* src, size_t count) {
+    if (!dest || destSize == 0) return;
+    
+    size_t len = 0;
+    if (src) {
+        while (len < count && len < destSize - 1 && src[len] != '\0') len++;
+        
+        // Cut short: don't leave part of a character at the end
+        if (len == destSize - 1 && len < count && src[len] != '\0') {
+            while (len > 0 && ((unsigned char)src[len] & 0xC0) == 0x80) len--;
+        }
+        memcpy(dest, src, len);
+    }
+    dest[len] = '\0';
+}
+
+bool EqualsIgnoreCase(const char* a, const char* b) {
+    if (!a || !b) return a == b;
+    
+    while (*a && *b) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+uint64_t HashString(const char* s) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+const char* FindFilename(const char* filepath) {
+    const char* lastSlash = strrchr(filepath, '\\');
+    if (!lastSlash) lastSlash = strrchr(filepath, '/');
+    return lastSlash ? lastSlash + 1 : filepath;
+}
+
+void GetFilenameFromPath(const char* filepath, char* filename, size_t bufferSize) {
+    filename[0] = '\0';
+    if (!filepath) return;
+    
+    CopyString(filename, bufferSize, FindFilename(filepath));
+}
+
+size_t Utf16ToUtf8(const char16_t* text, size_t length, char* buffer, size_t bufferSize) {
+    if (!buffer || bufferSize == 0) return 0;
+    size_t room = bufferSize - 1;
+    size_t n = 0;
+    size_t i = 0;
+    while (i < length) {
+        // Runs of ASCII, four code units at a time
+        while (i + 4 <= length && n + 4 <= room) {
+            uint64_t units;
+            memcpy(&units, text + i, sizeof(units));
+            if (units & 0xFF80FF80FF80FF80ULL) break;
+            buffer[n] = (char)text[i];
+            buffer[n + 1] = (char)text[i + 1];
+            buffer[n + 2] = (char)text[i + 2];
+            buffer[n + 3] = (char)text[i + 3];
+            i += 4;
+            n += 4;
+        }
+        if (i >= length) break;
+        
+        uint32_t c = text[i++];
+        if (c >= 0xD800 && c <= 0xDBFF && i < length && text[i] >= 0xDC00 && text[i] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (text[i++] - 0xDC00);
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = 0xFFFD;
+        }
+        
+        size_t size = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (n + size > room) break;
+        if (size == 1) {
+            buffer[n] = (char)c;
+        } else if (size == 2) {
+            buffer[n] = (char)(0xC0 | (c >> 6));
+            buffer[n + 1] = (char)(0x80 | (c & 0x3F));
+        } else if (size == 3) {
+            buffer[n] = (char)(0xE0 | (c >> 12));
+            buffer[n + 1] = (char)(0x80 | ((c >> 6) & 0x3F));
+            buffer[n + 2] = (char)(0x80 | (c & 0x3F));
+        } else {
+            buffer[n] = (char)(0xF0 | (c >> 18));
+            buffer[n + 1] = (char)(0x80 | ((c >> 12) & 0x3F));
+            buffer[n + 2] = (char)(0x80 | ((c >> 6) & 0x3F));
+            buffer[n + 3] = (char)(0x80 | (c & 0x3F));
+        }
+        n += size;
+    }
+    buffer[n] = '\0';
+    return n;
+}
+
+size_t Utf8ToUtf16(const char* text, size_t length, char16_t* buffer, size_t bufferSize) {
+    if (!buffer || bufferSize == 0) return 0;
+    const unsigned char* s = (const unsigned char*)text;
+    size_t room = bufferSize - 1;
+    size_t n = 0;
+    size_t i = 0;
+    while (i < length) {
+        // Runs of ASCII, eight bytes at a time
+        while (i + 8 <= length && n + 8 <= room) {
+            uint64_t bytes;
+            memcpy(&bytes, s + i, sizeof(bytes));
+            if (bytes & 0x8080808080808080ULL) break;
+            for (int k = 0; k < 8; k++) buffer[n + k] = s[i + k];
+            i += 8;
+            n += 8;
+        }
+        if (i >= length) break;
+        
+        // Decode one sequence; anything malformed, overlong or out of range
+        // is one U+FFFD per byte skipped
+        uint32_t c = s[i];
+        size_t size = c < 0x80 ? 1 : c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+        if (size == 0 || i + size > length) {
+            size = 1;
+            c = 0xFFFD;
+        } else if (size > 1) {
+            c &= 0x3F >> (size - 1);
+            for (size_t k = 1; k < size; k++) {
+                if ((s[i + k] & 0xC0) != 0x80) {
+                    size = 1;
+                    c = 0xFFFD;
+                    break;
+                }
+                c = (c << 6) | (s[i + k] & 0x3F);
+            }
+            if (size == 3 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF))) {
+                size = 1;
+                c = 0xFFFD;
+            } else if (size == 4 && (c < 0x10000 || c > 0x10FFFF)) {
+                size = 1;
+                c = 0xFFFD;
+            }
+        }
+        
+        if (n + (c >= 0x10000 ? 2 : 1) > room) break;
+        if (c >= 0x10000) {
+            buffer[n++] = (char16_t)(0xD800 + ((c - 0x10000) >> 10));
+            buffer[n++] = (char16_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+        } else {
+            buffer[n++] = (char16_t)c;
+        }
+        i += size;
+    }
+    buffer[n] = 0;
+    return n;
+}
+
+FILE* OpenFile(const char* path, const char* mode) {
+#ifdef _WIN32
+    FILE* file = NULL;
+    return fopen_s(&file, path, mode) == 0 ? file : NULL;
+#else
+    return fopen(path, mode);
+#endif
+}
+
+bool TruncateFile(FILE* file) {
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), 0) == 0;
+#else
+    return ftruncate(fileno(file), 0) == 0;
+#endif
+}
+
+bool RenameFile(const char* oldPath, const char* newPath) {
+#ifdef _WIN32
+    return MoveFileExA(oldPath, newPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(oldPath, newPath) == 0;
+#endif
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data(NULL), size(0), mapping(NULL) {
+}
+#else
+MappedFile::MappedFile() : data(NULL), size(0) {
+}
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const char* path) {
+    Close();
+#ifdef _WIN32
+    // Shared for reading and deleting, so the file can be replaced by
+    // renaming over it once this view is closed
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && (uint64_t)fileSize.QuadPart <= (size_t)-1) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (!mapping) return false;
+    
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        mapping = NULL;
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    return true;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+    
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (view == MAP_FAILED) return false;
+    
+    data = (const unsigned char*)view;
+    size = (size_t)info.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::Close() {
+    if (!data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    mapping = NULL;
+#else
+    munmap((void*)data, size);
+#endif
+    data = NULL;
+    size = 0;
+}
+
+int GetUtcOffsetMinutes(time_t t) {
+    // Reinterpret the local broken-down time as UTC; the difference is the offset
+    struct tm timeinfo;
+#ifdef _WIN32
+    localtime_s(&timeinfo, &t);
+    time_t local = _mkgmtime(&timeinfo);
+#else
+    localtime_r(&t, &timeinfo);
+    time_t local = timegm(&timeinfo);
+#endif
+    return (int)((local - t) / 60);
+}
@@ -0,0 +1,79 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+// Portable string, file and time helpers used by the logging core (stand-ins
+// for the MSVC-only strncpy_s/_stricmp/fopen_s/localtime_s)
+
+// Copy src into dest, always NUL-terminating and truncating if necessary
+// (at a UTF-8 character boundary)
+void CopyString(char* dest, size_t destSize, const char* src);
+
+// As above, but copy at most count characters of src
+void CopyString(char* dest, size_t destSize, const char* src, size_t count);
+
+// Convert UTF-16 text (e.g. from Winamp's wide IPC messages) of length
+// code units to UTF-8, NUL-terminated and cut at a character boundary if
+// it doesn't fit. Unpaired surrogates become U+FFFD. Returns the bytes
+// written, not counting the terminator.
+size_t Utf16ToUtf8(const char16_t* text, size_t length, char* buffer, size_t bufferSize);
+
+// The reverse, e.g. to pass a path to a wide IPC message. Invalid UTF-8
+// becomes U+FFFD. Returns the code units written, not counting the
+// terminator; a buffer of length + 1 units always suffices.
+size_t Utf8ToUtf16(const char* text, size_t length, char16_t* buffer, size_t bufferSize);
+
+// Case-insensitive ASCII comparison
+bool EqualsIgnoreCase(const char* a, const char* b);
+
+// 64-bit FNV-1a hash of a string
+uint64_t HashString(const char* s);
+
+// Start of the filename in a full path (after the last separator of either kind)
+const char* FindFilename(const char* filepath);
+
+// Extract filename from full path (either separator)
+void GetFilenameFromPath(const char* filepath, char* filename, size_t bufferSize);
+
+// fopen, or NULL on failure (files opened on Windows are not shared)
+FILE* OpenFile(const char* path, const char* mode);
+
+// Cut an open file down to nothing; false if it could not be
+bool TruncateFile(FILE* file);
+
+// Rename a file, replacing any file already at newPath
+bool RenameFile(const char* oldPath, const char* newPath);
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    
+    // Map the file at path; fails if it is missing or empty
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return data != NULL; }
+    
+    const unsigned char* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+    
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    void* mapping;   // HANDLE
+#endif
+};
+
+// Local time zone offset from UTC at time t, in minutes (DST included)
+int GetUtcOffsetMinutes(time_t t);
+
+#endif // UTIL_H
@@ -0,0 +1,168 @@
+#include "win32pipe.h"
+#include "spool.h"
+#include "util.h"
+#include <cctype>
+#include <cstdio>
+
+// How long a sender waits for the owner to take a play
+#define PIPE_FORWARD_TIMEOUT_MS 2000
+
+// How often an instance that isn't the owner checks whether it should be
+#define PIPE_ELECTION_RETRY_MS 1000
+
+SharedWriterPipe::SharedWriterPipe()
+    : hPipe(INVALID_HANDLE_VALUE), hStopEvent(NULL), hIoEvent(NULL), receive(NULL), owner(false) {
+    pipeName[0] = '\0';
+}
+
+SharedWriterPipe::~SharedWriterPipe() {
+    Stop();
+}
+
+bool SharedWriterPipe::Start(const char* dbPath, PlayEventSink receiveProc) {
+    if (thread.joinable() || !receiveProc) return false;
+    
+    // One pipe per database file (Windows paths are case-insensitive)
+    char key[MAX_PATH];
+    size_t length = 0;
+    for (; dbPath[length] && length + 1 < sizeof(key); length++) {
+        key[length] = (char)tolower((unsigned char)dbPath[length]);
+    }
+    key[length] = '\0';
+    snprintf(pipeName, sizeof(pipeName), "\\\\.\\pipe\\winnp-%016llx", (unsigned long long)HashString(key));
+    
+    hStopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    hIoEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!hStopEvent || !hIoEvent) {
+        Stop();
+        return false;
+    }
+    receive = receiveProc;
+    
+    // Hold the first election here, so the caller knows its role at once
+    owner.store(CreateFirstInstance(), std::memory_order_release);
+    
+    try {
+        thread = std::thread(&SharedWriterPipe::ThreadProc, this);
+    } catch (...) {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void SharedWriterPipe::Stop() {
+    if (hStopEvent) SetEvent(hStopEvent);
+    if (thread.joinable()) {
+        thread.join();
+    }
+    
+    if (hPipe != INVALID_HANDLE_VALUE) {
+        CloseHandle(hPipe);
+        hPipe = INVALID_HANDLE_VALUE;
+    }
+    HANDLE* events[] = { &hStopEvent, &hIoEvent };
+    for (HANDLE* event : events) {
+        if (*event) {
+            CloseHandle(*event);
+            *event = NULL;
+        }
+    }
+    owner.store(false, std::memory_order_release);
+    receive = NULL;
+}
+
+// Create the pipe, which fails while another instance has it
+bool SharedWriterPipe::CreateFirstInstance() {
+    hPipe = CreateNamedPipeA(pipeName,
+                             PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+                             PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                             1, 16, PLAY_RECORD_MAX_SIZE, 0, NULL);
+    return hPipe != INVALID_HANDLE_VALUE;
+}
+
+// Pipe thread: wait to become the owner, then serve until stopped
+void SharedWriterPipe::ThreadProc() {
+    while (!IsOwner()) {
+        if (WaitForSingleObject(hStopEvent, PIPE_ELECTION_RETRY_MS) != WAIT_TIMEOUT) return;
+        if (CreateFirstInstance()) {
+            owner.store(true, std::memory_order_release);
+        }
+    }
+    Serve();
+}
+
+// Finish an overlapped operation on the pipe, abandoning it if Stop is
+// called meanwhile
+bool SharedWriterPipe::WaitForIo(OVERLAPPED& overlapped, BOOL started) {
+    if (!started && GetLastError() != ERROR_IO_PENDING) return false;
+    
+    HANDLE handles[] = { hStopEvent, overlapped.hEvent };
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+        CancelIo(hPipe);
+    }
+    DWORD bytes = 0;
+    return GetOverlappedResult(hPipe, &overlapped, &bytes, TRUE) != FALSE;
+}
+
+// Take one play per connection: read it, answer whether it was accepted,
+// then wait for the sender to hang up before serving the next
+void SharedWriterPipe::Serve() {
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    PlayEvent event;
+    
+    while (WaitForSingleObject(hStopEvent, 0) == WAIT_TIMEOUT) {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = hIoEvent;
+        
+        BOOL connected = ConnectNamedPipe(hPipe, &overlapped);
+        if (connected || GetLastError() == ERROR_PIPE_CONNECTED || WaitForIo(overlapped, connected)) {
+            DWORD size = 0;
+            BOOL read = ReadFile(hPipe, record, sizeof(record), NULL, &overlapped);
+            if (WaitForIo(overlapped, read) && GetOverlappedResult(hPipe, &overlapped, &size, FALSE)) {
+                unsigned char accepted = DecodePlayRecord(record, size, event) && receive(event) ? 1 : 0;
+                
+                BOOL written = WriteFile(hPipe, &accepted, sizeof(accepted), NULL, &overlapped);
+                if (WaitForIo(overlapped, written)) {
+                    // Fails once the sender has read the answer and closed its end
+                    read = ReadFile(hPipe, record, sizeof(record), NULL, &overlapped);
+                    WaitForIo(overlapped, read);
+                }
+            }
+        }
+        DisconnectNamedPipe(hPipe);
+    }
+}
+
+bool SharedWriterPipe::Forward(const PlayEvent& event) {
+    unsigned char record[PLAY_RECORD_MAX_SIZE];
+    DWORD size = (DWORD)EncodePlayRecord(event, record);
+    
+    // Waits while the owner is busy with another sender
+    if (!WaitNamedPipeA(pipeName, PIPE_FORWARD_TIMEOUT_MS)) return false;
+    HANDLE hClient = CreateFileA(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (hClient == INVALID_HANDLE_VALUE) return false;
+    
+    bool accepted = false;
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    HANDLE hDone = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (hDone && SetNamedPipeHandleState(hClient, &mode, NULL, NULL)) {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = hDone;
+        unsigned char answer = 0;
+        DWORD answerSize = 0;
+        
+        // Don't hang on an owner that never answers; the play stays spooled
+        BOOL started = TransactNamedPipe(hClient, record, size, &answer, sizeof(answer), NULL, &overlapped);
+        if (started || GetLastError() == ERROR_IO_PENDING) {
+            if (WaitForSingleObject(hDone, PIPE_FORWARD_TIMEOUT_MS) != WAIT_OBJECT_0) {
+                CancelIo(hClient);
+            }
+            accepted = GetOverlappedResult(hClient, &overlapped, &answerSize, TRUE) && answerSize == 1 && answer == 1;
+        }
+    }
+    
+    if (hDone) CloseHandle(hDone);
+    CloseHandle(hClient);
+    return accepted;
+}
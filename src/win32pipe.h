@@ -0,0 +1,50 @@
+#ifndef WIN32PIPE_H
+#define WIN32PIPE_H
+
+#include "playevent.h"
+#include <windows.h>
+#include <atomic>
+#include <thread>
+
+// Elects one instance per database as its writer, and carries the other
+// instances' plays to it over a local named pipe.
+//
+// The pipe is also the election: whoever creates its first instance owns
+// the database, and the others take over when it goes away (they try again
+// every second). The owner passes each play it receives to a sink, which
+// returns once the play is durable on the owner's side (see
+// AcceptForwardedPlayEvent), and answers whether it was, so a sender
+// knows to keep the play in its spool otherwise.
+class SharedWriterPipe {
+public:
+    SharedWriterPipe();
+    ~SharedWriterPipe();
+    
+    // Join the election for the database at dbPath; receive is called on
+    // the pipe's own thread for each play handed over, and must only
+    // return true once the play can't be lost
+    bool Start(const char* dbPath, PlayEventSink receive);
+    void Stop();
+    
+    // True while this instance owns the database
+    bool IsOwner() const { return owner.load(std::memory_order_acquire); }
+    
+    // Hand a play to the owner; false if there is none or it didn't take it
+    bool Forward(const PlayEvent& event);
+
+private:
+    void ThreadProc();
+    bool CreateFirstInstance();
+    bool WaitForIo(OVERLAPPED& overlapped, BOOL started);
+    void Serve();
+    
+    char pipeName[64];
+    HANDLE hPipe;
+    HANDLE hStopEvent;
+    HANDLE hIoEvent;
+    PlayEventSink receive;
+    std::atomic<bool> owner;
+    std::thread thread;
+};
+
+#endif // WIN32PIPE_H
@@ -0,0 +1,57 @@
+#include "win32timer.h"
+
+TimerQueueTimer::TimerQueueTimer() : hTimerQueue(NULL), hTimer(NULL), proc(NULL), context(NULL), intervalMs(0) {
+}
+
+TimerQueueTimer::~TimerQueueTimer() {
+    Stop();
+}
+
+void CALLBACK TimerQueueTimer::TimerCallback(PVOID lpParam, BOOLEAN TimerOrWaitFired) {
+    TimerQueueTimer* timer = (TimerQueueTimer*)lpParam;
+    timer->proc(timer->context);
+}
+
+bool TimerQueueTimer::Start(unsigned int tickIntervalMs, TickProc tickProc, void* tickContext) {
+    if (hTimerQueue || !tickProc) return false;
+    
+    proc = tickProc;
+    context = tickContext;
+    intervalMs = tickIntervalMs;
+    
+    // Create timer queue for periodic checking
+    hTimerQueue = CreateTimerQueue();
+    if (!hTimerQueue) return false;
+    
+    if (!CreateTimerQueueTimer(&hTimer, hTimerQueue, TimerCallback, this, intervalMs, intervalMs, WT_EXECUTEINTIMERTHREAD)) {
+        DeleteTimerQueue(hTimerQueue);
+        hTimerQueue = NULL;
+        hTimer = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool TimerQueueTimer::SetInterval(unsigned int newIntervalMs) {
+    if (!hTimerQueue || !hTimer) return false;
+    intervalMs = newIntervalMs;
+    return ChangeTimerQueueTimer(hTimerQueue, hTimer, intervalMs, intervalMs) != FALSE;
+}
+
+bool TimerQueueTimer::TickNow() {
+    if (!hTimerQueue || !hTimer) return false;
+    // Due immediately; WT_EXECUTEINTIMERTHREAD keeps it serialized with the periodic ticks
+    return ChangeTimerQueueTimer(hTimerQueue, hTimer, 0, intervalMs) != FALSE;
+}
+
+void TimerQueueTimer::Stop() {
+    // INVALID_HANDLE_VALUE waits for a callback in progress to complete
+    if (hTimer && hTimerQueue) {
+        DeleteTimerQueueTimer(hTimerQueue, hTimer, INVALID_HANDLE_VALUE);
+    }
+    if (hTimerQueue) {
+        DeleteTimerQueue(hTimerQueue);
+    }
+    hTimer = NULL;
+    hTimerQueue = NULL;
+}
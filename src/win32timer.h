@@ -0,0 +1,28 @@
+#ifndef WIN32TIMER_H
+#define WIN32TIMER_H
+
+#include "timing.h"
+#include <windows.h>
+
+// TickTimer on a Win32 timer queue; ticks run on the timer thread
+class TimerQueueTimer : public TickTimer {
+public:
+    TimerQueueTimer();
+    ~TimerQueueTimer();
+    
+    bool Start(unsigned int intervalMs, TickProc proc, void* context) override;
+    bool SetInterval(unsigned int intervalMs) override;
+    bool TickNow() override;
+    void Stop() override;
+
+private:
+    static void CALLBACK TimerCallback(PVOID lpParam, BOOLEAN TimerOrWaitFired);
+    
+    HANDLE hTimerQueue;
+    HANDLE hTimer;
+    TickProc proc;
+    void* context;
+    unsigned int intervalMs;
+};
+
+#endif // WIN32TIMER_H
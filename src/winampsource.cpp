@@ -0,0 +1,219 @@
+#include "winampsource.h"
+#include "playevent.h"
+#include "winnp.h"
+#include "util.h"
+#include <commctrl.h>
+#include <cstring>
+#include <cwchar>
+
+// Sent to the marshal window; lParam points to a MetadataBatch
+#define WM_WINNP_FETCH_METADATA (WM_USER + 1)
+
+static const char marshalClassName[] = "winnp_marshal";
+
+// A batched metadata lookup handed to Winamp's thread
+struct MetadataBatch {
+    WinampPlayerSource* source;
+    const char* filepath;
+    MetadataField* fields;
+    size_t count;
+};
+
+// Text from Winamp's wide IPC messages, as UTF-8 (wchar_t is UTF-16 on
+// Windows)
+static void CopyWideString(char* buffer, size_t bufferSize, const wchar_t* text) {
+    Utf16ToUtf8((const char16_t*)text, wcslen(text), buffer, bufferSize);
+}
+
+WinampPlayerSource::WinampPlayerSource()
+    : hwndWinamp(NULL), hwndMarshal(NULL), hMarshalInstance(NULL), hwndSubclassed(NULL),
+      eventProc(NULL), eventContext(NULL) {
+}
+
+bool WinampPlayerSource::CreateMarshalWindow(HINSTANCE hInstance) {
+    if (hwndMarshal) return true;
+    
+    WNDCLASSA wc = {};
+    wc.lpfnWndProc = MarshalWndProc;
+    wc.hInstance = hInstance;
+    wc.lpszClassName = marshalClassName;
+    RegisterClassA(&wc);
+    
+    // Message-only window on the calling (Winamp UI) thread
+    hwndMarshal = CreateWindowExA(0, marshalClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+    if (!hwndMarshal) {
+        UnregisterClassA(marshalClassName, hInstance);
+        return false;
+    }
+    hMarshalInstance = hInstance;
+    return true;
+}
+
+void WinampPlayerSource::DestroyMarshalWindow() {
+    if (hwndMarshal) {
+        DestroyWindow(hwndMarshal);
+        UnregisterClassA(marshalClassName, hMarshalInstance);
+        hwndMarshal = NULL;
+        hMarshalInstance = NULL;
+    }
+}
+
+// Runs on Winamp's thread, where each IPC query is a direct call into
+// Winamp's window procedure rather than a cross-thread round trip
+LRESULT CALLBACK WinampPlayerSource::MarshalWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    if (msg == WM_WINNP_FETCH_METADATA) {
+        MetadataBatch* batch = (MetadataBatch*)lParam;
+        batch->source->PlayerSource::GetExtendedFileInfoBatch(batch->filepath, batch->fields, batch->count);
+        return 1;
+    }
+    return DefWindowProcA(hwnd, msg, wParam, lParam);
+}
+
+// comctl32 keeps its own chain of subclasses per window, so ours can be
+// removed whether or not another plugin has subclassed the window since,
+// and nothing is left calling into this module once it is unloaded
+bool WinampPlayerSource::SubscribeEvents(PlayerEventProc proc, void* context) {
+    if (!proc || !hwndWinamp || hwndSubclassed) return false;
+    
+    eventProc = proc;
+    eventContext = context;
+    if (!SetWindowSubclass(hwndWinamp, SubclassWndProc, (UINT_PTR)this, (DWORD_PTR)this)) {
+        eventProc = NULL;
+        return false;
+    }
+    hwndSubclassed = hwndWinamp;
+    return true;
+}
+
+void WinampPlayerSource::UnsubscribeEvents() {
+    eventProc = NULL;
+    if (!hwndSubclassed) return;
+    
+    RemoveWindowSubclass(hwndSubclassed, SubclassWndProc, (UINT_PTR)this);
+    hwndSubclassed = NULL;
+}
+
+// Runs on Winamp's thread for every message to its main window, including
+// our own IPC queries, so anything beyond a few comparisons is deferred to
+// the event handler
+LRESULT CALLBACK WinampPlayerSource::SubclassWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam,
+                                                     UINT_PTR id, DWORD_PTR refData) {
+    WinampPlayerSource* source = (WinampPlayerSource*)refData;
+    
+    // The window is going away before we unsubscribed
+    if (msg == WM_NCDESTROY) {
+        RemoveWindowSubclass(hwnd, SubclassWndProc, id);
+        source->hwndSubclassed = NULL;
+        return DefSubclassProc(hwnd, msg, wParam, lParam);
+    }
+    
+    LRESULT result = DefSubclassProc(hwnd, msg, wParam, lParam);
+    
+    // Winamp has acted on the message by now, so a query will see the new state
+    if (msg == WM_WA_IPC && source->eventProc) {
+        if (lParam == IPC_PLAYING_FILE || lParam == IPC_PLAYING_FILEW) {
+            source->eventProc(PlayerEventTrackStarted, source->eventContext);
+        } else if (lParam == IPC_CB_MISC && wParam == IPC_CB_MISC_STATUS) {
+            source->eventProc(PlayerEventStateChanged, source->eventContext);
+        } else if (lParam == IPC_CB_MISC && wParam == IPC_CB_MISC_TITLE) {
+            source->eventProc(PlayerEventTitleChanged, source->eventContext);
+        }
+    }
+    return result;
+}
+
+void WinampPlayerSource::Attach(HWND hwnd) {
+    hwndWinamp = hwnd;
+}
+
+bool WinampPlayerSource::IsAvailable() {
+    // Try to get Winamp window handle if we don't have it yet
+    if (!hwndWinamp) {
+        hwndWinamp = FindWindowA("Winamp v1.x", NULL);
+    }
+    return hwndWinamp != NULL;
+}
+
+int WinampPlayerSource::GetPlayState() {
+    return (int)SendMessage(hwndWinamp, WM_WA_IPC, 0, IPC_ISPLAYING);
+}
+
+int WinampPlayerSource::GetListPos() {
+    return (int)SendMessage(hwndWinamp, WM_WA_IPC, 0, IPC_GETLISTPOS);
+}
+
+// The wide variants of the playlist queries, so names outside the ANSI
+// code page (and paths longer than MAX_PATH) arrive intact
+void WinampPlayerSource::GetPlaylistTitle(int position, char* buffer, size_t bufferSize) {
+    buffer[0] = '\0';
+    wchar_t* titlePtr = (wchar_t*)SendMessage(hwndWinamp, WM_WA_IPC, position, IPC_GETPLAYLISTTITLEW);
+    if (titlePtr && titlePtr != (wchar_t*)-1) {
+        CopyWideString(buffer, bufferSize, titlePtr);
+    }
+}
+
+void WinampPlayerSource::GetPlaylistFile(int position, char* buffer, size_t bufferSize) {
+    buffer[0] = '\0';
+    wchar_t* filePtr = (wchar_t*)SendMessage(hwndWinamp, WM_WA_IPC, position, IPC_GETPLAYLISTFILEW);
+    if (filePtr && filePtr != (wchar_t*)-1) {
+        CopyWideString(buffer, bufferSize, filePtr);
+    }
+}
+
+// Get title from window ("Artist - Title - Winamp")
+void WinampPlayerSource::GetFallbackTitle(char* buffer, size_t bufferSize) {
+    buffer[0] = '\0';
+    wchar_t windowTitle[512];
+    if (GetWindowTextW(hwndWinamp, windowTitle, (int)(sizeof(windowTitle) / sizeof(windowTitle[0]))) > 0) {
+        wchar_t* dashPos = wcsstr(windowTitle, L" - Winamp");
+        if (dashPos) {
+            Utf16ToUtf8((const char16_t*)windowTitle, dashPos - windowTitle, buffer, bufferSize);
+        }
+    }
+}
+
+int WinampPlayerSource::GetOutputTime(int mode) {
+    return (int)SendMessage(hwndWinamp, WM_WA_IPC, mode, IPC_GETOUTPUTTIME);
+}
+
+void WinampPlayerSource::GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) {
+    // No room even for the terminator (and retlen - 1 below would wrap)
+    if (bufferSize == 0) return;
+    buffer[0] = '\0';
+    if (!hwndWinamp || !filepath || filepath[0] == '\0') return;
+    
+    // The path and field name go over as UTF-16 and the value comes back
+    // as UTF-16; each is converted once. A path that fits our UTF-8 buffer
+    // fits this one.
+    wchar_t widePath[PLAYEVENT_PATH_LEN];
+    wchar_t wideField[32];
+    wchar_t wideValue[PLAYEVENT_TITLE_LEN];
+    Utf8ToUtf16(filepath, strlen(filepath), (char16_t*)widePath, sizeof(widePath) / sizeof(widePath[0]));
+    Utf8ToUtf16(field, strlen(field), (char16_t*)wideField, sizeof(wideField) / sizeof(wideField[0]));
+    wideValue[0] = L'\0';
+    
+    extendedFileInfoStructW info;
+    info.filename = widePath;
+    info.metadata = wideField;
+    info.ret = wideValue;
+    info.retlen = bufferSize < PLAYEVENT_TITLE_LEN ? bufferSize : PLAYEVENT_TITLE_LEN;
+    
+    if (SendMessage(hwndWinamp, WM_WA_IPC, (WPARAM)&info, IPC_GET_EXTENDED_FILE_INFOW)) {
+        wideValue[info.retlen - 1] = L'\0';
+        CopyWideString(buffer, bufferSize, wideValue);
+    }
+}
+
+// One cross-thread message for all fields instead of one per field
+void WinampPlayerSource::GetExtendedFileInfoBatch(const char* filepath, MetadataField* fields, size_t count) {
+    if (!hwndMarshal) {
+        PlayerSource::GetExtendedFileInfoBatch(filepath, fields, count);
+        return;
+    }
+    
+    MetadataBatch batch = { this, filepath, fields, count };
+    if (!SendMessage(hwndMarshal, WM_WINNP_FETCH_METADATA, 0, (LPARAM)&batch)) {
+        // Not handled (window gone); fall back to individual queries
+        PlayerSource::GetExtendedFileInfoBatch(filepath, fields, count);
+    }
+}
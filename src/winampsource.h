@@ -0,0 +1,51 @@
+#ifndef WINAMPSOURCE_H
+#define WINAMPSOURCE_H
+
+#include "playersource.h"
+#include <windows.h>
+
+// PlayerSource over Winamp's IPC messages
+class WinampPlayerSource : public PlayerSource {
+public:
+    WinampPlayerSource();
+    
+    // Use this window (normally the plugin's hwndParent); if NULL the
+    // Winamp window is looked up by class name on demand
+    void Attach(HWND hwnd);
+    HWND GetWindow() const { return hwndWinamp; }
+    
+    // Create/destroy the hidden window used to run batched metadata lookups
+    // on Winamp's own thread. Must be called on Winamp's UI thread (init/quit).
+    bool CreateMarshalWindow(HINSTANCE hInstance);
+    void DestroyMarshalWindow();
+    
+    // Subclass the Winamp window (through comctl32) to hear about track and
+    // state changes. Must be called on Winamp's UI thread; proc is called on
+    // that thread.
+    bool SubscribeEvents(PlayerEventProc proc, void* context) override;
+    void UnsubscribeEvents() override;
+    
+    bool IsAvailable() override;
+    int GetPlayState() override;
+    int GetListPos() override;
+    void GetPlaylistTitle(int position, char* buffer, size_t bufferSize) override;
+    void GetPlaylistFile(int position, char* buffer, size_t bufferSize) override;
+    void GetFallbackTitle(char* buffer, size_t bufferSize) override;
+    int GetOutputTime(int mode) override;
+    void GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) override;
+    void GetExtendedFileInfoBatch(const char* filepath, MetadataField* fields, size_t count) override;
+
+private:
+    static LRESULT CALLBACK MarshalWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+    static LRESULT CALLBACK SubclassWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam,
+                                            UINT_PTR id, DWORD_PTR refData);
+    
+    HWND hwndWinamp;
+    HWND hwndMarshal;
+    HINSTANCE hMarshalInstance;
+    HWND hwndSubclassed;
+    PlayerEventProc eventProc;
+    void* eventContext;
+};
+
+#endif // WINAMPSOURCE_H
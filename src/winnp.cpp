@@ -1,22 +1,48 @@
 #include "winnp.h"
-#include "sqlite3.h"
+#include "database.h"
+#include "metacache.h"
+#include "metasnapshot.h"
+#include "metrics.h"
+#include "pollschedule.h"
+#include "spool.h"
+#include "tracker.h"
+#include "util.h"
+#include "winampsource.h"
+#include "win32pipe.h"
+#include "win32timer.h"
+#include "writer.h"
 #include <windows.h>
 #include <shlobj.h>
-#include <string>
-#include <ctime>
 #include <cstdlib>
+#include <string>
+
+// Polling period for track changes (the starting period when adaptive)
+#define POLL_INTERVAL_MS 500
+#define EVENT_FALLBACK_INTERVAL_MS 5000  // Polling period when Winamp notifies us of changes
 
 // Global variables
-HWND hwndWinamp = NULL;
-char currentTitle[2048] = "";
 char dbPath[MAX_PATH] = "";
-HANDLE hTimer = NULL;
-HANDLE hTimerQueue = NULL;
+char spoolPath[MAX_PATH] = "";
+char cachePath[MAX_PATH] = "";
+char sourceName[PLAYEVENT_SOURCE_LEN] = "";
+char synchronousSetting[16] = "";
+char metricsPath[MAX_PATH] = "";
+DatabaseOptions dbOptions = {};
 winampGeneralPurposePlugin* g_plugin = NULL;
 HMODULE g_hModule = NULL;
-sqlite3* db = NULL;
-int lastPositionPercent = 0;       // Track position percentage (0-100)
-char lastFilepath[MAX_PATH] = "";  // Track filepath for repeat detection
+WinampPlayerSource winampSource;
+SystemClock systemClock;
+TrackTracker tracker(winampSource, systemClock, EnqueuePlayEvent);
+MetadataCache metadataCache;
+MetadataSnapshot metadataSnapshot;
+PlayMetrics metrics;
+PlaySpool playSpool;
+SharedWriterPipe sharedPipe;
+bool sharedWriter = false;
+TimerQueueTimer pollTimer;
+PollScheduler pollScheduler;
+bool adaptivePolling = false;
+unsigned int pollIntervalMs = POLL_INTERVAL_MS;
 
 // DLL entry point
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
@@ -31,13 +57,17 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
 }
 
 // Forward declarations
-void CALLBACK TimerCallback(PVOID lpParam, BOOLEAN TimerOrWaitFired);
-void LogToDatabase(const char* title, const char* filepath);
+void PollTick(void* context);
+void OnPlayerEvent(PlayerEvent event, void* context);
 void GetDatabasePath();
-bool InitDatabase();
-void CloseDatabase();
-void GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize);
-void GetFilenameFromPath(const char* filepath, char* filename, size_t bufferSize);
+void GetLocalPath(const char* setting, const char* extension, char* path);
+void GetSourceName(char* name, size_t nameSize);
+bool ConnectDatabase();
+bool DisconnectDatabase();
+bool ReadEnvironmentSetting(const char* name, char* buffer, size_t bufferSize);
+OverflowPolicy GetOverflowPolicy();
+int GetIntSetting(const char* name, int defaultValue);
+void GetDatabaseOptions(DatabaseOptions& options);
 
 // Plugin description string
 static char pluginDescription[] = "winnp - Now Playing Logger (SQLite)";
@@ -53,26 +83,59 @@ winampGeneralPurposePlugin plugin = {
     NULL
 };
 
+// Read a per-user environment variable (read from the registry directly, which feels like a hack
+// but means I don't have to log out/restart anything in order to pick up the env. var.)
+bool ReadEnvironmentSetting(const char* name, char* buffer, size_t bufferSize) {
+    buffer[0] = '\0';
+    
+    HKEY hKey;
+    if (RegOpenKeyExA(HKEY_CURRENT_USER, "Environment", 0, KEY_READ, &hKey) != ERROR_SUCCESS) {
+        return false;
+    }
+    
+    char regValue[MAX_PATH] = "";
+    DWORD regSize = sizeof(regValue) - 1;
+    DWORD regType = 0;
+    
+    bool found = false;
+    if (RegQueryValueExA(hKey, name, NULL, &regType, (LPBYTE)regValue, &regSize) == ERROR_SUCCESS) {
+        if (strlen(regValue) > 0) {
+            CopyString(buffer, bufferSize, regValue);
+            found = true;
+        }
+    }
+    RegCloseKey(hKey);
+    return found;
+}
+
+// Read the queue overflow policy (winnp_overflow = drop-newest | drop-oldest | block)
+OverflowPolicy GetOverflowPolicy() {
+    char value[32];
+    if (ReadEnvironmentSetting("winnp_overflow", value, sizeof(value))) {
+        if (EqualsIgnoreCase(value, "drop-oldest")) return OverflowDropOldest;
+        if (EqualsIgnoreCase(value, "block")) return OverflowBlock;
+    }
+    return OverflowDropNewest;
+}
+
+// Read a numeric setting, falling back to defaultValue if unset or invalid
+int GetIntSetting(const char* name, int defaultValue) {
+    char value[32];
+    if (ReadEnvironmentSetting(name, value, sizeof(value))) {
+        char* end = NULL;
+        long parsed = strtol(value, &end, 10);
+        if (end != value && parsed >= 0) return (int)parsed;
+    }
+    return defaultValue;
+}
+
 // Get the database path
 void GetDatabasePath() {
     if (strlen(dbPath) > 0) return;
     
-    // Read environment variable (read from the registry directly, which feels like a hack
-    // but means I don't have to log out/restart anything in order to pick up the env. var.
-    HKEY hKey;
-    if (RegOpenKeyExA(HKEY_CURRENT_USER, "Environment", 0, KEY_READ, &hKey) == ERROR_SUCCESS) {
-        char regValue[MAX_PATH] = "";
-        DWORD regSize = sizeof(regValue);
-        DWORD regType = 0;
-        
-        if (RegQueryValueExA(hKey, "winnp_db_path", NULL, &regType, (LPBYTE)regValue, &regSize) == ERROR_SUCCESS) {
-            if (strlen(regValue) > 0) {
-                strncpy_s(dbPath, MAX_PATH, regValue, _TRUNCATE);
-                RegCloseKey(hKey);
-                return;
-            }
-        }
-        RegCloseKey(hKey);
+    // Read environment variable
+    if (ReadEnvironmentSetting("winnp_db_path", dbPath, sizeof(dbPath))) {
+        return;
     }
     
     // Fallback to Documents folder
@@ -86,306 +149,278 @@ void GetDatabasePath() {
         if (GetEnvironmentVariableA("USERPROFILE", userProfile, size) > 0) {
             snprintf(dbPath, MAX_PATH, "%s\\Documents\\nowplaying.db", userProfile);
         } else {
-            strncpy_s(dbPath, MAX_PATH, "C:\\nowplaying.db", _TRUNCATE);
+            CopyString(dbPath, sizeof(dbPath), "C:\\nowplaying.db");
         }
     }
 }
 
-// Initialize SQLite database
-bool InitDatabase() {
-    GetDatabasePath();
-    
-    int rc = sqlite3_open(dbPath, &db);
-    if (rc != SQLITE_OK) {
-        db = NULL;
-        return false;
+// Get the path of one of this instance's own files (path holds MAX_PATH),
+// from the setting if given: somewhere local, so e.g. plays survive the
+// database being on a share that goes away, and named after the source so
+// that instances on one machine each have their own
+void GetLocalPath(const char* setting, const char* extension, char* path) {
+    if (strlen(path) > 0) return;
+    
+    if (ReadEnvironmentSetting(setting, path, MAX_PATH)) {
+        return;
     }
     
-    // Create table with extended metadata
-    const char* createTableSQL = 
-        "CREATE TABLE IF NOT EXISTS play_history ("
-        "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "    played_at TEXT NOT NULL,"
-        "    filepath TEXT,"
-        "    filename TEXT,"
-        "    title TEXT,"
-        "    artist TEXT,"
-        "    album TEXT,"
-        "    genre TEXT,"
-        "    track_number TEXT,"
-        "    year TEXT,"
-        "    duration_ms INTEGER"
-        ");";
-    
-    char* errMsg = NULL;
-    rc = sqlite3_exec(db, createTableSQL, NULL, NULL, &errMsg);
-    if (rc != SQLITE_OK) {
-        if (errMsg) sqlite3_free(errMsg);
-        sqlite3_close(db);
-        db = NULL;
-        return false;
+    char fileName[PLAYEVENT_SOURCE_LEN + 16];
+    snprintf(fileName, sizeof(fileName), "winnp-%s.%s", sourceName, extension);
+    for (char* c = fileName; *c; c++) {
+        if (strchr("\\/:*?\"<>|", *c)) *c = '_';
     }
     
-    // Create index on played_at for faster queries
-    const char* createIndexSQL = 
-        "CREATE INDEX IF NOT EXISTS idx_played_at ON play_history(played_at);";
-    sqlite3_exec(db, createIndexSQL, NULL, NULL, NULL);
-    
-    return true;
+    char localAppData[MAX_PATH];
+    if (SUCCEEDED(SHGetFolderPathA(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, localAppData))) {
+        snprintf(path, MAX_PATH, "%s\\%s", localAppData, fileName);
+    } else {
+        snprintf(path, MAX_PATH, "%s.%s", dbPath, fileName);
+    }
 }
 
-// Close database connection
-void CloseDatabase() {
-    if (db) {
-        sqlite3_close(db);
-        db = NULL;
-    }
+// Name recorded with each play: winnp_source from this process's own
+// environment (so instances can be told apart, e.g. started from a batch
+// file that sets it), then the per-user setting, then the computer name
+void GetSourceName(char* name, size_t nameSize) {
+    DWORD length = GetEnvironmentVariableA("winnp_source", name, (DWORD)nameSize);
+    if (length > 0 && length < nameSize) return;
+    if (ReadEnvironmentSetting("winnp_source", name, nameSize)) return;
+    
+    char computerName[MAX_PATH];
+    DWORD size = sizeof(computerName);
+    CopyString(name, nameSize, GetComputerNameA(computerName, &size) ? computerName : "");
 }
 
-// Get extended file info from Winamp
-void GetExtendedFileInfo(const char* filepath, const char* field, char* buffer, size_t bufferSize) {
-    buffer[0] = '\0';
-    if (!hwndWinamp || !filepath || strlen(filepath) == 0) return;
-    
-    extendedFileInfoStruct info;
-    info.filename = filepath;
-    info.metadata = field;
-    info.ret = buffer;
-    info.retlen = bufferSize;
-    
-    SendMessage(hwndWinamp, WM_WA_IPC, (WPARAM)&info, IPC_GET_EXTENDED_FILE_INFO);
+// Read database options from the environment:
+//   winnp_schema             = normalized to store plays against interned artists/albums/etc.
+//   winnp_journal_mode       = wal to enable write-ahead logging (default: rollback journal)
+//   winnp_synchronous        = off | normal | full | extra
+//   winnp_wal_autocheckpoint = pages before SQLite checkpoints on its own (0 = only when idle)
+//   winnp_busy_timeout_ms    = how long to wait for other instances to release the database
+void GetDatabaseOptions(DatabaseOptions& options) {
+    char value[32];
+    options.normalized = ReadEnvironmentSetting("winnp_schema", value, sizeof(value)) && EqualsIgnoreCase(value, "normalized");
+    options.wal = ReadEnvironmentSetting("winnp_journal_mode", value, sizeof(value)) && EqualsIgnoreCase(value, "wal");
+    options.synchronous = ReadEnvironmentSetting("winnp_synchronous", synchronousSetting, sizeof(synchronousSetting)) ? synchronousSetting : NULL;
+    options.walAutocheckpoint = GetIntSetting("winnp_wal_autocheckpoint", -1);
+    options.busyTimeoutMs = GetIntSetting("winnp_busy_timeout_ms", 5000);
 }
 
-// Extract filename from full path
-void GetFilenameFromPath(const char* filepath, char* filename, size_t bufferSize) {
-    filename[0] = '\0';
-    if (!filepath) return;
-    
-    const char* lastSlash = strrchr(filepath, '\\');
-    if (!lastSlash) lastSlash = strrchr(filepath, '/');
-    
-    if (lastSlash) {
-        strncpy_s(filename, bufferSize, lastSlash + 1, _TRUNCATE);
-    } else {
-        strncpy_s(filename, bufferSize, filepath, _TRUNCATE);
-    }
+// Writer thread: true while another instance owns the database, so plays
+// are handed to it instead of written here
+bool IsForwarding() {
+    return sharedWriter && !sharedPipe.IsOwner();
 }
 
-// Log track to database with extended metadata
-void LogToDatabase(const char* title, const char* filepath) {
-    if (!db) return;
-    
-    // Get current local time
-    time_t now = time(0);
-    struct tm timeinfo;
-    localtime_s(&timeinfo, &now);
-    char timeStr[64];
-    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    
-    // Get filename from path
-    char filename[MAX_PATH] = "";
-    GetFilenameFromPath(filepath, filename, sizeof(filename));
-    
-    // Get extended metadata from Winamp
-    char artist[256] = "";
-    char album[256] = "";
-    char genre[128] = "";
-    char trackNum[32] = "";
-    char year[32] = "";
-    char lengthStr[32] = "";
-    
-    if (filepath && strlen(filepath) > 0) {
-        GetExtendedFileInfo(filepath, "artist", artist, sizeof(artist));
-        GetExtendedFileInfo(filepath, "album", album, sizeof(album));
-        GetExtendedFileInfo(filepath, "genre", genre, sizeof(genre));
-        GetExtendedFileInfo(filepath, "track", trackNum, sizeof(trackNum));
-        GetExtendedFileInfo(filepath, "year", year, sizeof(year));
-        GetExtendedFileInfo(filepath, "length", lengthStr, sizeof(lengthStr));
-    }
-    
-    // Parse duration (length is in milliseconds as string, or might be in seconds)
-    int durationMs = 0;
-    if (strlen(lengthStr) > 0) {
-        durationMs = atoi(lengthStr);
-        // If it looks like seconds (< 10000), convert to ms
-        if (durationMs > 0 && durationMs < 10000) {
-            durationMs *= 1000;
-        }
-    }
-    
-    // Use title from parameter if metadata title is empty
-    const char* finalTitle = title;
-    char metaTitle[512] = "";
-    if (filepath && strlen(filepath) > 0) {
-        GetExtendedFileInfo(filepath, "title", metaTitle, sizeof(metaTitle));
-        if (strlen(metaTitle) > 0) {
-            finalTitle = metaTitle;
-        }
-    }
-    
-    // Prepare SQL statement
-    const char* insertSQL = 
-        "INSERT INTO play_history (played_at, filepath, filename, title, artist, album, genre, track_number, year, duration_ms) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    sqlite3_stmt* stmt = NULL;
-    
-    int rc = sqlite3_prepare_v2(db, insertSQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) return;
-    
-    // Bind parameters
-    sqlite3_bind_text(stmt, 1, timeStr, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, filepath ? filepath : "", -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, filename, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 4, finalTitle ? finalTitle : "", -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 5, artist, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 6, album, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 7, genre, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 8, trackNum, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 9, year, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 10, durationMs);
-    
-    // Execute
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+// Writer hooks: the database when this instance owns it, otherwise the
+// owner. Becoming the owner mid-batch fails the commit (no transaction was
+// begun), so the batch is replayed from the spool.
+bool StorePlayEvent(const PlayEvent& event) {
+    return IsForwarding() ? sharedPipe.Forward(event) : WritePlayEvent(event);
 }
 
-// Timer callback to check for track changes
-void CALLBACK TimerCallback(PVOID lpParam, BOOLEAN TimerOrWaitFired) {
-    // Try to get Winamp window handle if we don't have it yet
-    if (!hwndWinamp) {
-        if (g_plugin && g_plugin->hwndParent) {
-            hwndWinamp = g_plugin->hwndParent;
-        } else {
-            hwndWinamp = FindWindowA("Winamp v1.x", NULL);
-        }
-        if (!hwndWinamp) {
-            return;
-        }
-    }
-    
-    // Check if Winamp is playing
-    int isPlaying = (int)SendMessage(hwndWinamp, WM_WA_IPC, 0, IPC_ISPLAYING);
-    if (isPlaying != 1) return; // 1 = playing, 0 = stopped, 3 = paused
-    
-    // Get current track info
-    char title[2048] = "";
-    char filepath[MAX_PATH] = "";
-    
-    int position = (int)SendMessage(hwndWinamp, WM_WA_IPC, 0, IPC_GETLISTPOS);
-    
-    if (position >= 0) {
-        // Get title
-        char* titlePtr = (char*)SendMessage(hwndWinamp, WM_WA_IPC, position, IPC_GETPLAYLISTTITLE);
-        if (titlePtr && titlePtr != (char*)-1) {
-            strncpy_s(title, sizeof(title), titlePtr, _TRUNCATE);
-        }
-        
-        // Get filepath
-        char* filePtr = (char*)SendMessage(hwndWinamp, WM_WA_IPC, position, IPC_GETPLAYLISTFILE);
-        if (filePtr && filePtr != (char*)-1) {
-            strncpy_s(filepath, sizeof(filepath), filePtr, _TRUNCATE);
-        }
-    }
-    
-    // Fallback: get title from window
-    if (strlen(title) == 0) {
-        char windowTitle[512];
-        if (GetWindowTextA(hwndWinamp, windowTitle, sizeof(windowTitle)) > 0) {
-            char* dashPos = strstr(windowTitle, " - Winamp");
-            if (dashPos) {
-                size_t len = dashPos - windowTitle;
-                strncpy_s(title, sizeof(title), windowTitle, len);
-            }
-        }
-    }
-    
-    // Get track position and length for repeat detection
-    int currentPosMs = (int)SendMessage(hwndWinamp, WM_WA_IPC, 0, IPC_GETOUTPUTTIME);
-    int trackLengthMs = (int)SendMessage(hwndWinamp, WM_WA_IPC, 1, IPC_GETOUTPUTTIME);
-    
-    int currentPercent = 0;
-    if (trackLengthMs > 0 && currentPosMs >= 0) {
-        currentPercent = (currentPosMs * 100) / trackLengthMs;
-    }
-    
-    bool shouldLog = false;
-    
-    // Check if track has changed
-    if (strlen(title) > 0 && strcmp(title, currentTitle) != 0) {
-        shouldLog = true;
-    }
-    // Check for repeat: same track, was at 90%+, now at <5%
-    else if (strlen(filepath) > 0 && strcmp(filepath, lastFilepath) == 0 &&
-             lastPositionPercent >= 90 && currentPercent < 5) {
-        shouldLog = true;
-    }
-    
-    if (shouldLog && strlen(title) > 0) {
-        strncpy_s(currentTitle, sizeof(currentTitle), title, _TRUNCATE);
-        strncpy_s(lastFilepath, sizeof(lastFilepath), filepath, _TRUNCATE);
-        LogToDatabase(title, filepath);
+bool StoreSpooledPlayEvent(const PlayEvent& event) {
+    return IsForwarding() ? sharedPipe.Forward(event) : WriteSpooledPlayEvent(event);
+}
+
+bool BeginStoreBatch() {
+    return IsForwarding() || BeginBatch();
+}
+
+bool CommitStoreBatch() {
+    return IsForwarding() || CommitBatch();
+}
+
+bool RollbackStoreBatch() {
+    return IsForwarding() || RollbackBatch();
+}
+
+bool CheckpointStore() {
+    return !IsForwarding() && CheckpointDatabase();
+}
+
+// Writer thread: record the metrics in winnp_metrics_path if set, otherwise
+// in the database's metrics table (by whichever instance owns it)
+bool SaveMetrics() {
+    if (metricsPath[0]) {
+        FILE* file = OpenFile(metricsPath, "a");
+        if (!file) return false;
+        bool saved = metrics.AppendCsv(file, systemClock.NowMs(), sourceName);
+        return fclose(file) == 0 && saved;
     }
-    
-    // Update last position (only if we got a valid reading)
-    if (trackLengthMs > 0) {
-        lastPositionPercent = currentPercent;
-        if (strlen(filepath) > 0) {
-            strncpy_s(lastFilepath, sizeof(lastFilepath), filepath, _TRUNCATE);
+    return !IsForwarding() && IsDatabaseOpen() && WriteMetrics(metrics, systemClock.NowMs(), sourceName);
+}
+
+// Writer thread: open the database if it isn't already (e.g. the share is back)
+bool ConnectDatabase() {
+    if (IsForwarding()) return true;
+    return IsDatabaseOpen() || OpenDatabase(dbPath, dbOptions);
+}
+
+// Writer thread: drop a connection that failed, to reopen it later
+bool DisconnectDatabase() {
+    CloseDatabase();
+    return true;
+}
+
+// Timer tick: check for track changes and let the writer know when the player is idle
+void PollTick(void* context) {
+    tracker.Tick();
+    NotifyPlayerIdle(tracker.IsIdle());
+    
+    // Reschedule from what this tick saw (only this thread touches the period)
+    if (adaptivePolling) {
+        unsigned int next = pollScheduler.Next(tracker.IsIdle(), tracker.GetPositionMs(), tracker.GetLengthMs());
+        if (next != pollIntervalMs && pollTimer.SetInterval(next)) {
+            pollIntervalMs = next;
         }
     }
 }
 
+// Winamp notification (on its UI thread): check right away, on the timer thread
+void OnPlayerEvent(PlayerEvent event, void* context) {
+    tracker.NotifyPlayerEvent(event);
+    pollTimer.TickNow();
+}
+
 // Plugin initialization
 int init() {
-    if (g_plugin && g_plugin->hwndParent) {
-        hwndWinamp = g_plugin->hwndParent;
-    } else {
-        hwndWinamp = FindWindowA("Winamp v1.x", NULL);
+    winampSource.Attach(g_plugin ? g_plugin->hwndParent : NULL);
+    tracker.Reset();
+    
+    // Serve tags of recently played files from memory:
+    //   winnp_cache_size     = number of files to remember (0 disables)
+    //   winnp_cache_validate = 1 to check each file's size/mtime before trusting the cache
+    metadataCache.SetCapacity((size_t)GetIntSetting("winnp_cache_size", 1024));
+    tracker.SetMetadataCache(&metadataCache, GetIntSetting("winnp_cache_validate", 1) != 0);
+    
+    // init() runs on Winamp's thread; metadata lookups are marshalled back here in one go
+    winampSource.CreateMarshalWindow(g_hModule);
+    
+    // Record which instance logged each play
+    GetSourceName(sourceName, sizeof(sourceName));
+    tracker.SetSourceName(sourceName);
+    tracker.SetMetrics(&metrics);
+    
+    // Instances sharing a database can leave it to one of them
+    // (winnp_shared_writer=1), handing their plays over a local pipe;
+    // otherwise each writes itself, waiting its turn for the lock
+    GetDatabasePath();
+    sharedWriter = GetIntSetting("winnp_shared_writer", 0) != 0 && sharedPipe.Start(dbPath, AcceptForwardedPlayEvent);
+    
+    // Start with the tags cached by the last session (winnp_cache_path);
+    // mapping the file reads nothing until a lookup needs it
+    if (metadataCache.GetCapacity() > 0) {
+        GetLocalPath("winnp_cache_path", "tags", cachePath);
+        metadataSnapshot.Open(cachePath);
+        metadataCache.SetSnapshot(&metadataSnapshot);
     }
     
-    // Initialize database
-    if (!InitDatabase()) {
+    // Initialize database. Every play goes to the spool first, so either
+    // one is enough to start; the writer keeps retrying the database.
+    GetDatabaseOptions(dbOptions);
+    bool dbOpen = IsForwarding() || OpenDatabase(dbPath, dbOptions);
+    GetLocalPath("winnp_spool_path", "spool", spoolPath);
+    bool spoolOpen = playSpool.Open(spoolPath);
+    if (!dbOpen && !spoolOpen) {
+        sharedPipe.Stop();
+        winampSource.DestroyMarshalWindow();
         return 1;
     }
     
-    // Create timer queue for periodic checking
-    hTimerQueue = CreateTimerQueue();
-    if (hTimerQueue) {
-        CreateTimerQueueTimer(&hTimer, hTimerQueue, TimerCallback, NULL, 500, 500, WT_EXECUTEINTIMERTHREAD);
+    // Start the background writer so database I/O never stalls polling
+    WriterConfig writerConfig = {};
+    writerConfig.sink = StorePlayEvent;
+    writerConfig.replaySink = StoreSpooledPlayEvent;
+    writerConfig.beginBatch = BeginStoreBatch;
+    writerConfig.commitBatch = CommitStoreBatch;
+    writerConfig.rollbackBatch = RollbackStoreBatch;
+    writerConfig.checkpoint = dbOptions.wal ? CheckpointStore : NULL;
+    writerConfig.connect = ConnectDatabase;
+    writerConfig.disconnect = DisconnectDatabase;
+    writerConfig.spool = spoolOpen ? &playSpool : NULL;
+    writerConfig.metrics = &metrics;
+    writerConfig.policy = GetOverflowPolicy();
+    writerConfig.batchSize = GetIntSetting("winnp_batch_size", 1);
+    writerConfig.batchMs = GetIntSetting("winnp_batch_ms", 1000);
+    writerConfig.retryMs = GetIntSetting("winnp_retry_ms", WRITER_RETRY_MS);
+    
+    // Record the instrumentation every winnp_metrics_ms (default never),
+    // in the file winnp_metrics_path if set, otherwise in the database
+    ReadEnvironmentSetting("winnp_metrics_path", metricsPath, sizeof(metricsPath));
+    writerConfig.saveMetrics = SaveMetrics;
+    writerConfig.metricsMs = GetIntSetting("winnp_metrics_ms", 0);
+    
+    if (!StartWriter(writerConfig)) {
+        sharedPipe.Stop();
+        CloseDatabase();
+        playSpool.Close();
+        winampSource.DestroyMarshalWindow();
+        return 1;
     }
     
+    // React to Winamp's notifications where possible, polling rarely as a
+    // fallback; winnp_detection=poll restores polling alone
+    char detection[16];
+    bool useEvents = !(ReadEnvironmentSetting("winnp_detection", detection, sizeof(detection)) && EqualsIgnoreCase(detection, "poll"));
+    useEvents = useEvents && winampSource.SubscribeEvents(OnPlayerEvent, NULL);
+    
+    // Without notifications, poll slowly while idle or mid-track and closely
+    // near the end of each track (winnp_poll_adaptive=0 for a fixed 500 ms)
+    adaptivePolling = !useEvents && GetIntSetting("winnp_poll_adaptive", 1) != 0;
+    pollIntervalMs = useEvents ? EVENT_FALLBACK_INTERVAL_MS : POLL_INTERVAL_MS;
+    
+    // Poll for track changes periodically
+    pollTimer.Start(pollIntervalMs, PollTick, NULL);
+    
     return 0;
 }
 
-// Plugin configuration
+// Plugin configuration, with the instrumentation so far
 void config() {
-    char msg[600];
+    std::string report;
+    metrics.Format(report);
+    
+    char msg[2048];
     snprintf(msg, sizeof(msg),
         "winnp - Now Playing Logger\n\n"
         "Logs currently playing songs to SQLite database:\n"
         "%s\n\n"
         "Table: play_history\n"
         "Columns: id, played_at, filepath, filename,\n"
-        "title, artist, album, genre, track_number, year, duration_ms",
-        dbPath);
+        "title, artist, album, genre, track_number, year, duration_ms,\n"
+        "played_at_ms, utc_offset_min, source\n\n"
+        "Plays waiting for the database are kept in:\n"
+        "%s\n\n"
+        "Since Winamp started:\n"
+        "%s",
+        dbPath, spoolPath, report.c_str());
     
     MessageBoxA(NULL, msg, "winnp Configuration", MB_OK | MB_ICONINFORMATION);
 }
 
 // Plugin cleanup
 void quit() {
-    if (hTimer && hTimerQueue) {
-        DeleteTimerQueueTimer(hTimerQueue, hTimer, INVALID_HANDLE_VALUE);
-    }
-    if (hTimerQueue) {
-        DeleteTimerQueue(hTimerQueue);
-    }
-    
+    winampSource.UnsubscribeEvents();
+    pollTimer.Stop();
+    
+    // Stop taking plays from other instances (they keep theirs spooled
+    // until one of them takes over), then write out anything still queued
+    // and commit the open batch before closing the database; whatever the
+    // database could not take stays in the spool
+    sharedPipe.Stop();
+    StopWriter();
     CloseDatabase();
+    playSpool.Close();
+    
+    // Keep the cached tags for the next session (polling has stopped)
+    if (metadataCache.GetCapacity() > 0) {
+        metadataCache.SaveSnapshot(cachePath);
+    }
     
-    hwndWinamp = NULL;
-    hTimer = NULL;
-    hTimerQueue = NULL;
+    winampSource.DestroyMarshalWindow();
+    winampSource.Attach(NULL);
 }
 
 // Plugin export function
@@ -8,9 +8,19 @@
 #define IPC_GETLISTPOS 125
 #define IPC_GETPLAYLISTTITLE 212
 #define IPC_GETPLAYLISTFILE 211
+#define IPC_GETPLAYLISTTITLEW 213
+#define IPC_GETPLAYLISTFILEW 214
 #define IPC_ISPLAYING 104
 #define IPC_GETOUTPUTTIME 105  // wparam=0: position ms, wparam=1: track length ms
 #define IPC_GET_EXTENDED_FILE_INFO 290
+#define IPC_GET_EXTENDED_FILE_INFOW 3026
+
+// Sent to Winamp's own window; seen by subclassing it
+#define IPC_CB_MISC 603             // wparam=IPC_CB_MISC_TITLE or IPC_CB_MISC_STATUS
+#define IPC_CB_MISC_TITLE 0
+#define IPC_CB_MISC_STATUS 2
+#define IPC_PLAYING_FILE 3003       // A file started playing (wparam=filename)
+#define IPC_PLAYING_FILEW 13003
 
 // Structure for getting extended file info
 typedef struct {
@@ -20,6 +30,13 @@ typedef struct {
     size_t retlen;
 } extendedFileInfoStruct;
 
+typedef struct {
+    const wchar_t* filename;
+    const wchar_t* metadata;
+    wchar_t* ret;
+    size_t retlen;
+} extendedFileInfoStructW;
+
 // Winamp General Purpose Plugin structure
 #define GPPHDR_VER 0x10
 
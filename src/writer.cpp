@@ -0,0 +1,387 @@
+#include "writer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <cstdint>
+#include <thread>
+
+// No deadline to wake for
+#define WRITER_NEVER UINT64_MAX
+
+// A play handed over by another instance, numbered so the receiving thread
+// can wait for the writer to make it durable
+struct ForwardedPlay {
+    PlayEvent event;
+    uint64_t ticket;
+};
+
+// Writer state
+static std::thread writerThread;
+static SpscRingBuffer<PlayEvent, WRITER_QUEUE_CAPACITY> eventQueue;
+static SpscRingBuffer<ForwardedPlay, WRITER_QUEUE_CAPACITY> forwardedQueue;  // From other instances
+static WriterConfig writerConfig = {};
+static SystemClock systemClock;
+static Clock* writerClock = &systemClock;
+static std::atomic<bool> writerRunning(false);
+static std::atomic<unsigned long> rejectedEvents(0);  // Pushed while the writer was stopped
+static std::atomic<bool> playerIdle(false);
+static std::atomic<unsigned long> lostEvents(0);      // Neither written nor spooled
+
+// The writer sleeps on wakeSignal while it has nothing to do. Producers
+// only take wakeMutex to wake it when writerSleeping says it is asleep.
+static std::mutex wakeMutex;
+static std::condition_variable wakeSignal;
+static std::atomic<bool> writerSleeping(false);
+static std::atomic<bool> wakeRequested(false);
+
+// The outcome of the latest forwarded play the writer has dealt with,
+// waited for by AcceptForwardedPlayEvent
+static std::mutex forwardMutex;
+static std::condition_variable forwardSignal;
+static uint64_t resolvedTicket = 0;
+static bool resolvedDurable = false;
+
+// Writer thread state
+struct WriterState {
+    bool connected;      // The sink's database is usable
+    bool backlog;        // The spool holds events that may not be in the database
+    bool inBatch;
+    int batchCount;
+    unsigned long unspooled;  // Events in the open batch that only the database has
+    uint64_t forwardTicket;   // A forwarded play in the open batch that only the database has
+    uint64_t batchStartMs;
+    uint64_t lastRetryMs;
+};
+
+// Wake the writer if it is asleep. The fence pairs with the one in
+// WriterSleep: either the writer sees what was queued before it sleeps, or
+// this sees it sleeping and signals it.
+void WakeWriter() {
+    wakeRequested.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writerSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeSignal.notify_one();
+    }
+}
+
+// Sleep until an event is queued, the writer is woken or wakeAtMs passes
+// (on the writer's clock; a ManualClock that is moved on must wake it)
+static void WriterSleep(uint64_t wakeAtMs) {
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    writerSleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto awake = [] {
+        return wakeRequested.load(std::memory_order_relaxed) || !eventQueue.Empty() || !forwardedQueue.Empty();
+    };
+    uint64_t nowMs = writerClock->MonotonicMs();
+    if (wakeAtMs == WRITER_NEVER) {
+        wakeSignal.wait(lock, awake);
+    } else if (wakeAtMs > nowMs) {
+        wakeSignal.wait_for(lock, std::chrono::milliseconds(wakeAtMs - nowMs), awake);
+    }
+    writerSleeping.store(false, std::memory_order_relaxed);
+    wakeRequested.store(false, std::memory_order_relaxed);
+}
+
+// Tell AcceptForwardedPlayEvent whether a forwarded play is now durable,
+// i.e. in the spool or committed to the database
+static void ResolveForwarded(uint64_t ticket, bool durable) {
+    std::lock_guard<std::mutex> lock(forwardMutex);
+    resolvedTicket = ticket;
+    resolvedDurable = durable;
+    forwardSignal.notify_all();
+}
+
+// Give up on the database until the next retry. Events in the abandoned
+// batch are still in the spool, except any the spool failed to take.
+static void WriterFail(WriterState& state) {
+    if (writerConfig.metrics) writerConfig.metrics->Count(MetricFailures);
+    if (state.inBatch && writerConfig.rollbackBatch) {
+        writerConfig.rollbackBatch();
+    }
+    lostEvents.fetch_add(state.unspooled, std::memory_order_relaxed);
+    state.inBatch = false;
+    state.unspooled = 0;
+    if (state.forwardTicket) {
+        ResolveForwarded(state.forwardTicket, false);
+        state.forwardTicket = 0;
+    }
+    
+    if (writerConfig.connect) {
+        if (writerConfig.disconnect) writerConfig.disconnect();
+        state.connected = false;
+    }
+    state.backlog = writerConfig.spool && writerConfig.spool->IsOpen();
+    state.lastRetryMs = writerClock->MonotonicMs();
+}
+
+// Commit the open batch, timing it
+static bool WriterCommit() {
+    StageTimer timer(writerConfig.metrics, MetricCommit);
+    return writerConfig.commitBatch();
+}
+
+// Hand an event to a sink, timing it
+static bool WriterStore(PlayEventSink sink, const PlayEvent& event) {
+    StageTimer timer(writerConfig.metrics, MetricInsert);
+    bool stored = sink(event);
+    if (stored && writerConfig.metrics) writerConfig.metrics->Count(MetricInserts);
+    return stored;
+}
+
+// Events the database has now committed no longer need the spool. If it
+// cannot be cleared they stay in it, harmlessly, as replaySink skips plays
+// already stored; the failure is counted and the next commit tries again.
+static void WriterCommitted(WriterState& state) {
+    state.unspooled = 0;
+    if (state.forwardTicket) {
+        ResolveForwarded(state.forwardTicket, true);
+        state.forwardTicket = 0;
+    }
+    if (writerConfig.spool && writerConfig.spool->GetRecordCount() > 0 && !writerConfig.spool->Clear()) {
+        if (writerConfig.metrics) writerConfig.metrics->Count(MetricFailures);
+    }
+}
+
+// Reconnect if needed, then move the spool into the database in one batch
+static void WriterRecover(WriterState& state) {
+    state.lastRetryMs = writerClock->MonotonicMs();
+    if (!state.connected) {
+        if (!writerConfig.connect || !writerConfig.connect()) return;
+        state.connected = true;
+    }
+    if (!state.backlog) return;
+    
+    PlayEventSink replaySink = writerConfig.replaySink ? writerConfig.replaySink : writerConfig.sink;
+    PlaySpool* spool = writerConfig.spool;
+    bool transaction = writerConfig.beginBatch && writerConfig.commitBatch;
+    
+    state.inBatch = transaction && writerConfig.beginBatch();
+    bool ok = (state.inBatch || !transaction) && spool->Replay(replaySink);
+    ok = ok && (!transaction || WriterCommit());
+    if (!ok) {
+        WriterFail(state);
+        return;
+    }
+    state.inBatch = false;
+    state.backlog = false;
+    WriterCommitted(state);
+}
+
+// Writer thread: drain the queue, handing events to the sink in order and
+// grouping them into batches, and sleep whenever it runs dry until more
+// arrive or a batch, retry or metrics deadline comes round.
+static void WriterThreadProc() {
+    const bool batching = writerConfig.batchSize > 1 && writerConfig.beginBatch && writerConfig.commitBatch;
+    const uint64_t batchTimeoutMs = (uint64_t)std::max(writerConfig.batchMs, 0);
+    const uint64_t retryIntervalMs = (uint64_t)(writerConfig.retryMs > 0 ? writerConfig.retryMs : WRITER_RETRY_MS);
+    const bool savingMetrics = writerConfig.saveMetrics && writerConfig.metricsMs > 0;
+    const uint64_t metricsIntervalMs = (uint64_t)std::max(writerConfig.metricsMs, 0);
+    PlaySpool* spool = writerConfig.spool;
+    
+    WriterState state = {};
+    state.connected = !writerConfig.connect || writerConfig.connect();
+    state.backlog = spool && spool->GetRecordCount() > 0;
+    state.lastRetryMs = writerClock->MonotonicMs() - retryIntervalMs;
+    bool needsCheckpoint = false;
+    uint64_t lastMetricsMs = writerClock->MonotonicMs();
+    
+    PlayEventSink replaySink = writerConfig.replaySink ? writerConfig.replaySink : writerConfig.sink;
+    PlayEvent ownEvent;
+    ForwardedPlay forwardedPlay;
+    for (;;) {
+        for (;;) {
+            // This instance's plays first; those handed over can wait a little
+            bool forwarded = false;
+            if (!eventQueue.Pop(ownEvent)) {
+                if (!forwardedQueue.Pop(forwardedPlay)) break;
+                forwarded = true;
+            }
+            const PlayEvent& event = forwarded ? forwardedPlay.event : ownEvent;
+            
+            // The spool first, so the event survives whatever the database
+            // does. A forwarded play is durable once it is in the spool;
+            // otherwise its sender is answered once it is committed.
+            bool spooled = spool && spool->Append(event);
+            if (forwarded) {
+                if (spooled) {
+                    ResolveForwarded(forwardedPlay.ticket, true);
+                } else {
+                    state.forwardTicket = forwardedPlay.ticket;
+                }
+            }
+            if (!state.connected || state.backlog) {
+                if (!spooled) lostEvents.fetch_add(1, std::memory_order_relaxed);
+                state.backlog = state.backlog || spooled;
+                if (state.forwardTicket) {
+                    ResolveForwarded(state.forwardTicket, false);
+                    state.forwardTicket = 0;
+                }
+                continue;
+            }
+            
+            if (batching && !state.inBatch) {
+                if (!writerConfig.beginBatch()) {
+                    if (!spooled) lostEvents.fetch_add(1, std::memory_order_relaxed);
+                    WriterFail(state);
+                    continue;
+                }
+                state.inBatch = true;
+                state.batchCount = 0;
+                state.batchStartMs = writerClock->MonotonicMs();
+            }
+            
+            if (!spooled) state.unspooled++;
+            if (!WriterStore(forwarded ? replaySink : writerConfig.sink, event)) {
+                WriterFail(state);
+                continue;
+            }
+            needsCheckpoint = true;
+            
+            // Don't keep a sender waiting on the batch
+            if (!state.inBatch) {
+                WriterCommitted(state);
+            } else if (++state.batchCount >= writerConfig.batchSize || state.forwardTicket) {
+                if (WriterCommit()) {
+                    state.inBatch = false;
+                    WriterCommitted(state);
+                } else {
+                    WriterFail(state);
+                }
+            }
+        }
+        
+        bool running = writerRunning.load(std::memory_order_acquire);
+        
+        // Close the open batch once it is old enough, or when shutting down
+        uint64_t batchAgeMs = writerClock->MonotonicMs() - state.batchStartMs;
+        if (state.inBatch && (!running || batchAgeMs >= batchTimeoutMs)) {
+            if (WriterCommit()) {
+                state.inBatch = false;
+                WriterCommitted(state);
+            } else {
+                WriterFail(state);
+            }
+        }
+        
+        // Retry the database now and then while it is unreachable or behind
+        // the spool, and once more before stopping
+        if ((!state.connected || state.backlog) &&
+            (!running || writerClock->MonotonicMs() - state.lastRetryMs >= retryIntervalMs)) {
+            WriterRecover(state);
+        }
+        
+        // Stop only once everything queued has been written
+        if (!running) {
+            if (!eventQueue.Empty() || !forwardedQueue.Empty()) continue;
+            if (savingMetrics) writerConfig.saveMetrics();
+            return;
+        }
+        
+        // Housekeeping between tracks rather than in the middle of a write
+        if (needsCheckpoint && state.connected && !state.inBatch && writerConfig.checkpoint && playerIdle.load(std::memory_order_relaxed)) {
+            writerConfig.checkpoint();
+            needsCheckpoint = false;
+        }
+        
+        if (savingMetrics && !state.inBatch && writerClock->MonotonicMs() - lastMetricsMs >= metricsIntervalMs) {
+            writerConfig.saveMetrics();
+            lastMetricsMs = writerClock->MonotonicMs();
+        }
+        
+        // Nothing more to do until an event arrives or the next deadline
+        uint64_t wakeAtMs = WRITER_NEVER;
+        if (state.inBatch) {
+            wakeAtMs = std::min(wakeAtMs, state.batchStartMs + batchTimeoutMs);
+        }
+        if (!state.connected || state.backlog) {
+            wakeAtMs = std::min(wakeAtMs, state.lastRetryMs + retryIntervalMs);
+        }
+        if (savingMetrics) {
+            wakeAtMs = std::min(wakeAtMs, lastMetricsMs + metricsIntervalMs);
+        }
+        WriterSleep(wakeAtMs);
+    }
+}
+
+bool StartWriter(const WriterConfig& config) {
+    if (!config.sink || writerThread.joinable()) return false;
+    
+    writerConfig = config;
+    writerClock = config.clock ? config.clock : &systemClock;
+    eventQueue.SetPolicy(config.policy);
+    forwardedQueue.SetPolicy(config.policy);
+    writerRunning.store(true, std::memory_order_release);
+    
+    try {
+        writerThread = std::thread(WriterThreadProc);
+    } catch (...) {
+        writerRunning.store(false, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+void StopWriter() {
+    writerRunning.store(false, std::memory_order_release);
+    WakeWriter();
+    
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+    writerConfig = WriterConfig();
+}
+
+bool EnqueuePlayEvent(const PlayEvent& event) {
+    if (!writerRunning.load(std::memory_order_acquire)) {
+        rejectedEvents.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    bool queued = eventQueue.Push(event);
+    WakeWriter();
+    return queued;
+}
+
+bool AcceptForwardedPlayEvent(const PlayEvent& event) {
+    if (!writerRunning.load(std::memory_order_acquire)) {
+        rejectedEvents.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Only ever called on the receiving thread
+    static ForwardedPlay incoming;
+    static uint64_t lastTicket = 0;
+    incoming.event = event;
+    incoming.ticket = ++lastTicket;
+    bool queued = forwardedQueue.Push(incoming);
+    WakeWriter();
+    if (!queued) return false;
+    
+    // A play that timed out earlier may be resolved meanwhile; only this
+    // one's outcome counts
+    std::unique_lock<std::mutex> lock(forwardMutex);
+    uint64_t ticket = incoming.ticket;
+    bool resolved = forwardSignal.wait_for(lock, std::chrono::milliseconds(WRITER_FORWARD_TIMEOUT_MS),
+                                           [ticket] { return resolvedTicket >= ticket; });
+    return resolved && resolvedTicket == ticket && resolvedDurable;
+}
+
+void NotifyPlayerIdle(bool idle) {
+    // Wake the writer for its housekeeping once the player stops
+    if (!playerIdle.exchange(idle, std::memory_order_relaxed) && idle) {
+        WakeWriter();
+    }
+}
+
+unsigned long GetDroppedEventCount() {
+    return eventQueue.GetDroppedNewest() + eventQueue.GetDroppedOldest() +
+           forwardedQueue.GetDroppedNewest() + forwardedQueue.GetDroppedOldest() +
+           rejectedEvents.load(std::memory_order_relaxed);
+}
+
+unsigned long GetLostEventCount() {
+    return lostEvents.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,92 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "metrics.h"
+#include "playevent.h"
+#include "ringbuffer.h"
+#include "spool.h"
+#include "timing.h"
+
+// Number of preallocated play event slots between poller and writer
+#define WRITER_QUEUE_CAPACITY 64
+
+// How often the writer retries an unreachable database by default
+#define WRITER_RETRY_MS 5000
+
+// How long AcceptForwardedPlayEvent waits for the writer, which must be
+// less than a sender waits for its answer (PIPE_FORWARD_TIMEOUT_MS)
+#define WRITER_FORWARD_TIMEOUT_MS 1500
+
+// Called on the writer thread around the events it writes; return false on
+// failure
+typedef bool (*WriterHook)();
+
+// Writer configuration. The sink is called on the writer thread for every
+// queued event.
+//
+// With a spool, every event is appended to it before anything else. Events
+// go straight to the sink only while the database is connected and the
+// spool holds nothing older; otherwise they stay in the spool, and every
+// retryMs the writer reconnects and replays it (through replaySink, which
+// must skip plays already stored) in one batch, clearing it on success.
+// The spool is also cleared after each successful write or commit.
+struct WriterConfig {
+    PlayEventSink sink;
+    PlayEventSink replaySink; // Optional; stores a spooled event unless already stored (default: sink)
+    WriterHook beginBatch;    // Optional; called before the first event of a batch
+    WriterHook commitBatch;   // Optional; called after the last event of a batch
+    WriterHook rollbackBatch; // Optional; called to abandon a batch after a failure
+    WriterHook checkpoint;    // Optional; called while the player is idle if events were written since the last call
+    WriterHook connect;       // Optional; (re)opens the database, returning true if it is usable
+    WriterHook disconnect;    // Optional; closes the database after a failure, before retrying
+    WriterHook saveMetrics;   // Optional; records the metrics every metricsMs between batches, and when stopping
+    PlaySpool* spool;         // Optional; opened by the caller and used only by the writer thread
+    PlayMetrics* metrics;     // Optional; times writes and commits, and counts writes and failures
+    Clock* clock;             // Optional; times batches, retries and metrics (default: the system clock)
+    OverflowPolicy policy;
+    int batchSize;            // Commit after this many events (<= 1 disables batching)
+    int batchMs;              // ...or once the open batch is this old, whichever comes first
+    int retryMs;              // Reconnect/replay interval (<= 0 for WRITER_RETRY_MS)
+    int metricsMs;            // saveMetrics interval (<= 0 never calls it)
+};
+
+// Start the background writer thread; events are passed to the sink in order
+bool StartWriter(const WriterConfig& config);
+
+// Drain any queued events, commit the open batch (or leave it in the spool)
+// and stop the writer thread
+void StopWriter();
+
+// Queue an event for the writer thread. Lock-free while the writer is busy,
+// and wait-free except under OverflowBlock (or DropOldest, for as long as
+// the writer takes to copy out the event it is discarding); if the writer
+// is asleep, its lock is taken just long enough to wake it. Must only be
+// called from the polling thread. Returns false if the event was dropped.
+bool EnqueuePlayEvent(const PlayEvent& event);
+
+// Queue an event handed over by another instance and wait until it is
+// durable: in the spool or, without one, committed to the database (which
+// closes the open batch at once). Returns false if it was dropped, could
+// not be stored, or took longer than WRITER_FORWARD_TIMEOUT_MS; the sender
+// then keeps it and may send it again, so it is stored through replaySink.
+// Uses its own queue, and must only be called from the thread receiving
+// from other instances.
+bool AcceptForwardedPlayEvent(const PlayEvent& event);
+
+// Wake the writer to look at its deadlines again, e.g. after moving the
+// config's ManualClock on
+void WakeWriter();
+
+// Tell the writer whether the player is stopped/paused, i.e. whether this
+// is a good moment for housekeeping such as WAL checkpoints
+void NotifyPlayerIdle(bool idle);
+
+// Number of events lost to a full queue (incoming and discarded oldest,
+// both queues)
+unsigned long GetDroppedEventCount();
+
+// Number of events lost because the database failed and the spool could
+// not take them either
+unsigned long GetLostEventCount();
+
+#endif // WRITER_H